@@ -9,6 +9,9 @@
 // These values should be positive integers and increase whenever their respective structure changes.
 #define IMC_CRYPTO_VERSION      1   // Encrypted stream of the hidden file
 #define IMC_FILEINFO_VERSION    1   // Metadata stored inside the encrypted stream
+#define IMC_FILEINFO_SHARD      2   // Metadata of a shard of a file split among many images (older versions refuse it)
+#define IMC_FILEINFO_TREE       3   // Metadata of a folder hidden as an archive of its entries (older versions refuse it)
+#define IMC_CARRIER_VERSION     1   // Rules for selecting the carrier bytes of an image (the cached capacities depend on it)
 
 // Function return codes
 #define IMC_SUCCESS             0   // Operation completed successfully
@@ -26,6 +29,15 @@
 #define IMC_ERR_NAME_TOO_LONG  -12  // The file name has more characters than the maximum allowed
 #define IMC_ERR_FILE_CORRUPTED -13  // The file read has a different size than expected
 #define IMC_ERR_PATH_IS_DIR    -14  // The path is of a directory rather than a file
+#define IMC_ERR_NO_CARRIER     -15  // The image has no suitable bits for hiding data
+#define IMC_ERR_ENCODE_FAIL    -16  // Failed to encode the image with hidden data
+#define IMC_ERR_INPUT_TOO_BIG  -17  // The file to be hidden is bigger than the maximum allowed size
+#define IMC_ERR_SOCKET_FAIL    -18  // The server's socket could not be created or used
+#define IMC_ERR_BAD_REQUEST    -19  // The request sent to the server is malformed
+#define IMC_ERR_CANCELLED      -20  // The operation was cancelled before finishing
+#define IMC_ERR_MEMORY_BUDGET  -21  // The operation needs more memory than the budget allows ('--max-memory' option)
+#define IMC_ERR_SHARD_STREAM   -22  // A part of a split file cannot be extracted to a stream (it needs the other parts on disk)
+#define IMC_ERR_TREE_STREAM    -23  // A hidden folder can be extracted to a stream only as a tar archive
 
 // Maximum size in bytes of the file being hidden
 #define IMC_MAX_INPUT_SIZE  500000000
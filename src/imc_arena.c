@@ -0,0 +1,140 @@
+/* Memory arena: the buffers of an image are allocated from a region that is freed all at once when the image is closed. */
+
+#include "imc_includes.h"
+
+/* Note: See the 'imc_arena.h' file for how the arena works. */
+
+// Round a size up to the alignment of the allocations
+static size_t __arena_align(size_t size)
+{
+    const size_t alignment = _Alignof(max_align_t);
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+// Add a block with room for 'size' bytes to the arena (or a regular block, if 'size' is zero)
+// 'tag' tells where the block is used (the regular blocks are always tagged as 'IMC_MEMORY_IMAGE').
+static ArenaBlock *__arena_new_block(MemoryArena *arena, size_t size, MemoryTag tag)
+{
+    // The regular blocks are sized so that, along with the headers, they fill exactly a class of the pool
+    if (size == 0)
+    {
+        size = IMC_ARENA_BLOCK_SIZE - sizeof(ArenaBlock) - sizeof(PoolHeader);
+        tag = IMC_MEMORY_IMAGE;
+    }
+
+    ArenaBlock *block = imc_pool_alloc(sizeof(ArenaBlock) + size, tag);
+    block->next = arena ? arena->blocks : NULL;
+    block->size = size;
+    block->used = 0;
+    if (arena) arena->blocks = block;
+    return block;
+}
+
+// Create an empty arena (the arena itself is stored on its first block)
+// The returned 'MemoryArena' should be freed with 'imc_arena_destroy()'.
+MemoryArena *imc_arena_create(uint64_t flags)
+{
+    ArenaBlock *const block = __arena_new_block(NULL, 0, IMC_MEMORY_IMAGE);
+    MemoryArena *const arena = (MemoryArena *)&block[1];
+    block->used = __arena_align(sizeof(MemoryArena));
+
+    *arena = (MemoryArena){
+        .blocks = block,
+        .current = block,
+        .flags = flags,
+    };
+
+    return arena;
+}
+
+// Allocate 'size' bytes from an arena (its contents are not initialized)
+void *imc_arena_alloc(MemoryArena *arena, size_t size)
+{
+    return imc_arena_alloc_tag(arena, size, IMC_MEMORY_IMAGE);
+}
+
+// Allocate 'size' bytes from an arena, with the tag telling where they are used (if they get a block of their own)
+void *imc_arena_alloc_tag(MemoryArena *arena, size_t size, MemoryTag tag)
+{
+    size = __arena_align(size ? size : 1);
+
+    // Big buffers get a block of their own
+    if (size >= IMC_ARENA_LARGE_SIZE)
+    {
+        ArenaBlock *const block = __arena_new_block(arena, size, tag);
+        block->used = size;
+        return &block[1];
+    }
+
+    // Start a new regular block if the current one is full
+    ArenaBlock *block = arena->current;
+    if (block->used + size > block->size)
+    {
+        block = __arena_new_block(arena, 0, IMC_MEMORY_IMAGE);
+        arena->current = block;
+    }
+
+    void *const ptr = (uint8_t *)&block[1] + block->used;
+    block->used += size;
+    return ptr;
+}
+
+// Allocate 'item_count' elements of 'item_size' bytes from an arena, all initialized to zero
+void *imc_arena_calloc(MemoryArena *arena, size_t item_count, size_t item_size)
+{
+    const size_t size = item_count * item_size;
+    void *const ptr = imc_arena_alloc(arena, size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+// Free the unused space of a buffer allocated from an arena, so it has 'size' bytes
+// Only buffers that got their own block can shrink (the others are unchanged). Function returns the new address of the buffer.
+void *imc_arena_trim(MemoryArena *arena, void *ptr, size_t size)
+{
+    // Find the block of the buffer (a buffer with its own block begins right after the header)
+    ArenaBlock **link = &arena->blocks;
+    while (*link && (void *)&(*link)[1] != ptr) link = &(*link)->next;
+
+    ArenaBlock *block = *link;
+    if (!block || block == arena->current || block->used != block->size) return ptr;
+
+    size = __arena_align(size ? size : 1);
+    if (size >= block->size) return ptr;
+
+    // The buffer might move, so the link to its block is updated
+    block = imc_pool_trim(block, sizeof(ArenaBlock) + size);
+    block->size = size;
+    block->used = size;
+    *link = block;
+    return &block[1];
+}
+
+// Get the total amount of memory used by an arena (including the unused space of its blocks)
+size_t imc_arena_footprint(MemoryArena *arena)
+{
+    size_t total = 0;
+    for (ArenaBlock *block = arena->blocks; block; block = block->next)
+    {
+        total += imc_pool_footprint(block);
+    }
+    return total;
+}
+
+// Free all memory allocated from an arena, including the arena itself
+void imc_arena_destroy(MemoryArena *arena)
+{
+    if (!arena) return;
+
+    // The arena is on one of the blocks, so its fields are read before any block is freed
+    ArenaBlock *block = arena->blocks;
+    const bool is_secure = arena->flags & IMC_ARENA_SECURE;
+
+    while (block)
+    {
+        ArenaBlock *const next = block->next;
+        if (is_secure) sodium_memzero(&block[1], block->used);
+        imc_pool_free(block);
+        block = next;
+    }
+}
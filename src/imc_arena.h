@@ -0,0 +1,71 @@
+/* Memory arena: the buffers of an image are allocated from a region that is freed all at once when the image is closed. */
+
+#ifndef _IMC_ARENA_H
+#define _IMC_ARENA_H
+
+#include "imc_includes.h"
+
+/*  How the arena works
+
+    The memory is taken in blocks from the buffer pool ('imc_pool.h'), and the small allocations are placed one after
+    another on the current block. Allocations of 'IMC_ARENA_LARGE_SIZE' bytes or more get a block of their own (so a
+    big buffer does not waste the rest of a regular block), and those big blocks are the ones that the pool recycles
+    between the images processed by the same thread.
+
+    Nothing is freed individually: destroying the arena returns all of its blocks to the pool, so the cost of closing
+    an image depends only on the amount of blocks (usually a few), not on how many buffers the image used.
+    If the arena was created with the IMC_ARENA_SECURE flag, the blocks are set to zero before being returned.
+*/
+
+#define IMC_ARENA_BLOCK_SIZE    65536   // Size in bytes of the regular blocks (counting their headers)
+#define IMC_ARENA_LARGE_SIZE    16384   // Allocations of this size or bigger get their own block
+#define IMC_ARENA_SECURE        (1 << 0)    // Flag: set the memory to zero when the arena is destroyed
+
+// Header stored at the beginning of each block of an arena
+typedef union ArenaBlock {
+    struct {
+        union ArenaBlock *next; // Block allocated before this one
+        size_t size;            // Amount of bytes after the header
+        size_t used;            // Amount of bytes already allocated from this block
+    };
+    max_align_t align;          // Keep the memory after the header aligned as if it was returned by 'malloc()'
+} ArenaBlock;
+
+// Region from where the buffers of an image are allocated
+typedef struct MemoryArena {
+    ArenaBlock *blocks;     // Most recently allocated block (the others are linked from it)
+    ArenaBlock *current;    // Regular block where the small allocations are placed
+    uint64_t flags;         // Options of the arena ('IMC_ARENA_SECURE')
+} MemoryArena;
+
+// Round a size up to the alignment of the allocations
+static size_t __arena_align(size_t size);
+
+// Add a block with room for 'size' bytes to the arena (or a regular block, if 'size' is zero)
+// 'tag' tells where the block is used (the regular blocks are always tagged as 'IMC_MEMORY_IMAGE').
+static ArenaBlock *__arena_new_block(MemoryArena *arena, size_t size, MemoryTag tag);
+
+// Create an empty arena (the arena itself is stored on its first block)
+// The returned 'MemoryArena' should be freed with 'imc_arena_destroy()'.
+MemoryArena *imc_arena_create(uint64_t flags);
+
+// Allocate 'size' bytes from an arena (its contents are not initialized)
+void *imc_arena_alloc(MemoryArena *arena, size_t size);
+
+// Allocate 'size' bytes from an arena, with the tag telling where they are used (if they get a block of their own)
+void *imc_arena_alloc_tag(MemoryArena *arena, size_t size, MemoryTag tag);
+
+// Allocate 'item_count' elements of 'item_size' bytes from an arena, all initialized to zero
+void *imc_arena_calloc(MemoryArena *arena, size_t item_count, size_t item_size);
+
+// Free the unused space of a buffer allocated from an arena, so it has 'size' bytes
+// Only buffers that got their own block can shrink (the others are unchanged). Function returns the new address of the buffer.
+void *imc_arena_trim(MemoryArena *arena, void *ptr, size_t size);
+
+// Get the total amount of memory used by an arena (including the unused space of its blocks)
+size_t imc_arena_footprint(MemoryArena *arena);
+
+// Free all memory allocated from an arena, including the arena itself
+void imc_arena_destroy(MemoryArena *arena);
+
+#endif  // _IMC_ARENA_H
@@ -0,0 +1,333 @@
+/* Asynchronous jobs: hide, extract, or check operations that run in the background on a thread pool. */
+
+#include "imc_includes.h"
+
+/* Note: See the 'imc_async.h' file for how the asynchronous jobs are used. */
+
+// Create a queue whose jobs run on 'num_threads' worker threads (zero for one per processor)
+AsyncQueue *imc_async_create(size_t num_threads)
+{
+    return __async_create_queue(imc_threadpool_create(num_threads), true);
+}
+
+// Create a queue whose jobs run on an existing thread pool
+// The pool is not destroyed along with the queue, so it can be shared by many queues.
+// Note: the jobs should not be waited for from a worker of the same pool (all workers could end up waiting).
+AsyncQueue *imc_async_create_shared(ThreadPool *pool)
+{
+    return __async_create_queue(pool, false);
+}
+
+// Create the fields of a queue that are common to both ways of creating it
+static AsyncQueue *__async_create_queue(ThreadPool *pool, bool owns_pool)
+{
+    AsyncQueue *queue = imc_calloc(1, sizeof(AsyncQueue));
+    queue->pool = pool;
+    queue->owns_pool = owns_pool;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->has_finished, NULL);
+
+    #ifdef _WIN32
+    queue->event_fd = -1;
+    #else // Linux
+    queue->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    #endif // _WIN32
+
+    return queue;
+}
+
+// Submit a job to the queue, and return immediately
+// The returned job should be freed with 'imc_async_free()' after it was taken from the queue.
+// Function returns NULL if there is no enough memory for copying the password or the key.
+AsyncJob *imc_async_submit(AsyncQueue *queue, const AsyncRequest *request)
+{
+    AsyncJob *job = imc_calloc(1, sizeof(AsyncJob));
+    job->operation = request->operation;
+    job->image = imc_strdup(request->image);
+    job->output = request->output ? imc_strdup(request->output) : NULL;
+    job->append = request->append;
+    job->log = request->log;
+    job->progress = request->progress;
+    job->on_finish = request->on_finish;
+    job->user_data = request->user_data;
+    job->queue = queue;
+    job->state = IMC_ASYNC_QUEUED;
+    atomic_init(&job->cancelled, false);
+
+    // Copy the paths of the files being hidden
+    job->payloads = imc_calloc(request->payload_count + 1, sizeof(char *));
+    for (size_t i = 0; i < request->payload_count; i++)
+    {
+        job->payloads[i] = imc_strdup(request->payloads[i]);
+    }
+    job->payload_count = request->payload_count;
+
+    if (request->key)
+    {
+        // Copy the secret key (the password is not needed then)
+        if (imc_crypto_context_copy(request->key, &job->key) != IMC_SUCCESS)
+        {
+            imc_async_free(job);
+            return NULL;
+        }
+    }
+    else
+    {
+        // Copy the password to protected memory (an empty password is used if none was provided)
+        job->password = sodium_malloc(sizeof(PassBuff));
+        if (!job->password)
+        {
+            imc_async_free(job);
+            return NULL;
+        }
+        sodium_memzero(job->password, sizeof(PassBuff));
+        job->password->capacity = sizeof(job->password->buffer);
+        if (request->password)
+        {
+            job->password->length = request->password->length;
+            memcpy(job->password->buffer, request->password->buffer, request->password->length);
+        }
+    }
+
+    // Add the job to the list of unfinished jobs (so it can be cancelled if the queue is destroyed)
+    pthread_mutex_lock(&queue->lock);
+    job->next = queue->unfinished_head;
+    if (queue->unfinished_head) queue->unfinished_head->prev = job;
+    queue->unfinished_head = job;
+    queue->unfinished++;
+    pthread_mutex_unlock(&queue->lock);
+
+    imc_threadpool_submit(queue->pool, &__async_run_job, job);
+
+    return job;
+}
+
+// Perform a job (this function runs on a worker thread)
+static void __async_run_job(void *job_ptr)
+{
+    AsyncJob *const job = (AsyncJob *)job_ptr;
+    AsyncQueue *const queue = job->queue;
+
+    // Skip the job if it was cancelled while waiting on the queue
+    pthread_mutex_lock(&queue->lock);
+    const bool cancelled = atomic_load(&job->cancelled) || queue->shutdown;
+    if (!cancelled) job->state = IMC_ASYNC_RUNNING;
+    pthread_mutex_unlock(&queue->lock);
+
+    if (cancelled)
+    {
+        __async_finish(job, IMC_ERR_CANCELLED);
+        return;
+    }
+
+    // Generate the secret key, then erase the password
+    if (!job->key)
+    {
+        const int key_status = imc_crypto_context_create(job->password, &job->key);
+        sodium_free(job->password);
+        job->password = NULL;
+
+        if (key_status != IMC_SUCCESS)
+        {
+            __async_finish(job, key_status);
+            return;
+        }
+    }
+
+    // Perform the operation as a batch with a single job
+    static const enum BatchOperation operations[] = {
+        [IMC_ASYNC_HIDE] = IMC_BATCH_HIDE,
+        [IMC_ASYNC_EXTRACT] = IMC_BATCH_EXTRACT,
+        [IMC_ASYNC_CHECK] = IMC_BATCH_CHECK,
+    };
+
+    BatchJob batch_job = {
+        .operation = operations[job->operation],
+        .image = job->image,
+        .output = job->output,
+        .payloads = job->payloads,
+        .payload_count = job->payload_count,
+    };
+
+    BatchContext batch = {
+        .jobs = &batch_job,
+        .job_count = 1,
+        .key = job->key,
+        .append = job->append,
+        .log = job->log,
+        .cancelled = &job->cancelled,
+        .progress = job->progress,
+        .progress_data = job->user_data,
+    };
+    pthread_mutex_init(&batch.lock, NULL);
+    batch_job.batch = &batch;
+
+    imc_batch_run_job(&batch_job);
+
+    pthread_mutex_destroy(&batch.lock);
+    __async_finish(job, batch_job.status);
+}
+
+// Mark a job as finished, and move it to the list of finished jobs
+static void __async_finish(AsyncJob *job, int status)
+{
+    AsyncQueue *const queue = job->queue;
+    job->status = status;
+
+    if (job->password)
+    {
+        sodium_free(job->password);
+        job->password = NULL;
+    }
+
+    imc_crypto_context_destroy(job->key);
+    job->key = NULL;
+
+    if (job->on_finish) job->on_finish(job, job->user_data);
+
+    pthread_mutex_lock(&queue->lock);
+
+    // Remove the job from the list of unfinished jobs
+    if (job->prev) job->prev->next = job->next;
+    else queue->unfinished_head = job->next;
+    if (job->next) job->next->prev = job->prev;
+    queue->unfinished--;
+
+    // Add it to the end of the list of finished jobs
+    job->state = IMC_ASYNC_FINISHED;
+    job->prev = NULL;
+    job->next = NULL;
+    if (queue->finished_tail) queue->finished_tail->next = job;
+    else queue->finished_head = job;
+    queue->finished_tail = job;
+
+    // Notify the event loop
+    #ifndef _WIN32
+    if (queue->event_fd >= 0)
+    {
+        const uint64_t increment = 1;
+        const ssize_t count = write(queue->event_fd, &increment, sizeof(increment));
+        (void)count;
+    }
+    #endif // _WIN32
+
+    pthread_cond_broadcast(&queue->has_finished);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Get the file descriptor that becomes readable while there are finished jobs to be taken from the queue
+// (returns -1 on systems where this is not supported)
+int imc_async_get_fd(const AsyncQueue *queue)
+{
+    return queue->event_fd;
+}
+
+// Take the oldest finished job from the queue, without blocking
+// Function returns NULL if no job has finished yet.
+AsyncJob *imc_async_poll(AsyncQueue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+
+    AsyncJob *job = queue->finished_head;
+    if (job)
+    {
+        queue->finished_head = job->next;
+        if (!queue->finished_head) queue->finished_tail = NULL;
+        job->next = NULL;
+    }
+
+    // Once there are no finished jobs left, reset the counter of the event file descriptor
+    // (so it stays readable only while there are jobs to be taken)
+    #ifndef _WIN32
+    if (!queue->finished_head && queue->event_fd >= 0)
+    {
+        uint64_t counter;
+        const ssize_t count = read(queue->event_fd, &counter, sizeof(counter));
+        (void)count;
+    }
+    #endif // _WIN32
+
+    pthread_mutex_unlock(&queue->lock);
+
+    return job;
+}
+
+// Take the oldest finished job from the queue, waiting until one finishes if needed
+// Function returns NULL if there are no jobs left (all of them were already taken).
+AsyncJob *imc_async_wait(AsyncQueue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->finished_head && queue->unfinished > 0)
+    {
+        pthread_cond_wait(&queue->has_finished, &queue->lock);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return imc_async_poll(queue);
+}
+
+// Request a job to be cancelled
+// Function returns false if the job has already finished.
+bool imc_async_cancel(AsyncJob *job)
+{
+    pthread_mutex_lock(&job->queue->lock);
+    const bool is_unfinished = (job->state != IMC_ASYNC_FINISHED);
+    if (is_unfinished) atomic_store(&job->cancelled, true);
+    pthread_mutex_unlock(&job->queue->lock);
+
+    return is_unfinished;
+}
+
+// Free the memory used by a job that was taken from the queue
+void imc_async_free(AsyncJob *job)
+{
+    if (!job) return;
+
+    for (size_t i = 0; i < job->payload_count; i++)
+    {
+        imc_free(job->payloads[i]);
+    }
+    imc_free(job->payloads);
+    imc_free(job->image);
+    imc_free(job->output);
+    if (job->password) sodium_free(job->password);
+    imc_crypto_context_destroy(job->key);
+    imc_free(job);
+}
+
+// Cancel the unfinished jobs, wait for them to stop, and free the queue
+// (the jobs that were not taken from the queue are also freed)
+void imc_async_destroy(AsyncQueue *queue)
+{
+    if (!queue) return;
+
+    // The queued jobs are skipped, and the running ones stop at their next step
+    pthread_mutex_lock(&queue->lock);
+    queue->shutdown = true;
+    for (AsyncJob *job = queue->unfinished_head; job; job = job->next)
+    {
+        atomic_store(&job->cancelled, true);
+    }
+
+    while (queue->unfinished > 0)
+    {
+        pthread_cond_wait(&queue->has_finished, &queue->lock);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    if (queue->owns_pool) imc_threadpool_destroy(queue->pool);
+
+    AsyncJob *job;
+    while ( (job = imc_async_poll(queue)) )
+    {
+        imc_async_free(job);
+    }
+
+    #ifndef _WIN32
+    if (queue->event_fd >= 0) close(queue->event_fd);
+    #endif // _WIN32
+
+    pthread_cond_destroy(&queue->has_finished);
+    pthread_mutex_destroy(&queue->lock);
+    imc_free(queue);
+}
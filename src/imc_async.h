@@ -0,0 +1,142 @@
+/* Asynchronous jobs: hide, extract, or check operations that run in the background on a thread pool. */
+
+#ifndef _IMC_ASYNC_H
+#define _IMC_ASYNC_H
+
+#include "imc_includes.h"
+
+/*  Usage of the asynchronous jobs
+
+    1. Create a queue with 'imc_async_create()', or with 'imc_async_create_shared()' for running its jobs
+       on an existing thread pool (so many queues can share the same workers).
+    2. Submit jobs with 'imc_async_submit()'. The function returns immediately, and the job runs on a worker thread.
+    3. Get the finished jobs with 'imc_async_poll()' (does not block) or 'imc_async_wait()' (blocks).
+       On Linux, 'imc_async_get_fd()' returns a file descriptor that becomes readable while there are
+       finished jobs to be taken, so it can be added to an event loop (poll, epoll, select, etc).
+    4. Read the result of the job, then free it with 'imc_async_free()'.
+    5. Once done, destroy the queue with 'imc_async_destroy()' (the unfinished jobs are cancelled).
+
+    A job can be cancelled with 'imc_async_cancel()'. A job still waiting on the queue is skipped once a worker
+    takes it (without opening its image), while a running job stops at its next step (between the hidden
+    or extracted files, or before saving the image). Cancelled jobs finish with the IMC_ERR_CANCELLED status,
+    and they still need to be taken from the queue and freed.
+
+    A job is performed as a batch with a single job (see 'imc_batch.h'), so its status messages are the same
+    as printed by the '--batch' option, and they can be written to a stream of the caller's choice.
+
+    The callbacks of a job ('progress' and 'on_finish') are called on the worker thread that runs the job.
+*/
+
+// Operations that can be performed by an asynchronous job
+enum AsyncOperation {IMC_ASYNC_HIDE, IMC_ASYNC_EXTRACT, IMC_ASYNC_CHECK};
+
+// States that an asynchronous job goes through
+enum AsyncState {IMC_ASYNC_QUEUED, IMC_ASYNC_RUNNING, IMC_ASYNC_FINISHED};
+
+struct AsyncJob;
+
+// Function called when a job finishes (on the worker thread, right before the job can be taken from the queue)
+typedef void (*imc_async_func)(struct AsyncJob *job, void *user_data);
+
+// Parameters of an asynchronous job
+// (all strings, the password, and the key are copied when submitting, so they do not need to be kept by the caller)
+typedef struct AsyncRequest {
+    enum AsyncOperation operation;  // What is being done with the image
+    const char *image;              // Path to the image being processed
+    const char *output;             // Path of the new image or of the extraction directory (NULL for the default)
+    const char *const *payloads;    // Paths to the files being hidden
+    size_t payload_count;           // Amount of elements on the 'payloads' array
+    bool append;                    // Whether the hidden files are appended to the existing ones
+    const PassBuff *password;       // Password of the hidden data (NULL if there is no password)
+    const CryptoContext *key;       // Secret key already generated from the password (if not NULL, 'password' is not used)
+    FILE *log;                      // Stream for the status messages of the job (NULL for stdout and stderr)
+    imc_progress_func progress;     // Receives the progress of each stage of the operation (can be NULL)
+    imc_async_func on_finish;       // Called when the job finishes (can be NULL)
+    void *user_data;                // Pointer passed to the 'progress' and 'on_finish' functions
+} AsyncRequest;
+
+// A job submitted to the queue
+typedef struct AsyncJob {
+    enum AsyncOperation operation;  // What is being done with the image
+    char *image;                    // Path to the image being processed
+    char *output;                   // Path of the new image or of the extraction directory (NULL for the default)
+    char **payloads;                // Paths to the files being hidden
+    size_t payload_count;           // Amount of elements on the 'payloads' array
+    bool append;                    // Whether the hidden files are appended to the existing ones
+    PassBuff *password;             // Copy of the password (erased once the secret key is generated)
+    CryptoContext *key;             // Copy of the secret key (NULL until it is generated from the password)
+    FILE *log;                      // Stream for the status messages of the job (NULL for stdout and stderr)
+    imc_progress_func progress;     // Receives the progress of each stage of the operation
+    imc_async_func on_finish;       // Called when the job finishes
+    void *user_data;                // Pointer passed to the 'progress' and 'on_finish' functions
+
+    // Result of the job (only valid after it has finished)
+    enum AsyncState state;          // Whether the job is waiting, running, or finished
+    int status;                     // IMC_SUCCESS, IMC_ERR_CANCELLED, or the first error that happened
+
+    atomic_bool cancelled;          // Set when the job should stop as soon as possible
+    struct AsyncQueue *queue;       // The queue that the job was submitted to
+    struct AsyncJob *prev;          // Previous job on the list of unfinished jobs
+    struct AsyncJob *next;          // Next job on the list of unfinished jobs (or of finished jobs, once it has finished)
+} AsyncJob;
+
+// Jobs running on a thread pool
+typedef struct AsyncQueue {
+    ThreadPool *pool;           // Worker threads that run the jobs
+    bool owns_pool;             // Whether the pool was created by the queue (and is destroyed along with it)
+    AsyncJob *unfinished_head;  // Jobs that were submitted but have not finished yet
+    AsyncJob *finished_head;    // Oldest finished job that was not taken yet
+    AsyncJob *finished_tail;    // Newest finished job
+    size_t unfinished;          // Amount of elements on the list of unfinished jobs
+    bool shutdown;              // Signals the queued jobs to be skipped (when the queue is being destroyed)
+    int event_fd;               // Readable while there are finished jobs to be taken (-1 if not supported)
+    pthread_mutex_t lock;       // Protects all the fields above, as well as the state of the jobs
+    pthread_cond_t has_finished;    // Signaled when a job finishes
+} AsyncQueue;
+
+// Create a queue whose jobs run on 'num_threads' worker threads (zero for one per processor)
+AsyncQueue *imc_async_create(size_t num_threads);
+
+// Create a queue whose jobs run on an existing thread pool
+// The pool is not destroyed along with the queue, so it can be shared by many queues.
+// Note: the jobs should not be waited for from a worker of the same pool (all workers could end up waiting).
+AsyncQueue *imc_async_create_shared(ThreadPool *pool);
+
+// Create the fields of a queue that are common to both ways of creating it
+static AsyncQueue *__async_create_queue(ThreadPool *pool, bool owns_pool);
+
+// Submit a job to the queue, and return immediately
+// The returned job should be freed with 'imc_async_free()' after it was taken from the queue.
+// Function returns NULL if there is no enough memory for copying the password or the key.
+AsyncJob *imc_async_submit(AsyncQueue *queue, const AsyncRequest *request);
+
+// Perform a job (this function runs on a worker thread)
+static void __async_run_job(void *job_ptr);
+
+// Mark a job as finished, and move it to the list of finished jobs
+static void __async_finish(AsyncJob *job, int status);
+
+// Get the file descriptor that becomes readable while there are finished jobs to be taken from the queue
+// (returns -1 on systems where this is not supported)
+int imc_async_get_fd(const AsyncQueue *queue);
+
+// Take the oldest finished job from the queue, without blocking
+// Function returns NULL if no job has finished yet.
+AsyncJob *imc_async_poll(AsyncQueue *queue);
+
+// Take the oldest finished job from the queue, waiting until one finishes if needed
+// Function returns NULL if there are no jobs left (all of them were already taken).
+AsyncJob *imc_async_wait(AsyncQueue *queue);
+
+// Request a job to be cancelled
+// Function returns false if the job has already finished.
+bool imc_async_cancel(AsyncJob *job);
+
+// Free the memory used by a job that was taken from the queue
+void imc_async_free(AsyncJob *job);
+
+// Cancel the unfinished jobs, wait for them to stop, and free the queue
+// (the jobs that were not taken from the queue are also freed)
+void imc_async_destroy(AsyncQueue *queue);
+
+#endif  // _IMC_ASYNC_H
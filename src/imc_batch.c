@@ -0,0 +1,785 @@
+/* Batch mode: perform many hide, extract, or check operations listed on a manifest file. */
+
+#include "imc_includes.h"
+
+/* Note: See the 'imc_batch.h' file for the format of the manifest. */
+
+// Read a manifest file and parse the jobs listed on it
+// Function returns IMC_ERR_FILE_NOT_FOUND if the file could not be opened,
+// and IMC_ERR_FILE_INVALID if a line could not be parsed (the reason is printed to stderr).
+// The returned 'BatchContext' should be freed with 'imc_batch_free()'.
+int imc_batch_load(const char *manifest_path, BatchContext **output)
+{
+    struct stat manifest_stats;
+    if (stat(manifest_path, &manifest_stats) == 0 && S_ISDIR(manifest_stats.st_mode)) return IMC_ERR_PATH_IS_DIR;
+    FILE *manifest = fopen(manifest_path, "rb");
+    if (!manifest) return IMC_ERR_FILE_NOT_FOUND;
+
+    // Read the whole manifest into a null-terminated string
+    fseek(manifest, 0, SEEK_END);
+    const long manifest_size = ftell(manifest);
+    fseek(manifest, 0, SEEK_SET);
+    if (manifest_size < 0)
+    {
+        fclose(manifest);
+        return IMC_ERR_FILE_NOT_FOUND;
+    }
+
+    char *text = imc_malloc(manifest_size + 1);
+    const size_t read_count = fread(text, 1, manifest_size, manifest);
+    fclose(manifest);
+    text[read_count] = '\0';
+
+    BatchContext *batch = imc_calloc(1, sizeof(BatchContext));
+    batch->manifest_text = text;
+    pthread_mutex_init(&batch->lock, NULL);
+    size_t job_capacity = 0;
+
+    // Parse the manifest line by line
+    char *line = text;
+    size_t line_num = 0;
+    while (line)
+    {
+        line_num++;
+
+        // Null-terminate the current line, and remember where the next one begins
+        char *next_line = strchr(line, '\n');
+        if (next_line) *next_line++ = '\0';
+
+        // Remove the carriage return at the end (in case the line break is CRLF)
+        const size_t line_len = strlen(line);
+        if (line_len > 0 && line[line_len-1] == '\r') line[line_len-1] = '\0';
+
+        // Skip empty lines and comments
+        if (line[0] == '\0' || line[0] == '#')
+        {
+            line = next_line;
+            continue;
+        }
+
+        // Add a job to the array (its size is doubled when it becomes full)
+        if (batch->job_count == job_capacity)
+        {
+            job_capacity = job_capacity ? job_capacity * 2 : 16;
+            batch->jobs = imc_realloc(batch->jobs, job_capacity * sizeof(BatchJob));
+        }
+
+        BatchJob *job = &batch->jobs[batch->job_count];
+        memset(job, 0, sizeof(BatchJob));
+        batch->job_count++;
+
+        if (!__batch_parse_line(line, line_num, job))
+        {
+            imc_batch_free(batch);
+            return IMC_ERR_FILE_INVALID;
+        }
+
+        line = next_line;
+    }
+
+    // Get the sizes of the images, and link the jobs to the batch
+    // (this is done only after parsing, because the jobs array might have moved while growing)
+    for (size_t i = 0; i < batch->job_count; i++)
+    {
+        BatchJob *job = &batch->jobs[i];
+        job->batch = batch;
+
+        struct stat image_stats;
+        if (stat(job->image, &image_stats) == 0) job->image_size = image_stats.st_size;
+    }
+
+    *output = batch;
+    return IMC_SUCCESS;
+}
+
+// Parse one line of the manifest into a job
+// Note: the line is modified in place (the fields are null-terminated).
+static bool __batch_parse_line(char *line, size_t line_num, BatchJob *job)
+{
+    // Split the line into its tab separated fields
+    size_t field_count = 1;
+    for (const char *c = line; *c; c++)
+    {
+        if (*c == '\t') field_count++;
+    }
+
+    char *fields[field_count];
+    fields[0] = line;
+    for (size_t i = 1; i < field_count; i++)
+    {
+        char *tab = strchr(fields[i-1], '\t');
+        *tab = '\0';
+        fields[i] = tab + 1;
+    }
+
+    job->line = line_num;
+
+    // Operation
+    if (strcmp(fields[0], "hide") == 0)
+    {
+        job->operation = IMC_BATCH_HIDE;
+    }
+    else if (strcmp(fields[0], "extract") == 0)
+    {
+        job->operation = IMC_BATCH_EXTRACT;
+    }
+    else if (strcmp(fields[0], "check") == 0)
+    {
+        job->operation = IMC_BATCH_CHECK;
+    }
+    else
+    {
+        fprintf(stderr, "Error: manifest line %zu: unknown operation '%s' (it should be 'hide', 'extract', or 'check').\n", line_num, fields[0]);
+        return false;
+    }
+
+    // Image
+    if (field_count < 2 || fields[1][0] == '\0')
+    {
+        fprintf(stderr, "Error: manifest line %zu: missing the path to the image.\n", line_num);
+        return false;
+    }
+    job->image = fields[1];
+
+    // Output (an empty field means the default output)
+    if (field_count >= 3 && fields[2][0] != '\0')
+    {
+        if (job->operation == IMC_BATCH_CHECK)
+        {
+            fprintf(stderr, "Error: manifest line %zu: 'check' does not have an output.\n", line_num);
+            return false;
+        }
+        job->output = fields[2];
+    }
+
+    // Files being hidden
+    if (job->operation == IMC_BATCH_HIDE)
+    {
+        job->payloads = imc_calloc(field_count, sizeof(char *));
+        for (size_t i = 3; i < field_count; i++)
+        {
+            if (fields[i][0] != '\0') job->payloads[job->payload_count++] = fields[i];
+        }
+
+        if (job->payload_count == 0)
+        {
+            fprintf(stderr, "Error: manifest line %zu: 'hide' needs at least one file to be hidden.\n", line_num);
+            return false;
+        }
+    }
+    else if (field_count > 3)
+    {
+        fprintf(stderr, "Error: manifest line %zu: only 'hide' can have files after the output field.\n", line_num);
+        return false;
+    }
+
+    return true;
+}
+
+// Check if any of the jobs on the batch is hiding files
+bool imc_batch_has_hide(const BatchContext *batch)
+{
+    for (size_t i = 0; i < batch->job_count; i++)
+    {
+        if (batch->jobs[i].operation == IMC_BATCH_HIDE) return true;
+    }
+    return false;
+}
+
+// Print a status message of a job, prefixed by the job's line on the manifest (if it has one)
+// The messages of failures are printed to stderr, and the others to stdout,
+// unless the batch has its own log stream (then all messages are written to it).
+static void __batch_print(BatchJob *job, bool is_failure, const char *format, ...)
+{
+    BatchContext *const batch = job->batch;
+    if (batch->silent && !is_failure && !batch->log) return;
+
+    FILE *const stream = batch->log ? batch->log : (is_failure ? stderr : stdout);
+
+    pthread_mutex_lock(&batch->lock);
+    va_list arguments;
+    va_start(arguments, format);
+    if (job->line > 0) fprintf(stream, "[line %zu] ", job->line);
+    vfprintf(stream, format, arguments);
+    fprintf(stream, "\n");
+    fflush(stream);
+    va_end(arguments);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+// Check whether the jobs of a batch were cancelled
+// If so, a failure message is printed for the job (so it is clear why it stopped).
+static bool __batch_is_cancelled(BatchJob *job)
+{
+    if (!job->batch->cancelled || !atomic_load(job->batch->cancelled)) return false;
+
+    __batch_print(job, true, "FAIL: the operation on '%s' was cancelled.", job->image);
+    return true;
+}
+
+// Get the encrypted stream of a shared file, preparing it if this is the first job that needs it
+// Function returns the same status codes as 'imc_steg_prepare()'.
+static int __batch_get_payload(BatchPayload *shared, CryptoContext *key, PreparedPayload **output)
+{
+    pthread_mutex_lock(&shared->lock);
+    
+    if (!shared->is_done)
+    {
+        shared->status = imc_steg_prepare(key, shared->path, false, &shared->prepared);
+        shared->is_done = true;
+    }
+    
+    *output = shared->prepared;
+    const int status = shared->status;
+    
+    pthread_mutex_unlock(&shared->lock);
+    return status;
+}
+
+// Signal that a job is no longer using a shared file (its stream is freed once no job needs it)
+static void __batch_put_payload(BatchPayload *shared)
+{
+    pthread_mutex_lock(&shared->lock);
+    
+    if (--shared->users == 0)
+    {
+        imc_steg_prepared_free(shared->prepared);
+        shared->prepared = NULL;
+    }
+    
+    pthread_mutex_unlock(&shared->lock);
+}
+
+// Hide the files of a job in its cover image
+static int __batch_hide(BatchJob *job, CarrierImage *steg_image)
+{
+    // If on "append mode": Skip to the end of the hidden data
+    if (job->batch->append)
+    {
+        imc_steg_seek_to_end(steg_image);
+
+        if (steg_image->carrier_pos == 0)
+        {
+            // Safeguard to prevent the user from overwriting files in case the password is wrong
+            __batch_print(job, true, "FAIL: image '%s' contains no hidden data or the password is incorrect "
+                "(the existing hidden files are needed in order to append).", job->image);
+            return IMC_ERR_INVALID_MAGIC;
+        }
+    }
+
+    // Hide the files on the image
+    int status = IMC_SUCCESS;
+    size_t hidden_count = 0;
+    for (size_t i = 0; i < job->payload_count; i++)
+    {
+        if (__batch_is_cancelled(job)) return IMC_ERR_CANCELLED;
+
+        // A file shared with other jobs is written from its already encrypted stream
+        int hide_status;
+        if (job->shared && job->shared[i])
+        {
+            PreparedPayload *prepared = NULL;
+            hide_status = __batch_get_payload(job->shared[i], job->batch->key, &prepared);
+            if (hide_status == IMC_SUCCESS) hide_status = imc_steg_insert_prepared(steg_image, prepared);
+        }
+        else
+        {
+            hide_status = imc_steg_insert(steg_image, job->payloads[i]);
+        }
+        
+        if (hide_status == IMC_SUCCESS)
+        {
+            hidden_count++;
+        }
+        else
+        {
+            status = hide_status;
+            __batch_print(job, true, "FAIL: could not hide '%s' in '%s' (%s).",
+                job->payloads[i], job->image, imc_steg_strerror(hide_status));
+        }
+    }
+
+    if (hidden_count == 0) return status;
+    if (__batch_is_cancelled(job)) return IMC_ERR_CANCELLED;
+
+    // Save the modified image
+    const char *const save_path = job->output ? job->output : job->image;
+    const int save_status = imc_steg_save(steg_image, save_path);
+    if (save_status != IMC_SUCCESS)
+    {
+        __batch_print(job, true, "FAIL: could not save '%s' (%s).", save_path, imc_steg_strerror(save_status));
+        return save_status;
+    }
+
+    __batch_print(job, false, "SUCCESS: hidden %zu of %zu files in '%s', saved to '%s'.",
+        hidden_count, job->payload_count, job->image, steg_image->out_path);
+
+    return status;
+}
+
+// Extract or check the hidden files of a job
+static int __batch_extract(BatchJob *job, CarrierImage *steg_image)
+{
+    const bool just_check = (job->operation == IMC_BATCH_CHECK);
+
+    // Create the output folder, if one was specified for the extracted files
+    if (!just_check && job->output)
+    {
+        #ifdef _WIN32
+        const int mk_status = _mkdir(job->output);
+        #else // Linux
+        const int mk_status = mkdir(job->output, 0700); // Create with read and write access for only the current user
+        #endif
+
+        if (mk_status != 0 && errno != EEXIST)
+        {
+            __batch_print(job, true, "FAIL: could not create output directory '%s'. Reason: %s.", job->output, strerror(errno));
+            return IMC_ERR_SAVE_FAIL;
+        }
+
+        steg_image->out_dir = job->output;
+    }
+
+    // Save or just check the files hidden on the image
+    size_t file_count = 0;
+    int status = IMC_SUCCESS;
+    while ( (status = imc_steg_extract(steg_image)) == IMC_SUCCESS )
+    {
+        file_count++;
+
+        const FileMetadata *const info = steg_image->steg_info;
+
+        if (just_check)
+        {
+            char size_str[256];
+            imc_cli_filesize_to_string(info->file_size, size_str, sizeof(size_str));
+            if (info->shard_count > 0)
+            {
+                __batch_print(job, false, "Found part %u of %u of file '%s' in '%s' (size of the whole file: %s).",
+                    info->shard_index + 1, info->shard_count, info->file_name, job->image, size_str);
+            }
+            else if (info->is_tree)
+            {
+                __batch_print(job, false, "Found folder '%s' in '%s' (%zu entries, size: %s).",
+                    info->file_name, job->image, info->entry_count, size_str);
+            }
+            else
+            {
+                __batch_print(job, false, "Found file '%s' in '%s' (size: %s).", info->file_name, job->image, size_str);
+            }
+        }
+        else if (info->shard_count > 0)
+        {
+            __batch_print(job, false, "SUCCESS: extracted part %u of %u of '%s' from '%s'%s.",
+                info->shard_index + 1, info->shard_count, info->file_name, job->image,
+                info->is_joined ? " (all parts were extracted, so the file was rebuilt)" : "");
+        }
+        else
+        {
+            __batch_print(job, false, "SUCCESS: extracted '%s' from '%s'.", info->file_name, job->image);
+        }
+
+        if (__batch_is_cancelled(job)) return IMC_ERR_CANCELLED;
+    }
+
+    // After all hidden files have been read, the extraction returns IMC_ERR_INVALID_MAGIC or IMC_ERR_PAYLOAD_OOB
+    const bool reached_end = (status == IMC_ERR_INVALID_MAGIC || status == IMC_ERR_PAYLOAD_OOB);
+
+    if (!reached_end || (file_count == 0 && !just_check))
+    {
+        __batch_print(job, true, "FAIL: could not %s '%s' (%s).",
+            just_check ? "check" : "extract from", job->image, imc_steg_strerror(status));
+        return status;
+    }
+
+    if (just_check)
+    {
+        // How much space the image has left
+        const size_t free_bytes = (file_count > 0)
+            ? (steg_image->carrier_length - steg_image->carrier_pos) / 8
+            : steg_image->carrier_length / 8;
+
+        char size_str[256];
+        imc_cli_filesize_to_string(free_bytes, size_str, sizeof(size_str));
+        __batch_print(job, false, "Image '%s' has %zu hidden file%s, and can hide approximately more %s.",
+            job->image, file_count, (file_count == 1) ? "" : "s", size_str);
+    }
+
+    return IMC_SUCCESS;
+}
+
+// Get the identifier of a job on the journal (a hash of its operation, image, output, and files)
+static void __batch_job_id(const BatchJob *job, uint8_t *id)
+{
+    crypto_generichash_state state;
+    crypto_generichash_init(&state, NULL, 0, IMC_JOURNAL_ID_SIZE);
+
+    // The fields are hashed with their null terminators, so they cannot run into each other
+    const uint8_t operation = job->operation;
+    crypto_generichash_update(&state, &operation, 1);
+    crypto_generichash_update(&state, (const uint8_t *)job->image, strlen(job->image) + 1);
+    const char *const output = job->output ? job->output : "";
+    crypto_generichash_update(&state, (const uint8_t *)output, strlen(output) + 1);
+
+    for (size_t i = 0; i < job->payload_count; i++)
+    {
+        crypto_generichash_update(&state, (const uint8_t *)job->payloads[i], strlen(job->payloads[i]) + 1);
+    }
+
+    crypto_generichash_final(&state, id, IMC_JOURNAL_ID_SIZE);
+}
+
+// Skip the jobs that succeeded on a previous run, according to the batch's journal
+static void __batch_resume(BatchContext *batch)
+{
+    for (size_t i = 0; i < batch->job_count; i++)
+    {
+        BatchJob *const job = &batch->jobs[i];
+        __batch_job_id(job, job->journal_id);
+
+        const char *output_path = NULL;
+        if (!imc_journal_is_done(batch->journal, job->journal_id, &output_path)) continue;
+
+        job->is_resumed = true;
+        job->status = IMC_SUCCESS;
+        batch->resumed_count++;
+
+        if (job->operation == IMC_BATCH_HIDE)
+        {
+            __batch_print(job, false, "SKIPPED: '%s' was already done on a previous run (saved to '%s').", job->image, output_path);
+        }
+        else
+        {
+            __batch_print(job, false, "SKIPPED: '%s' was already done on a previous run.", job->image);
+        }
+    }
+}
+
+// Perform the operation of a single job (this function runs on a worker thread)
+// The job's result is stored on its 'status' field.
+void imc_batch_run_job(void *job_ptr)
+{
+    BatchJob *const job = (BatchJob *)job_ptr;
+    BatchContext *const batch = job->batch;
+    const uint64_t flags = (job->operation == IMC_BATCH_CHECK) ? IMC_JUST_CHECK : 0;
+
+    // Let one more image be read ahead (the images shared by many jobs are decoded only once, so they are not prefetched)
+    if (!job->cover) imc_prefetch_consume(batch->prefetcher);
+
+    // Prepare the shared files before opening the image, so the job does not hold the memory of its image while it
+    // waits for another job that is preparing them (the result is kept, and checked when the files are hidden)
+    if (job->operation == IMC_BATCH_HIDE && job->shared)
+    {
+        for (size_t i = 0; i < job->payload_count; i++)
+        {
+            PreparedPayload *prepared = NULL;
+            if (job->shared[i]) __batch_get_payload(job->shared[i], batch->key, &prepared);
+        }
+    }
+
+    // Open the image using a copy of the batch's secret key
+    // (or take it already decoded from the template, if other jobs share the same cover image)
+    CarrierImage *steg_image = NULL;
+    int status = job->cover
+        ? imc_template_acquire(job->cover, batch->key, &steg_image, batch->progress, batch->progress_data)
+        : imc_steg_init_from_key(job->image, batch->key, &steg_image, flags, batch->progress, batch->progress_data);
+
+    if (status == IMC_SUCCESS)
+    {
+        switch (job->operation)
+        {
+            case IMC_BATCH_HIDE:
+                status = __batch_hide(job, steg_image);
+                break;
+
+            case IMC_BATCH_EXTRACT:
+            case IMC_BATCH_CHECK:
+                status = __batch_extract(job, steg_image);
+                break;
+        }
+
+        // Record the finished job (the new image is hashed, so it can be checked when resuming)
+        if (batch->journal)
+        {
+            const bool has_image = (job->operation == IMC_BATCH_HIDE) && steg_image->out_path;
+            imc_journal_record(batch->journal, job->journal_id, status, job->image,
+                has_image ? steg_image->out_path : job->output, has_image);
+        }
+
+        if (job->cover) imc_template_release(job->cover, steg_image);
+        else imc_steg_finish(steg_image);
+    }
+    else
+    {
+        __batch_print(job, true, "FAIL: could not open '%s' (%s).", job->image, imc_steg_strerror(status));
+        if (batch->journal) imc_journal_record(batch->journal, job->journal_id, status, job->image, job->output, false);
+    }
+
+    // Release the shared files (even if the job failed before using them)
+    if (job->shared)
+    {
+        for (size_t i = 0; i < job->payload_count; i++)
+        {
+            if (job->shared[i]) __batch_put_payload(job->shared[i]);
+        }
+    }
+
+    job->status = status;
+
+    if (status != IMC_SUCCESS)
+    {
+        pthread_mutex_lock(&batch->lock);
+        batch->fail_count++;
+        pthread_mutex_unlock(&batch->lock);
+    }
+}
+
+// Comparison function for sorting the jobs from the biggest image to the smallest
+static int __batch_compare_size(const void *job_a, const void *job_b)
+{
+    const BatchJob *const a = *(const BatchJob **)job_a;
+    const BatchJob *const b = *(const BatchJob **)job_b;
+
+    if (a->image_size != b->image_size) return (a->image_size > b->image_size) ? -1 : 1;
+    return (a->line > b->line) - (a->line < b->line);   // Same size: keep the order of the manifest
+}
+
+// Comparison function for sorting the jobs by the path of their image
+static int __batch_compare_image(const void *job_a, const void *job_b)
+{
+    const BatchJob *const a = *(const BatchJob **)job_a;
+    const BatchJob *const b = *(const BatchJob **)job_b;
+    return strcmp(a->image, b->image);
+}
+
+// Create a template for each cover image used by more than one hiding job
+// 'max_instances' is how many copies of each image can be decoded (one per job running at the same time).
+static void __batch_create_covers(BatchContext *batch, size_t max_instances)
+{
+    // Group the hiding jobs by their cover image
+    BatchJob **hide_jobs = imc_malloc(batch->job_count * sizeof(BatchJob *));
+    size_t hide_count = 0;
+    for (size_t i = 0; i < batch->job_count; i++)
+    {
+        if (batch->jobs[i].operation == IMC_BATCH_HIDE && !batch->jobs[i].is_resumed) hide_jobs[hide_count++] = &batch->jobs[i];
+    }
+    qsort(hide_jobs, hide_count, sizeof(BatchJob *), &__batch_compare_image);
+
+    for (size_t start = 0; start < hide_count; )
+    {
+        // Find where the group of the current image ends
+        size_t end = start + 1;
+        while (end < hide_count && strcmp(hide_jobs[start]->image, hide_jobs[end]->image) == 0) end++;
+
+        // Share a template among the jobs, if there are more than one
+        const size_t group_size = end - start;
+        if (group_size > 1)
+        {
+            const size_t instances = (group_size < max_instances) ? group_size : max_instances;
+            CarrierTemplate *cover = imc_template_create(hide_jobs[start]->image, 0, instances);
+
+            batch->covers = imc_realloc(batch->covers, (batch->cover_count + 1) * sizeof(CarrierTemplate *));
+            batch->covers[batch->cover_count++] = cover;
+
+            for (size_t i = start; i < end; i++)
+            {
+                hide_jobs[i]->cover = cover;
+            }
+        }
+
+        start = end;
+    }
+
+    imc_free(hide_jobs);
+}
+
+// Comparison function for sorting the payloads of the jobs by their path
+static int __batch_compare_payload(const void *ref_a, const void *ref_b)
+{
+    const BatchPayloadRef *const a = (const BatchPayloadRef *)ref_a;
+    const BatchPayloadRef *const b = (const BatchPayloadRef *)ref_b;
+    return strcmp(a->job->payloads[a->index], b->job->payloads[b->index]);
+}
+
+// Find the files hidden by more than one job, so each of them is compressed and encrypted only once
+static void __batch_share_payloads(BatchContext *batch)
+{
+    // List the payloads of all hiding jobs
+    size_t ref_count = 0;
+    for (size_t i = 0; i < batch->job_count; i++)
+    {
+        if (batch->jobs[i].operation == IMC_BATCH_HIDE && !batch->jobs[i].is_resumed) ref_count += batch->jobs[i].payload_count;
+    }
+    if (ref_count < 2) return;
+
+    BatchPayloadRef *refs = imc_malloc(ref_count * sizeof(BatchPayloadRef));
+    size_t pos = 0;
+    for (size_t i = 0; i < batch->job_count; i++)
+    {
+        if (batch->jobs[i].operation != IMC_BATCH_HIDE || batch->jobs[i].is_resumed) continue;
+        for (size_t j = 0; j < batch->jobs[i].payload_count; j++)
+        {
+            refs[pos++] = (BatchPayloadRef){.job = &batch->jobs[i], .index = j};
+        }
+    }
+    qsort(refs, ref_count, sizeof(BatchPayloadRef), &__batch_compare_payload);
+
+    // Count the groups of the same file, so the array of shared files does not need to be moved afterwards
+    // (the jobs keep pointers to its elements)
+    size_t group_count = 0;
+    for (size_t start = 0, end; start < ref_count; start = end)
+    {
+        end = start + 1;
+        while (end < ref_count && __batch_compare_payload(&refs[start], &refs[end]) == 0) end++;
+        if (end - start > 1) group_count++;
+    }
+
+    if (group_count == 0)
+    {
+        imc_free(refs);
+        return;
+    }
+
+    batch->shared = imc_calloc(group_count, sizeof(BatchPayload));
+
+    for (size_t start = 0, end; start < ref_count; start = end)
+    {
+        end = start + 1;
+        while (end < ref_count && __batch_compare_payload(&refs[start], &refs[end]) == 0) end++;
+        if (end - start < 2) continue;
+
+        BatchPayload *const shared = &batch->shared[batch->shared_count++];
+        shared->path = refs[start].job->payloads[refs[start].index];
+        shared->users = end - start;
+        pthread_mutex_init(&shared->lock, NULL);
+
+        for (size_t i = start; i < end; i++)
+        {
+            BatchJob *const job = refs[i].job;
+            if (!job->shared) job->shared = imc_calloc(job->payload_count, sizeof(BatchPayload *));
+            job->shared[refs[i].index] = shared;
+        }
+    }
+
+    imc_free(refs);
+}
+
+// Free the files shared among the jobs
+static void __batch_free_payloads(BatchContext *batch)
+{
+    for (size_t i = 0; i < batch->shared_count; i++)
+    {
+        imc_steg_prepared_free(batch->shared[i].prepared);
+        pthread_mutex_destroy(&batch->shared[i].lock);
+    }
+
+    for (size_t i = 0; i < batch->job_count; i++)
+    {
+        imc_free(batch->jobs[i].shared);
+        batch->jobs[i].shared = NULL;
+    }
+
+    imc_free(batch->shared);
+    batch->shared = NULL;
+    batch->shared_count = 0;
+}
+
+// Perform all jobs of the batch, using 'num_threads' worker threads (zero for one thread per processor)
+// The password is hashed only once, and the resulting key is shared by all jobs.
+// Function returns the amount of jobs that failed.
+size_t imc_batch_run(BatchContext *batch, const PassBuff *password, size_t num_threads)
+{
+    if (batch->job_count == 0) return 0;
+
+    // Hash the password (this is the slowest step, so it is done only once for the whole batch)
+    const int crypto_status = imc_crypto_context_create(password, &batch->key);
+    if (crypto_status != IMC_SUCCESS)
+    {
+        fprintf(stderr, "Error: No enough memory for hashing the password.\n");
+        batch->fail_count = batch->job_count;
+        return batch->fail_count;
+    }
+
+    // Skip the jobs that were already done (if resuming from a journal)
+    if (batch->journal) __batch_resume(batch);
+
+    // Schedule the jobs with the biggest images first
+    // (so the longest jobs are not left to the end, when most worker threads would be idle)
+    BatchJob **schedule = imc_malloc(batch->job_count * sizeof(BatchJob *));
+    size_t schedule_count = 0;
+    for (size_t i = 0; i < batch->job_count; i++)
+    {
+        if (!batch->jobs[i].is_resumed) schedule[schedule_count++] = &batch->jobs[i];
+    }
+    qsort(schedule, schedule_count, sizeof(BatchJob *), &__batch_compare_size);
+
+    // There is no point in having more threads than jobs
+    if (num_threads == 0) num_threads = imc_cpu_count();
+    if (num_threads > schedule_count) num_threads = schedule_count;
+    if (num_threads == 0) num_threads = 1;
+
+    // Decode only once the cover images shared by many jobs
+    // (not when there is a memory budget, because the decoded covers would keep their memory reserved while idle)
+    if (imc_memory_get_budget() == 0) __batch_create_covers(batch, num_threads);
+
+    // Compress and encrypt only once the files hidden in many images
+    __batch_share_payloads(batch);
+
+    // Read the images ahead of the jobs, in the same order that the jobs start
+    batch->prefetcher = imc_prefetch_create(batch->prefetch_window);
+    for (size_t i = 0; i < schedule_count; i++)
+    {
+        if (!schedule[i]->cover) imc_prefetch_add(batch->prefetcher, schedule[i]->image);
+    }
+
+    // Run the jobs
+    ThreadPool *pool = imc_threadpool_create(num_threads);
+    for (size_t i = 0; i < schedule_count; i++)
+    {
+        imc_threadpool_submit(pool, &imc_batch_run_job, schedule[i]);
+    }
+    imc_threadpool_destroy(pool);
+    imc_free(schedule);
+
+    imc_prefetch_destroy(batch->prefetcher);
+    batch->prefetcher = NULL;
+
+    for (size_t i = 0; i < batch->cover_count; i++)
+    {
+        imc_template_destroy(batch->covers[i]);
+    }
+    imc_free(batch->covers);
+    batch->covers = NULL;
+    batch->cover_count = 0;
+
+    __batch_free_payloads(batch);
+
+    imc_crypto_context_destroy(batch->key);
+    batch->key = NULL;
+
+    if (!batch->silent)
+    {
+        printf("Batch finished: %zu of %zu jobs succeeded", batch->job_count - batch->fail_count, batch->job_count);
+        if (batch->resumed_count > 0) printf(" (%zu of them on a previous run)", batch->resumed_count);
+        printf(".\n");
+        fflush(stdout);
+    }
+
+    return batch->fail_count;
+}
+
+// Free the memory used by a batch
+void imc_batch_free(BatchContext *batch)
+{
+    if (!batch) return;
+
+    for (size_t i = 0; i < batch->job_count; i++)
+    {
+        imc_free(batch->jobs[i].payloads);
+    }
+
+    pthread_mutex_destroy(&batch->lock);
+    imc_free(batch->jobs);
+    imc_free(batch->manifest_text);
+    imc_free(batch);
+}
@@ -0,0 +1,164 @@
+/* Batch mode: perform many hide, extract, or check operations listed on a manifest file. */
+
+#ifndef _IMC_BATCH_H
+#define _IMC_BATCH_H
+
+#include "imc_includes.h"
+
+/*  Format of the manifest file
+
+    Each line of the manifest is a job, with the fields separated by tabs:
+    OPERATION   IMAGE   OUTPUT  FILE_1  FILE_2  ...
+
+    - OPERATION: either 'hide', 'extract', or 'check'.
+    - IMAGE: path to the cover image (when hiding) or to the image with hidden data (when extracting or checking).
+    - OUTPUT: where to save the new image (when hiding) or the directory for the extracted files (when extracting).
+              This field can be left empty in order to use the default behavior, and it is not used when checking.
+    - FILE_1, FILE_2, ...: paths of the files being hidden (at least one is needed when hiding).
+
+    Empty lines and lines beginning with '#' are ignored.
+    Relative paths are relative to the current working directory (not to the manifest's directory).
+
+    When the same IMAGE appears on more than one 'hide' line, the image is decoded only once and shared
+    by those jobs as a template (see 'imc_template.h'). The paths are compared as written on the manifest.
+
+    Likewise, when the same FILE appears on more than one 'hide' line (broadcasting a file to many images),
+    the file is read, compressed, and encrypted only once, and the resulting stream is written to all images.
+
+    If the batch has a journal (see 'imc_journal.h'), each job is recorded once it finishes,
+    and the jobs that succeeded on a previous run of the same manifest are skipped.
+*/
+
+// Operations that can be performed by a batch job
+enum BatchOperation {IMC_BATCH_HIDE, IMC_BATCH_EXTRACT, IMC_BATCH_CHECK};
+
+// A single operation listed on the manifest
+typedef struct BatchJob {
+    enum BatchOperation operation;  // What is being done with the image
+    char *image;                    // Path to the image being processed
+    char *output;                   // Path of the new image or of the extraction directory (NULL for the default)
+    char **payloads;                // Paths to the files being hidden
+    size_t payload_count;           // Amount of elements on the 'payloads' array
+    size_t line;                    // Line number of the job on the manifest (zero if not from a manifest)
+    off_t image_size;               // Size in bytes of the image (the biggest images are processed first)
+    int status;                     // Return code of the job (IMC_SUCCESS if everything went well)
+    CarrierTemplate *cover;         // Decoded cover image shared with other jobs (NULL if the job opens the image itself)
+    struct BatchPayload **shared;   // For each payload, its encrypted stream shared with other jobs (NULL if none is shared)
+    uint8_t journal_id[IMC_JOURNAL_ID_SIZE];    // Identifier of the job on the journal (if the batch has one)
+    bool is_resumed;                // Whether the job was skipped because it succeeded on a previous run
+    struct BatchContext *batch;     // The batch that this job belongs to
+} BatchJob;
+
+// A file hidden by more than one job, which is compressed and encrypted only once for all of them
+typedef struct BatchPayload {
+    const char *path;           // Path to the file (as written on the manifest)
+    PreparedPayload *prepared;  // Compressed and encrypted file (NULL until the first job needs it, or if that failed)
+    int status;                 // Status code of the preparation (IMC_SUCCESS if the file could be prepared)
+    bool is_done;               // Whether the preparation was already attempted
+    size_t users;               // Amount of jobs that have not finished yet (the stream is freed after the last one)
+    pthread_mutex_t lock;       // Held while the file is prepared (so the other jobs wait for it instead of repeating it)
+} BatchPayload;
+
+// A payload of a hiding job (used for finding the files hidden by more than one job)
+typedef struct BatchPayloadRef {
+    BatchJob *job;              // The job hiding the file
+    size_t index;               // Position of the file on the job's 'payloads' array
+} BatchPayloadRef;
+
+// Shared state of all jobs of a batch
+typedef struct BatchContext {
+    BatchJob *jobs;             // Array with the jobs parsed from the manifest
+    size_t job_count;           // Amount of elements on the 'jobs' array
+    char *manifest_text;        // Contents of the manifest file (the jobs' strings point to it)
+    CryptoContext *key;         // Secret key generated from the password (each job uses a copy of it)
+    bool append;                // Whether the hidden files are appended to the existing ones
+    bool silent;                // Print only the failures
+    FILE *log;                  // Stream for the status messages of the jobs (NULL for stdout and stderr)
+    CarrierTemplate **covers;   // Cover images shared by more than one hiding job
+    size_t cover_count;         // Amount of elements on the 'covers' array
+    BatchPayload *shared;       // Files hidden by more than one job
+    size_t shared_count;        // Amount of elements on the 'shared' array
+    BatchJournal *journal;      // Where the finished jobs are recorded (NULL if the batch has no journal)
+    size_t prefetch_window;     // Amount of images read ahead of the jobs being run (zero for no prefetching)
+    FilePrefetcher *prefetcher; // Thread reading ahead the images (NULL while the batch is not running)
+    atomic_bool *cancelled;     // Set when the jobs should stop as soon as possible (NULL if they cannot be cancelled)
+    imc_progress_func progress; // Receives the progress of the operations on each image (NULL for no progress)
+    void *progress_data;        // Pointer passed to the 'progress' function
+    size_t resumed_count;       // Amount of jobs skipped because they succeeded on a previous run
+    size_t fail_count;          // Amount of jobs that failed
+    pthread_mutex_t lock;       // Prevents the status messages and counters from being written at the same time
+} BatchContext;
+
+// Read a manifest file and parse the jobs listed on it
+// Function returns IMC_ERR_FILE_NOT_FOUND if the file could not be opened,
+// and IMC_ERR_FILE_INVALID if a line could not be parsed (the reason is printed to stderr).
+// The returned 'BatchContext' should be freed with 'imc_batch_free()'.
+int imc_batch_load(const char *manifest_path, BatchContext **output);
+
+// Parse one line of the manifest into a job
+// Note: the line is modified in place (the fields are null-terminated).
+static bool __batch_parse_line(char *line, size_t line_num, BatchJob *job);
+
+// Check if any of the jobs on the batch is hiding files
+bool imc_batch_has_hide(const BatchContext *batch);
+
+// Print a status message of a job, prefixed by the job's line on the manifest (if it has one)
+// The messages of failures are printed to stderr, and the others to stdout,
+// unless the batch has its own log stream (then all messages are written to it).
+static void __batch_print(BatchJob *job, bool is_failure, const char *format, ...);
+
+// Check whether the jobs of a batch were cancelled
+// If so, a failure message is printed for the job (so it is clear why it stopped).
+static bool __batch_is_cancelled(BatchJob *job);
+
+// Get the encrypted stream of a shared file, preparing it if this is the first job that needs it
+// Function returns the same status codes as 'imc_steg_prepare()'.
+static int __batch_get_payload(BatchPayload *shared, CryptoContext *key, PreparedPayload **output);
+
+// Signal that a job is no longer using a shared file (its stream is freed once no job needs it)
+static void __batch_put_payload(BatchPayload *shared);
+
+// Hide the files of a job in its cover image
+static int __batch_hide(BatchJob *job, CarrierImage *steg_image);
+
+// Extract or check the hidden files of a job
+static int __batch_extract(BatchJob *job, CarrierImage *steg_image);
+
+// Get the identifier of a job on the journal (a hash of its operation, image, output, and files)
+static void __batch_job_id(const BatchJob *job, uint8_t *id);
+
+// Skip the jobs that succeeded on a previous run, according to the batch's journal
+static void __batch_resume(BatchContext *batch);
+
+// Perform the operation of a single job (this function runs on a worker thread)
+// The job's result is stored on its 'status' field.
+void imc_batch_run_job(void *job_ptr);
+
+// Comparison function for sorting the jobs from the biggest image to the smallest
+static int __batch_compare_size(const void *job_a, const void *job_b);
+
+// Comparison function for sorting the jobs by the path of their image
+static int __batch_compare_image(const void *job_a, const void *job_b);
+
+// Create a template for each cover image used by more than one hiding job
+// 'max_instances' is how many copies of each image can be decoded (one per job running at the same time).
+static void __batch_create_covers(BatchContext *batch, size_t max_instances);
+
+// Comparison function for sorting the payloads of the jobs by their path
+static int __batch_compare_payload(const void *ref_a, const void *ref_b);
+
+// Find the files hidden by more than one job, so each of them is compressed and encrypted only once
+static void __batch_share_payloads(BatchContext *batch);
+
+// Free the files shared among the jobs
+static void __batch_free_payloads(BatchContext *batch);
+
+// Perform all jobs of the batch, using 'num_threads' worker threads (zero for one thread per processor)
+// The password is hashed only once, and the resulting key is shared by all jobs.
+// Function returns the amount of jobs that failed.
+size_t imc_batch_run(BatchContext *batch, const PassBuff *password, size_t num_threads);
+
+// Free the memory used by a batch
+void imc_batch_free(BatchContext *batch);
+
+#endif  // _IMC_BATCH_H
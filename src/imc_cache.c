@@ -0,0 +1,284 @@
+/* Capacity cache: remembers how many carrier bytes the cover images have, so unchanged images are not decoded again. */
+
+#include "imc_includes.h"
+
+/* Note: See the 'imc_cache.h' file for the format of the cache file. */
+
+// Load the cache file at 'path'
+// If the file does not exist (or cannot be parsed), the cache begins empty, and the file is created when saving.
+// The returned 'CapacityCache' should be freed with 'imc_cache_close()'.
+CapacityCache *imc_cache_open(const char *path)
+{
+    CapacityCache *cache = imc_calloc(1, sizeof(CapacityCache));
+    const size_t path_size = strlen(path) + 1;
+    cache->path = imc_malloc(path_size);
+    memcpy(cache->path, path, path_size);
+    pthread_mutex_init(&cache->lock, NULL);
+
+    FILE *cache_file = fopen(path, "rb");
+    if (!cache_file) return cache;
+
+    // Check if the file has a valid header, and the amount of records that it says
+    struct stat file_stats;
+    CacheHeader header;
+    const bool is_valid = fstat(fileno(cache_file), &file_stats) == 0
+        && !S_ISDIR(file_stats.st_mode)
+        && (size_t)file_stats.st_size >= sizeof(CacheHeader)
+        && fread(&header, sizeof(CacheHeader), 1, cache_file) == 1
+        && memcmp(header.magic, IMC_CACHE_MAGIC, sizeof(header.magic)) == 0
+        && le32toh(header.version) == IMC_CACHE_VERSION
+        && (size_t)file_stats.st_size == sizeof(CacheHeader) + (size_t)le32toh(header.count) * sizeof(CacheRecord);
+
+    if (!is_valid || le32toh(header.count) == 0)
+    {
+        fclose(cache_file);
+        return cache;
+    }
+
+    const size_t map_size = file_stats.st_size;
+
+    #ifdef _WIN32
+
+    // Read the whole file into memory
+    void *map = imc_malloc(map_size);
+    fseek(cache_file, 0, SEEK_SET);
+    const bool read_success = fread(map, 1, map_size, cache_file) == map_size;
+    fclose(cache_file);
+    if (!read_success)
+    {
+        imc_free(map);
+        return cache;
+    }
+
+    #else // Linux
+
+    // Map the file into memory (only the pages that the binary searches touch are read from the disk)
+    void *map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fileno(cache_file), 0);
+    fclose(cache_file);
+    if (map == MAP_FAILED) return cache;
+
+    #endif // _WIN32
+
+    const CacheRecord *const records = (const CacheRecord *)((uint8_t *)map + sizeof(CacheHeader));
+    const size_t count = le32toh(header.count);
+
+    // The records must be sorted, otherwise the binary search would not find them
+    for (size_t i = 1; i < count; i++)
+    {
+        if (__cache_compare_key(&records[i-1], &records[i]) >= 0)
+        {
+            #ifdef _WIN32
+            imc_free(map);
+            #else
+            munmap(map, map_size);
+            #endif
+            return cache;
+        }
+    }
+
+    cache->map = map;
+    cache->map_size = map_size;
+    cache->records = records;
+    cache->count = count;
+
+    return cache;
+}
+
+// Hash the contents of an image file, and get its format
+// Function returns IMC_ERR_FILE_NOT_FOUND if the file could not be read,
+// IMC_ERR_PATH_IS_DIR if the path is a directory, or IMC_ERR_FILE_INVALID if the file is not a supported image.
+int imc_cache_hash_file(const char *path, uint8_t *hash, enum ImageType *type)
+{
+    FILE *image = fopen(path, "rb");
+    if (!image) return IMC_ERR_FILE_NOT_FOUND;
+
+    struct stat file_stats;
+    if (fstat(fileno(image), &file_stats) != 0)
+    {
+        fclose(image);
+        return IMC_ERR_FILE_NOT_FOUND;
+    }
+
+    if (S_ISDIR(file_stats.st_mode))
+    {
+        fclose(image);
+        return IMC_ERR_PATH_IS_DIR;
+    }
+
+    const size_t buffer_size = 65536;
+    uint8_t *const buffer = imc_malloc(buffer_size);
+    crypto_generichash_state state;
+    crypto_generichash_init(&state, NULL, 0, IMC_CACHE_HASH_SIZE);
+
+    // The format is determined from the first bytes of the file
+    size_t read_count = fread(buffer, 1, buffer_size, image);
+    if (!imc_steg_detect_type(buffer, read_count, type))
+    {
+        imc_free(buffer);
+        fclose(image);
+        return IMC_ERR_FILE_INVALID;
+    }
+
+    while (read_count > 0)
+    {
+        crypto_generichash_update(&state, buffer, read_count);
+        read_count = fread(buffer, 1, buffer_size, image);
+    }
+
+    const bool read_error = ferror(image);
+    imc_free(buffer);
+    fclose(image);
+    if (read_error) return IMC_ERR_FILE_NOT_FOUND;
+
+    crypto_generichash_final(&state, hash, IMC_CACHE_HASH_SIZE);
+
+    return IMC_SUCCESS;
+}
+
+// Comparison function for the keys of the records
+static int __cache_compare_key(const void *record_a, const void *record_b)
+{
+    return memcmp(record_a, record_b, IMC_CACHE_KEY_SIZE);
+}
+
+// Look for the capacity of an image on the cache (this function can be called from many threads at once)
+// Function returns 'true' if the image was found, and the record is copied to 'output'
+// (with its values converted to the byte order of the host).
+bool imc_cache_lookup(CapacityCache *cache, const uint8_t *hash, enum ImageType type, CacheRecord *output)
+{
+    CacheRecord key = {.type = type, .rules = IMC_CARRIER_VERSION};
+    memcpy(key.hash, hash, IMC_CACHE_HASH_SIZE);
+
+    const CacheRecord *found = NULL;
+    if (cache->count > 0) found = bsearch(&key, cache->records, cache->count, sizeof(CacheRecord), &__cache_compare_key);
+
+    if (found)
+    {
+        *output = *found;
+    }
+    else
+    {
+        // Search the records that were added after loading the file
+        pthread_mutex_lock(&cache->lock);
+        for (size_t i = 0; i < cache->added_count && !found; i++)
+        {
+            if (__cache_compare_key(&key, &cache->added[i]) == 0)
+            {
+                found = &cache->added[i];
+                *output = *found;
+            }
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+
+    if (!found) return false;
+
+    output->width = le32toh(output->width);
+    output->height = le32toh(output->height);
+    output->carrier_count = le64toh(output->carrier_count);
+
+    return true;
+}
+
+// Add the capacity of an image to the cache (this function can be called from many threads at once)
+// The record is only written to the file when the cache is saved.
+void imc_cache_add(CapacityCache *cache, const uint8_t *hash, const CarrierImage *carrier_img)
+{
+    CacheRecord record = {
+        .type = carrier_img->type,
+        .rules = IMC_CARRIER_VERSION,
+        .width = htole32(carrier_img->width),
+        .height = htole32(carrier_img->height),
+        .carrier_count = htole64(carrier_img->carrier_length),
+    };
+    memcpy(record.hash, hash, IMC_CACHE_HASH_SIZE);
+
+    pthread_mutex_lock(&cache->lock);
+
+    if (cache->added_count == cache->added_capacity)
+    {
+        cache->added_capacity = (cache->added_capacity > 0) ? cache->added_capacity * 2 : 64;
+        cache->added = imc_realloc(cache->added, cache->added_capacity * sizeof(CacheRecord));
+    }
+
+    cache->added[cache->added_count++] = record;
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Write to the cache file the records added since it was loaded (if any)
+// Function returns IMC_ERR_SAVE_FAIL if the file could not be written (the old file is kept in that case).
+int imc_cache_save(CapacityCache *cache)
+{
+    if (cache->added_count == 0) return IMC_SUCCESS;
+
+    // Merge the new records (sorted) with the ones from the file (already sorted)
+    qsort(cache->added, cache->added_count, sizeof(CacheRecord), &__cache_compare_key);
+
+    const size_t max_count = cache->count + cache->added_count;
+    if (max_count > UINT32_MAX) return IMC_ERR_SAVE_FAIL;
+    CacheRecord *merged = imc_malloc(max_count * sizeof(CacheRecord));
+    size_t count = 0;
+    size_t old_pos = 0;
+    size_t new_pos = 0;
+
+    while (old_pos < cache->count || new_pos < cache->added_count)
+    {
+        const CacheRecord *next;
+        if (new_pos == cache->added_count) next = &cache->records[old_pos++];
+        else if (old_pos == cache->count) next = &cache->added[new_pos++];
+        else if (__cache_compare_key(&cache->records[old_pos], &cache->added[new_pos]) <= 0) next = &cache->records[old_pos++];
+        else next = &cache->added[new_pos++];
+
+        // The same image might have been added more than once (the first record is kept)
+        if (count > 0 && __cache_compare_key(&merged[count-1], next) == 0) continue;
+        merged[count++] = *next;
+    }
+
+    // Write the records to a temporary file, then replace the old file with it
+    // (so a cache that is being read by another process is never seen half written)
+    // Note: each save has its own temporary file, so processes saving the same cache at the same time do not write
+    //       over each other's file. The last one to finish replaces the cache, and the images added only by the others
+    //       are just scanned again the next time.
+    OutputFile *cache_file = imc_output_open(cache->path, (count * sizeof(CacheRecord)) + sizeof(CacheHeader), IMC_OUTPUT_REPLACE);
+    if (!cache_file)
+    {
+        imc_free(merged);
+        return IMC_ERR_SAVE_FAIL;
+    }
+
+    CacheHeader header = {.version = htole32(IMC_CACHE_VERSION), .count = htole32(count)};
+    memcpy(header.magic, IMC_CACHE_MAGIC, sizeof(header.magic));
+
+    const bool write_success = imc_output_write(cache_file, (const uint8_t *)&header, sizeof(CacheHeader))
+        && imc_output_write(cache_file, (const uint8_t *)merged, count * sizeof(CacheRecord));
+    imc_free(merged);
+
+    if (!write_success)
+    {
+        imc_output_discard(cache_file);
+        return IMC_ERR_SAVE_FAIL;
+    }
+
+    return (imc_output_commit(cache_file, NULL) == IMC_SUCCESS) ? IMC_SUCCESS : IMC_ERR_SAVE_FAIL;
+}
+
+// Free the memory used by a cache (the records that were not saved are discarded)
+void imc_cache_close(CapacityCache *cache)
+{
+    if (!cache) return;
+
+    if (cache->map)
+    {
+        #ifdef _WIN32
+        imc_free(cache->map);
+        #else
+        munmap(cache->map, cache->map_size);
+        #endif
+    }
+
+    pthread_mutex_destroy(&cache->lock);
+    imc_free(cache->added);
+    imc_free(cache->path);
+    imc_free(cache);
+}
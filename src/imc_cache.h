@@ -0,0 +1,95 @@
+/* Capacity cache: remembers how many carrier bytes the cover images have, so unchanged images are not decoded again. */
+
+#ifndef _IMC_CACHE_H
+#define _IMC_CACHE_H
+
+#include "imc_includes.h"
+
+/*  Format of the cache file
+
+    The file begins with a 'CacheHeader', followed by an array of 'CacheRecord' sorted by their key
+    (compared byte by byte), so a record can be found with a binary search directly on the file's memory map.
+    All integers are stored in little endian byte order.
+
+    The key of a record is the BLAKE2b hash of the whole image file, the image's format, and the version of the
+    rules for selecting the carrier bytes ('IMC_CARRIER_VERSION'). So an image is looked up by its contents
+    (renaming or copying it does not matter), and the records become stale by themselves if the rules change.
+    Hashing a file is much faster than decoding it, so scanning an unchanged archive of images only reads the files.
+
+    The cache is only written by 'imc_cache_save()', which merges the new records into a temporary file,
+    then replaces the old file with it. A cache file that cannot be parsed is treated as empty.
+*/
+
+#define IMC_CACHE_MAGIC     "imccache"  // First bytes of the cache file (8 bytes, without the null terminator)
+#define IMC_CACHE_VERSION   1           // Version of the cache file's format
+#define IMC_CACHE_HASH_SIZE 32          // Size in bytes of the hash of an image file (BLAKE2b)
+
+// Beginning of the cache file
+typedef struct __attribute__ ((__packed__)) CacheHeader
+{
+    uint8_t magic[8];   // IMC_CACHE_MAGIC
+    uint32_t version;   // IMC_CACHE_VERSION
+    uint32_t count;     // Amount of records after the header
+} CacheHeader;
+
+// Capacity of an image
+typedef struct __attribute__ ((__packed__)) CacheRecord
+{
+    // Key
+    uint8_t hash[IMC_CACHE_HASH_SIZE];  // Hash of the image file
+    uint8_t type;                       // Format of the image ('enum ImageType')
+    uint8_t rules;                      // Version of the rules for selecting the carrier bytes
+
+    // Values
+    uint16_t reserved;                  // Always zero
+    uint32_t width;                     // Width of the image in pixels
+    uint32_t height;                    // Height of the image in pixels
+    uint64_t carrier_count;             // Amount of carrier bytes of the image (each one carries one bit)
+} CacheRecord;
+
+// Size in bytes of the key at the beginning of a record
+#define IMC_CACHE_KEY_SIZE offsetof(CacheRecord, reserved)
+
+// Cache of the capacities of the images, loaded from a file
+typedef struct CapacityCache {
+    char *path;                 // Path to the cache file
+    const CacheRecord *records; // Records on the file, sorted by their key
+    size_t count;               // Amount of elements on the 'records' array
+    void *map;                  // Memory map of the file (on Windows, a buffer with the file's contents)
+    size_t map_size;            // Size in bytes of the memory map
+    CacheRecord *added;         // Records added since the file was loaded (not sorted)
+    size_t added_count;         // Amount of elements on the 'added' array
+    size_t added_capacity;      // Maximum amount of elements that the 'added' array can hold before it is resized
+    pthread_mutex_t lock;       // Protects the 'added' array
+} CapacityCache;
+
+// Load the cache file at 'path'
+// If the file does not exist (or cannot be parsed), the cache begins empty, and the file is created when saving.
+// The returned 'CapacityCache' should be freed with 'imc_cache_close()'.
+CapacityCache *imc_cache_open(const char *path);
+
+// Hash the contents of an image file, and get its format
+// Function returns IMC_ERR_FILE_NOT_FOUND if the file could not be read,
+// IMC_ERR_PATH_IS_DIR if the path is a directory, or IMC_ERR_FILE_INVALID if the file is not a supported image.
+int imc_cache_hash_file(const char *path, uint8_t *hash, enum ImageType *type);
+
+// Comparison function for the keys of the records
+static int __cache_compare_key(const void *record_a, const void *record_b);
+
+// Look for the capacity of an image on the cache (this function can be called from many threads at once)
+// Function returns 'true' if the image was found, and the record is copied to 'output'
+// (with its values converted to the byte order of the host).
+bool imc_cache_lookup(CapacityCache *cache, const uint8_t *hash, enum ImageType type, CacheRecord *output);
+
+// Add the capacity of an image to the cache (this function can be called from many threads at once)
+// The record is only written to the file when the cache is saved.
+void imc_cache_add(CapacityCache *cache, const uint8_t *hash, const CarrierImage *carrier_img);
+
+// Write to the cache file the records added since it was loaded (if any)
+// Function returns IMC_ERR_SAVE_FAIL if the file could not be written (the old file is kept in that case).
+int imc_cache_save(CapacityCache *cache);
+
+// Free the memory used by a cache (the records that were not saved are discarded)
+void imc_cache_close(CapacityCache *cache);
+
+#endif  // _IMC_CACHE_H
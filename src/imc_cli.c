@@ -3,6 +3,19 @@
 #include "imc_includes.h"
 
 #define PRINT_ALGORITHM 1001    // Option ID for printing a summary of the algorithm used by this program
+#define SERVE_SOCKET 1002       // Option ID for running as a server on a local socket
+#define SHARD_FILE 1003         // Option ID for splitting a file among many images
+#define PLAN_MANIFEST 1004      // Option ID for planning which images receive each file
+#define PLAN_BALANCE 1005       // Option ID for spreading the planned files among all images
+#define CAPACITY_CACHE 1006     // Option ID for the file that caches the capacities of the images
+#define CORPUS_SCAN 1007        // Option ID for checking all images on a directory tree
+#define BATCH_JOURNAL 1008      // Option ID for the file that records the finished jobs of a batch
+#define PREFETCH_WINDOW 1009    // Option ID for how many images are read ahead of the ones being processed
+#define MAX_MEMORY 1010         // Option ID for the maximum amount of memory used by the images being processed
+#define STDIN_NAME 1011         // Option ID for the name of the file hidden from the standard input
+#define STDOUT_FORMAT 1012      // Option ID for writing the extracted files to the standard output
+#define PRINT_STATS 1013        // Option ID for printing how much time and memory each stage took
+#define PRINT_STATS_JSON 1014   // Option ID for printing those statistics as JSON
 
 // Command line options for imgconceal
 static const struct argp_option argp_options[] = {
@@ -24,7 +37,19 @@ static const struct argp_option argp_options[] = {
         "If there is no enough space in the cover image, some files may fail being hidden "\
         "(files specified first have priority when trying to hide). "\
         "The default behavior is to overwrite the existing previously hidden files, "\
-        "to avoid that add the '--append' option.", 2},
+        "to avoid that add the '--append' option. Use '-' as the path for hiding the data read from the standard input. "\
+        "If the path is a folder, the folder is hidden whole (with its files and subfolders) as a single file.", 2},
+    {"name", STDIN_NAME, "NAME", 0, "When hiding the standard input with '--hide -', the file name under which the data is stored "\
+        "(default: 'stdin'). The data is read until the end of the input, and gets the current time as its timestamps.", 2},
+    {"stdout", STDOUT_FORMAT, "FORMAT", OPTION_ARG_OPTIONAL, "When extracting with '--extract', write the hidden files "\
+        "to the standard output instead of saving them. FORMAT is either 'raw' (the default), which writes the contents of "\
+        "the hidden file as-is (the image must contain a single file), or 'tar', which writes a tar archive with all "\
+        "hidden files. A password must be given with '--password' or '--no-password', and the status messages are not shown.", 2},
+    {"shard", SHARD_FILE, "FILE", 0, "Split a file that does not fit on a single image among all cover images passed to '--input' "\
+        "(with this option, '--input' accepts more than one image). Each image receives a part of the file sized to its capacity, "\
+        "and the images are saved on the '--output' folder (or next to their covers). "\
+        "To get the file back, extract all of those images to the same folder, in any order: "\
+        "the file is rebuilt once its last part is extracted.", 2},
     {"append", 'a', NULL, 0, "When hiding a file with the '--hide' option, "\
         "append the new file instead of overwriting the existing hidden files. "\
         "For this option to work, the password must be the same as the one used for the previous files.", 3},
@@ -38,6 +63,53 @@ static const struct argp_option argp_options[] = {
         "This option can be used with '--hide', '--extract', or '--check'." , 4},
     {"verbose", 'v', NULL, 0, "Print detailed progress information.", 5},
     {"silent", 's', NULL, 0, "Do not print any progress information (errors are still shown).", 5},
+    {"batch", 'b', "MANIFEST", 0, "Perform many hiding, extraction, or checking operations listed on a manifest file "\
+        "(a text file with one operation per line). Each line has the fields OPERATION, IMAGE, OUTPUT, and FILES, "\
+        "separated by tabs: OPERATION is either 'hide', 'extract', or 'check'; OUTPUT may be left empty for the default; "\
+        "and FILES are the paths of the files being hidden (hide only, at least one). Lines beginning with '#' are ignored. "\
+        "The operations are run in parallel, and all of them use the same password (which is hashed only once). "\
+        "The '--append' option applies to all hiding operations.", 1},
+    {"plan", PLAN_MANIFEST, "MANIFEST", 0, "Plan which cover images receive each file, without hiding anything yet. "\
+        "The images (or folders with images) are passed to '--input', and the files to '--hide'. "\
+        "The capacity of the images is scanned and the compressed size of the files is estimated (both in parallel), "\
+        "then the files are assigned to as few images as possible (or to all of them, with '--balance'). "\
+        "The plan is saved as a manifest for the '--batch' option, with the new images going to the '--output' folder "\
+        "(or named automatically).", 1},
+    {"balance", PLAN_BALANCE, NULL, 0, "When planning with '--plan', spread the files among all images "\
+        "(instead of using as few images as possible).", 3},
+    {"cache", CAPACITY_CACHE, "FILE", 0, "When planning with '--plan', remember on this file the capacity of the scanned images "\
+        "(the file is created if it does not exist). Images whose contents were scanned before are only hashed, instead of decoded.", 3},
+    {"journal", BATCH_JOURNAL, "FILE", 0, "When running a manifest with '--batch', record on this file each job that finishes "\
+        "(the file is created if it does not exist). If the batch is interrupted, running it again with the same journal "\
+        "skips the jobs that already succeeded.", 3},
+    {"prefetch", PREFETCH_WINDOW, "N", 0, "When processing many images with '--batch' or '--scan', how many images are read from the disk "\
+        "ahead of the ones being processed, so the disk is not idle while the images are decoded (default: 8, or 0 to disable).", 3},
+    {"max-memory", MAX_MEMORY, "SIZE", 0, "Maximum amount of memory used by the images being processed at the same time "\
+        "(in bytes, or with the suffix K, M or G). The memory needed by each image is estimated from its dimensions before "\
+        "decoding it: images that do not fit at the moment wait for the others to finish, and images that alone need more "\
+        "than the maximum fail right away.", 3},
+    {"scan", CORPUS_SCAN, "FOLDER", 0, "Check all JPEG, PNG and WebP images on a folder and its subfolders for data hidden by this program, "\
+        "and write a report with one line per image in the JSON Lines format (fields: path, has_data, entries, free_bytes, "\
+        "and error if the image could not be checked). The report goes to the '--output' file (or to the standard output). "\
+        "The images are checked in parallel, and all of them use the same password (which is hashed only once).", 1},
+    {"serve", SERVE_SOCKET, "SOCKET", 0, "Run as a server that performs the hiding, extraction, or checking operations "\
+        "requested through a Unix domain socket created at the given path, until interrupted with Ctrl+C. "\
+        "Keys generated from the passwords are kept in memory for the following requests. "\
+        "Each request is a 4-byte length (big-endian) followed by null-separated fields: the operation (hide, append, extract, "\
+        "or check), the password, the image (or fd:N for a file descriptor passed with the request), the output (can be empty), "\
+        "and the files being hidden. Each response is a 4-byte length (big-endian) followed by a line with the status code "\
+        "(zero on success) and the elapsed microseconds, then the status messages. Adding '+progress' to the operation "\
+        "(like hide+progress) sends the progress before the response, and closing the connection cancels the operation. "\
+        "Not available on Windows.", 1},
+    {"threads", 't', "N", 0, "Amount of threads used for processing the images (default: one per available processor, "\
+        "taking into account the CPU limits of containers). With the '--batch' or '--serve' options, "\
+        "this is also how many operations are performed in parallel.", 1},
+    {"stats", PRINT_STATS, NULL, 0, "When the operation finishes, print to the standard error a table with how much time each stage "\
+        "took (key generation, file reading, image decoding and scanning, shuffling, compression, encryption, embedding, extraction, "\
+        "decryption, decompression, image encoding, and file writing), with the bytes processed by each stage and its throughput, "\
+        "followed by the current and peak memory allocated for each kind of buffer, the total CPU time, the peak memory usage, "\
+        "and how many bits of the cover images were used.", 5},
+    {"stats-json", PRINT_STATS_JSON, NULL, 0, "Same as '--stats', but print the statistics as a single JSON object.", 5},
     {"algorithm", PRINT_ALGORITHM, NULL, 0, "Print a summary of the algorithm used by imgconceal, then exit.", 6},
     {0}
 };
@@ -48,10 +120,24 @@ static const char help_text[] = "\nSteganography tool for hiding and extracting
     "and the hidden data can be (optionally) protected with a password.\n\n"\
     "Hiding a file on an image:\n"\
     "  imgconceal --input=IMAGE --hide=FILE [--output=NEW_IMAGE] [--append] [--password=TEXT | --no-password]\n\n"\
+    "Hiding the standard input on an image:\n"\
+    "  imgconceal --input=IMAGE --hide=- [--name=NAME] [--output=NEW_IMAGE] (--password=TEXT | --no-password)\n\n"\
+    "Splitting a file among many images:\n"\
+    "  imgconceal --shard=FILE --input=IMAGE_1 IMAGE_2 ... [--output=FOLDER] [--password=TEXT | --no-password]\n\n"\
     "Extracting a hidden file from an image:\n"\
     "  imgconceal --extract=IMAGE [--output=FOLDER] [--password=TEXT | --no-password]\n\n"\
+    "Extracting the hidden files to the standard output:\n"\
+    "  imgconceal --extract=IMAGE --stdout[=raw|tar] (--password=TEXT | --no-password)\n\n"\
     "Check if an image has data hidden by this program:\n"\
     "  imgconceal --check=IMAGE [--password=TEXT | --no-password]\n\n"\
+    "Perform the operations listed on a manifest file:\n"\
+    "  imgconceal --batch=MANIFEST [--threads=N] [--prefetch=N] [--max-memory=SIZE] [--append] [--journal=FILE] [--password=TEXT | --no-password]\n\n"\
+    "Plan which images receive each file (saved as a manifest for '--batch'):\n"\
+    "  imgconceal --plan=MANIFEST --input=IMAGE_OR_FOLDER ... --hide=FILE ... [--output=FOLDER] [--balance] [--cache=FILE]\n\n"\
+    "Check all images on a folder tree (report in JSON Lines):\n"\
+    "  imgconceal --scan=FOLDER [--output=REPORT] [--threads=N] [--prefetch=N] [--max-memory=SIZE] [--password=TEXT | --no-password]\n\n"\
+    "Serve requests on a local socket:\n"\
+    "  imgconceal --serve=SOCKET [--threads=N]\n\n"\
     "All options:\n";
 
 static const char imgconceal_algorithm_text[] = "The password is hashed using the Argon2id "\
@@ -89,9 +175,28 @@ static const struct argp argp_struct = {argp_options, &imc_cli_parse_options, NU
 // Internal data structure to store the user's options
 typedef struct UserOptions {
     char *input;        // Path to the image which will get data hidden into it
+    struct HideList *more_inputs;       // Linked list with the paths to the other images (only when splitting a file)
+    struct HideList *more_inputs_tail;  // Last element of the 'more_inputs' linked list
+    char *shard;        // Path to the file being split among many images
+    char *plan;         // Path where to save the manifest planned for the files being hidden
+    bool balance;       // Whether the planned files are spread among all images
+    char *cache;        // Path to the file with the capacities of the images scanned before
+    char *journal;      // Path to the file that records the finished jobs of a batch
     char *output;       // Path where to save the image with hidden data
     char *extract;      // Path to the image with hidden data being extracted
     char *check;        // Path to the image being checked for hidden data
+    char *batch;        // Path to the manifest with the operations to be performed
+    char *serve;        // Path to the socket where the server listens for requests
+    char *scan;         // Path to the folder whose images are checked for hidden data
+    size_t threads;     // Amount of worker threads (zero means one per processor)
+    size_t prefetch;    // Amount of images read ahead of the ones being processed
+    bool has_prefetch;  // Whether the amount of images read ahead was provided by the user
+    size_t max_memory;  // Maximum amount of memory used by the images being processed (zero means no limit)
+    char *name;         // Name stored for the data hidden from the standard input ('--hide -')
+    bool to_stdout;     // Whether the extracted files are written to the standard output
+    bool stdout_tar;    // Whether the files written to the standard output are put in a tar archive
+    bool stats;         // Whether to print how much time and memory each stage took
+    bool stats_json;    // Whether those statistics are printed as JSON (instead of a table)
     struct HideList {
         char *data;
         struct HideList *next;
@@ -105,6 +210,25 @@ typedef struct UserOptions {
     bool silent;        // Do not print any information during operation
 } UserOptions;
 
+// State shared by the status messages of the files being hidden on an image
+typedef struct HideReport {
+    struct argp_state *state;   // State of the command line parser
+    const UserOptions *opt;     // Options provided by the user
+    const CarrierImage *steg_image; // Image where the files are hidden
+    char *const *paths;         // Paths to the files being hidden, in the same order as they are reported
+    bool image_has_changed;     // Whether any file was hidden on the image
+} HideReport;
+
+// State shared by the status messages of the files being extracted from an image
+typedef struct ExtractReport {
+    struct argp_state *state;   // State of the command line parser
+    const UserOptions *opt;     // Options provided by the user
+    CarrierImage *steg_image;   // Image from where the files are extracted
+    const char *image_name;     // Name of the image with hidden data
+    bool is_check;              // Whether the files are just being checked (instead of extracted)
+    bool has_file;              // Whether the image contains a hidden file
+} ExtractReport;
+
 // Get a password from the user on the command-line. The typed characters are not displayed.
 // They are stored on the 'output' buffer, up to 'buffer_size' bytes.
 // Function returns the amount of bytes in the password.
@@ -298,129 +422,1011 @@ static inline void __password_normalize(PassBuff *password, bool from_argv)
     #endif
 }
 
-// Free the memory of a 'PassBuff' struct
-static void imc_cli_password_free(PassBuff *password)
-{
-    sodium_free(password);
-    // Note: the above function already overwrites the memory before freeing it.
+// Free the memory of a 'PassBuff' struct
+static void imc_cli_password_free(PassBuff *password)
+{
+    sodium_free(password);
+    // Note: the above function already overwrites the memory before freeing it.
+}
+
+// Get the pointer of the struct needed by the 'argp_parse()' function
+const struct argp *restrict imc_cli_get_argp_struct()
+{
+    return &argp_struct;
+}
+
+// Store a copy of the path of a file
+static inline void __store_path(const char *path, char **destination)
+{
+    if (!path) return;
+    
+    #ifdef _WIN32   // Windows systems
+    
+    // Convert the terminal input to wide char string
+    const int w_path_len = MultiByteToWideChar(CP_ACP, 0, path, -1, NULL, 0);
+    wchar_t w_path[w_path_len];
+    MultiByteToWideChar(CP_ACP, 0, path, -1, w_path, w_path_len);
+
+    // Convert wide char to UTF-8 string
+    const int u8_path_len = WideCharToMultiByte(CP_UTF8, 0, w_path, -1, NULL, 0, NULL, NULL);;
+    char *u8_path = imc_malloc(u8_path_len * sizeof(char));
+    WideCharToMultiByte(CP_UTF8, 0, w_path, -1, u8_path, u8_path_len, NULL, NULL);
+
+    // Store the unicode path string
+    *destination = u8_path;
+    
+    #else   // Linux systems
+
+    // Duplicate the path string and store it
+    *destination = imc_strdup(path);
+    
+    #endif // _WIN32
+}
+
+// Check if an option has not been passed before (program exits if this check fails)
+// The idea is to check if the option's value evaluates to 'false'. If it doesn't, then the check fails.
+// The error message contains the name of the option, that is why it is needed.
+static inline void __check_unique_option(struct argp_state *state, const char *option_name, bool option_value)
+{
+    if (option_value)
+    {
+        argp_error(state, "the '%s' option can be used only once.", option_name);
+    }
+}
+
+// Convert a timespec struct to a date string, and store it on 'out_buff'
+static inline void __timespec_to_string(struct timespec *time, char *out_buff, size_t buff_size)
+{
+    // ISO C 'broken-down time' structure
+    struct tm my_time = {0};
+    #ifdef _WIN32
+    const struct tm *time_status = localtime(&time->tv_sec);    // The 'localtime_r()' function did not work on Windows (with the MSYS2 runtime)
+    if (time_status) my_time = *time_status;
+    #else
+    const struct tm *time_status = localtime_r(&time->tv_sec, &my_time);
+    #endif
+    
+    if (time_status)
+    {
+        const size_t date_status = strftime(out_buff, buff_size, "%c", &my_time);
+        if (!date_status) strncpy(out_buff, "(unknown)", buff_size);
+    }
+    else
+    {
+        strncpy(out_buff, "(unknown)", buff_size);
+    }
+}
+
+// Convert a file size (in bytes) to a string in the appropriate scale, and store it on 'out_buff'
+void imc_cli_filesize_to_string(size_t file_size, char *out_buff, size_t buff_size)
+{
+    static const char *scale[] = {"bytes", "KB", "MB", "GB", "TB"};
+    static const size_t scale_len = sizeof(scale) / sizeof(char *);
+    
+    // File size as a floating point number
+    double size_fp = (double)file_size;
+    const char *unit = scale[0];
+
+    // Increase the scale until the value is smaller than 1000 or the maximum scale is reached
+    for (size_t i = 0; (i < scale_len - 1) && (size_fp > 1000.0); i++)
+    {
+        size_fp /= 1000.0;
+        unit = scale[i + 1];
+    }
+
+    // Store the file size string on the buffer
+    if (unit == scale[0])
+    {
+        // Have no decimals if the unit is 'bytes'
+        snprintf(out_buff, buff_size, "%.0f %s", size_fp, unit);
+    }
+    else
+    {
+        // Have two decimals for the other units
+        snprintf(out_buff, buff_size, "%.2f %s", size_fp, unit);
+    }
+}
+
+// Parse the amount of threads passed to the '--threads' option (program exits if the value is invalid)
+static inline size_t __parse_thread_count(struct argp_state *state, const char *arg)
+{
+    char *end = NULL;
+    errno = 0;
+    const unsigned long long value = strtoull(arg, &end, 10);
+    
+    if (errno != 0 || end == arg || *end != '\0' || arg[0] == '-' || value == 0 || value > 1024)
+    {
+        argp_error(state, "the amount of threads must be a number from 1 to 1024 (got '%s').", arg);
+    }
+
+    return (size_t)value;
+}
+
+// Parse the amount of images passed to the '--prefetch' option (program exits if the value is invalid)
+static inline size_t __parse_prefetch_window(struct argp_state *state, const char *arg)
+{
+    char *end = NULL;
+    errno = 0;
+    const unsigned long long value = strtoull(arg, &end, 10);
+    
+    if (errno != 0 || end == arg || *end != '\0' || arg[0] == '-' || value > IMC_PREFETCH_MAX)
+    {
+        argp_error(state, "the amount of prefetched images must be a number from 0 to %d (got '%s').", IMC_PREFETCH_MAX, arg);
+    }
+
+    return (size_t)value;
+}
+
+// Parse the amount of bytes passed to the '--max-memory' option (program exits if the value is invalid)
+// The value may end with the suffix K, M, or G (multiples of 1024).
+static inline size_t __parse_memory_size(struct argp_state *state, const char *arg)
+{
+    char *end = NULL;
+    errno = 0;
+    unsigned long long value = strtoull(arg, &end, 10);
+
+    unsigned int shift = 0;
+    if (end != arg && *end != '\0' && end[1] == '\0')
+    {
+        switch (toupper((unsigned char)*end))
+        {
+            case 'K': shift = 10; end++; break;
+            case 'M': shift = 20; end++; break;
+            case 'G': shift = 30; end++; break;
+        }
+    }
+
+    if (errno != 0 || end == arg || *end != '\0' || arg[0] == '-' || value == 0 || value > (SIZE_MAX >> shift))
+    {
+        argp_error(state, "the maximum memory must be a positive amount of bytes, optionally followed by K, M or G (got '%s').", arg);
+    }
+
+    return (size_t)(value << shift);
+}
+
+// Perform the operations listed on a manifest file (the '--batch' option)
+// This is a helper for the '__execute_options()' function.
+static inline void __execute_batch(struct argp_state *state, void *options)
+{
+    UserOptions *opt = (UserOptions*)options;
+
+    if (opt->input || opt->output)
+    {
+        argp_error(state, "the 'input' and 'output' options cannot be used with 'batch' (use the manifest's fields instead).");
+    }
+
+    if (opt->verbose)
+    {
+        argp_error(state, "the 'verbose' option cannot be used with 'batch'.");
+    }
+
+    // Parse the manifest
+    BatchContext *batch = NULL;
+    const int load_status = imc_batch_load(opt->batch, &batch);
+
+    switch (load_status)
+    {
+        case IMC_SUCCESS:
+            break;
+        
+        case IMC_ERR_PATH_IS_DIR:
+            argp_failure(state, EXIT_FAILURE, 0, "'%s' is a directory; instead of a manifest file.", opt->batch);
+            break;
+        
+        case IMC_ERR_FILE_NOT_FOUND:
+            argp_failure(state, EXIT_FAILURE, 0, "file '%s' could not be opened. Reason: %s.", opt->batch, strerror(errno));
+            break;
+        
+        default:
+            argp_failure(state, EXIT_FAILURE, 0, "could not parse the manifest '%s'.", opt->batch);
+            break;
+    }
+
+    batch->append = opt->append;
+    batch->silent = opt->silent;
+    batch->prefetch_window = opt->has_prefetch ? opt->prefetch : IMC_PREFETCH_DEFAULT;
+
+    // Open the journal (the jobs recorded on it as finished are skipped)
+    if (opt->journal)
+    {
+        const int journal_status = imc_journal_open(opt->journal, &batch->journal);
+        if (journal_status != IMC_SUCCESS)
+        {
+            imc_batch_free(batch);
+        }
+
+        switch (journal_status)
+        {
+            case IMC_SUCCESS:
+                break;
+            
+            case IMC_ERR_PATH_IS_DIR:
+                argp_failure(state, EXIT_FAILURE, 0, "'%s' is a directory; instead of a journal file.", opt->journal);
+                break;
+            
+            case IMC_ERR_FILE_INVALID:
+                argp_failure(state, EXIT_FAILURE, 0, "'%s' is not a journal of imgconceal.", opt->journal);
+                break;
+            
+            default:
+                argp_failure(state, EXIT_FAILURE, 0, "journal '%s' could not be opened. Reason: %s.", opt->journal, strerror(errno));
+                break;
+        }
+    }
+
+    // Display a password prompt, if a password wasn't provided
+    // (the password is asked twice if any file is being hidden)
+    if (!opt->password)
+    {
+        printf("Input password for the hidden files (may be blank)\n");
+        opt->password = imc_cli_password_input(imc_batch_has_hide(batch));
+        
+        if (!opt->password)
+        {
+            imc_journal_close(batch->journal);
+            imc_batch_free(batch);
+            argp_failure(state, EXIT_FAILURE, 0, "passwords do not match.");
+        }
+    }
+
+    // Perform the operations
+    const size_t fail_count = imc_batch_run(batch, opt->password, opt->threads);
+    const size_t job_count = batch->job_count;
+    imc_cli_password_free(opt->password);
+    opt->password = NULL;
+
+    const int journal_status = imc_journal_close(batch->journal);
+    batch->journal = NULL;
+    imc_batch_free(batch);
+
+    if (journal_status != IMC_SUCCESS)
+    {
+        fprintf(stderr, "Warning: could not write the journal to '%s'.\n", opt->journal);
+    }
+
+    if (fail_count > 0)
+    {
+        argp_failure(state, EXIT_FAILURE, 0, "%zu of %zu operations failed.", fail_count, job_count);
+    }
+}
+
+// Run the server on a local socket (the '--serve' option)
+// This is a helper for the '__execute_options()' function.
+static inline void __execute_server(struct argp_state *state, void *options)
+{
+    UserOptions *opt = (UserOptions*)options;
+
+    #ifdef _WIN32
+    argp_error(state, "the 'serve' option is not available on Windows.");
+    #else
+
+    if (opt->input || opt->output || opt->append || opt->verbose || opt->password || opt->no_password)
+    {
+        argp_error(state, "the 'serve' option can only be used with 'threads' or 'silent' (the other options are sent with each request).");
+    }
+
+    const int server_status = imc_server_run(opt->serve, opt->threads, opt->silent);
+
+    switch (server_status)
+    {
+        case IMC_SUCCESS:
+            break;
+        
+        case IMC_ERR_NAME_TOO_LONG:
+            argp_failure(state, EXIT_FAILURE, 0, "the socket path '%s' is too long.", opt->serve);
+            break;
+        
+        case IMC_ERR_FILE_EXISTS:
+            argp_failure(state, EXIT_FAILURE, 0, "'%s' already exists (or another server is listening on it).", opt->serve);
+            break;
+        
+        case IMC_ERR_NO_MEMORY:
+            argp_failure(state, EXIT_FAILURE, 0, "no enough memory for starting the server.");
+            break;
+        
+        default:
+            argp_failure(state, EXIT_FAILURE, 0, "could not listen on '%s'. Reason: %s.", opt->serve, strerror(errno));
+            break;
+    }
+
+    #endif // _WIN32
+}
+
+// Split a file among many images (the '--shard' option)
+// This is a helper for the '__execute_options()' function.
+static inline void __execute_shard(struct argp_state *state, void *options)
+{
+    UserOptions *opt = (UserOptions*)options;
+
+    if (!opt->input)
+    {
+        argp_error(state, "please use '--input' to specify the images among which to split the file.");
+    }
+
+    if (opt->append || opt->verbose)
+    {
+        argp_error(state, "the 'append' and 'verbose' options cannot be used with 'shard'.");
+    }
+
+    // Create the output folder (if it does not exist already)
+    if (opt->output)
+    {
+        #ifdef _WIN32
+        const int mk_status = _mkdir(opt->output);
+        #else // Linux
+        const int mk_status = mkdir(opt->output, 0700); // Create with read and write access for only the current user
+        #endif
+
+        if (mk_status != 0 && errno != EEXIST)
+        {
+            argp_failure(
+                state, EXIT_FAILURE, 0,
+                "Could not create output directory '%s'. Reason: %s.\n"
+                "Note: only the last directory of a path is created, its parent directories must exist already.",
+                opt->output, strerror(errno)
+            );
+        }
+    }
+
+    // Display a password prompt, if a password wasn't provided
+    if (!opt->password)
+    {
+        printf("Input password for the hidden file (may be blank)\n");
+        opt->password = imc_cli_password_input(true);
+
+        if (!opt->password)
+        {
+            argp_failure(state, EXIT_FAILURE, 0, "passwords do not match.");
+        }
+    }
+
+    // Hash the password only once for all images
+    CryptoContext *key = NULL;
+    const int crypto_status = imc_crypto_context_create(opt->password, &key);
+    imc_cli_password_free(opt->password);
+    opt->password = NULL;
+    if (crypto_status != IMC_SUCCESS)
+    {
+        argp_failure(state, EXIT_FAILURE, 0, "no enough memory for hashing the password.");
+    }
+
+    // List the cover images
+    size_t target_count = 1;
+    for (struct HideList *node = opt->more_inputs; node; node = node->next) target_count++;
+
+    ShardTarget *targets = imc_calloc(target_count, sizeof(ShardTarget));
+    targets[0].cover = opt->input;
+    size_t pos = 1;
+    for (struct HideList *node = opt->more_inputs; node; node = node->next) targets[pos++].cover = node->data;
+
+    // Split the file, and hide the shards in parallel
+    if (!opt->silent) printf("Splitting '%s' among %zu images...\n", basename(opt->shard), target_count);
+    fflush(stdout);
+    const int shard_status = imc_shard_hide(opt->shard, targets, target_count, opt->output, key);
+    imc_crypto_context_destroy(key);
+
+    // Result of each image
+    size_t shard_count = 0;
+    size_t total_capacity = 0;
+    for (size_t i = 0; i < target_count; i++)
+    {
+        if (targets[i].size > 0) shard_count++;
+        total_capacity += targets[i].capacity;
+    }
+
+    for (size_t i = 0; i < target_count; i++)
+    {
+        const ShardTarget *const target = &targets[i];
+        if (target->status != IMC_SUCCESS)
+        {
+            fprintf(stderr, "FAIL: could not use '%s' (%s).\n", target->cover, imc_steg_strerror(target->status));
+        }
+        else if (target->out_path && !opt->silent)
+        {
+            char size_str[256];
+            imc_cli_filesize_to_string(target->size, size_str, sizeof(size_str));
+            printf("SUCCESS: hidden part %u of %zu (%s) in '%s', saved to '%s'.\n",
+                target->index + 1, shard_count, size_str, target->cover, target->out_path);
+        }
+    }
+
+    imc_shard_targets_free(targets, target_count);
+    imc_free(targets);
+
+    switch (shard_status)
+    {
+        case IMC_SUCCESS:
+            break;
+        
+        case IMC_ERR_FILE_TOO_BIG:
+            {
+                char size_str[256];
+                imc_cli_filesize_to_string(total_capacity, size_str, sizeof(size_str));
+                argp_failure(state, EXIT_FAILURE, 0, "'%s' does not fit on the given images (together, they can hide approximately %s).",
+                    opt->shard, size_str);
+            }
+            break;
+        
+        default:
+            argp_failure(state, EXIT_FAILURE, 0, "could not split '%s' (%s).", opt->shard, imc_steg_strerror(shard_status));
+            break;
+    }
+}
+
+// Plan which images receive each file, then save the plan as a manifest (the '--plan' option)
+// This is a helper for the '__execute_options()' function.
+static inline void __execute_plan(struct argp_state *state, void *options)
+{
+    UserOptions *opt = (UserOptions*)options;
+
+    if (!opt->input || !opt->hide.data)
+    {
+        argp_error(state, "please use '--input' for the images (or folders with images) and '--hide' for the files being planned.");
+    }
+
+    if (opt->append || opt->verbose || opt->password || opt->no_password)
+    {
+        argp_error(state, "the 'append', 'verbose', and password options cannot be used with 'plan' (use them when running the manifest).");
+    }
+
+    // Create the folder for the new images (if it does not exist already), so the manifest can be run right away
+    if (opt->output)
+    {
+        #ifdef _WIN32
+        const int mk_status = _mkdir(opt->output);
+        #else // Linux
+        const int mk_status = mkdir(opt->output, 0700); // Create with read and write access for only the current user
+        #endif
+
+        if (mk_status != 0 && errno != EEXIST)
+        {
+            argp_failure(
+                state, EXIT_FAILURE, 0,
+                "Could not create output directory '%s'. Reason: %s.\n"
+                "Note: only the last directory of a path is created, its parent directories must exist already.",
+                opt->output, strerror(errno)
+            );
+        }
+    }
+
+    // List the paths of the images and of the files
+    size_t cover_count = 1;
+    for (struct HideList *node = opt->more_inputs; node; node = node->next) cover_count++;
+    
+    const char **cover_paths = imc_calloc(cover_count, sizeof(char *));
+    cover_paths[0] = opt->input;
+    size_t pos = 1;
+    for (struct HideList *node = opt->more_inputs; node; node = node->next) cover_paths[pos++] = node->data;
+
+    size_t file_count = 0;
+    for (struct HideList *node = &opt->hide; node; node = node->next) file_count++;
+
+    const char **file_paths = imc_calloc(file_count, sizeof(char *));
+    pos = 0;
+    for (struct HideList *node = &opt->hide; node; node = node->next) file_paths[pos++] = node->data;
+
+    // Scan the images and estimate the files in parallel, then assign the files to the images
+    if (!opt->silent) printf("Planning %zu files...\n", file_count);
+    fflush(stdout);
+    const enum PlanStrategy strategy = opt->balance ? IMC_PLAN_BALANCE : IMC_PLAN_MINIMIZE;
+    CapacityCache *cache = opt->cache ? imc_cache_open(opt->cache) : NULL;
+    HidePlan *plan = imc_plan_create(cover_paths, cover_count, file_paths, file_count, strategy, cache);
+    imc_free(cover_paths);
+    imc_free(file_paths);
+
+    // Remember the capacities of the images that were decoded
+    if (cache)
+    {
+        size_t cached_count = 0;
+        for (size_t i = 0; i < plan->cover_count; i++) cached_count += plan->covers[i].is_cached;
+        if (!opt->silent) printf("Capacity of %zu of %zu images read from the cache.\n", cached_count, plan->cover_count);
+
+        if (imc_cache_save(cache) != IMC_SUCCESS)
+        {
+            fflush(stdout);
+            fprintf(stderr, "Warning: could not save the cache to '%s'.\n", opt->cache);
+        }
+
+        imc_cache_close(cache);
+        plan->cache = NULL;
+    }
+
+    // Images that could not be used, and files that were left out
+    /* Note: the standard output is flushed before each failure, so the messages stay in order when redirected. */
+    size_t fail_count = 0;
+    size_t usable_count = 0;
+    size_t total_capacity = 0;
+    for (size_t i = 0; i < plan->cover_count; i++)
+    {
+        const PlanCover *const cover = &plan->covers[i];
+        if (cover->status == IMC_SUCCESS)
+        {
+            usable_count++;
+            total_capacity += cover->capacity;
+        }
+        else if (!opt->silent)
+        {
+            printf("Skipped '%s' (%s).\n", cover->path, imc_steg_strerror(cover->status));
+        }
+    }
+
+    for (size_t i = 0; i < plan->file_count; i++)
+    {
+        const PlanFile *const file = &plan->files[i];
+        if (file->status != IMC_SUCCESS || !file->cover) fflush(stdout);
+        if (file->status != IMC_SUCCESS)
+        {
+            fprintf(stderr, "FAIL: could not read '%s' (%s).\n", file->path, imc_steg_strerror(file->status));
+            fail_count++;
+        }
+        else if (!file->cover)
+        {
+            char size_str[256];
+            imc_cli_filesize_to_string(file->estimate, size_str, sizeof(size_str));
+            fprintf(stderr, "FAIL: '%s' does not fit on any image (it needs about %s).\n", file->path, size_str);
+            fail_count++;
+        }
+    }
+
+    // Files assigned to each image
+    size_t used_count = 0;
+    for (size_t i = 0; i < plan->cover_count; i++)
+    {
+        const PlanCover *const cover = &plan->covers[i];
+        if (cover->file_count == 0) continue;
+        used_count++;
+
+        if (!opt->silent)
+        {
+            char used_str[256], capacity_str[256];
+            imc_cli_filesize_to_string(cover->used, used_str, sizeof(used_str));
+            imc_cli_filesize_to_string(cover->capacity, capacity_str, sizeof(capacity_str));
+            printf("'%s': %zu files, about %s of %s (%.1f%%).\n",
+                cover->path, cover->file_count, used_str, capacity_str, 100.0 * (double)cover->used / (double)cover->capacity);
+        }
+    }
+
+    // Save the manifest
+    const int write_status = imc_plan_write(plan, opt->plan, opt->output);
+    const size_t planned_count = file_count - fail_count;
+    imc_plan_free(plan);
+
+    switch (write_status)
+    {
+        case IMC_SUCCESS:
+            break;
+        
+        case IMC_ERR_FILE_INVALID:
+            argp_failure(state, EXIT_FAILURE, 0, "a path has a tab or line break, which cannot be written to a manifest.");
+            break;
+        
+        default:
+            argp_failure(state, EXIT_FAILURE, 0, "could not save the plan to '%s'. Reason: %s.", opt->plan, strerror(errno));
+            break;
+    }
+
+    if (!opt->silent)
+    {
+        char size_str[256];
+        imc_cli_filesize_to_string(total_capacity, size_str, sizeof(size_str));
+        printf("Planned %zu of %zu files on %zu of %zu images (%s available), saved to '%s'.\n",
+            planned_count, file_count, used_count, usable_count, size_str, opt->plan);
+        printf("To hide the files, run: imgconceal --batch=\"%s\"\n", opt->plan);
+    }
+
+    if (fail_count > 0)
+    {
+        argp_failure(state, EXIT_FAILURE, 0, "%zu of %zu files could not be planned.", fail_count, file_count);
+    }
+}
+
+// Check all images on a folder tree, and write a report (the '--scan' option)
+// This is a helper for the '__execute_options()' function.
+static inline void __execute_scan(struct argp_state *state, void *options)
+{
+    UserOptions *opt = (UserOptions*)options;
+
+    if (opt->input || opt->append || opt->verbose)
+    {
+        argp_error(state, "the 'input', 'append', and 'verbose' options cannot be used with 'scan'.");
+    }
+
+    // Display a password prompt, if a password wasn't provided
+    if (!opt->password)
+    {
+        printf("Input password for the hidden files (may be blank)\n");
+        opt->password = imc_cli_password_input(false);
+    }
+
+    // Hash the password only once for all images
+    CryptoContext *key = NULL;
+    const int crypto_status = imc_crypto_context_create(opt->password, &key);
+    imc_cli_password_free(opt->password);
+    opt->password = NULL;
+    if (crypto_status != IMC_SUCCESS)
+    {
+        argp_failure(state, EXIT_FAILURE, 0, "no enough memory for hashing the password.");
+    }
+
+    // Open the report (if not on the standard output)
+    FILE *report = stdout;
+    if (opt->output)
+    {
+        report = fopen(opt->output, "w");
+        if (!report)
+        {
+            imc_crypto_context_destroy(key);
+            argp_failure(state, EXIT_FAILURE, 0, "could not create the report '%s'. Reason: %s.", opt->output, strerror(errno));
+        }
+    }
+
+    // Check the images in parallel
+    CorpusStats stats;
+    const size_t prefetch_window = opt->has_prefetch ? opt->prefetch : IMC_PREFETCH_DEFAULT;
+    const int scan_status = imc_corpus_scan(opt->scan, key, report, opt->threads, prefetch_window, &stats);
+    imc_crypto_context_destroy(key);
+
+    bool write_error = ferror(report);
+    if (report != stdout && fclose(report) != 0) write_error = true;
+
+    if (scan_status != IMC_SUCCESS)
+    {
+        argp_failure(state, EXIT_FAILURE, 0, "the folder '%s' was not found.", opt->scan);
+    }
+
+    if (write_error)
+    {
+        argp_failure(state, EXIT_FAILURE, 0, "could not write the report.");
+    }
+
+    // Summary of the scan (on the standard error, since the standard output might have the report)
+    if (!opt->silent)
+    {
+        const double per_second = (stats.seconds > 0.0) ? (double)stats.image_count / stats.seconds : 0.0;
+        fprintf(stderr, "Scanned %zu images in %.2f seconds: %zu with hidden data (%zu files), %zu failed, %zu other files skipped.\n",
+            stats.image_count, stats.seconds, stats.data_count, stats.entry_count, stats.error_count, stats.skip_count);
+        fprintf(stderr, "Throughput: %.1f images per second (%.2f per second per thread, using %zu threads).\n",
+            per_second, per_second / (double)stats.thread_count, stats.thread_count);
+    }
+
+    if (stats.error_count > 0)
+    {
+        argp_failure(state, EXIT_FAILURE, 0, "%zu of %zu images could not be checked.", stats.error_count, stats.image_count);
+    }
+}
+
+// Print the result of hiding one of the files on the image (called by 'imc_steg_insert_many()' in the order of the files)
+static void __hide_report(size_t index, int hide_status, void *report_ptr)
+{
+    HideReport *const report = (HideReport *)report_ptr;
+    const UserOptions *const opt = report->opt;
+    const CarrierImage *const steg_image = report->steg_image;
+
+    // The standard input ('-') is hidden under the name given by the '--name' option
+    const bool is_stdin = (strcmp(report->paths[index], "-") == 0);
+    char *const hide_path = is_stdin ? opt->name : report->paths[index];
+
+    // Error handling and status messages
+    switch (hide_status)
+    {
+        case IMC_SUCCESS:
+            if (!opt->silent) printf("SUCCESS: hidden '%s' in the cover image.\n", basename(hide_path));
+            report->image_has_changed = true;
+            break;
+        
+        case IMC_ERR_PATH_IS_DIR:
+            fprintf(stderr, "FAIL: '%s' is a directory, instead of a single file.\n", hide_path);
+            break;
+        
+        case IMC_ERR_FILE_NOT_FOUND:
+            fprintf(stderr, "FAIL: file '%s' could not be opened. Reason: %s\n.", hide_path, strerror(errno));
+            break;
+        
+        case IMC_ERR_NAME_TOO_LONG:
+            fprintf(stderr, "FAIL: file name '%16s...' is too long.\n", basename(hide_path));
+            break;
+        
+        case IMC_ERR_FILE_CORRUPTED:
+            fprintf(stderr, "FAIL: file '%s' is corrupted or might have changed while being hidden.\n", basename(hide_path));
+            break;
+        
+        case IMC_ERR_NO_MEMORY:
+            fprintf(stderr, "FAIL: no enough memory for handling file '%s'.\n", basename(hide_path));
+            break;
+        
+        case IMC_ERR_MEMORY_BUDGET:
+            fprintf(stderr, "FAIL: hiding file '%s' needs more memory than the maximum allowed.\n", basename(hide_path));
+            break;
+        
+        case IMC_ERR_FILE_TOO_BIG:
+            char size_left[256];
+            imc_cli_filesize_to_string((steg_image->carrier_length - steg_image->carrier_pos) / 8, size_left, sizeof(size_left));
+            fprintf(
+                stderr, "FAIL: no enough space in '%s' to hide '%s' (free space: %s).\n",
+                basename(opt->input), basename(hide_path), size_left
+            );
+            break;
+        
+        case IMC_ERR_CRYPTO_FAIL:
+            fprintf(stderr, "FAIL: could not encrypt '%s'.\n", basename(hide_path));
+            break;
+        
+        case IMC_ERR_INPUT_TOO_BIG:
+            fprintf(stderr, "FAIL: '%s' is bigger than the maximum size of 500 MB.\n", basename(hide_path));
+            break;
+        
+        default:
+            argp_failure(report->state, EXIT_FAILURE, 0, "unknown error when hiding data. (%d)", hide_status);
+            break;
+    }
+}
+
+// Print the result of extracting one of the files from the image (called by 'imc_steg_extract_all()' in the order of the files)
+static void __extract_report(size_t index, int unhide_status, void *report_ptr)
+{
+    (void)index;    // The files are reported in order, so their position is not needed
+    ExtractReport *const report = (ExtractReport *)report_ptr;
+    struct argp_state *const state = report->state;
+    const UserOptions *const opt = report->opt;
+    CarrierImage *const steg_image = report->steg_image;
+    const char const* image_name = report->image_name;  // Name of the image with hidden data
+
+    // Without a tar archive, the standard output can receive only one file
+    // (so after the first, the image is just checked for more files)
+    if (opt->to_stdout && !opt->stdout_tar && report->has_file)
+    {
+        if (unhide_status == IMC_SUCCESS)
+        {
+            argp_failure(state, EXIT_FAILURE, 0, "image '%s' contains more than one hidden file, but only the first "\
+                "was written (use '--stdout=tar' for writing all of them).", image_name);
+        }
+        return;
+    }
+
+    // Name of the unhidden file (the metadata is missing if the file could not be decrypted)
+    const char const* unhid_name = steg_image->steg_info ? steg_image->steg_info->file_name : "";
+
+    // Error handling and status messages
+    // Note: after all hidden files have been extracted, the last
+    //       status is IMC_ERR_INVALID_MAGIC or IMC_ERR_PAYLOAD_OOB
+    switch (unhide_status)
+    {
+        case IMC_SUCCESS:
+            if (report->is_check)
+            {
+                if (report->has_file) printf("\n");
+                else if (opt->verbose) printf("\n");
+                
+                if (steg_image->steg_info->shard_count > 0)
+                {
+                    printf("Found part %u of %u of file '%s':\n",
+                        steg_image->steg_info->shard_index + 1, steg_image->steg_info->shard_count, steg_image->steg_info->file_name);
+                }
+                else if (steg_image->steg_info->is_tree)
+                {
+                    printf("Found folder '%s' (%zu entries):\n", steg_image->steg_info->file_name, steg_image->steg_info->entry_count);
+                }
+                else
+                {
+                    printf("Found file '%s':\n", steg_image->steg_info->file_name);
+                }
+                
+                char str_buffer[256];   // Buffer for the formatted strings
+
+                __timespec_to_string(&steg_image->steg_info->steg_time, str_buffer, sizeof(str_buffer));
+                printf("  hidden on:     %s\n", str_buffer);
+
+                __timespec_to_string(&steg_image->steg_info->access_time, str_buffer, sizeof(str_buffer));
+                printf("  last access:   %s\n", str_buffer);
+
+                __timespec_to_string(&steg_image->steg_info->mod_time, str_buffer, sizeof(str_buffer));
+                printf("  last modified: %s\n", str_buffer);
+                
+                imc_cli_filesize_to_string(steg_image->steg_info->file_size, str_buffer, sizeof(str_buffer));
+                printf("  size: %s\n", str_buffer);
+            }
+            else // (mode == EXTRACT)
+            {
+                if (!opt->silent && steg_image->steg_info->shard_count > 0)
+                {
+                    printf("SUCCESS: extracted part %u of %u of '%s' from '%s'.\n",
+                        steg_image->steg_info->shard_index + 1, steg_image->steg_info->shard_count, unhid_name, image_name);
+                    
+                    if (steg_image->steg_info->is_joined)
+                    {
+                        printf("  all parts were extracted, so '%s' was rebuilt.\n", unhid_name);
+                    }
+                    else
+                    {
+                        printf("  '%s' is rebuilt once all of its parts are extracted to the same folder.\n", unhid_name);
+                    }
+                }
+                else if (!opt->silent)
+                {
+                    printf("SUCCESS: extracted %s'%s' from '%s'.\n",
+                        steg_image->steg_info->is_tree ? "folder " : "", unhid_name, image_name);
+                    
+                    // The date in which the extracted file was hidden on
+                    char date_str[256];
+                    __timespec_to_string(&steg_image->steg_info->steg_time, date_str, sizeof(date_str));
+                    printf("  hidden on: %s\n", date_str);
+                }
+            }
+            
+            report->has_file = true;
+            break;
+        
+        case IMC_ERR_PAYLOAD_OOB:
+            if (!report->has_file)
+            {
+                fprintf(stderr, "FAIL: image '%s' is too small to contain hidden data.\n", image_name);
+            }
+            break;
+        
+        case IMC_ERR_INVALID_MAGIC:
+            if (!report->has_file)
+            {
+                if (report->is_check)
+                {
+                    char str_buffer[256];
+                    imc_cli_filesize_to_string(steg_image->carrier_length / 8, str_buffer, sizeof(str_buffer));
+                    printf(
+                        "Image '%s' contains no hidden data or the password is incorrect.\n"
+                        "This image can hide approximately %s "
+                        "(it depends on how well the hidden data can be compressed).\n",
+                        image_name,
+                        str_buffer
+                    );
+                }
+                else // (mode == EXTRACT)
+                {
+                    fprintf(stderr, "FAIL: image '%s' contains no hidden data or the password is incorrect.\n", image_name);
+                }
+            }
+            break;
+        
+        case IMC_ERR_CRYPTO_FAIL:
+            fprintf(stderr, "FAIL: could not decrypt the data on '%s'.\n", image_name);
+            break;
+        
+        case IMC_ERR_MEMORY_BUDGET:
+            fprintf(stderr, "FAIL: extracting the data on '%s' needs more memory than the maximum allowed.\n", image_name);
+            break;
+        
+        case IMC_ERR_SHARD_STREAM:
+            fprintf(stderr, "FAIL: '%s' is a part of a split file, which cannot be written to the standard output.\n", unhid_name);
+            break;
+        
+        case IMC_ERR_TREE_STREAM:
+            fprintf(stderr, "FAIL: '%s' is a folder, which can be written to the standard output only with '--stdout=tar'.\n", unhid_name);
+            break;
+        
+        case IMC_ERR_NEWER_VERSION:
+            fprintf(stderr, "FAIL: a newer version of %s was used to hide the data on '%s'.\n", state->name, image_name);
+            break;
+        
+        case IMC_ERR_FILE_EXISTS:
+            fprintf(stderr, "FAIL: could not save '%s' because a file with the same name already exists.\n", unhid_name);
+            break;
+        
+        case IMC_ERR_FILE_CORRUPTED:
+        case IMC_ERR_FILE_NOT_FOUND:
+            if (steg_image->steg_info && steg_image->steg_info->is_tree)
+            {
+                fprintf(stderr, "FAIL: the hidden folder '%s' is malformed, or has a path outside of it.\n", unhid_name);
+            }
+            else
+            {
+                fprintf(stderr, "FAIL: the parts of '%s' do not match each other.\n", unhid_name);
+            }
+            break;
+        
+        case IMC_ERR_SAVE_FAIL:
+            fprintf(stderr, "FAIL: could not save '%s'. Reason: %s.\n", unhid_name, strerror(errno));
+            break;
+        
+        default:
+            argp_failure(state, EXIT_FAILURE, 0, "unknown error when extracting hidden data. (%d)", unhide_status);
+            break;
+    }
+
+    // The files after the first one are not written to the standard output (without a tar archive)
+    if (unhide_status == IMC_SUCCESS && opt->to_stdout && !opt->stdout_tar) steg_image->just_check = true;
 }
 
-// Get the pointer of the struct needed by the 'argp_parse()' function
-const struct argp *restrict imc_cli_get_argp_struct()
+// Validate the command line options, and perform the requested operation
+// This is a helper for the 'imc_cli_parse_options()' function.
+static inline void __execute_options(struct argp_state *state, void *options)
 {
-    return &argp_struct;
-}
+    UserOptions *opt = (UserOptions*)options;
 
-// Store a copy of the path of a file
-static inline void __store_path(const char *path, char **destination)
-{
-    if (!path) return;
-    
-    #ifdef _WIN32   // Windows systems
-    
-    // Convert the terminal input to wide char string
-    const int w_path_len = MultiByteToWideChar(CP_ACP, 0, path, -1, NULL, 0);
-    wchar_t w_path[w_path_len];
-    MultiByteToWideChar(CP_ACP, 0, path, -1, w_path, w_path_len);
+    // Check if the user has specified exactly one operation
+    // (when planning, the '--hide' option lists the files being planned)
+    int mode_count = (bool)(opt->hide.data && !opt->plan) + (bool)opt->extract + (bool)opt->check + (bool)opt->batch
+        + (bool)opt->serve + (bool)opt->shard + (bool)opt->plan + (bool)opt->scan;
 
-    // Convert wide char to UTF-8 string
-    const int u8_path_len = WideCharToMultiByte(CP_UTF8, 0, w_path, -1, NULL, 0, NULL, NULL);;
-    char *u8_path = imc_malloc(u8_path_len * sizeof(char));
-    WideCharToMultiByte(CP_UTF8, 0, w_path, -1, u8_path, u8_path_len, NULL, NULL);
+    if (mode_count == 0)
+    {
+        argp_error(state, "you must specify either the 'hide', 'shard', 'plan', 'extract', 'check', 'scan', 'batch', or 'serve' option.");
+    }
+    else if (mode_count != 1)
+    {
+        argp_error(state, "you can specify only one among the 'hide', 'shard', 'plan', 'extract', 'check', 'scan', 'batch', or 'serve' options.");
+    }
 
-    // Store the unicode path string
-    *destination = u8_path;
-    
-    #else   // Linux systems
+    if (opt->more_inputs && !opt->shard && !opt->plan)
+    {
+        argp_error(state, "only one image can be passed to '--input' (except with the '--shard' or '--plan' options).");
+    }
 
-    // Duplicate the path string and store it
-    *destination = strdup(path);
-    
-    #endif // _WIN32
-}
+    if ((opt->balance || opt->cache) && !opt->plan)
+    {
+        argp_error(state, "the 'balance' and 'cache' options can only be used with 'plan'.");
+    }
 
-// Check if an option has not been passed before (program exits if this check fails)
-// The idea is to check if the option's value evaluates to 'false'. If it doesn't, then the check fails.
-// The error message contains the name of the option, that is why it is needed.
-static inline void __check_unique_option(struct argp_state *state, const char *option_name, bool option_value)
-{
-    if (option_value)
+    if (opt->journal && !opt->batch)
     {
-        argp_error(state, "the '%s' option can be used only once.", option_name);
+        argp_error(state, "the 'journal' option can only be used with 'batch'.");
     }
-}
 
-// Convert a timespec struct to a date string, and store it on 'out_buff'
-static inline void __timespec_to_string(struct timespec *time, char *out_buff, size_t buff_size)
-{
-    // ISO C 'broken-down time' structure
-    struct tm my_time = {0};
-    #ifdef _WIN32
-    const struct tm *time_status = localtime(&time->tv_sec);    // The 'localtime_r()' function did not work on Windows (with the MSYS2 runtime)
-    if (time_status) my_time = *time_status;
-    #else
-    const struct tm *time_status = localtime_r(&time->tv_sec, &my_time);
-    #endif
-    
-    if (time_status)
+    if (opt->has_prefetch && !opt->batch && !opt->scan)
     {
-        const size_t date_status = strftime(out_buff, buff_size, "%c", &my_time);
-        if (!date_status) strncpy(out_buff, "(unknown)", buff_size);
+        argp_error(state, "the 'prefetch' option can only be used with 'batch' or 'scan'.");
     }
-    else
+
+    if (opt->stats && opt->stats_json)
     {
-        strncpy(out_buff, "(unknown)", buff_size);
+        argp_error(state, "you can specify only one among the 'stats' and 'stats-json' options.");
     }
-}
 
-// Convert a file size (in bytes) to a string in the appropriate scale, and store it on 'out_buff'
-static inline void __filesize_to_string(size_t file_size, char *out_buff, size_t buff_size)
-{
-    static const char *scale[] = {"bytes", "KB", "MB", "GB", "TB"};
-    static const size_t scale_len = sizeof(scale) / sizeof(char *);
-    
-    // File size as a floating point number
-    double size_fp = (double)file_size;
-    const char *unit = scale[0];
+    // Measure the stages of the operation (the statistics are printed when the program exits)
+    if (opt->stats || opt->stats_json) imc_stats_enable(opt->stats_json);
 
-    // Increase the scale until the value is smaller than 1000 or the maximum scale is reached
-    for (size_t i = 0; (i < scale_len - 1) && (size_fp > 1000.0); i++)
+    // Amount of threads that process each image (zero for one per processor)
+    imc_threads_set_count(opt->threads);
+
+    // Maximum amount of memory used by the images being processed (zero for no limit)
+    imc_memory_set_budget(opt->max_memory);
+
+    // The operations listed on a manifest are handled separately
+    if (opt->batch)
     {
-        size_fp /= 1000.0;
-        unit = scale[i + 1];
+        __execute_batch(state, options);
+        return;
     }
 
-    // Store the file size string on the buffer
-    if (unit == scale[0])
+    // The server mode is handled separately
+    if (opt->serve)
     {
-        // Have no decimals if the unit is 'bytes'
-        snprintf(out_buff, buff_size, "%.0f %s", size_fp, unit);
+        __execute_server(state, options);
+        return;
     }
-    else
+
+    // Splitting a file among many images is handled separately
+    if (opt->shard)
     {
-        // Have two decimals for the other units
-        snprintf(out_buff, buff_size, "%.2f %s", size_fp, unit);
+        __execute_shard(state, options);
+        return;
     }
-}
-
-// Validate the command line options, and perform the requested operation
-// This is a helper for the 'imc_cli_parse_options()' function.
-static inline void __execute_options(struct argp_state *state, void *options)
-{
-    UserOptions *opt = (UserOptions*)options;
-
-    // Check if the user has specified exactly one operation
-    int mode_count = (bool)opt->hide.data + (bool)opt->extract + (bool)opt->check;
 
-    if (mode_count == 0)
+    // Planning which images receive each file is handled separately
+    if (opt->plan)
     {
-        argp_error(state, "you must specify either the 'hide', 'extract', or 'check' option.");
+        __execute_plan(state, options);
+        return;
     }
-    else if (mode_count != 1)
+
+    // Checking a whole folder tree is handled separately
+    if (opt->scan)
     {
-        argp_error(state, "you can specify only one among the 'hide', 'extract', or 'check' options.");
+        __execute_scan(state, options);
+        return;
     }
 
+    // A single operation can map the files being hidden into memory, since a file being truncated meanwhile
+    // would only stop this operation (unlike a batch or a server, where all the other operations would stop too)
+    imc_steg_set_file_mapping(true);
+
     // Mode of operation
     enum {HIDE, EXTRACT, CHECK} mode;
 
@@ -463,6 +1469,57 @@ static inline void __execute_options(struct argp_state *state, void *options)
         argp_error(state, "the 'output' option can only be used when hiding or extracting files.");
     }
 
+    // Hiding from the standard input ('--hide -')
+    size_t stdin_count = 0;
+    for (struct HideList *node = &opt->hide; node && node->data; node = node->next)
+    {
+        if (strcmp(node->data, "-") == 0) stdin_count++;
+    }
+
+    if (stdin_count > 1)
+    {
+        argp_error(state, "the standard input ('-') can be hidden only once.");
+    }
+
+    if (opt->name && stdin_count == 0)
+    {
+        argp_error(state, "the 'name' option can only be used when hiding the standard input ('--hide -').");
+    }
+
+    if (stdin_count > 0 && !opt->password)
+    {
+        // The password cannot be typed when the standard input is the data being hidden
+        argp_error(state, "when hiding the standard input, the password must be given with '--password' or '--no-password'.");
+    }
+
+    // Extracting to the standard output ('--stdout')
+    if (opt->to_stdout)
+    {
+        if (mode != EXTRACT)
+        {
+            argp_error(state, "the 'stdout' option can only be used when extracting files.");
+        }
+
+        if (opt->output)
+        {
+            argp_error(state, "the 'stdout' and 'output' options cannot be used together.");
+        }
+
+        if (!opt->password)
+        {
+            // The password prompt would be mixed with the extracted data
+            argp_error(state, "when extracting to the standard output, the password must be given with '--password' or '--no-password'.");
+        }
+
+        if (opt->verbose)
+        {
+            argp_error(state, "the 'verbose' option cannot be used along with 'stdout'.");
+        }
+
+        // The standard output only receives the extracted data (errors still go to the standard error)
+        opt->silent = true;
+    }
+
     // Display a password prompt, if a password wasn't provided
     // (and the user did not specify the '--no-password' option)
     if (!opt->password)
@@ -531,11 +1588,20 @@ static inline void __execute_options(struct argp_state *state, void *options)
             break;
         
         case IMC_ERR_NO_MEMORY:
-            argp_failure(state, EXIT_FAILURE, 0, "no enough memory for hashing the password.");
+            argp_failure(state, EXIT_FAILURE, 0, "no enough memory for processing '%s'.", steg_path);
+            break;
+        
+        case IMC_ERR_MEMORY_BUDGET:
+            argp_failure(state, EXIT_FAILURE, 0, "processing '%s' needs more memory than the maximum allowed.", steg_path);
+            break;
+        
+        case IMC_ERR_NO_CARRIER:
+            argp_failure(state, EXIT_FAILURE, 0, "the image '%s' has no suitable bits for hiding the data. "\
+                "This may happen if the image is just a flat color or is fully transparent.", steg_path);
             break;
         
         default:
-            argp_failure(state, EXIT_FAILURE, 0, "unknown error when hashing the password. (%d)", steg_status);
+            argp_failure(state, EXIT_FAILURE, 0, "unknown error when opening the image. (%d)", steg_status);
             break;
     }
 
@@ -562,79 +1628,40 @@ static inline void __execute_options(struct argp_state *state, void *options)
         }
         
         // Hide the files on the image
-        struct HideList *node = &opt->hide;
-        while (node)
-        {
-            int hide_status = imc_steg_insert(steg_image, node->data);
-
-            // Error handling and status messages
-            switch (hide_status)
-            {
-                case IMC_SUCCESS:
-                    if (!opt->silent) printf("SUCCESS: hidden '%s' in the cover image.\n", basename(node->data));
-                    image_has_changed = true;
-                    break;
-                
-                case IMC_ERR_PATH_IS_DIR:
-                    fprintf(stderr, "FAIL: '%s' is a directory, instead of a single file.\n", node->data);
-                    break;
-                
-                case IMC_ERR_FILE_NOT_FOUND:
-                    fprintf(stderr, "FAIL: file '%s' could not be opened. Reason: %s\n.", node->data, strerror(errno));
-                    break;
-                
-                case IMC_ERR_NAME_TOO_LONG:
-                    fprintf(stderr, "FAIL: file name '%16s...' is too long.\n", basename(node->data));
-                    break;
-                
-                case IMC_ERR_FILE_CORRUPTED:
-                    fprintf(stderr, "FAIL: file '%s' is corrupted or might have changed while being hidden.\n", basename(node->data));
-                    break;
-                
-                case IMC_ERR_NO_MEMORY:
-                    fprintf(stderr, "FAIL: no enough memory for handling file '%s'.\n", basename(node->data));
-                    break;
-                
-                case IMC_ERR_FILE_TOO_BIG:
-                    char size_left[256];
-                    __filesize_to_string((steg_image->carrier_length - steg_image->carrier_pos) / 8, size_left, sizeof(size_left));
-                    fprintf(
-                        stderr, "FAIL: no enough space in '%s' to hide '%s' (free space: %s).\n",
-                        basename(opt->input), basename(node->data), size_left
-                    );
-                    break;
-                
-                case IMC_ERR_CRYPTO_FAIL:
-                    fprintf(stderr, "FAIL: could not encrypt '%s'.\n", basename(node->data));
-                    break;
-                
-                default:
-                    argp_failure(state, EXIT_FAILURE, 0, "unknown error when hiding data. (%d)", hide_status);
-                    break;
-            }
-
-            // Move to the next file to be hidden
-            node = node->next;
-        }
+        if (!opt->name) __store_path("stdin", &opt->name);  // Name of the standard input, if hidden
+        #ifdef _WIN32
+        if (stdin_count > 0) _setmode(_fileno(stdin), _O_BINARY);  // Do not convert the line endings of the data being hidden
+        #endif
+
+        // Gather the paths of the files being hidden
+        size_t hide_count = 0;
+        for (struct HideList *node = &opt->hide; node; node = node->next) hide_count++;
+        char **hide_paths = imc_malloc(hide_count * sizeof(char *));
+        size_t hide_index = 0;
+        for (struct HideList *node = &opt->hide; node; node = node->next) hide_paths[hide_index++] = node->data;
+
+        // Hide the files in their order, while the next ones are compressed and encrypted in parallel
+        HideReport report = {
+            .state = state,
+            .opt = opt,
+            .steg_image = steg_image,
+            .paths = hide_paths,
+            .image_has_changed = false,
+        };
+        imc_steg_insert_many(steg_image, hide_paths, hide_count, stdin, opt->name, &__hide_report, &report);
+        image_has_changed = report.image_has_changed;
+        imc_free(hide_paths);
     }
     else // (mode == EXTRACT) || (mode == CHECK)
     {
         bool has_file = false;  // Whether the image contains a hidden file
         
-        // Variables used in case the hidden files are being extracted to another folder
-        char *cwd_start = NULL;         // The current working directory at the beginning of extraction
-        bool outdir_existed = false;    // If the output directory already exists
+        // Whether the output folder already existed (in case the hidden files are being extracted to another folder)
+        bool outdir_existed = false;
 
         // Create the output folder, if one was specified for the extracted files
         if (mode == EXTRACT && opt->output)
         {
-            // Remember the current working directory
-            #ifdef _WIN32
-            cwd_start = _getcwd(NULL, 0);  // Note: this function is allocating memory
-            #else // Linux
-            cwd_start = getcwd(NULL, 0);   // Note: this function is allocating memory
-            #endif
-
             // Create the output folder
             #ifdef _WIN32
             const int mk_status = _mkdir(opt->output);
@@ -660,143 +1687,47 @@ static inline void __execute_options(struct argp_state *state, void *options)
                 }
             }
 
-            // Change the current working directory to the output folder
+            // Save the extracted files to the output folder
+            steg_image->out_dir = opt->output;
+        }
+        
+        // Write the extracted files to the standard output, instead of saving them
+        if (opt->to_stdout)
+        {
             #ifdef _WIN32
-            const int ch_status = _chdir(opt->output);
-            #else // Linux
-            const int ch_status = chdir(opt->output);
+            _setmode(_fileno(stdout), _O_BINARY);   // Do not convert the line endings of the extracted data
             #endif
-
-            if (ch_status != 0)
-            {
-                argp_failure(
-                    state, EXIT_FAILURE, 0,
-                    "Could not extract the hidden files to the directory '%s'. Reason: %s.",
-                    opt->output, strerror(errno)
-                );
-            }
+            steg_image->out_stream = stdout;
+            steg_image->out_tar = opt->stdout_tar;
         }
         
         // Save or just check the files hidden on the image
-        int unhide_status = IMC_SUCCESS;
-        while (unhide_status == IMC_SUCCESS)
+        ExtractReport report = {
+            .state = state,
+            .opt = opt,
+            .steg_image = steg_image,
+            .image_name = basename(steg_path),
+            .is_check = (mode == CHECK),
+            .has_file = false,
+        };
+        imc_steg_extract_all(steg_image, &__extract_report, &report);
+        has_file = report.has_file;
+
+        // End the tar archive (even if no file was extracted, so the output is still a valid archive)
+        if (opt->to_stdout && opt->stdout_tar && imc_tar_finish(stdout) != IMC_SUCCESS)
         {
-            unhide_status = imc_steg_extract(steg_image);
-            const char const* image_name = basename(steg_path); // Name of the image with hidden data
-            const char const* unhid_name = steg_image->steg_info->file_name; // Name of the unhidden file
-
-            // Error handling and status messages
-            // Note: after all hidden files have been extracted, the function
-            //       will return IMC_ERR_INVALID_MAGIC or IMC_ERR_PAYLOAD_OOB
-            switch (unhide_status)
-            {
-                case IMC_SUCCESS:
-                    if (mode == CHECK)
-                    {
-                        if (has_file) printf("\n");
-                        else if (opt->verbose) printf("\n");
-                        
-                        printf("Found file '%s':\n", steg_image->steg_info->file_name);
-                        
-                        char str_buffer[256];   // Buffer for the formatted strings
-
-                        __timespec_to_string(&steg_image->steg_info->steg_time, str_buffer, sizeof(str_buffer));
-                        printf("  hidden on:     %s\n", str_buffer);
-
-                        __timespec_to_string(&steg_image->steg_info->access_time, str_buffer, sizeof(str_buffer));
-                        printf("  last access:   %s\n", str_buffer);
-
-                        __timespec_to_string(&steg_image->steg_info->mod_time, str_buffer, sizeof(str_buffer));
-                        printf("  last modified: %s\n", str_buffer);
-                        
-                        __filesize_to_string(steg_image->steg_info->file_size, str_buffer, sizeof(str_buffer));
-                        printf("  size: %s\n", str_buffer);
-                    }
-                    else // (mode == EXTRACT)
-                    {
-                        if (!opt->silent)
-                        {
-                            printf("SUCCESS: extracted '%s' from '%s'.\n", unhid_name, image_name);
-                            
-                            // The date in which the extracted file was hidden on
-                            char date_str[256];
-                            __timespec_to_string(&steg_image->steg_info->steg_time, date_str, sizeof(date_str));
-                            printf("  hidden on: %s\n", date_str);
-                        }
-                    }
-                    
-                    has_file = true;
-                    break;
-                
-                case IMC_ERR_PAYLOAD_OOB:
-                    if (!has_file)
-                    {
-                        fprintf(stderr, "FAIL: image '%s' is too small to contain hidden data.\n", image_name);
-                    }
-                    break;
-                
-                case IMC_ERR_INVALID_MAGIC:
-                    if (!has_file)
-                    {
-                        if (mode == CHECK)
-                        {
-                            char str_buffer[256];
-                            __filesize_to_string(steg_image->carrier_length / 8, str_buffer, sizeof(str_buffer));
-                            printf(
-                                "Image '%s' contains no hidden data or the password is incorrect.\n"
-                                "This image can hide approximately %s "
-                                "(it depends on how well the hidden data can be compressed).\n",
-                                image_name,
-                                str_buffer
-                            );
-                        }
-                        else // (mode == EXTRACT)
-                        {
-                            fprintf(stderr, "FAIL: image '%s' contains no hidden data or the password is incorrect.\n", image_name);
-                        }
-                    }
-                    break;
-                
-                case IMC_ERR_CRYPTO_FAIL:
-                    fprintf(stderr, "FAIL: could not decrypt the data on '%s'.\n", image_name);
-                    break;
-                
-                case IMC_ERR_NEWER_VERSION:
-                    fprintf(stderr, "FAIL: a newer version of %s was used to hide the data on '%s'.\n", state->name, image_name);
-                    break;
-                
-                case IMC_ERR_FILE_EXISTS:
-                    fprintf(stderr, "FAIL: could not save '%s' because a file with the same name already exists.\n", unhid_name);
-                    break;
-                
-                case IMC_ERR_SAVE_FAIL:
-                    fprintf(stderr, "FAIL: could not save '%s'. Reason: %s.\n", unhid_name, strerror(errno));
-                    break;
-                
-                default:
-                    argp_failure(state, EXIT_FAILURE, 0, "unknown error when extracting hidden data. (%d)", unhide_status);
-                    break;
-            }
+            argp_failure(state, EXIT_FAILURE, 0, "could not write to the standard output. Reason: %s.", strerror(errno));
         }
 
         if (mode == EXTRACT && opt->output)
         {
-            // Change the current working directory back to the initial one
-            #ifdef _WIN32
-            const int ch_status = _chdir(cwd_start);
-            #else // Linux
-            const int ch_status = chdir(cwd_start);
-            #endif
-
-            free(cwd_start);
-
             // Remove the output directory if no file could be extracted and it didn't exist already
             if (!has_file && !outdir_existed)
             {
                 #ifdef _WIN32
-                const int ch_status = _rmdir(opt->output);
+                _rmdir(opt->output);
                 #else // Linux
-                const int ch_status = rmdir(opt->output);
+                rmdir(opt->output);
                 #endif
             }
         }
@@ -805,7 +1736,7 @@ static inline void __execute_options(struct argp_state *state, void *options)
         if (mode == CHECK && has_file)
         {
             char str_buffer[256];
-            __filesize_to_string((steg_image->carrier_length - steg_image->carrier_pos) / 8, str_buffer, sizeof(str_buffer));
+            imc_cli_filesize_to_string((steg_image->carrier_length - steg_image->carrier_pos) / 8, str_buffer, sizeof(str_buffer));
             printf(
                 "\nThe cover image '%s' can hide approximately more %s "
                 "(after compression of hidden data).\n",
@@ -844,6 +1775,14 @@ static inline void __execute_options(struct argp_state *state, void *options)
                 argp_failure(state, EXIT_FAILURE, 0, "could not save '%s'. Reason: %s.", save_path, strerror(errno));
                 break;
             
+            case IMC_ERR_ENCODE_FAIL:
+                argp_failure(state, EXIT_FAILURE, 0, "could not encode the new image '%s'.", save_path);
+                break;
+            
+            case IMC_ERR_NO_MEMORY:
+                argp_failure(state, EXIT_FAILURE, 0, "no enough memory for saving '%s'.", save_path);
+                break;
+            
             default:
                 argp_failure(state, EXIT_FAILURE, 0, "unknown error when extracting hidden data. (%d)", save_status);
                 break;
@@ -880,6 +1819,30 @@ static int imc_cli_parse_options(int key, char *arg, struct argp_state *state)
             __store_path(arg, &((UserOptions*)(state->hook))->check);
             break;
         
+        // --batch: Manifest with the operations to be performed
+        case 'b':
+            __check_unique_option(state, "batch", ((UserOptions*)(state->hook))->batch);
+            __store_path(arg, &((UserOptions*)(state->hook))->batch);
+            break;
+        
+        // --scan: Folder whose images are checked for hidden data
+        case CORPUS_SCAN:
+            __check_unique_option(state, "scan", ((UserOptions*)(state->hook))->scan);
+            __store_path(arg, &((UserOptions*)(state->hook))->scan);
+            break;
+        
+        // --serve: Socket where the server listens for requests
+        case SERVE_SOCKET:
+            __check_unique_option(state, "serve", ((UserOptions*)(state->hook))->serve);
+            __store_path(arg, &((UserOptions*)(state->hook))->serve);
+            break;
+        
+        // --threads: Amount of worker threads
+        case 't':
+            __check_unique_option(state, "threads", ((UserOptions*)(state->hook))->threads);
+            ((UserOptions*)(state->hook))->threads = __parse_thread_count(state, arg);
+            break;
+        
         // --extract: Image to have its hidden data extracted
         case 'e':
             __check_unique_option(state, "extract", ((UserOptions*)(state->hook))->extract);
@@ -887,9 +1850,92 @@ static int imc_cli_parse_options(int key, char *arg, struct argp_state *state)
             break;
         
         // --input: Image to get data hidden into it
+        // (more than one image is accepted, but that is only valid with '--shard')
         case 'i':
-            __check_unique_option(state, "input", ((UserOptions*)(state->hook))->input);
-            __store_path(arg, &((UserOptions*)(state->hook))->input);
+            input:
+            if (((UserOptions*)(state->hook))->input)
+            {
+                struct HideList *node = imc_calloc(1, sizeof(struct HideList));
+                struct HideList **tail = &((UserOptions*)(state->hook))->more_inputs_tail;
+                __store_path(arg, &node->data);
+                
+                if (*tail) (*tail)->next = node;
+                else ((UserOptions*)(state->hook))->more_inputs = node;
+                *tail = node;
+            }
+            else
+            {
+                __store_path(arg, &((UserOptions*)(state->hook))->input);
+            }
+            break;
+        
+        // --shard: File being split among many images
+        case SHARD_FILE:
+            __check_unique_option(state, "shard", ((UserOptions*)(state->hook))->shard);
+            __store_path(arg, &((UserOptions*)(state->hook))->shard);
+            break;
+        
+        // --plan: Where to save the manifest planned for the files
+        case PLAN_MANIFEST:
+            __check_unique_option(state, "plan", ((UserOptions*)(state->hook))->plan);
+            __store_path(arg, &((UserOptions*)(state->hook))->plan);
+            break;
+        
+        // --balance: Spread the planned files among all images
+        case PLAN_BALANCE:
+            ((UserOptions*)(state->hook))->balance = true;
+            break;
+        
+        // --cache: File with the capacities of the images
+        case CAPACITY_CACHE:
+            __check_unique_option(state, "cache", ((UserOptions*)(state->hook))->cache);
+            __store_path(arg, &((UserOptions*)(state->hook))->cache);
+            break;
+        
+        // --journal: File that records the finished jobs of a batch
+        case BATCH_JOURNAL:
+            __check_unique_option(state, "journal", ((UserOptions*)(state->hook))->journal);
+            __store_path(arg, &((UserOptions*)(state->hook))->journal);
+            break;
+        
+        // --prefetch: Amount of images read ahead of the ones being processed
+        case PREFETCH_WINDOW:
+            __check_unique_option(state, "prefetch", ((UserOptions*)(state->hook))->has_prefetch);
+            ((UserOptions*)(state->hook))->prefetch = __parse_prefetch_window(state, arg);
+            ((UserOptions*)(state->hook))->has_prefetch = true;
+            break;
+        
+        // --name: Name of the file hidden from the standard input
+        case STDIN_NAME:
+            __check_unique_option(state, "name", ((UserOptions*)(state->hook))->name);
+            __store_path(arg, &((UserOptions*)(state->hook))->name);
+            break;
+        
+        // --stdout: Write the extracted files to the standard output (as-is, or as a tar archive)
+        case STDOUT_FORMAT:
+            __check_unique_option(state, "stdout", ((UserOptions*)(state->hook))->to_stdout);
+            if (arg && strcmp(arg, "tar") != 0 && strcmp(arg, "raw") != 0)
+            {
+                argp_error(state, "the format of the standard output must be either 'raw' or 'tar' (got '%s').", arg);
+            }
+            ((UserOptions*)(state->hook))->to_stdout = true;
+            ((UserOptions*)(state->hook))->stdout_tar = (arg && strcmp(arg, "tar") == 0);
+            break;
+        
+        // --stats: Print how much time and memory each stage took
+        case PRINT_STATS:
+            ((UserOptions*)(state->hook))->stats = true;
+            break;
+        
+        // --stats-json: Print those statistics as JSON
+        case PRINT_STATS_JSON:
+            ((UserOptions*)(state->hook))->stats_json = true;
+            break;
+        
+        // --max-memory: Maximum amount of memory used by the images being processed
+        case MAX_MEMORY:
+            __check_unique_option(state, "max-memory", ((UserOptions*)(state->hook))->max_memory);
+            ((UserOptions*)(state->hook))->max_memory = __parse_memory_size(state, arg);
             break;
         
         // --output: Where to save the image with hidden data
@@ -989,14 +2035,34 @@ static int imc_cli_parse_options(int key, char *arg, struct argp_state *state)
         
         // After the program finished the requested operation: free the options struct
         case ARGP_KEY_FINI:
-            free( ((UserOptions*)(state->hook))->check );
-            free( ((UserOptions*)(state->hook))->extract );
-            free( ((UserOptions*)(state->hook))->input );
-            free( ((UserOptions*)(state->hook))->output );
+            imc_free( ((UserOptions*)(state->hook))->check );
+            imc_free( ((UserOptions*)(state->hook))->batch );
+            imc_free( ((UserOptions*)(state->hook))->serve );
+            imc_free( ((UserOptions*)(state->hook))->scan );
+            imc_free( ((UserOptions*)(state->hook))->extract );
+            imc_free( ((UserOptions*)(state->hook))->input );
+            imc_free( ((UserOptions*)(state->hook))->output );
+            imc_free( ((UserOptions*)(state->hook))->shard );
+            imc_free( ((UserOptions*)(state->hook))->plan );
+            imc_free( ((UserOptions*)(state->hook))->cache );
+            imc_free( ((UserOptions*)(state->hook))->journal );
+            imc_free( ((UserOptions*)(state->hook))->name );
+
+            // Freeing the list of the other images
+            {
+                struct HideList *node = ((UserOptions*)(state->hook))->more_inputs;
+                while (node)
+                {
+                    struct HideList *next_node = node->next;
+                    imc_free(node->data);
+                    imc_free(node);
+                    node = next_node;
+                }
+            }
 
             // Freeing the linked list
             {
-                free( ((UserOptions*)(state->hook))->hide.data );
+                imc_free( ((UserOptions*)(state->hook))->hide.data );
                 struct HideList *node = ((UserOptions*)(state->hook))->hide.next;
                 while (node)
                 {
@@ -1023,6 +2089,12 @@ static int imc_cli_parse_options(int key, char *arg, struct argp_state *state)
                 goto hide;
             }
             
+            if (((UserOptions*)(state->hook))->prev_arg == 'i')
+            {
+                // The '--input' argument accepts more than one image (when splitting a file)
+                goto input;
+            }
+            
             // Exit with error if an unknown option has been received
             argp_error(state, "unrecognized option '%s'\n"
                 "Hint: you should surround an argument with \"quotation marks\" if it contains spaces "
@@ -1051,3 +2123,16 @@ static void imc_cli_print_algorithm()
 }
 
 #undef PRINT_ALGORITHM
+#undef SERVE_SOCKET
+#undef SHARD_FILE
+#undef PLAN_MANIFEST
+#undef PLAN_BALANCE
+#undef CAPACITY_CACHE
+#undef CORPUS_SCAN
+#undef BATCH_JOURNAL
+#undef PREFETCH_WINDOW
+#undef MAX_MEMORY
+#undef STDIN_NAME
+#undef STDOUT_FORMAT
+#undef PRINT_STATS
+#undef PRINT_STATS_JSON
@@ -53,7 +53,43 @@ static inline void __check_unique_option(struct argp_state *state, const char *o
 static inline void __timespec_to_string(struct timespec *time, char *out_buff, size_t buff_size);
 
 // Convert a file size (in bytes) to a string in the appropriate scale, and store it on 'out_buff'
-static inline void __filesize_to_string(size_t file_size, char *out_buff, size_t buff_size);
+void imc_cli_filesize_to_string(size_t file_size, char *out_buff, size_t buff_size);
+
+// Parse the amount of threads passed to the '--threads' option (program exits if the value is invalid)
+static inline size_t __parse_thread_count(struct argp_state *state, const char *arg);
+
+// Parse the amount of images passed to the '--prefetch' option (program exits if the value is invalid)
+static inline size_t __parse_prefetch_window(struct argp_state *state, const char *arg);
+
+// Parse the amount of bytes passed to the '--max-memory' option (program exits if the value is invalid)
+// The value may end with the suffix K, M, or G (multiples of 1024).
+static inline size_t __parse_memory_size(struct argp_state *state, const char *arg);
+
+// Perform the operations listed on a manifest file (the '--batch' option)
+// This is a helper for the '__execute_options()' function.
+static inline void __execute_batch(struct argp_state *state, void *options);
+
+// Run the server on a local socket (the '--serve' option)
+// This is a helper for the '__execute_options()' function.
+static inline void __execute_server(struct argp_state *state, void *options);
+
+// Split a file among many images (the '--shard' option)
+// This is a helper for the '__execute_options()' function.
+static inline void __execute_shard(struct argp_state *state, void *options);
+
+// Plan which images receive each file, then save the plan as a manifest (the '--plan' option)
+// This is a helper for the '__execute_options()' function.
+static inline void __execute_plan(struct argp_state *state, void *options);
+
+// Check all images on a folder tree, and write a report (the '--scan' option)
+// This is a helper for the '__execute_options()' function.
+static inline void __execute_scan(struct argp_state *state, void *options);
+
+// Print the result of hiding one of the files on the image (called by 'imc_steg_insert_many()' in the order of the files)
+static void __hide_report(size_t index, int hide_status, void *report_ptr);
+
+// Print the result of extracting one of the files from the image (called by 'imc_steg_extract_all()' in the order of the files)
+static void __extract_report(size_t index, int unhide_status, void *report_ptr);
 
 // Validate the command line options, and perform the requested operation
 // This is a helper for the 'imc_cli_parse_options()' function.
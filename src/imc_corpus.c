@@ -0,0 +1,232 @@
+/* Corpus scan: check all images on a directory tree for hidden data, and write a report with one line per image. */
+
+#include "imc_includes.h"
+
+/* Note: See the 'imc_corpus.h' file for how the tree is scanned, and for the format of the report. */
+
+// Write a string to the report, with the characters escaped as required by JSON
+static void __corpus_write_string(FILE *report, const char *text)
+{
+    fputc('"', report);
+
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++)
+    {
+        switch (*c)
+        {
+            case '"':  fputs("\\\"", report); break;
+            case '\\': fputs("\\\\", report); break;
+            case '\n': fputs("\\n", report);  break;
+            case '\r': fputs("\\r", report);  break;
+            case '\t': fputs("\\t", report);  break;
+            default:
+                if (*c < 0x20) fprintf(report, "\\u%04x", *c);  // Other control characters
+                else fputc(*c, report);
+                break;
+        }
+    }
+
+    fputc('"', report);
+}
+
+// Check one image, then write its line to the report (this function runs on a worker thread)
+static void __corpus_run_job(void *job_ptr)
+{
+    CorpusJob *const job = (CorpusJob *)job_ptr;
+    CorpusScan *const scan = job->scan;
+    imc_prefetch_consume(scan->prefetcher);
+
+    // Reject the files that are not images by their signature, before decoding anything
+    uint8_t signature[IMC_SIGNATURE_SIZE];
+    size_t sig_size = 0;
+    FILE *file = fopen(job->path, "rb");
+    if (file)
+    {
+        sig_size = fread(signature, 1, sizeof(signature), file);
+        fclose(file);
+    }
+
+    enum ImageType type;
+    if (sig_size == 0 || !imc_steg_detect_type(signature, sig_size, &type))
+    {
+        atomic_fetch_add(&scan->skip_count, 1);
+        imc_free(job);
+        return;
+    }
+
+    // Decode the image, and shuffle its carrier with the shared key
+    CarrierImage *steg_image = NULL;
+    int status = imc_steg_init_from_key(job->path, scan->key, &steg_image, IMC_JUST_CHECK, NULL, NULL);
+
+    // Read the hidden files until the magic bytes no longer match
+    size_t entries = 0;
+    size_t free_bytes = 0;
+    if (status == IMC_SUCCESS)
+    {
+        while ( (status = imc_steg_extract(steg_image)) == IMC_SUCCESS ) entries++;
+
+        // After all hidden files have been read, the extraction returns IMC_ERR_INVALID_MAGIC or IMC_ERR_PAYLOAD_OOB
+        if (status == IMC_ERR_INVALID_MAGIC || status == IMC_ERR_PAYLOAD_OOB) status = IMC_SUCCESS;
+
+        free_bytes = (entries > 0)
+            ? (steg_image->carrier_length - steg_image->carrier_pos) / 8
+            : steg_image->carrier_length / 8;
+
+        imc_steg_finish(steg_image);
+    }
+
+    atomic_fetch_add(&scan->image_count, 1);
+    atomic_fetch_add(&scan->entry_count, entries);
+    if (entries > 0) atomic_fetch_add(&scan->data_count, 1);
+    if (status != IMC_SUCCESS) atomic_fetch_add(&scan->error_count, 1);
+
+    // Write the image's line to the report
+    pthread_mutex_lock(&scan->lock);
+
+    fputs("{\"path\":", scan->report);
+    __corpus_write_string(scan->report, job->path);
+    fprintf(scan->report, ",\"has_data\":%s,\"entries\":%zu,\"free_bytes\":%zu",
+        (entries > 0) ? "true" : "false", entries, free_bytes);
+
+    if (status != IMC_SUCCESS)
+    {
+        fputs(",\"error\":", scan->report);
+        __corpus_write_string(scan->report, imc_steg_strerror(status));
+    }
+
+    fputs("}\n", scan->report);
+
+    pthread_mutex_unlock(&scan->lock);
+
+    imc_free(job);
+}
+
+// Walk a directory, submitting each file found for checking (the subdirectories are walked recursively)
+static void __corpus_walk(CorpusScan *scan, const char *dir_path)
+{
+    DIR *dir = opendir(dir_path);
+    if (!dir) return;
+
+    const size_t dir_len = strlen(dir_path);
+    const bool has_separator = (dir_len > 0) && (dir_path[dir_len-1] == '/');
+    struct dirent *entry;
+
+    while ( (entry = readdir(dir)) )
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        // Path of the entry
+        const size_t path_size = dir_len + strlen(entry->d_name) + 2;
+        CorpusJob *job = imc_malloc(sizeof(CorpusJob) + path_size);
+        job->scan = scan;
+        snprintf(job->path, path_size, has_separator ? "%s%s" : "%s/%s", dir_path, entry->d_name);
+
+        struct stat entry_stats;
+        #ifdef _WIN32
+        bool is_valid = stat(job->path, &entry_stats) == 0;
+        #else
+        bool is_valid = lstat(job->path, &entry_stats) == 0;
+
+        // Symbolic links to directories are not followed (so the walk cannot loop), but links to files are checked
+        if (is_valid && S_ISLNK(entry_stats.st_mode))
+        {
+            is_valid = stat(job->path, &entry_stats) == 0 && !S_ISDIR(entry_stats.st_mode);
+        }
+        #endif
+
+        if (!is_valid)
+        {
+            imc_free(job);
+            continue;
+        }
+
+        if (S_ISDIR(entry_stats.st_mode))
+        {
+            __corpus_walk(scan, job->path);
+            imc_free(job);
+        }
+        else if (S_ISREG(entry_stats.st_mode))
+        {
+            imc_prefetch_add(scan->prefetcher, job->path);
+            imc_threadpool_submit(scan->pool, &__corpus_run_job, job);
+        }
+        else
+        {
+            imc_free(job);
+        }
+    }
+
+    closedir(dir);
+}
+
+// Check all images on the directory tree at 'root_path' (or just the image at 'root_path', if it is a file),
+// using 'num_threads' worker threads (zero for one thread per processor), and reading 'prefetch_window' files ahead of them
+// The lines of the report are written to 'report', and the totals are stored on 'stats'.
+// Function returns IMC_ERR_FILE_NOT_FOUND if 'root_path' does not exist.
+int imc_corpus_scan(
+    const char *root_path,
+    const CryptoContext *key,
+    FILE *report,
+    size_t num_threads,
+    size_t prefetch_window,
+    CorpusStats *stats
+)
+{
+    struct stat root_stats;
+    if (stat(root_path, &root_stats) != 0) return IMC_ERR_FILE_NOT_FOUND;
+
+    struct timespec start_time, end_time;
+    #ifdef _WIN32
+    timespec_get(&start_time, TIME_UTC);
+    #else
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    #endif
+
+    if (num_threads == 0) num_threads = imc_cpu_count();
+
+    CorpusScan scan = {
+        .key = key,
+        .report = report,
+        .pool = imc_threadpool_create(num_threads),
+        .prefetcher = imc_prefetch_create(prefetch_window),
+    };
+    pthread_mutex_init(&scan.lock, NULL);
+
+    // At most two images per thread wait to be checked, while the tree is being walked
+    imc_threadpool_set_limit(scan.pool, num_threads * 2);
+
+    if (S_ISDIR(root_stats.st_mode))
+    {
+        __corpus_walk(&scan, root_path);
+    }
+    else
+    {
+        const size_t path_size = strlen(root_path) + 1;
+        CorpusJob *job = imc_malloc(sizeof(CorpusJob) + path_size);
+        job->scan = &scan;
+        memcpy(job->path, root_path, path_size);
+        imc_threadpool_submit(scan.pool, &__corpus_run_job, job);
+    }
+
+    imc_threadpool_destroy(scan.pool);
+    imc_prefetch_destroy(scan.prefetcher);
+    pthread_mutex_destroy(&scan.lock);
+    fflush(report);
+
+    #ifdef _WIN32
+    timespec_get(&end_time, TIME_UTC);
+    #else
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    #endif
+
+    *stats = (CorpusStats){
+        .image_count = atomic_load(&scan.image_count),
+        .data_count = atomic_load(&scan.data_count),
+        .entry_count = atomic_load(&scan.entry_count),
+        .error_count = atomic_load(&scan.error_count),
+        .skip_count = atomic_load(&scan.skip_count),
+        .thread_count = num_threads,
+        .seconds = (double)(end_time.tv_sec - start_time.tv_sec) + (double)(end_time.tv_nsec - start_time.tv_nsec) / 1e9,
+    };
+
+    return IMC_SUCCESS;
+}
@@ -0,0 +1,78 @@
+/* Corpus scan: check all images on a directory tree for hidden data, and write a report with one line per image. */
+
+#ifndef _IMC_CORPUS_H
+#define _IMC_CORPUS_H
+
+#include "imc_includes.h"
+
+/*  How a directory tree is scanned
+
+    The tree is walked on the calling thread, while each image found is checked on a worker thread
+    (the walk waits when too many images are pending, so the memory used does not depend on the size of the tree).
+    The password is hashed only once, and all images use a copy of the resulting key.
+
+    Files are first rejected by their signature (the first bytes of the file), so files that are not
+    JPEG, PNG, or WebP images are skipped without being decoded. Each image is then checked the same way
+    as the '--check' option does, which stops on the first position where the magic bytes do not match.
+    Subdirectories are followed, but symbolic links to directories are not (so the walk cannot loop).
+    The files are read ahead of the workers by a prefetching thread (see 'imc_prefetch.h'), in the order they were found.
+
+    The report has one JSON object per line (JSON Lines), in the order that the images finish:
+    {"path":"photos/a.jpg","has_data":true,"entries":2,"free_bytes":10512}
+    An image that could not be checked also has an "error" field, with the reason.
+*/
+
+// Totals of a scan
+typedef struct CorpusStats {
+    size_t image_count;     // Amount of images checked (including the ones that failed)
+    size_t data_count;      // Amount of images with hidden data
+    size_t entry_count;     // Amount of hidden files found on all images
+    size_t error_count;     // Amount of images that could not be checked
+    size_t skip_count;      // Amount of files skipped because they are not images
+    size_t thread_count;    // Amount of images checked at the same time
+    double seconds;         // Time that the scan took
+} CorpusStats;
+
+// State shared by the threads checking the images
+typedef struct CorpusScan {
+    const CryptoContext *key;   // Secret key generated from the password (each image uses a copy of it)
+    FILE *report;               // Stream where the lines of the report are written
+    ThreadPool *pool;           // Threads that check the images
+    FilePrefetcher *prefetcher; // Thread reading ahead the files found (NULL if not prefetching)
+    atomic_size_t image_count;  // Amount of images checked (including the ones that failed)
+    atomic_size_t data_count;   // Amount of images with hidden data
+    atomic_size_t entry_count;  // Amount of hidden files found on all images
+    atomic_size_t error_count;  // Amount of images that could not be checked
+    atomic_size_t skip_count;   // Amount of files skipped because they are not images
+    pthread_mutex_t lock;       // Prevents the lines of the report from being written at the same time
+} CorpusScan;
+
+// An image waiting to be checked
+typedef struct CorpusJob {
+    CorpusScan *scan;           // The scan that the image belongs to
+    char path[];                // Path to the image
+} CorpusJob;
+
+// Write a string to the report, with the characters escaped as required by JSON
+static void __corpus_write_string(FILE *report, const char *text);
+
+// Check one image, then write its line to the report (this function runs on a worker thread)
+static void __corpus_run_job(void *job_ptr);
+
+// Walk a directory, submitting each file found for checking (the subdirectories are walked recursively)
+static void __corpus_walk(CorpusScan *scan, const char *dir_path);
+
+// Check all images on the directory tree at 'root_path' (or just the image at 'root_path', if it is a file),
+// using 'num_threads' worker threads (zero for one thread per processor), and reading 'prefetch_window' files ahead of them
+// The lines of the report are written to 'report', and the totals are stored on 'stats'.
+// Function returns IMC_ERR_FILE_NOT_FOUND if 'root_path' does not exist.
+int imc_corpus_scan(
+    const char *root_path,
+    const CryptoContext *key,
+    FILE *report,
+    size_t num_threads,
+    size_t prefetch_window,
+    CorpusStats *stats
+);
+
+#endif  // _IMC_CORPUS_H
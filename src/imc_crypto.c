@@ -2,6 +2,9 @@
 
 #include "imc_includes.h"
 
+// The secrets of each image should fit on a slot of the secure memory pool (so they do not need their own locked pages)
+_Static_assert(sizeof(CryptoContext) <= IMC_SECURE_PAGE_MIN - sizeof(SecureHeader), "CryptoContext does not fit on a secure slot");
+
 // Generate cryptographic secrets key from a password
 int imc_crypto_context_create(const PassBuff *password, CryptoContext **out)
 {
@@ -13,25 +16,30 @@ int imc_crypto_context_create(const PassBuff *password, CryptoContext **out)
     memcpy(salt, IMC_SALT, salt_len);
     
     // Storage for the secret key and the state of the pseudorandom number generator (PRNG)
-    CryptoContext *context = sodium_malloc(sizeof(CryptoContext));
+    CryptoContext *context = imc_secure_alloc(sizeof(CryptoContext));
     if (!context) return IMC_ERR_NO_MEMORY;
-    sodium_memzero(context, sizeof(CryptoContext));
 
-    // Seed for the PRNG
-    uint64_t prng_seed[4];
-    sodium_mlock(prng_seed, sizeof(prng_seed));
-    
-    // Storage for the password hash
+    // Storage for the password hash and the seed for the PRNG
+    // (on secure memory, instead of locking the pages of the stack)
     const size_t key_size = sizeof(context->xcc20_key);
-    const size_t seed_size = sizeof(prng_seed);
-    const size_t out_len = key_size + seed_size;
-    uint8_t output[out_len];
-    sodium_mlock(output, sizeof(output));
+    struct {
+        uint64_t prng_seed[4];
+        uint8_t output[sizeof(context->xcc20_key) + sizeof(uint64_t[4])];
+    } *const secrets = imc_secure_alloc(sizeof(*secrets));
+    if (!secrets)
+    {
+        imc_secure_free(context);
+        return IMC_ERR_NO_MEMORY;
+    }
+    uint64_t *const prng_seed = secrets->prng_seed;
+    uint8_t *const output = secrets->output;
+    const size_t seed_size = sizeof(secrets->prng_seed);
     
     // Password hashing: generate enough bytes for both the secret key and the PRNG seed
+    const StatsTimer kdf_timer = imc_stats_start();
     int status = crypto_pwhash(
-        (uint8_t * const)&output,   // Output buffer for the hash
-        sizeof(output),             // Size in bytes of the output buffer
+        output,                     // Output buffer for the hash
+        sizeof(secrets->output),    // Size in bytes of the output buffer
         password->buffer,           // Input buffer with the password
         password->length,           // Size in bytes of the input buffer
         salt,                       // Salt to be appended to the password
@@ -39,7 +47,13 @@ int imc_crypto_context_create(const PassBuff *password, CryptoContext **out)
         IMC_MEMLIMIT,               // Amount of memory used for hashing
         crypto_pwhash_ALG_ARGON2ID13    // Hashing algorithm
     );
-    if (status < 0) return IMC_ERR_NO_MEMORY;
+    imc_stats_stop(IMC_STATS_KDF, &kdf_timer, 0);
+    if (status < 0)
+    {
+        imc_secure_free(secrets);
+        imc_secure_free(context);
+        return IMC_ERR_NO_MEMORY;
+    }
 
     // The lower bytes are used for the key (32 bytes)
     memcpy(&context->xcc20_key, &output[0], key_size);
@@ -58,13 +72,24 @@ int imc_crypto_context_create(const PassBuff *password, CryptoContext **out)
     prng_gen(&context->shishua_state, context->prng_buffer.buf, IMC_PRNG_BUFFER);
     
     // Release the unnecessary memory and store the output
-    sodium_munlock(prng_seed, sizeof(prng_seed));
-    sodium_munlock(output, sizeof(output));
+    imc_secure_free(secrets);
     *out = context;
 
     return IMC_SUCCESS;
 }
 
+// Make a copy of the cryptographic secrets, so the password does not need to be hashed again
+// The copy has the same key and the same initial state of the pseudorandom number generator.
+int imc_crypto_context_copy(const CryptoContext *source, CryptoContext **out)
+{
+    CryptoContext *context = imc_secure_alloc(sizeof(CryptoContext));
+    if (!context) return IMC_ERR_NO_MEMORY;
+    memcpy(context, source, sizeof(CryptoContext));
+    
+    *out = context;
+    return IMC_SUCCESS;
+}
+
 // Pseudorandom number generator using the SHISHUA algorithm
 // It writes a given amount of bytes to the output.
 void imc_crypto_prng(CryptoContext *state, size_t num_bytes, uint8_t *output)
@@ -247,5 +272,5 @@ int imc_crypto_decrypt(
 // Free the memory used by the cryptographic secrets
 void imc_crypto_context_destroy(CryptoContext *state)
 {
-    sodium_free(state);
+    imc_secure_free(state);
 }
\ No newline at end of file
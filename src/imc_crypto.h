@@ -47,6 +47,10 @@ typedef struct CryptoContext
 // Generate cryptographic secrets key from a password
 int imc_crypto_context_create(const PassBuff *password, CryptoContext **out);
 
+// Make a copy of the cryptographic secrets, so the password does not need to be hashed again
+// The copy has the same key and the same initial state of the pseudorandom number generator.
+int imc_crypto_context_copy(const CryptoContext *source, CryptoContext **out);
+
 // Pseudorandom number generator using the SHISHUA algorithm
 // It writes a given amount of bytes to the output.
 void imc_crypto_prng(CryptoContext *state, size_t num_bytes, uint8_t *output);
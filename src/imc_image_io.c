@@ -2,6 +2,10 @@
  * Supported cover image's formats: JPEG and PNG.
  */
 
+#ifndef _WIN32
+#define _GNU_SOURCE     // For the renameat2() and fallocate() functions
+#endif // _WIN32
+
 #include "imc_includes.h"
 
 /* Note: See the 'imc_image_io.h' file for the binary format that we use to store the hidden data. */
@@ -10,75 +14,80 @@ static const uint8_t bit[8] = {1, 2, 4, 8, 16, 32, 64, 128};    // Masks for get
 static const uint8_t lsb_get   = 1;     // (0b00000001) Mask for getting the least significant bit of a byte
 static const uint8_t lsb_clear = 254;   // (0b11111110) Mask for clearing the least significant bit of a byte
 
+// Whether the files being hidden can be mapped into memory (see 'imc_steg_set_file_mapping()')
+static bool file_mapping = false;
+
 // Info for progress monitoring of PNG images
 static _Thread_local double png_num_passes = -1.0;  // How many passes for reading or writing the image
 static _Thread_local double png_num_rows = -1.0;    // Image's height
+static _Thread_local CarrierImage *png_progress_img = NULL; // Image whose progress is being reported
 // Note: I am storing these thread local variables, because libpng provides no
 //       easy way to access those values from within the row callback function.
 
-// Initialize an image for hiding data in it
-int imc_steg_init(const char *path, const PassBuff *password, CarrierImage **output, uint64_t flags)
+// Determine the format of an image from the first bytes of its file (at least 'IMC_SIGNATURE_SIZE' bytes should be given)
+// Function returns 'false' if the format is not supported.
+bool imc_steg_detect_type(const uint8_t *signature, size_t size, enum ImageType *output)
 {
-    if (__is_directory(path)) return IMC_ERR_PATH_IS_DIR;
-    FILE *image = fopen(path, "rb");
-    if (image == NULL) return IMC_ERR_FILE_NOT_FOUND;
-
     // The file should start with one of these sequences of bytes
     static const uint8_t JPEG_MAGIC[] = {0xFF, 0xD8, 0xFF};
     static const uint8_t PNG_MAGIC[]  = {0x89, 0x50, 0x4E, 0x47};
     static const uint8_t RIFF_MAGIC[] = {'R', 'I', 'F', 'F'};   // First 4 bytes of an WebP image
     static const uint8_t WEBP_MAGIC[] = {'W', 'E', 'B', 'P'};   // Bytes 8 to 11 of an WebP image (counting from 0)
 
-    // Get the file signature
-    const size_t sig_size = 4;
-    uint8_t img_marker[sig_size];
-    size_t read_count = fread(img_marker, 1, sig_size, image);
-    if (read_count != sig_size)
-    {
-        fclose(image);
-        return IMC_ERR_FILE_INVALID;
-    }
-    fseek(image, 0, SEEK_SET);
+    if (size < 4) return false;
 
-    // Determine the image format
-    enum ImageType img_type;
-    
-    if (memcmp(img_marker, JPEG_MAGIC, sizeof(JPEG_MAGIC)) == 0)
+    if (memcmp(signature, JPEG_MAGIC, sizeof(JPEG_MAGIC)) == 0)
     {
-        img_type = IMC_JPEG;
+        *output = IMC_JPEG;
+        return true;
     }
-    else if (memcmp(img_marker, PNG_MAGIC, sizeof(PNG_MAGIC)) == 0)
+    
+    if (memcmp(signature, PNG_MAGIC, sizeof(PNG_MAGIC)) == 0)
     {
-        img_type = IMC_PNG;
+        *output = IMC_PNG;
+        return true;
     }
-    else if (memcmp(img_marker, RIFF_MAGIC, sizeof(RIFF_MAGIC)) == 0)
+    
+    // The first 12 bytes of a WebP image should be something like: RIFF....WEBP
+    // (where '....' is the file size)
+    if (memcmp(signature, RIFF_MAGIC, sizeof(RIFF_MAGIC)) == 0)
     {
-        // Get the WebP file signature
-        // The first 12 bytes should be something like: RIFF....WEBP
-        // (where '....' is the file size)
-        fseek(image, 8, SEEK_SET);
-        size_t count = fread(img_marker, 1, sizeof(WEBP_MAGIC), image);
-        fseek(image, 0, SEEK_SET);
-
-        // Check if the WebP signature matches
-        if (count != sizeof(WEBP_MAGIC) || memcmp(img_marker, WEBP_MAGIC, sizeof(WEBP_MAGIC)) == 0)
-        {
-            img_type = IMC_WEBP;
-        }
-        else
+        if (size < 8 + sizeof(WEBP_MAGIC) || memcmp(&signature[8], WEBP_MAGIC, sizeof(WEBP_MAGIC)) == 0)
         {
-            goto file_magic_error;
+            *output = IMC_WEBP;
+            return true;
         }
     }
-    else
+
+    return false;
+}
+
+// Open an image and allocate the struct that holds its steganographic data
+// (the image format is determined from the file's signature)
+static int __steg_open_image(const char *path, CarrierImage **output, uint64_t flags)
+{
+    if (__is_directory(path)) return IMC_ERR_PATH_IS_DIR;
+    FILE *image = fopen(path, "rb");
+    if (image == NULL) return IMC_ERR_FILE_NOT_FOUND;
+
+    // Get the file signature (the first 12 bytes are enough for all supported formats)
+    uint8_t img_marker[IMC_SIGNATURE_SIZE];
+    const size_t read_count = fread(img_marker, 1, sizeof(img_marker), image);
+    fseek(image, 0, SEEK_SET);
+
+    // Determine the image format
+    enum ImageType img_type;
+    if (!imc_steg_detect_type(img_marker, read_count, &img_type))
     {
-        file_magic_error:
         fclose(image);
         return IMC_ERR_FILE_INVALID;
     }
 
     // Holds the information needed for hiding data in the image
-    CarrierImage *carrier_img = imc_calloc(1, sizeof(CarrierImage));
+    // (the struct and the buffers of the image come from an arena, which is freed at once when the image is closed)
+    MemoryArena *arena = imc_arena_create(0);
+    CarrierImage *carrier_img = imc_arena_calloc(arena, 1, sizeof(CarrierImage));
+    carrier_img->arena = arena;
     carrier_img->type = img_type;
     carrier_img->file = image;
     
@@ -86,23 +95,6 @@ int imc_steg_init(const char *path, const PassBuff *password, CarrierImage **out
     if (flags & IMC_JUST_CHECK) carrier_img->just_check = true; // '--check' option
     if (flags & IMC_VERBOSE)    carrier_img->verbose = true;    // '--verbose' option
 
-    // Status message (verbose)
-    if (carrier_img->verbose)
-    {
-        if (password->length > 0) printf("Generating secret key... ");
-        else printf("Generating key... ");
-        fflush(stdout);
-    }
-
-    // Generate a secret key, and seed the number generator
-    const int crypto_status = imc_crypto_context_create(password, &carrier_img->crypto);
-    if (carrier_img->verbose)
-    {
-        if (crypto_status == IMC_SUCCESS) printf("Done!\n");
-        else printf("\n");
-    }
-    if (crypto_status != IMC_SUCCESS) return crypto_status;
-
     // Set the struct's methods
     // ("open", "save", and "close" functions for the different supported image formats)
     switch (img_type)
@@ -125,23 +117,220 @@ int imc_steg_init(const char *path, const PassBuff *password, CarrierImage **out
             carrier_img->close = &imc_webp_carrier_close;
             break;
     }
-    
+
+    *output = carrier_img;
+    return IMC_SUCCESS;
+}
+
+// Get the carrier bytes of an open image, and shuffle them using the image's secret key
+// On failure, the image is closed and its struct is freed.
+static int __steg_load_carrier(CarrierImage *carrier_img)
+{
     // Get the carrier bytes from the image
-    carrier_img->open(carrier_img);
+    const int open_status = carrier_img->open(carrier_img);
+    if (open_status != IMC_SUCCESS)
+    {
+        fclose(carrier_img->file);
+        imc_memory_close(carrier_img->reserved_memory);
+        imc_crypto_context_destroy(carrier_img->crypto);
+        imc_arena_destroy(carrier_img->arena);
+        return open_status;
+    }
+
+    __steg_shuffle_carrier(carrier_img);
+    return IMC_SUCCESS;
+}
+
+// Reserve from the memory budget what an image needs, before its buffers are allocated (if there is a budget)
+// 'base' is the memory that the image needs for certain, and 'worst' the most that it might need (depending on how many
+// carrier bytes it has). Function returns IMC_ERR_MEMORY_BUDGET if 'base' alone is bigger than the budget.
+static int __steg_reserve_memory(CarrierImage *carrier_img, size_t base, size_t worst)
+{
+    const size_t budget = imc_memory_get_budget();
+    if (budget == 0) return IMC_SUCCESS;
+    if (base > budget) return IMC_ERR_MEMORY_BUDGET;
+
+    // The worst case is capped to the budget, so an image that might fit is still allowed to try
+    const size_t amount = (worst < budget) ? worst : budget;
+    const int status = imc_memory_reserve(amount);
+    if (status == IMC_SUCCESS) carrier_img->reserved_memory = amount;
+    return status;
+}
+
+// Reduce the memory reserved by an image to what it actually uses, after its carrier bytes were found
+// 'external' is the memory of the image that was not allocated from its arena (by the image libraries).
+// Function returns IMC_ERR_MEMORY_BUDGET if the image uses more memory than the budget.
+static int __steg_settle_memory(CarrierImage *carrier_img, size_t external)
+{
+    if (carrier_img->reserved_memory == 0) return IMC_SUCCESS;
+
+    const size_t used = imc_arena_footprint(carrier_img->arena) + external;
+    if (used > imc_memory_get_budget()) return IMC_ERR_MEMORY_BUDGET;
+
+    // Give back what was reserved for the carrier bytes that the image does not have
+    if (used < carrier_img->reserved_memory)
+    {
+        imc_memory_release(carrier_img->reserved_memory - used);
+        carrier_img->reserved_memory = used;
+    }
+
+    return IMC_SUCCESS;
+}
+
+// Reserve from the memory budget the buffers of a file being hidden or extracted (if there is a budget)
+// The amount is added to 'reserved'. Function returns IMC_ERR_MEMORY_BUDGET if the buffers do not fit in the budget.
+static int __steg_reserve_buffers(size_t bytes, size_t *reserved)
+{
+    if (imc_memory_get_budget() == 0) return IMC_SUCCESS;
+
+    const int status = imc_memory_reserve_buffers(bytes);
+    if (status == IMC_SUCCESS) *reserved += bytes;
+    return status;
+}
+
+// Give back to the memory budget what was reserved for the buffers of a file, except for 'keep' bytes
+static void __steg_release_buffers(size_t *reserved, size_t keep)
+{
+    if (*reserved <= keep) return;
+    imc_memory_release(*reserved - keep);
+    *reserved = keep;
+}
 
-    // Shuffle the array of pointers
-    // (so the order that the bytes are written depends on the password)
+// Shuffle the array of pointers to the carrier bytes, using the image's secret key
+// (so the order that the bytes are written depends on the password)
+static void __steg_shuffle_carrier(CarrierImage *carrier_img)
+{
+    if (carrier_img->progress) carrier_img->progress(IMC_STAGE_SHUFFLE, 0.0, carrier_img->progress_data);
+    const StatsTimer shuffle_timer = imc_stats_start();
     imc_crypto_shuffle_ptr(
         carrier_img->crypto,    // Has the state of the pseudo-random number generator
         (uintptr_t *)(&carrier_img->carrier[0]),    // Beginning of the array
         carrier_img->carrier_length,                // Amount of elements on the array
         carrier_img->verbose    // Print the progress if on "verbose" mode
     );
+    imc_stats_stop(IMC_STATS_SHUFFLE, &shuffle_timer, carrier_img->carrier_length * sizeof(carrier_img->carrier[0]));
+    if (carrier_img->progress) carrier_img->progress(IMC_STAGE_SHUFFLE, 100.0, carrier_img->progress_data);
+}
+
+// Initialize an image for hiding data in it
+int imc_steg_init(const char *path, const PassBuff *password, CarrierImage **output, uint64_t flags)
+{
+    CarrierImage *carrier_img = NULL;
+    const int img_status = __steg_open_image(path, &carrier_img, flags);
+    if (img_status != IMC_SUCCESS) return img_status;
+
+    // Status message (verbose)
+    if (carrier_img->verbose)
+    {
+        if (password->length > 0) printf("Generating secret key... ");
+        else printf("Generating key... ");
+        fflush(stdout);
+    }
+
+    // Generate a secret key, and seed the number generator
+    const int crypto_status = imc_crypto_context_create(password, &carrier_img->crypto);
+    if (carrier_img->verbose)
+    {
+        if (crypto_status == IMC_SUCCESS) printf("Done!\n");
+        else printf("\n");
+    }
+    if (crypto_status != IMC_SUCCESS)
+    {
+        fclose(carrier_img->file);
+        imc_arena_destroy(carrier_img->arena);
+        return crypto_status;
+    }
+
+    const int carrier_status = __steg_load_carrier(carrier_img);
+    if (carrier_status != IMC_SUCCESS) return carrier_status;
+    
+    *output = carrier_img;
+    return IMC_SUCCESS;
+}
+
+// Initialize an image for hiding data in it, using a secret key that was already generated
+// (the key is copied, so the same one can be used for initializing multiple images)
+// If 'progress' is not NULL, it receives the progress of the operations on the image (along with 'progress_data').
+int imc_steg_init_from_key(
+    const char *path,
+    const CryptoContext *key,
+    CarrierImage **output,
+    uint64_t flags,
+    imc_progress_func progress,
+    void *progress_data
+)
+{
+    CarrierImage *carrier_img = NULL;
+    const int img_status = __steg_open_image(path, &carrier_img, flags);
+    if (img_status != IMC_SUCCESS) return img_status;
+
+    carrier_img->progress = progress;
+    carrier_img->progress_data = progress_data;
+
+    const int crypto_status = imc_crypto_context_copy(key, &carrier_img->crypto);
+    if (crypto_status != IMC_SUCCESS)
+    {
+        fclose(carrier_img->file);
+        imc_arena_destroy(carrier_img->arena);
+        return crypto_status;
+    }
+
+    const int carrier_status = __steg_load_carrier(carrier_img);
+    if (carrier_status != IMC_SUCCESS) return carrier_status;
     
     *output = carrier_img;
     return IMC_SUCCESS;
 }
 
+// Open an image and get its carrier bytes, without shuffling them
+// The carrier stays in the same order as on the image until a key is set with 'imc_steg_set_key()'.
+// This allows the decoding and scanning of the image to be done only once for many hiding operations.
+int imc_steg_open_cover(const char *path, CarrierImage **output, uint64_t flags)
+{
+    CarrierImage *carrier_img = NULL;
+    const int img_status = __steg_open_image(path, &carrier_img, flags);
+    if (img_status != IMC_SUCCESS) return img_status;
+
+    const int open_status = carrier_img->open(carrier_img);
+    if (open_status != IMC_SUCCESS)
+    {
+        fclose(carrier_img->file);
+        imc_memory_close(carrier_img->reserved_memory);
+        imc_arena_destroy(carrier_img->arena);
+        return open_status;
+    }
+
+    *output = carrier_img;
+    return IMC_SUCCESS;
+}
+
+// Set the secret key of an open image, then shuffle its carrier using the key
+// The results of the previous operations on the image are cleared (the write position goes back to the beginning),
+// but the carrier bytes themselves are not restored, and the carrier is shuffled starting from its current order.
+// If 'progress' is not NULL, it receives the progress of the operations on the image (along with 'progress_data').
+int imc_steg_set_key(CarrierImage *carrier_img, const CryptoContext *key, imc_progress_func progress, void *progress_data)
+{
+    CryptoContext *new_key = NULL;
+    const int crypto_status = imc_crypto_context_copy(key, &new_key);
+    if (crypto_status != IMC_SUCCESS) return crypto_status;
+
+    imc_crypto_context_destroy(carrier_img->crypto);
+    carrier_img->crypto = new_key;
+    carrier_img->progress = progress;
+    carrier_img->progress_data = progress_data;
+
+    // Forget the previous operation
+    carrier_img->carrier_pos = 0;
+    carrier_img->out_dir = NULL;
+    imc_free(carrier_img->out_path);
+    carrier_img->out_path = NULL;
+    imc_free(carrier_img->steg_info);
+    carrier_img->steg_info = NULL;
+
+    __steg_shuffle_carrier(carrier_img);
+    return IMC_SUCCESS;
+}
+
 // Convenience function for converting the bytes from a timespec struct into
 // the byte layout used by this program: 64-bit little endian (each value)
 static inline struct timespec64 __timespec_to_64le(struct timespec time)
@@ -162,16 +351,225 @@ static inline struct timespec __timespec_from_64le(struct timespec64 time)
     };
 }
 
-// Hide a file in an image
-// Note: function can be called multiple times in order to hide more files in the same image.
-int imc_steg_insert(CarrierImage *carrier_img, const char *file_path)
+// Maximum size in bytes that some data can have after being compressed by 'imc_deflate_data()'
+size_t imc_deflate_bound(size_t size)
 {
-    if (__is_directory(file_path)) return IMC_ERR_PATH_IS_DIR;
-    FILE *file = fopen(file_path, "rb");
-    if (file == NULL) return IMC_ERR_FILE_NOT_FOUND;
+    if (size <= IMC_DEFLATE_CHUNK) return compressBound(size);
 
-    // Get the file's metadata
+    // Zlib header (2 bytes) and checksum (4 bytes), plus the bound of each chunk
+    // (a chunk might have a few more bytes than a complete stream, because of the marker added when flushing it)
+    const size_t chunk_count = (size + IMC_DEFLATE_CHUNK - 1) / IMC_DEFLATE_CHUNK;
+    return 6 + chunk_count * (compressBound(IMC_DEFLATE_CHUNK) + 16);
+}
+
+// Compress a chunk of the data (this function might run on a worker thread)
+static void __deflate_chunk(size_t index, void *deflate_ptr)
+{
+    ParallelDeflate *const deflate_state = (ParallelDeflate *)deflate_ptr;
+    DeflateChunk *const chunk = &deflate_state->chunks[index];
+
+    const size_t start = index * IMC_DEFLATE_CHUNK;
+    const bool is_last = (start + IMC_DEFLATE_CHUNK >= deflate_state->input_size);
+    const size_t length = is_last ? deflate_state->input_size - start : IMC_DEFLATE_CHUNK;
+    const uint8_t *const input = &deflate_state->input[start];
+
+    chunk->adler = adler32(adler32(0, Z_NULL, 0), input, length);
+
+    // Raw Deflate stream (negative window bits), with the same settings as 'compress2()'
+    z_stream stream = {0};
+    chunk->status = deflateInit2(&stream, deflate_state->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    if (chunk->status != Z_OK) return;
+
+    // Use the end of the previous chunk as the dictionary, so the compression ratio stays close to compressing the whole data at once
+    // (the first chunk uses the end of the prefix, if there is one)
+    const uint8_t *dictionary = input - IMC_DEFLATE_DICTIONARY;
+    size_t dictionary_size = IMC_DEFLATE_DICTIONARY;
+    if (index == 0)
+    {
+        dictionary_size = (deflate_state->prefix_size < IMC_DEFLATE_DICTIONARY) ? deflate_state->prefix_size : IMC_DEFLATE_DICTIONARY;
+        dictionary = &deflate_state->prefix[deflate_state->prefix_size - dictionary_size];
+    }
+
+    if (dictionary_size > 0)
+    {
+        chunk->status = deflateSetDictionary(&stream, dictionary, dictionary_size);
+        if (chunk->status != Z_OK)
+        {
+            deflateEnd(&stream);
+            return;
+        }
+    }
+
+    const size_t capacity = compressBound(length) + 16;
+    chunk->data = imc_malloc_tag(capacity, IMC_MEMORY_ZLIB);
+
+    stream.next_in = (Bytef *)input;
+    stream.avail_in = length;
+    stream.next_out = chunk->data;
+    stream.avail_out = capacity;
+
+    // The last chunk ends the stream, while the others end on a byte boundary so they can be joined
+    const int deflate_status = deflate(&stream, is_last ? Z_FINISH : Z_SYNC_FLUSH);
+    const bool is_complete = is_last ? (deflate_status == Z_STREAM_END) : (deflate_status == Z_OK && stream.avail_out > 0);
+
+    chunk->size = stream.total_out;
+    chunk->status = is_complete ? Z_OK : Z_BUF_ERROR;
+    deflateEnd(&stream);
+}
+
+// Add a compressed chunk to the output (chunks are added in order)
+static void __deflate_append(size_t index, void *deflate_ptr)
+{
+    ParallelDeflate *const deflate_state = (ParallelDeflate *)deflate_ptr;
+    DeflateChunk *const chunk = &deflate_state->chunks[index];
+
+    if (deflate_state->status == Z_OK) deflate_state->status = chunk->status;
+
+    if (deflate_state->status == Z_OK)
+    {
+        if (deflate_state->output_pos + chunk->size + 4 <= deflate_state->output_size)
+        {
+            memcpy(&deflate_state->output[deflate_state->output_pos], chunk->data, chunk->size);
+            deflate_state->output_pos += chunk->size;
+
+            const size_t start = index * IMC_DEFLATE_CHUNK;
+            const size_t remaining = deflate_state->input_size - start;
+            const size_t length = (remaining < IMC_DEFLATE_CHUNK) ? remaining : IMC_DEFLATE_CHUNK;
+            deflate_state->adler = adler32_combine(deflate_state->adler, chunk->adler, length);
+        }
+        else
+        {
+            deflate_state->status = Z_BUF_ERROR;
+        }
+    }
+
+    imc_free(chunk->data);
+    chunk->data = NULL;
+}
+
+// Compress some data into a Zlib stream, at the compression 'level' (either Z_BEST_COMPRESSION, or Z_NO_COMPRESSION for data that is already compressed)
+// 'output_size' is the size of the output buffer, and the function updates it to the compressed size.
+// Function returns Z_OK on success, or the error code returned by Zlib.
+int imc_deflate_data(const uint8_t *input, size_t input_size, uint8_t *output, size_t *output_size, int level)
+{
+    return imc_deflate_prefixed(NULL, 0, input, input_size, output, output_size, level);
+}
+
+// Compress a small prefix followed by some data into a single Zlib stream, without joining them on the same buffer first
+// (the output is the same stream as compressing both together, so it is decompressed as one piece)
+// The output buffer should have at least 'imc_deflate_bound(prefix_size) + imc_deflate_bound(input_size)' bytes.
+// The other parameters and the return value are the same as of 'imc_deflate_data()'.
+int imc_deflate_prefixed(
+    const uint8_t *prefix,
+    size_t prefix_size,
+    const uint8_t *input,
+    size_t input_size,
+    uint8_t *output,
+    size_t *output_size,
+    int level
+)
+{
+    // Data that fits in a single chunk is compressed at once
+    if (input_size <= IMC_DEFLATE_CHUNK)
+    {
+        // Same settings as 'compress2()', but the prefix and the data are fed one after the other
+        z_stream stream = {0};
+        int status = deflateInit(&stream, level);
+        if (status != Z_OK) return status;
+
+        stream.next_out = output;
+        stream.avail_out = *output_size;
+        /* Note: 'avail_out' is 32-bit, but the output of a chunk is far smaller than 4 GB. */
+
+        if (prefix_size > 0)
+        {
+            stream.next_in = (Bytef *)prefix;
+            stream.avail_in = prefix_size;
+            status = deflate(&stream, Z_NO_FLUSH);
+        }
+
+        if (status == Z_OK)
+        {
+            stream.next_in = (Bytef *)input;
+            stream.avail_in = input_size;
+            status = deflate(&stream, Z_FINISH);
+            status = (status == Z_STREAM_END) ? Z_OK : Z_BUF_ERROR;
+        }
+
+        if (status == Z_OK) *output_size = stream.total_out;
+        deflateEnd(&stream);
+        return status;
+    }
+
+    // Zlib header: Deflate with a 32 KB window, at the maximum or at the fastest compression level
+    // (the second byte also makes the 16-bit header a multiple of 31, as required by the format)
+    if (*output_size < 6) return Z_BUF_ERROR;
+    output[0] = 0x78;
+    output[1] = (level == Z_BEST_COMPRESSION) ? 0xDA : 0x01;
+
+    ParallelDeflate deflate_state = {
+        .prefix = prefix,
+        .prefix_size = prefix_size,
+        .input = input,
+        .input_size = input_size,
+        .chunks = imc_calloc((input_size + IMC_DEFLATE_CHUNK - 1) / IMC_DEFLATE_CHUNK, sizeof(DeflateChunk)),
+        .output = output,
+        .output_size = *output_size,
+        .output_pos = 2,
+        .adler = adler32(0, Z_NULL, 0),
+        .level = level,
+        .status = Z_OK,
+    };
+
+    // The prefix is compressed first, as a chunk of its own that ends on a byte boundary
+    // (it is small, so this does not need a worker thread)
+    if (prefix_size > 0)
+    {
+        z_stream stream = {0};
+        deflate_state.status = deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        if (deflate_state.status != Z_OK)
+        {
+            imc_free(deflate_state.chunks);
+            return deflate_state.status;
+        }
+
+        stream.next_in = (Bytef *)prefix;
+        stream.avail_in = prefix_size;
+        stream.next_out = &output[deflate_state.output_pos];
+        stream.avail_out = deflate_state.output_size - deflate_state.output_pos - 4;
+
+        const int deflate_status = deflate(&stream, Z_SYNC_FLUSH);
+        deflate_state.status = (deflate_status == Z_OK && stream.avail_in == 0 && stream.avail_out > 0) ? Z_OK : Z_BUF_ERROR;
+        deflate_state.output_pos += stream.total_out;
+        deflate_state.adler = adler32(deflate_state.adler, prefix, prefix_size);
+        deflateEnd(&stream);
+
+        if (deflate_state.status != Z_OK)
+        {
+            imc_free(deflate_state.chunks);
+            return deflate_state.status;
+        }
+    }
+
+    // Compress the chunks in parallel, while joining them in order
+    // (at most two chunks per thread are kept in memory waiting to be joined)
+    const size_t chunk_count = (input_size + IMC_DEFLATE_CHUNK - 1) / IMC_DEFLATE_CHUNK;
+    imc_parallel_ordered(chunk_count, 2 * imc_threads_get_count(), &__deflate_chunk, &__deflate_append, &deflate_state);
+    imc_free(deflate_state.chunks);
+
+    if (deflate_state.status != Z_OK) return deflate_state.status;
 
+    // Zlib trailer: checksum of the uncompressed data, counting the prefix (big-endian)
+    const uint32_t adler_be = htobe32((uint32_t)deflate_state.adler);
+    memcpy(&output[deflate_state.output_pos], &adler_be, sizeof(adler_be));
+    *output_size = deflate_state.output_pos + sizeof(adler_be);
+
+    return Z_OK;
+}
+
+// Get the size and timestamps of an open file
+static void __steg_file_metadata(FILE *file, off_t *file_size, struct timespec *access_time, struct timespec *mod_time)
+{
     #ifdef _WIN32   // Windows systems
     
     HANDLE file_handle = __win_get_file_handle(file);   // File handle on Windows
@@ -179,14 +577,14 @@ int imc_steg_insert(CarrierImage *carrier_img, const char *file_path)
     // File size
     LARGE_INTEGER file_size_win = {0};                  // A Windows struct with the file size
     GetFileSizeEx(file_handle, &file_size_win);
-    const off_t file_size = file_size_win.QuadPart;     // File size in bytes
+    *file_size = file_size_win.QuadPart;                // File size in bytes
 
     // Timestamps
     FILETIME file_mod_time_win = {0};       // Last modified time (Windows timestamp)
     FILETIME file_access_time_win = {0};    // Last access time (Windows timestamp)
     GetFileTime(file_handle, NULL, &file_access_time_win, &file_mod_time_win);
-    const struct timespec file_mod_time = __win_filetime_to_timespec(file_mod_time_win);        // Last modified time (Unix timestamp)
-    const struct timespec file_access_time = __win_filetime_to_timespec(file_access_time_win);  // Last access time (Unix timestamp)
+    *mod_time = __win_filetime_to_timespec(file_mod_time_win);          // Last modified time (Unix timestamp)
+    *access_time = __win_filetime_to_timespec(file_access_time_win);    // Last access time (Unix timestamp)
     
     #else   // Linux systems
     
@@ -195,19 +593,41 @@ int imc_steg_insert(CarrierImage *carrier_img, const char *file_path)
     // File size
     struct stat file_stats = {0};
     fstat(file_descriptor, &file_stats);
-    const off_t file_size = file_stats.st_size;
+    *file_size = file_stats.st_size;
 
     // Timestamps
-    const struct timespec file_mod_time = file_stats.st_mtim;       // Last modified time (Unix timestamp)
-    const struct timespec file_access_time = file_stats.st_atim;    // Last access time (Unix timestamp)
+    *mod_time = file_stats.st_mtim;         // Last modified time (Unix timestamp)
+    *access_time = file_stats.st_atim;      // Last access time (Unix timestamp)
     
     #endif // _WIN32
+}
+
+// Read a file into a new buffer, leaving 'prefix_size' bytes at the beginning of the buffer (for the metadata stored before the file)
+// The size and timestamps of the file are stored on 'file_size_out', 'access_time', and 'mod_time'.
+// The buffer has 'prefix_size' plus 'file_size_out' bytes, and it should be freed with 'imc_clear_free()'.
+int imc_steg_read_file(
+    const char *file_path,
+    size_t prefix_size,
+    uint8_t **output,
+    size_t *file_size_out,
+    struct timespec *access_time,
+    struct timespec *mod_time
+)
+{
+    if (__is_directory(file_path)) return IMC_ERR_PATH_IS_DIR;
+    FILE *file = fopen(file_path, "rb");
+    if (file == NULL) return IMC_ERR_FILE_NOT_FOUND;
+
+    // Get the file's metadata
+    off_t file_size;
+    struct timespec file_access_time, file_mod_time;
+    __steg_file_metadata(file, &file_size, &file_access_time, &file_mod_time);
     
     // Sanity check
     if (file_size > IMC_MAX_INPUT_SIZE)
     {
-        fprintf(stderr, "Error: Maximum size of the hidden file is 500 MB");
-        exit(EXIT_FAILURE);
+        fclose(file);
+        return IMC_ERR_INPUT_TOO_BIG;
         /* Note:
             The 500 MB limit is for preventing a huge file from being accidentally loaded.
             Since the amount of data that can realistically be hidden usually is quite small,
@@ -215,102 +635,217 @@ int imc_steg_insert(CarrierImage *carrier_img, const char *file_path)
         */
     }
 
-    // Get the file name from the path
-    const size_t path_len = strlen(file_path);
-    char path_temp[path_len+1];
-    strcpy(path_temp, file_path);
-    const char *const file_name = basename(path_temp);
-    
-    // Calculate the size for the file's metadata that will be stored
-    const size_t name_size = strlen(file_name) + 1;
-    if (name_size > UINT16_MAX) return IMC_ERR_NAME_TOO_LONG;
-    const size_t info_size = sizeof(FileInfo) + name_size;
-    
-    // Read the file into a buffer
-    if (carrier_img->verbose) printf("Loading '%s'... ", file_name);
-    if (carrier_img->verbose) fflush(stdout);
-    const size_t raw_size = info_size + file_size;
-    uint8_t *const raw_buffer = imc_malloc(raw_size);
-    const size_t read_count = fread(&raw_buffer[info_size], 1, file_size, file);
+    // Read the file into the buffer
+    const StatsTimer read_timer = imc_stats_start();
+    uint8_t *const buffer = imc_malloc_tag(prefix_size + file_size, IMC_MEMORY_FILE);
+    const size_t read_count = fread(&buffer[prefix_size], 1, file_size, file);
     fclose(file);
-    if (carrier_img->verbose) printf("Done!\n");
-    if (read_count != file_size) return IMC_ERR_FILE_CORRUPTED;
-
-    // The offset from which the data will be compressed
-    const size_t compressed_offset = offsetof(FileInfo, access_time);
-    
-    // Store the metadata
-    // Note: integers are always stored in little endian byte order.
-    FileInfo *file_info = (FileInfo*)raw_buffer;
-    
-    file_info->version = htole32((uint32_t)IMC_FILEINFO_VERSION);
-    file_info->uncompressed_size = htole64(raw_size - compressed_offset);
-    file_info->access_time = __timespec_to_64le(file_access_time);
-    file_info->mod_time = __timespec_to_64le(file_mod_time);
-    file_info->name_size = htole16(name_size);
+    imc_stats_stop(IMC_STATS_READ_FILE, &read_timer, read_count);
     
-    memcpy(&file_info->file_name[0], file_name, name_size);
-    
-    // Get the current time (UTC)
-    struct timespec current_time = {0};
-    #ifdef _WIN32
-    timespec_get(&current_time, TIME_UTC);
-    #else
-    clock_gettime(CLOCK_REALTIME, &current_time);
-    #endif
-    
-    file_info->steg_time = __timespec_to_64le(current_time);
+    if (read_count != file_size)
+    {
+        imc_clear_free(buffer, prefix_size + file_size);
+        return IMC_ERR_FILE_CORRUPTED;
+    }
 
-    // Create a buffer for the compressed data
-    // Note: For the overhead calculation, see https://zlib.net/zlib_tech.html
-    const size_t zlib_overhead = 6 + (5 * (file_size / 16000)) + 1;
-    size_t zlib_buffer_size = raw_size + zlib_overhead;
-    uint8_t *const input_buffer = (uint8_t *)(&file_info->access_time);
-    uint8_t *zlib_buffer = imc_malloc(zlib_buffer_size);
+    *output = buffer;
+    *file_size_out = file_size;
+    *access_time = file_access_time;
+    *mod_time = file_mod_time;
     
-    // Copy the uncompressed metadata to the beginning of the buffer
-    memcpy(zlib_buffer, file_info, compressed_offset);
-    zlib_buffer_size -= compressed_offset;
+    return IMC_SUCCESS;
+}
+
+// Set whether the files being hidden are mapped into memory, instead of read into a buffer (disabled by default)
+// Note: If a mapped file is truncated by another process while it is being read, the program is killed by a SIGBUS signal.
+//       So the mapping should be enabled only when that cannot take down other operations (not for '--batch' nor '--serve').
+void imc_steg_set_file_mapping(bool enabled)
+{
+    file_mapping = enabled;
+}
+
+// Map a file into memory for reading it, if the mapping was enabled (otherwise, or on Windows, the file is read into a buffer)
+// The pages are read from the disk as they are accessed, and are shared with the system's cache, so hiding
+// the same file many times does not read it again. The size and timestamps of the file are also stored on 'output'.
+// The file should be released with 'imc_steg_unmap_file()'.
+int imc_steg_map_file(const char *file_path, MappedFile *output)
+{
+    if (__is_directory(file_path)) return IMC_ERR_PATH_IS_DIR;
+    FILE *file = fopen(file_path, "rb");
+    if (file == NULL) return IMC_ERR_FILE_NOT_FOUND;
+
+    off_t file_size;
+    struct timespec file_access_time, file_mod_time;
+    __steg_file_metadata(file, &file_size, &file_access_time, &file_mod_time);
+
+    // Sanity check (see 'imc_steg_read_file()')
+    if (file_size > IMC_MAX_INPUT_SIZE)
+    {
+        fclose(file);
+        return IMC_ERR_INPUT_TOO_BIG;
+    }
+
+    *output = (MappedFile){
+        .data = NULL,
+        .size = file_size,
+        .is_mapped = false,
+        .access_time = file_access_time,
+        .mod_time = file_mod_time,
+    };
+
+    // An empty file has nothing to map
+    if (file_size == 0)
+    {
+        fclose(file);
+        return IMC_SUCCESS;
+    }
+
+    const StatsTimer read_timer = imc_stats_start();
+
+    #ifndef _WIN32
+
+    // The file is read from beginning to end, so the system can read ahead more aggressively
+    void *map = file_mapping ? mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fileno(file), 0) : MAP_FAILED;
+    if (map != MAP_FAILED)
+    {
+        madvise(map, file_size, MADV_SEQUENTIAL);
+        fclose(file);
+        output->data = map;
+        output->is_mapped = true;
+        imc_stats_stop(IMC_STATS_READ_FILE, &read_timer, file_size);
+        return IMC_SUCCESS;
+    }
 
-    #ifdef _WIN32
-    uLongf compress_size_win = zlib_buffer_size;
-    /* Note: For some reason, on Windows the length of the buffer size variable
-       is 4 bytes, while on Linux its 8 bytes. Since my code assumes that it is
-       going to be 8 bytes, then I am creating this additional variable so I do
-       not pass to the compression function a pointer to a size different than
-       what the function expects. */
     #endif // _WIN32
 
-    // Compress the data on the buffer (from the '.access_time' onwards)
-    if (carrier_img->verbose) printf("Compressing '%s'... ", file_name);
-    if (carrier_img->verbose) fflush(stdout);
-    int zlib_status = compress2(
+    // Read the file into a buffer (if it was not mapped)
+    uint8_t *const buffer = imc_malloc_tag(file_size, IMC_MEMORY_FILE);
+    const size_t read_count = fread(buffer, 1, file_size, file);
+    fclose(file);
+    imc_stats_stop(IMC_STATS_READ_FILE, &read_timer, read_count);
+
+    if (read_count != (size_t)file_size)
+    {
+        imc_clear_free(buffer, file_size);
+        return IMC_ERR_FILE_CORRUPTED;
+    }
+
+    output->data = buffer;
+    return IMC_SUCCESS;
+}
+
+// Release a file mapped by 'imc_steg_map_file()'
+void imc_steg_unmap_file(MappedFile *file)
+{
+    #ifndef _WIN32
+    if (file->is_mapped)
+    {
+        munmap((void *)file->data, file->size);
+        file->data = NULL;
+        return;
+    }
+    #endif // _WIN32
+
+    if (file->data) imc_clear_free((void *)file->data, file->size);
+    file->data = NULL;
+}
+
+// Fill the metadata stored before a file (except for the sizes and the time of hiding, which are set when the file is prepared)
+// 'file_info' must have room for the file name ('name_size' bytes, counting the null terminator).
+// Note: integers are always stored in little endian byte order.
+void imc_steg_info_init(
+    FileInfo *file_info,
+    uint32_t version,
+    const char *file_name,
+    size_t name_size,
+    struct timespec access_time,
+    struct timespec mod_time
+)
+{
+    file_info->version = htole32(version);
+    file_info->access_time = __timespec_to_64le(access_time);
+    file_info->mod_time = __timespec_to_64le(mod_time);
+    file_info->name_size = htole16(name_size);
+    
+    memcpy(&file_info->file_name[0], file_name, name_size);
+}
+
+// Compress and encrypt the metadata of a file (filled by 'imc_steg_info_init()') followed by the data being hidden
+// The metadata and the data do not need to be on the same buffer: the metadata is compressed first, then the data
+// continues the same stream. 'level' is the compression level of Zlib. Neither buffer is freed by this function.
+// The returned 'PreparedPayload' should be freed with 'imc_steg_prepared_free()'.
+static int __steg_prepare_stream(
+    CryptoContext *crypto,
+    FileInfo *file_info,
+    const uint8_t *data,
+    size_t data_size,
+    int level,
+    bool verbose,
+    PreparedPayload **output
+)
+{
+    // The offset from which the data will be compressed
+    // (the metadata from that point onwards is compressed along with the data)
+    const size_t compressed_offset = offsetof(FileInfo, access_time);
+    const size_t name_size = le16toh(file_info->name_size);
+    const size_t prefix_size = sizeof(FileInfo) + name_size - compressed_offset;
+    file_info->uncompressed_size = htole64(prefix_size + data_size);
+
+    // Reserve the compressed and the encrypted streams, which are in memory at the same time
+    size_t zlib_buffer_size = imc_deflate_bound(prefix_size) + imc_deflate_bound(data_size);
+    size_t reserved_memory = 0;
+    const int reserve_status = __steg_reserve_buffers(
+        2 * (compressed_offset + zlib_buffer_size) + IMC_CRYPTO_OVERHEAD, &reserved_memory
+    );
+    if (reserve_status != IMC_SUCCESS) return reserve_status;
+    
+    // Keep a copy of the file name (for the status messages)
+    char *const file_name = imc_malloc(name_size);
+    memcpy(file_name, file_info->file_name, name_size);
+    
+    // Get the current time (UTC)
+    struct timespec current_time = {0};
+    #ifdef _WIN32
+    timespec_get(&current_time, TIME_UTC);
+    #else
+    clock_gettime(CLOCK_REALTIME, &current_time);
+    #endif
+    
+    file_info->steg_time = __timespec_to_64le(current_time);
+
+    // Create a buffer for the compressed data
+    const uint8_t *const prefix_buffer = (const uint8_t *)(&file_info->access_time);
+    uint8_t *zlib_buffer = imc_malloc_tag(compressed_offset + zlib_buffer_size, IMC_MEMORY_ZLIB);
+    
+    // Copy the uncompressed metadata to the beginning of the buffer
+    memcpy(zlib_buffer, file_info, compressed_offset);
+
+    // Compress the metadata (from the '.access_time' onwards), then the data
+    if (verbose) printf("Compressing '%s'... ", file_name);
+    if (verbose) fflush(stdout);
+    const StatsTimer compress_timer = imc_stats_start();
+    int zlib_status = imc_deflate_prefixed(
+        prefix_buffer,                      // Metadata compressed before the data
+        prefix_size,                        // Size in bytes of the metadata
+        data,                               // Data being compressed
+        data_size,                          // Size in bytes of the data
         &zlib_buffer[compressed_offset],    // Output buffer to store the compressed data (starting after the uncompressed section)
-        #ifdef _WIN32
-        &compress_size_win,                 // Size in bytes of the output buffer (the function updates the value to the used size)
-        #else
         &zlib_buffer_size,                  // Size in bytes of the output buffer (the function updates the value to the used size)
-        #endif // _WIN32
-        input_buffer,                       // Data being compressed
-        file_info->uncompressed_size,       // Size in bytes of the data
-        9                                   // Compression level
+        level                               // Compression level
     );
+    imc_stats_stop(IMC_STATS_COMPRESS, &compress_timer, prefix_size + data_size);
 
-    #ifdef _WIN32
-    zlib_buffer_size = compress_size_win;
-    #endif // _WIN32
-
-    if (zlib_status != 0)
+    if (zlib_status != Z_OK)
     {
-        // The only way for decompression to fail here is if no enough memory was available
+        // The only way for compression to fail here is if no enough memory was available
         imc_clear_free(zlib_buffer, zlib_buffer_size + compressed_offset);
-        imc_clear_free(raw_buffer, raw_size);
-        if (carrier_img->verbose) printf("\n");
+        imc_free(file_name);
+        __steg_release_buffers(&reserved_memory, 0);
+        if (verbose) printf("\n");
         return IMC_ERR_NO_MEMORY;
     }
 
-    imc_clear_free(raw_buffer, raw_size);
-    if (carrier_img->verbose) printf("Done!\n");
+    if (verbose) printf("Done!\n");
     
     // Store the actual size of the compressed data
     ((FileInfo *)zlib_buffer)->compressed_size = htole64(zlib_buffer_size);
@@ -322,43 +857,239 @@ int imc_steg_insert(CarrierImage *carrier_img, const char *file_path)
     // Total size of the encrypted stream
     const size_t crypto_size = IMC_CRYPTO_OVERHEAD + zlib_buffer_size;
 
-    if (crypto_size * 8 > carrier_img->carrier_length - carrier_img->carrier_pos)
-    {
-        // The carrier is not big enough to store the encrypted stream
-        imc_clear_free(zlib_buffer, zlib_buffer_size);
-        return IMC_ERR_FILE_TOO_BIG;
-    }
-    
     // Allocate the buffer for the encrypted stream
-    uint8_t *const crypto_buffer = imc_malloc(crypto_size);
+    uint8_t *const crypto_buffer = imc_malloc_tag(crypto_size, IMC_MEMORY_CRYPTO);
     unsigned long long crypto_output_len;
     
     // Encrypt the data stream
-    if (carrier_img->verbose) printf("Encrypting '%s'... ", file_name);
-    if (carrier_img->verbose) fflush(stdout);
+    if (verbose) printf("Encrypting '%s'... ", file_name);
+    if (verbose) fflush(stdout);
+    const StatsTimer encrypt_timer = imc_stats_start();
     int crypto_status = imc_crypto_encrypt(
-        carrier_img->crypto,    // Has the secret key (generated from the password)
+        crypto,                 // Has the secret key (generated from the password)
         zlib_buffer,            // Unencrypted data stream
         zlib_buffer_size,       // Size in bytes of the unencrypted stream
         crypto_buffer,          // Output buffer for the encrypted data
         &crypto_output_len      // Stores the amount of bytes written to the output buffer
     );
+    imc_stats_stop(IMC_STATS_ENCRYPT, &encrypt_timer, zlib_buffer_size);
 
     if (crypto_status < 0)
     {
         // It does not seem that encryption can fail, if the parameters are correct and the buffer is big enough.
         // But I still am doing this check here, just to be on the safe side.
         imc_clear_free(zlib_buffer, zlib_buffer_size);
-        imc_clear_free(crypto_buffer, crypto_size);
-        if (carrier_img->verbose) printf("\n");
+        imc_free(crypto_buffer);
+        imc_free(file_name);
+        __steg_release_buffers(&reserved_memory, 0);
+        if (verbose) printf("\n");
         return IMC_ERR_CRYPTO_FAIL;
     }
 
-    // Clear and free the buffer of the unencrypted stream
+    // Clear and free the buffer of the unencrypted stream (only the encrypted stream stays reserved)
     imc_clear_free(zlib_buffer, zlib_buffer_size);
-    if (carrier_img->verbose) printf("Done!\n");
+    __steg_release_buffers(&reserved_memory, crypto_size);
+    if (verbose) printf("Done!\n");
+
+    PreparedPayload *payload = imc_malloc(sizeof(PreparedPayload));
+    payload->file_name = file_name;
+    payload->stream = crypto_buffer;
+    payload->size = crypto_size;
+    payload->reserved_memory = reserved_memory;
+    
+    *output = payload;
+    return IMC_SUCCESS;
+}
+
+// Compress and encrypt a buffer that begins with a 'FileInfo' (filled by 'imc_steg_info_init()'), followed by the data being hidden
+// 'level' is the compression level of Zlib. The buffer is cleared and freed by this function, even on failure.
+// The returned 'PreparedPayload' should be freed with 'imc_steg_prepared_free()'.
+int imc_steg_prepare_buffer(
+    CryptoContext *crypto,
+    uint8_t *raw_buffer,
+    size_t raw_size,
+    int level,
+    bool verbose,
+    PreparedPayload **output
+)
+{
+    FileInfo *const file_info = (FileInfo *)raw_buffer;
+    const size_t info_size = sizeof(FileInfo) + le16toh(file_info->name_size);
+
+    const int status = __steg_prepare_stream(
+        crypto, file_info, &raw_buffer[info_size], raw_size - info_size, level, verbose, output
+    );
+
+    imc_clear_free(raw_buffer, raw_size);
+    return status;
+}
+
+// Read a stream until its end into a new buffer, leaving 'prefix_size' bytes at the beginning of the buffer
+// The amount of bytes read is stored on 'size_out'. The buffer should be freed with 'imc_clear_free()'.
+// Function returns IMC_ERR_INPUT_TOO_BIG if the stream has more than 'IMC_MAX_INPUT_SIZE' bytes,
+// or IMC_ERR_FILE_CORRUPTED if reading from the stream failed.
+int imc_steg_read_stream(FILE *stream, size_t prefix_size, uint8_t **output, size_t *size_out)
+{
+    // The size is not known beforehand, so the buffer doubles whenever it gets full
+    const StatsTimer read_timer = imc_stats_start();
+    size_t capacity = prefix_size + 65536;
+    size_t size = 0;
+    uint8_t *buffer = imc_malloc_tag(capacity, IMC_MEMORY_FILE);
+
+    while (true)
+    {
+        if (prefix_size + size == capacity)
+        {
+            // The old buffer is cleared before being released, since it has the data being hidden
+            uint8_t *const new_buffer = imc_malloc_tag(capacity * 2, IMC_MEMORY_FILE);
+            memcpy(new_buffer, buffer, capacity);
+            imc_clear_free(buffer, capacity);
+            buffer = new_buffer;
+            capacity *= 2;
+        }
+
+        const size_t read_count = fread(&buffer[prefix_size + size], 1, capacity - prefix_size - size, stream);
+        size += read_count;
+
+        if (size > IMC_MAX_INPUT_SIZE)
+        {
+            imc_clear_free(buffer, capacity);
+            return IMC_ERR_INPUT_TOO_BIG;
+        }
+
+        if (read_count == 0)
+        {
+            if (ferror(stream))
+            {
+                imc_clear_free(buffer, capacity);
+                return IMC_ERR_FILE_CORRUPTED;
+            }
+            if (feof(stream)) break;
+        }
+    }
+
+    // Clear the unused space, so the buffer can be cleared by its size alone when freed
+    sodium_memzero(&buffer[prefix_size + size], capacity - prefix_size - size);
+    *output = imc_realloc(buffer, prefix_size + size);
+    *size_out = size;
+    imc_stats_stop(IMC_STATS_READ_FILE, &read_timer, size);
+
+    return IMC_SUCCESS;
+}
+
+// Read, compress, and encrypt the data coming from a stream (for example, the standard input), so it can be hidden
+// The data is stored under 'file_name' (its directories are removed), with the current time as its timestamps.
+// The returned 'PreparedPayload' should be freed with 'imc_steg_prepared_free()'.
+int imc_steg_prepare_input(CryptoContext *crypto, FILE *stream, const char *file_name, bool verbose, PreparedPayload **output)
+{
+    // Remove the directories from the name
+    const size_t path_len = strlen(file_name);
+    char path_temp[path_len+1];
+    strcpy(path_temp, file_name);
+    const char *const base_name = basename(path_temp);
+
+    // Calculate the size for the file's metadata that will be stored
+    const size_t name_size = strlen(base_name) + 1;
+    if (name_size > UINT16_MAX) return IMC_ERR_NAME_TOO_LONG;
+    const size_t info_size = sizeof(FileInfo) + name_size;
+
+    // Read the whole stream into a buffer (after the space for its metadata)
+    // (the compression needs to know the data's size beforehand, so it cannot begin while the stream is being read)
+    if (verbose) printf("Reading '%s'... ", base_name);
+    if (verbose) fflush(stdout);
+    uint8_t *raw_buffer = NULL;
+    size_t data_size = 0;
+    const int read_status = imc_steg_read_stream(stream, info_size, &raw_buffer, &data_size);
+    if (read_status != IMC_SUCCESS)
+    {
+        if (verbose) printf("\n");
+        return read_status;
+    }
+    if (verbose) printf("Done!\n");
+
+    // The size was not known before reading, so only now the data can be reserved from the memory budget
+    size_t reserved_memory = 0;
+    const int reserve_status = __steg_reserve_buffers(info_size + data_size, &reserved_memory);
+    if (reserve_status != IMC_SUCCESS)
+    {
+        imc_clear_free(raw_buffer, info_size + data_size);
+        return reserve_status;
+    }
+
+    // The data did not come from a file, so its timestamps are the current time
+    struct timespec current_time = {0};
+    #ifdef _WIN32
+    timespec_get(&current_time, TIME_UTC);
+    #else
+    clock_gettime(CLOCK_REALTIME, &current_time);
+    #endif
+
+    // Store the metadata, then compress and encrypt the whole buffer
+    imc_steg_info_init((FileInfo *)raw_buffer, IMC_FILEINFO_VERSION, base_name, name_size, current_time, current_time);
+    const int status = imc_steg_prepare_buffer(crypto, raw_buffer, info_size + data_size, Z_BEST_COMPRESSION, verbose, output);
+    __steg_release_buffers(&reserved_memory, 0);
+    return status;
+}
+
+// Read, compress, and encrypt a file, so it can be hidden in one or more images
+// 'crypto' has the secret key of the images in which the file will be hidden. If 'verbose' is true, the status is printed to stdout.
+// The returned 'PreparedPayload' should be freed with 'imc_steg_prepared_free()'.
+int imc_steg_prepare(CryptoContext *crypto, const char *file_path, bool verbose, PreparedPayload **output)
+{
+    // A folder is hidden whole, as an archive of its files and subfolders
+    if (__is_directory(file_path)) return imc_tree_prepare(crypto, file_path, verbose, output);
+
+    // Get the file name from the path
+    const size_t path_len = strlen(file_path);
+    char path_temp[path_len+1];
+    strcpy(path_temp, file_path);
+    const char *const file_name = basename(path_temp);
+    
+    // Calculate the size for the file's metadata that will be stored
+    const size_t name_size = strlen(file_name) + 1;
+    if (name_size > UINT16_MAX) return IMC_ERR_NAME_TOO_LONG;
+    const size_t info_size = sizeof(FileInfo) + name_size;
+    
+    // Map the file into memory (it is compressed straight from the mapping)
+    if (verbose) printf("Loading '%s'... ", file_name);
+    if (verbose) fflush(stdout);
+    MappedFile file;
+    const int map_status = imc_steg_map_file(file_path, &file);
+    if (map_status != IMC_SUCCESS)
+    {
+        if (verbose) printf("\n");
+        if (verbose) fflush(stdout);
+        return map_status;
+    }
+    if (verbose) printf("Done!\n");
+
+    // Store the metadata on a separate buffer, then compress and encrypt it followed by the file
+    FileInfo *const file_info = imc_malloc(info_size);
+    imc_steg_info_init(file_info, IMC_FILEINFO_VERSION, file_name, name_size, file.access_time, file.mod_time);
+    const int status = __steg_prepare_stream(crypto, file_info, file.data, file.size, Z_BEST_COMPRESSION, verbose, output);
+
+    imc_clear_free(file_info, info_size);
+    imc_steg_unmap_file(&file);
+    return status;
+}
+
+// Write a prepared file to the carrier of an image
+// The same 'PreparedPayload' can be written to any amount of images, as long as they use the same key as when it was prepared.
+// Note: function can be called multiple times in order to hide more files in the same image.
+int imc_steg_insert_prepared(CarrierImage *carrier_img, const PreparedPayload *payload)
+{
+    const uint8_t *const crypto_buffer = payload->stream;
+    const size_t crypto_size = payload->size;
+    const char *const file_name = payload->file_name;
+    
+    if (crypto_size * 8 > carrier_img->carrier_length - carrier_img->carrier_pos)
+    {
+        // The carrier is not big enough to store the encrypted stream
+        return IMC_ERR_FILE_TOO_BIG;
+    }
 
     // Store the encrypted data stream on the least significant bits of the carrier
+    const StatsTimer embed_timer = imc_stats_start();
     for (size_t i = 0; i < crypto_size; i++)
     {
         for (size_t j = 0; j < 8; j++)
@@ -375,21 +1106,134 @@ int imc_steg_insert(CarrierImage *carrier_img, const char *file_path)
         }
 
         // Status message on verbose (printed once every 512 bytes of data)
-        if ( carrier_img->verbose && (i % 512 == 0) )
+        if ( (carrier_img->verbose || carrier_img->progress) && (i % 512 == 0) )
         {
             const double percent = ((double)i / (double)crypto_size) * 100.0;
-            printf_prog("Writing encrypted '%s' to the carrier... %.1f %%\r", file_name, percent);
+            __steg_progress(carrier_img, IMC_STAGE_WRITE_DATA, percent, "Writing encrypted '%s' to the carrier... %.1f %%\r", file_name, percent);
         }
     }
 
-    if (carrier_img->verbose) printf("Writing encrypted '%s' to the carrier... Done!  \n", file_name);
-
-    // Clear and free the buffer of the encrypted stream
-    imc_clear_free(crypto_buffer, crypto_size);
+    __steg_progress(carrier_img, IMC_STAGE_WRITE_DATA, 100.0, "Writing encrypted '%s' to the carrier... Done!  \n", file_name);
+    imc_stats_stop(IMC_STATS_EMBED, &embed_timer, crypto_size);
 
     return IMC_SUCCESS;
 }
 
+// Free the memory used by a prepared file
+// (its stream is not cleared, since it is encrypted, and the same bytes are written to the image anyway)
+void imc_steg_prepared_free(PreparedPayload *payload)
+{
+    if (payload == NULL) return;
+    imc_memory_release(payload->reserved_memory);
+    imc_free(payload->stream);
+    imc_free(payload->file_name);
+    imc_free(payload);
+}
+
+// Hide a file in an image
+// Note: function can be called multiple times in order to hide more files in the same image.
+int imc_steg_insert(CarrierImage *carrier_img, const char *file_path)
+{
+    PreparedPayload *payload = NULL;
+    const int prepare_status = imc_steg_prepare(carrier_img->crypto, file_path, carrier_img->verbose, &payload);
+    if (prepare_status != IMC_SUCCESS) return prepare_status;
+    
+    const int insert_status = imc_steg_insert_prepared(carrier_img, payload);
+    imc_steg_prepared_free(payload);
+    
+    return insert_status;
+}
+
+// Hide in an image the data coming from a stream (for example, the standard input), under the name 'file_name'
+// Note: function can be called multiple times in order to hide more files in the same image.
+int imc_steg_insert_input(CarrierImage *carrier_img, FILE *stream, const char *file_name)
+{
+    PreparedPayload *payload = NULL;
+    const int prepare_status = imc_steg_prepare_input(carrier_img->crypto, stream, file_name, carrier_img->verbose, &payload);
+    if (prepare_status != IMC_SUCCESS) return prepare_status;
+    
+    const int insert_status = imc_steg_insert_prepared(carrier_img, payload);
+    imc_steg_prepared_free(payload);
+    
+    return insert_status;
+}
+
+// Read, compress, and encrypt one of the files of a pipeline (this function might run on a worker thread)
+static void __insert_produce(size_t index, void *pipeline_ptr)
+{
+    InsertPipeline *const pipeline = (InsertPipeline *)pipeline_ptr;
+    CarrierImage *const carrier_img = pipeline->carrier_img;
+    const char *const path = pipeline->paths[index];
+    int status;
+
+    if (strcmp(path, "-") == 0)
+    {
+        status = imc_steg_prepare_input(
+            carrier_img->crypto, pipeline->stream, pipeline->stream_name, carrier_img->verbose, &pipeline->payloads[index]
+        );
+    }
+    else
+    {
+        status = imc_steg_prepare(carrier_img->crypto, path, carrier_img->verbose, &pipeline->payloads[index]);
+    }
+
+    pipeline->statuses[index] = status;
+    pipeline->errors[index] = errno;
+}
+
+// Write one of the files of a pipeline to the carrier (in the order of the files), then report the result
+static void __insert_consume(size_t index, void *pipeline_ptr)
+{
+    InsertPipeline *const pipeline = (InsertPipeline *)pipeline_ptr;
+    int status = pipeline->statuses[index];
+
+    // The files reach the carrier in their order, so each one begins where the previous one ended
+    if (status == IMC_SUCCESS) status = imc_steg_insert_prepared(pipeline->carrier_img, pipeline->payloads[index]);
+    imc_steg_prepared_free(pipeline->payloads[index]);
+    pipeline->payloads[index] = NULL;
+
+    errno = pipeline->errors[index];
+    if (pipeline->report) pipeline->report(index, status, pipeline->report_data);
+}
+
+// Hide many files in an image, preparing the next files while the current one is written to the carrier
+// The files are written in the order of 'paths', and a path of "-" hides the data from 'stream' under 'stream_name'.
+// 'report' is called on the calling thread, in the same order, with the status code of hiding each file.
+// Note: function can be called multiple times in order to hide more files in the same image.
+void imc_steg_insert_many(
+    CarrierImage *carrier_img,
+    char *const *paths,
+    size_t count,
+    FILE *stream,
+    const char *stream_name,
+    imc_insert_func report,
+    void *report_data
+)
+{
+    InsertPipeline pipeline = {
+        .carrier_img = carrier_img,
+        .paths = paths,
+        .stream = stream,
+        .stream_name = stream_name,
+        .payloads = imc_calloc(count ? count : 1, sizeof(PreparedPayload *)),
+        .statuses = imc_calloc(count ? count : 1, sizeof(int)),
+        .errors = imc_calloc(count ? count : 1, sizeof(int)),
+        .report = report,
+        .report_data = report_data,
+    };
+
+    // Each thread prepares a file ahead of the one being written
+    // (the files are prepared one at a time when the status messages are printed, so they are not mixed up;
+    //  or when there is a memory budget, since each file checks the budget as if it was the only one in memory)
+    const bool sequential = carrier_img->verbose || imc_memory_get_budget() != 0;
+    const size_t window = sequential ? 0 : imc_threads_get_count();
+    imc_parallel_ordered(count, window, &__insert_produce, &__insert_consume, &pipeline);
+
+    imc_free(pipeline.payloads);
+    imc_free(pipeline.statuses);
+    imc_free(pipeline.errors);
+}
+
 // Helper function for reading a given amount of bytes (the payload) from the carrier of an image
 // Returns 'false' if the read would go out of bounds (no read is done in this case).
 // Returns 'true' if the read could be made (the bytes are stored of the provided buffer).
@@ -416,12 +1260,9 @@ static bool __read_payload(CarrierImage *carrier_img, size_t num_bytes, uint8_t
     return true;
 }
 
-// Read the hidden data from the carrier bytes, and save it
-// The function extracts and save one file each time it is called.
-// So in order to extract all the hidden files, it should be called
-// until it stops returning the IMC_SUCCESS status code.
-// Note: The filename is stored with the hidden data
-int imc_steg_extract(CarrierImage *carrier_img)
+// Read the encrypted stream of the next hidden file from the carrier
+// (the streams are stored one after another, so they have to be read in order)
+static int __steg_read_entry(CarrierImage *carrier_img, ExtractEntry *entry)
 {
     bool read_status;
     
@@ -451,17 +1292,22 @@ int imc_steg_extract(CarrierImage *carrier_img)
     crypto_size = le32toh(crypto_size);
 
     // Get the header from the stream
-    uint8_t header[crypto_secretstream_xchacha20poly1305_HEADERBYTES];
-    read_status = __read_payload(carrier_img, sizeof(header), header);
+    read_status = __read_payload(carrier_img, sizeof(entry->header), entry->header);
     if (!read_status) return IMC_ERR_PAYLOAD_OOB;
-    crypto_size -= sizeof(header);
+    crypto_size -= sizeof(entry->header);
+
+    // Reserve the encrypted and the decrypted streams from the memory budget
+    const int reserve_status = __steg_reserve_buffers(2 * (size_t)crypto_size, &entry->reserved_memory);
+    if (reserve_status != IMC_SUCCESS) return reserve_status;
 
     // Read the encrypted stream into a buffer
-    uint8_t *crypto_buffer = imc_malloc(crypto_size);
+    uint8_t *crypto_buffer = imc_malloc_tag(crypto_size, IMC_MEMORY_CRYPTO);
     if (carrier_img->verbose && carrier_img->just_check) printf("\n");
     if (carrier_img->verbose) printf("Reading hidden file... ");
     if (carrier_img->verbose) fflush(stdout);
+    const StatsTimer extract_timer = imc_stats_start();
     read_status = __read_payload(carrier_img, crypto_size, crypto_buffer);
+    imc_stats_stop(IMC_STATS_EXTRACT, &extract_timer, crypto_size);
     if (!read_status)
     {
         imc_free(crypto_buffer);
@@ -470,10 +1316,23 @@ int imc_steg_extract(CarrierImage *carrier_img)
     }
     if (carrier_img->verbose) printf("Done!\n");
 
+    entry->crypto_buffer = crypto_buffer;
+    entry->crypto_size = crypto_size;
+    return IMC_SUCCESS;
+}
+
+// Decrypt and decompress a hidden file read by '__steg_read_entry()', then parse its metadata
+// The metadata is stored on the entry even if the file's contents are refused afterwards (so the file can be named on the error).
+// This function does not change the image, so it can run on a worker thread.
+static int __steg_decode_entry(const CarrierImage *carrier_img, ExtractEntry *entry)
+{
+    uint8_t *const crypto_buffer = entry->crypto_buffer;
+    const size_t crypto_size = entry->crypto_size;
+
     // Allocate a buffer for the decrypted data
     unsigned long long decrypt_size = crypto_size - crypto_secretstream_xchacha20poly1305_ABYTES;
     const unsigned long long decrypt_size_start = decrypt_size;
-    uint8_t *decrypt_buffer = imc_malloc(decrypt_size);
+    uint8_t *decrypt_buffer = imc_malloc_tag(decrypt_size, IMC_MEMORY_CRYPTO);
 
     // Whether to print a status message for decryption and decompression
     const bool print_msg = carrier_img->verbose && !carrier_img->just_check;
@@ -481,24 +1340,28 @@ int imc_steg_extract(CarrierImage *carrier_img)
     // Decrypt the data
     if (print_msg) printf("Decrypting hidden file... ");
     if (print_msg) fflush(stdout);
+    const StatsTimer decrypt_timer = imc_stats_start();
     int decrypt_status = imc_crypto_decrypt(
         carrier_img->crypto,    // Has the secret key (generated from the password)
-        header,                 // Header generated during encryption
+        entry->header,          // Header generated during encryption
         crypto_buffer,          // Encrypted data
         crypto_size,            // Size in bytes of the encrypted data
         decrypt_buffer,         // Output buffer for the decrypted data
         &decrypt_size           // Size in bytes of the output buffer
     );
+    imc_stats_stop(IMC_STATS_DECRYPT, &decrypt_timer, crypto_size);
+
+    // The encrypted stream is no longer needed
+    imc_free(crypto_buffer);
+    entry->crypto_buffer = NULL;
 
     if (decrypt_status < 0 || decrypt_size != decrypt_size_start)
     {
-        imc_free(crypto_buffer);
         imc_free(decrypt_buffer);
         if (print_msg) printf("\n");
         return IMC_ERR_CRYPTO_FAIL;
     }
 
-    imc_free(crypto_buffer);
     if (print_msg) printf("Done!\n");
 
     // Current position on the decrypted stream
@@ -508,7 +1371,7 @@ int imc_steg_extract(CarrierImage *carrier_img)
     uint32_t compress_version = UINT32_MAX;
     memcpy(&compress_version, &decrypt_buffer[d_pos], sizeof(compress_version));
     compress_version = le32toh(compress_version);
-    if (compress_version > IMC_FILEINFO_VERSION)
+    if (compress_version > IMC_FILEINFO_TREE)
     {
         imc_free(decrypt_buffer);
         return IMC_ERR_NEWER_VERSION;
@@ -527,8 +1390,16 @@ int imc_steg_extract(CarrierImage *carrier_img)
     d_pos += sizeof(compress_size);
 
     // Allocate buffer for decompressed data
+    // (reserving it first from the memory budget, in place of the encrypted stream that was freed)
     const size_t d_size = d_pos + decompress_size;
-    uint8_t *decompress_buffer = imc_malloc(d_size);
+    __steg_release_buffers(&entry->reserved_memory, decrypt_size);
+    const int reserve_status = __steg_reserve_buffers(d_size, &entry->reserved_memory);
+    if (reserve_status != IMC_SUCCESS)
+    {
+        imc_free(decrypt_buffer);
+        return reserve_status;
+    }
+    uint8_t *decompress_buffer = imc_malloc_tag(d_size, IMC_MEMORY_ZLIB);
     memcpy(&decompress_buffer[0], decrypt_buffer, d_pos);   // Copy the header to the beginning of the buffer
 
     #ifdef _WIN32
@@ -543,6 +1414,7 @@ int imc_steg_extract(CarrierImage *carrier_img)
     // Decompress the data using Zlib
     if (print_msg) printf("Decompressing hidden file... ");
     if (print_msg) fflush(stdout);
+    const StatsTimer inflate_timer = imc_stats_start();
     int decompress_status = uncompress(
         &decompress_buffer[d_pos],  // Output 
         #ifdef _WIN32
@@ -557,6 +1429,7 @@ int imc_steg_extract(CarrierImage *carrier_img)
     #ifdef _WIN32
     decompress_size = decompress_size_win;
     #endif // _WIN32
+    imc_stats_stop(IMC_STATS_INFLATE, &inflate_timer, decompress_size);
 
     if (decompress_status != 0 || decompress_size + d_pos != d_size)
     {
@@ -569,6 +1442,7 @@ int imc_steg_extract(CarrierImage *carrier_img)
     }
 
     imc_free(decrypt_buffer);
+    __steg_release_buffers(&entry->reserved_memory, d_size);
     if (print_msg) printf("Done!\n");
     
     // Get the data needed to reconstruct the hidden file
@@ -579,45 +1453,297 @@ int imc_steg_extract(CarrierImage *carrier_img)
     const size_t file_start = sizeof(FileInfo) + name_len;  // Data offset where the file begins
     const size_t file_size  = offsetof(FileInfo, access_time) + decompress_size - file_start;   // Size of the file (bytes)
 
-    // Struct to store the information of the hidden file
-    // (since this function can be called multiple times, the struct is only malloc'ed on the first time)
-    if (!carrier_img->steg_info)
-    {
-        carrier_img->steg_info = imc_malloc(sizeof(FileMetadata) + name_len);
-    }
-    else
+    entry->buffer = decompress_buffer;
+    entry->version = compress_version;
+    entry->file_start = file_start;
+    entry->file_size = file_size;
+
+    // A shard of a file split among many images has a header before its data
+    const bool is_shard = (compress_version == IMC_FILEINFO_SHARD);
+    ShardHeader shard_header = {0};
+    if (is_shard)
     {
-        carrier_img->steg_info = imc_realloc(carrier_img->steg_info, sizeof(FileMetadata) + name_len);
+        if (file_size < sizeof(ShardHeader)) return IMC_ERR_FILE_CORRUPTED;
+        memcpy(&shard_header, &decompress_buffer[file_start], sizeof(ShardHeader));
     }
 
+    // A hidden folder is an archive of its files and subfolders
+    const bool is_tree = (compress_version == IMC_FILEINFO_TREE);
+
     // Store the file's metadata
-    *(carrier_img->steg_info) = (FileMetadata){
+    // (for a shard, the size is of the whole file)
+    entry->info = imc_malloc(sizeof(FileMetadata) + name_len);
+    *(entry->info) = (FileMetadata){
         .access_time = __timespec_from_64le(file_info->access_time),
         .mod_time = __timespec_from_64le(file_info->mod_time),
         .steg_time = __timespec_from_64le(file_info->steg_time),
-        .file_size = file_size,
+        .file_size = is_shard ? le64toh(shard_header.file_size) : file_size,
+        .shard_index = is_shard ? le32toh(shard_header.index) : 0,
+        .shard_count = is_shard ? le32toh(shard_header.count) : 0,
+        .is_joined = false,
+        .is_tree = is_tree,
+        .entry_count = 0,
         .name_size = name_len,
     };
 
-    memcpy( carrier_img->steg_info->file_name, file_info->file_name, name_len );
-    
-    // If on "check mode": Exit the function without saving the file
-    if (carrier_img->just_check)
+    memcpy( entry->info->file_name, file_info->file_name, name_len );
+
+    // The paths of a folder's entries are checked before anything is written
+    // (and the size becomes the sum of the sizes of its files)
+    if (is_tree)
     {
-        imc_free(decompress_buffer);
-        return IMC_SUCCESS;
+        return imc_tree_check(
+            (const char *)file_info->file_name,
+            &decompress_buffer[file_start],
+            file_size,
+            &entry->info->entry_count,
+            &entry->info->file_size
+        );
     }
 
-    // Get the last access and last modified times of the hidden file
-    struct timespec file_times[2] = {
-        __timespec_from_64le(file_info->access_time),
-        __timespec_from_64le(file_info->mod_time),
-    };
+    return IMC_SUCCESS;
+}
 
-    // Get the name of the hidden file
-    char file_name[name_len + 16];  // Extra size added in case it needs to be renamed for avoiding name collision
+// Store the metadata of a decoded file on the image, as its most recent extracted file ('steg_info')
+static void __steg_publish_entry(CarrierImage *carrier_img, const ExtractEntry *entry)
+{
+    const size_t info_size = sizeof(FileMetadata) + entry->info->name_size;
+
+    // (since a file is extracted multiple times, the struct is only malloc'ed on the first time)
+    if (!carrier_img->steg_info)
+    {
+        carrier_img->steg_info = imc_malloc(info_size);
+    }
+    else
+    {
+        carrier_img->steg_info = imc_realloc(carrier_img->steg_info, info_size);
+    }
+
+    memcpy(carrier_img->steg_info, entry->info, info_size);
+}
+
+// Save a file decoded by '__steg_decode_entry()' (or write it to the image's output stream)
+// The file's metadata must have been stored on the image by '__steg_publish_entry()'.
+static int __steg_save_entry(CarrierImage *carrier_img, const ExtractEntry *entry)
+{
+    const FileInfo *const file_info = (const FileInfo *)entry->buffer;
+    const uint8_t *const file_data = &entry->buffer[entry->file_start];
+    const size_t file_size = entry->file_size;
+    const bool is_shard = (entry->version == IMC_FILEINFO_SHARD);
+    const bool is_tree = (entry->version == IMC_FILEINFO_TREE);
+
+    int save_status;
+    if (is_shard && carrier_img->out_stream)
+    {
+        // A shard can only be joined with the other shards saved on the disk
+        save_status = IMC_ERR_SHARD_STREAM;
+    }
+    else if (is_shard)
+    {
+        // Save the shard, and join the file if all of its shards were already extracted
+        save_status = imc_shard_store(carrier_img, file_info, file_data, file_size);
+    }
+    else if (is_tree && carrier_img->out_stream)
+    {
+        // A folder can only go to a stream as entries of a tar archive
+        save_status = carrier_img->out_tar
+            ? imc_tree_write_tar(
+                carrier_img->out_stream,
+                (const char *)file_info->file_name,
+                file_data,
+                file_size,
+                __timespec_from_64le(file_info->mod_time)
+            )
+            : IMC_ERR_TREE_STREAM;
+    }
+    else if (is_tree)
+    {
+        // Recreate the folder with all of its entries
+        save_status = imc_tree_restore(
+            carrier_img->out_dir,
+            (const char *)file_info->file_name,
+            file_data,
+            file_size,
+            __timespec_from_64le(file_info->access_time),
+            __timespec_from_64le(file_info->mod_time),
+            carrier_img->verbose
+        );
+    }
+    else if (carrier_img->out_stream)
+    {
+        // Write the file to the stream (either as-is, or as an entry of a tar archive)
+        if (carrier_img->out_tar)
+        {
+            save_status = imc_tar_write_file(
+                carrier_img->out_stream,
+                (const char *)file_info->file_name,
+                file_data,
+                file_size,
+                __timespec_from_64le(file_info->mod_time)
+            );
+        }
+        else
+        {
+            const bool write_success = file_size == 0
+                || fwrite(file_data, 1, file_size, carrier_img->out_stream) == file_size;
+            save_status = (write_success && fflush(carrier_img->out_stream) == 0) ? IMC_SUCCESS : IMC_ERR_SAVE_FAIL;
+        }
+    }
+    else
+    {
+        // Get the last access and last modified times of the hidden file
+        const struct timespec file_times[2] = {
+            __timespec_from_64le(file_info->access_time),
+            __timespec_from_64le(file_info->mod_time),
+        };
+
+        save_status = imc_steg_write_file(
+            carrier_img->out_dir,
+            (const char *)file_info->file_name,
+            file_data,
+            file_size,
+            file_times,
+            carrier_img->verbose
+        );
+    }
+
+    return save_status;
+}
+
+// Free the buffers of a hidden file being extracted (the entry itself is not freed)
+static void __steg_entry_free(ExtractEntry *entry)
+{
+    imc_free(entry->crypto_buffer);
+    imc_free(entry->buffer);
+    imc_free(entry->info);
+    imc_memory_release(entry->reserved_memory);
+    entry->crypto_buffer = NULL;
+    entry->buffer = NULL;
+    entry->info = NULL;
+    entry->reserved_memory = 0;
+}
+
+// Read the hidden data from the carrier bytes, and save it
+// The function extracts and save one file each time it is called.
+// So in order to extract all the hidden files, it should be called
+// until it stops returning the IMC_SUCCESS status code.
+// Note: The filename is stored with the hidden data
+int imc_steg_extract(CarrierImage *carrier_img)
+{
+    ExtractEntry entry = {0};
+
+    int status = __steg_read_entry(carrier_img, &entry);
+    if (status == IMC_SUCCESS) status = __steg_decode_entry(carrier_img, &entry);
+    if (entry.info) __steg_publish_entry(carrier_img, &entry);
+    
+    // If on "check mode": the file is not saved
+    if (status == IMC_SUCCESS && !carrier_img->just_check) status = __steg_save_entry(carrier_img, &entry);
+
+    __steg_entry_free(&entry);
+    return status;
+}
+
+// Decrypt and decompress one of the files of a pipeline (this function might run on a worker thread)
+static void __extract_produce(size_t index, void *pipeline_ptr)
+{
+    ExtractPipeline *const pipeline = (ExtractPipeline *)pipeline_ptr;
+    ExtractEntry *const entry = &pipeline->entries[index];
+    entry->status = __steg_decode_entry(pipeline->carrier_img, entry);
+}
+
+// Save one of the files of a pipeline (in the order of the files), then report the result
+static void __extract_consume(size_t index, void *pipeline_ptr)
+{
+    ExtractPipeline *const pipeline = (ExtractPipeline *)pipeline_ptr;
+    ExtractEntry *const entry = &pipeline->entries[index];
+    CarrierImage *const carrier_img = pipeline->carrier_img;
+
+    // Once a file fails, the ones after it are skipped (the same as when extracting one file at a time)
+    if (!pipeline->stopped)
+    {
+        int status = entry->status;
+        if (entry->info) __steg_publish_entry(carrier_img, entry);
+        if (status == IMC_SUCCESS && !carrier_img->just_check) status = __steg_save_entry(carrier_img, entry);
+
+        if (pipeline->report) pipeline->report(index, status, pipeline->report_data);
+        if (status != IMC_SUCCESS) pipeline->stopped = true;
+    }
+
+    __steg_entry_free(entry);
+}
+
+// Extract all files hidden on an image, decrypting and decompressing them in parallel
+// 'report' is called on the calling thread for each file in their order, with the status code of extracting the file,
+// then once more with the status code that ended the extraction (IMC_ERR_INVALID_MAGIC or IMC_ERR_PAYLOAD_OOB after
+// the last file). While a file is reported, its metadata is on the image's 'steg_info'. As with 'imc_steg_extract()',
+// the extraction stops on the first file that fails, and the files are just checked if the image is on "check mode".
+void imc_steg_extract_all(CarrierImage *carrier_img, imc_extract_func report, void *report_data)
+{
+    // One file at a time when the status messages are printed (so they are not mixed up),
+    // or when there is a memory budget (since the encrypted streams of all files are read before any is decoded)
+    if (carrier_img->verbose || imc_memory_get_budget() != 0)
+    {
+        int status = IMC_SUCCESS;
+        for (size_t i = 0; status == IMC_SUCCESS; i++)
+        {
+            status = imc_steg_extract(carrier_img);
+            if (report) report(i, status, report_data);
+        }
+        return;
+    }
+
+    // Read the encrypted streams of all files (each stream begins where the previous one ended)
+    ExtractEntry *entries = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    int end_status;
+
+    while (true)
+    {
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 8;
+            entries = imc_realloc(entries, capacity * sizeof(ExtractEntry));
+        }
+
+        entries[count] = (ExtractEntry){0};
+        end_status = __steg_read_entry(carrier_img, &entries[count]);
+        if (end_status != IMC_SUCCESS) break;
+        count++;
+    }
+
+    // Decode the files on the worker threads, while the ones before them are saved
+    ExtractPipeline pipeline = {
+        .carrier_img = carrier_img,
+        .entries = entries,
+        .stopped = false,
+        .report = report,
+        .report_data = report_data,
+    };
+    imc_parallel_ordered(count, imc_threads_get_count(), &__extract_produce, &__extract_consume, &pipeline);
+
+    if (!pipeline.stopped && report) report(count, end_status, report_data);
+    imc_free(entries);
+}
+
+// Save an extracted file to 'out_dir' (or to the current working directory, if NULL), then restore its timestamps
+// If a file with the same name already exists, a number is appended to the new file's name.
+// If 'verbose' is true, the status is printed to stdout.
+int imc_steg_write_file(
+    const char *out_dir,
+    const char *name,
+    const uint8_t *data,
+    size_t size,
+    const struct timespec file_times[2],
+    bool verbose
+)
+{
+    // Get the name of the hidden file
+    const size_t name_len = strlen(name) + 1;
+    const size_t dir_len = out_dir ? strlen(out_dir) + 1 : 0;
+    char file_name[dir_len + name_len + 16];  // Extra size added in case it needs to be renamed for avoiding name collision
     memset(file_name, 0, sizeof(file_name));
-    memcpy(file_name, file_info->file_name, name_len);
+    memcpy(file_name, name, name_len);
 
     // On Windows, replace by an underscore the forbidden filename characters
     #ifdef _WIN32
@@ -640,57 +1766,39 @@ int imc_steg_extract(CarrierImage *carrier_img)
         limit which characters the user can have on filenames. Because my design choice
         is to restore the file as close to the original as possible.
     */
-    
-    // Make the filename unique (if it already isn't)
-    bool is_unique = __resolve_filename_collision(file_name);
-    if (!is_unique) return IMC_ERR_FILE_EXISTS;
 
+    // Prepend the output directory to the file name (if one was specified)
+    if (out_dir)
+    {
+        memmove(&file_name[dir_len], file_name, name_len);
+        memcpy(file_name, out_dir, dir_len - 1);
+        file_name[dir_len - 1] = '/';
+    }
+    
     // Write the hidden file to disk
-    FILE *out_file = fopen(file_name, "wb");
+    // (to a temporary file, which gets the file's name once complete, with a number appended if the name already exists)
+    // (the runs of zeros are left as holes, so a file with big empty regions takes less space on the disk)
+    const StatsTimer write_timer = imc_stats_start();
+    OutputFile *out_file = imc_output_open(file_name, size, IMC_OUTPUT_SPARSE);
     if (!out_file) return IMC_ERR_SAVE_FAIL;
-    if (carrier_img->verbose) printf("Saving extracted file to '%s'... ", file_name);
-    if (carrier_img->verbose) fflush(stdout);
-    fwrite(&decompress_buffer[file_start], file_size, 1, out_file);
-    fclose(out_file);
-    if (carrier_img->verbose) printf("Done!\n");
-    imc_free(decompress_buffer);
+    if (verbose) printf("Saving extracted file... ");
+    if (verbose) fflush(stdout);
+    if (!imc_output_write(out_file, data, size))
+    {
+        imc_output_discard(out_file);
+        if (verbose) printf("\n");
+        return IMC_ERR_SAVE_FAIL;
+    }
 
-    // Restore the file's 'last access' and 'last modified' times
-    
-    #ifdef _WIN32   // Windows systems
-    
-    // Convert the file path string to wide char, in order to properly handle UTF-8 characters
-    size_t path_len = strlen(file_name) + 1;
-    int w_path_len = MultiByteToWideChar(CP_UTF8, 0, file_name, path_len, NULL, 0);
-    wchar_t w_path[w_path_len];
-    MultiByteToWideChar(CP_UTF8, 0, file_name, path_len, w_path, w_path_len);
-    
-    // Open the file with only the permission to change its attributes
-    HANDLE file_out = CreateFileW(
-        w_path,                 // Path to the destination file
-        FILE_WRITE_ATTRIBUTES,  // Open file for writing its attributes
-        FILE_SHARE_READ,        // Block file's write access to other programs
-        NULL,                   // Default security
-        OPEN_EXISTING,          // Open the file only if it already exists
-        FILE_ATTRIBUTE_NORMAL,  // Normal file (that is, no system or temporary file)
-        NULL                    // No template for the attributes
-    );
-    
-    // Write the timestamps to the file's metadata
-    if (file_out != INVALID_HANDLE_VALUE)
+    // Also restore the file's 'last access' and 'last modified' times
+    const int commit_status = imc_output_commit(out_file, file_times);
+    if (commit_status != IMC_SUCCESS)
     {
-        FILETIME access_time = __win_timespec_to_filetime(file_times[0]);
-        FILETIME mod_time = __win_timespec_to_filetime(file_times[1]);
-        SetFileTime(file_out, NULL, &access_time, &mod_time);
-        CloseHandle(file_out);
+        if (verbose) printf("\n");
+        return commit_status;
     }
-    
-    #else   // Unix systems
-    
-    // Write the timestamps to the file's metadata
-    utimensat(AT_FDCWD, file_name, file_times, 0);
-    
-    #endif // _WIN32
+    imc_stats_stop(IMC_STATS_WRITE, &write_timer, size);
+    if (verbose) printf("Done! Saved to '%s'.\n", file_name);
 
     return IMC_SUCCESS;
 }
@@ -748,6 +1856,15 @@ void imc_steg_seek_to_end(CarrierImage *carrier_img)
     carrier_img->carrier_pos = original_pos;
 }
 
+// Error handler of libjpeg-turbo: print the error message, then jump back to our code
+// (the default handler would exit the program instead)
+static void __jpeg_error_exit(j_common_ptr jpeg_obj)
+{
+    (*jpeg_obj->err->output_message)(jpeg_obj);
+    JpegErrorManager *const jpeg_err = (JpegErrorManager *)jpeg_obj->err;
+    longjmp(jpeg_err->jump, 1);
+}
+
 // Progress monitor when reading a JPEG image
 static void __jpeg_read_callback(j_common_ptr jpeg_obj)
 {
@@ -761,20 +1878,257 @@ static void __jpeg_read_callback(j_common_ptr jpeg_obj)
 
     // Percentage completed
     const double percent = ((pass_count + (unit_count / unit_max)) / pass_max) * 100.0;
-    printf_prog("Reading JPEG image... %.1f %%\r", percent);
+    __steg_progress((CarrierImage *)jpeg_obj->client_data, IMC_STAGE_READ_IMAGE, percent, "Reading JPEG image... %.1f %%\r", percent);
+}
+
+// Allocate the arrays of a parallel scan over 'row_count' rows
+static void __scan_init(
+    CarrierScan *scan,
+    CarrierImage *carrier_img,
+    enum ProgressStage stage,
+    const char *message,
+    size_t row_count
+)
+{
+    *scan = (CarrierScan){
+        .carrier_img = carrier_img,
+        .stage = stage,
+        .message = message,
+        .owner = pthread_self(),
+        .row_count = row_count,
+        .row_start = imc_calloc(row_count + 1, sizeof(size_t)),
+        .row_found = imc_calloc(row_count + 1, sizeof(size_t)),
+    };
+    atomic_init(&scan->rows_done, 0);
+}
+
+// Count a row of a parallel scan as processed, and report the progress
+// (only the thread that started the scan reports it, since the progress messages are not thread safe)
+static void __scan_row_done(CarrierScan *scan)
+{
+    const size_t rows_done = atomic_fetch_add(&scan->rows_done, 1) + 1;
+
+    if (!scan->carrier_img->verbose && !scan->carrier_img->progress) return;
+    if (!pthread_equal(pthread_self(), scan->owner)) return;
+
+    const double percent = ((double)rows_done / (double)scan->row_count) * 100.0;
+    if (percent < 100.0) __steg_progress(scan->carrier_img, scan->stage, percent, scan->message, percent);
+}
+
+// Move the carriers of each row of a parallel scan to right after the previous row's carriers
+// Function returns the total amount of carriers.
+static size_t __scan_join(CarrierScan *scan, size_t item_size)
+{
+    uint8_t *const output = (uint8_t *)scan->output;
+    size_t total = 0;
+
+    for (size_t row = 0; row < scan->row_count; row++)
+    {
+        // The rows only move backwards, so a row never overwrites the carriers of a row that was not moved yet
+        const size_t found = scan->row_found[row];
+        if (total != scan->row_start[row])
+        {
+            memmove(&output[total * item_size], &output[scan->row_start[row] * item_size], found * item_size);
+        }
+        total += found;
+    }
+
+    return total;
+}
+
+// Free the arrays of a parallel scan
+static void __scan_free(CarrierScan *scan)
+{
+    imc_free(scan->row_start);
+    imc_free(scan->row_found);
+    imc_free(scan->jpeg_rows);
+    imc_free(scan->jpeg_widths);
+    imc_free(scan->pixel_rows);
+    scan->row_start = NULL;
+    scan->row_found = NULL;
+    scan->jpeg_rows = NULL;
+    scan->jpeg_widths = NULL;
+    scan->pixel_rows = NULL;
+}
+
+// Get the pointers to each row of DCT blocks of a JPEG image (all color components, in order)
+static void __jpeg_gather_rows(
+    CarrierScan *scan,
+    struct jpeg_decompress_struct *jpeg_obj,
+    jvirt_barray_ptr *jpeg_dct,
+    bool writable
+)
+{
+    scan->jpeg_rows = imc_calloc(scan->row_count + 1, sizeof(JBLOCKROW));
+    scan->jpeg_widths = imc_calloc(scan->row_count + 1, sizeof(JDIMENSION));
+    size_t row = 0;
+
+    // Iterate over the color components
+    for (int comp = 0; comp < jpeg_obj->num_components; comp++)
+    {
+        // Iterate row by row from from top to bottom
+        for (JDIMENSION y = 0; y < jpeg_obj->comp_info[comp].height_in_blocks; y++)
+        {
+            // Array of DCT coefficients for the current color component
+            JBLOCKARRAY coef_array = jpeg_obj->mem->access_virt_barray(
+                (j_common_ptr)jpeg_obj,     // Pointer to the JPEG object
+                jpeg_dct[comp],             // DCT coefficients for the current color component
+                y,                          // The current row of DCT blocks on the image
+                1,                          // Access one row of DCT blocks at a time
+                writable                    // Whether the array is going to be modified
+            );
+
+            scan->jpeg_rows[row] = coef_array[0];
+            scan->jpeg_widths[row] = jpeg_obj->comp_info[comp].width_in_blocks;
+            row++;
+        }
+    }
+
+    /* Note:
+        The rows are processed after all of them were accessed, which relies on the whole image being in memory
+        (otherwise the library could reuse the buffer of a row for the next one). This is always the case
+        with the coefficients read by 'jpeg_read_coefficients()', because libjpeg-turbo does not use temporary files.
+    */
+}
+
+// Store the carrier bytes of some rows of DCT blocks (this function might run on a worker thread)
+static void __jpeg_scan_range(size_t start, size_t end, void *scan_ptr)
+{
+    CarrierScan *const scan = (CarrierScan *)scan_ptr;
+    uint8_t *const carrier_bytes = (uint8_t *)scan->output;
+
+    for (size_t row = start; row < end; row++)
+    {
+        const JBLOCKROW blocks = scan->jpeg_rows[row];
+        size_t pos = scan->row_start[row];
+
+        // Iterate column by column from left to right
+        for (JDIMENSION x = 0; x < scan->jpeg_widths[row]; x++)
+        {
+            // Iterate over the 63 AC coefficients
+            // (the DC coefficient of the block is skipped, because modifying it causes a bigger visual impact,
+            //  because this coefficient represents the average color of the current block of pixels)
+            for (JCOEF i = 1; i < DCTSIZE2; i++)
+            {
+                // The current coefficient
+                const JCOEF coef = blocks[x][i];
+
+                // Only the AC coefficients that are not 0 or 1 are used as carriers
+                // (that makes the new image to have nearly the same size as the original image,
+                //  because JPEG compresses zeroes using run length encoding)
+                if (coef != 0 && coef != 1)
+                {
+                    // Store the value of the least significant byte of the coefficient
+                    carrier_bytes[pos++] = (uint8_t)(coef & (JCOEF)255);
+                }
+            }
+        }
+
+        scan->row_found[row] = pos - scan->row_start[row];
+        __scan_row_done(scan);
+    }
+}
+
+// Count the carrier bytes of some rows of DCT blocks (this function might run on a worker thread)
+static void __jpeg_count_range(size_t start, size_t end, void *scan_ptr)
+{
+    CarrierScan *const scan = (CarrierScan *)scan_ptr;
+
+    for (size_t row = start; row < end; row++)
+    {
+        const JBLOCKROW blocks = scan->jpeg_rows[row];
+        size_t count = 0;
+
+        for (JDIMENSION x = 0; x < scan->jpeg_widths[row]; x++)
+        {
+            for (JCOEF i = 1; i < DCTSIZE2; i++)
+            {
+                const JCOEF coef = blocks[x][i];
+                count += (coef != 0 && coef != 1);
+            }
+        }
+
+        scan->row_found[row] = count;
+    }
+}
+
+// Write the carrier bytes back to some rows of DCT blocks (this function might run on a worker thread)
+static void __jpeg_write_range(size_t start, size_t end, void *scan_ptr)
+{
+    CarrierScan *const scan = (CarrierScan *)scan_ptr;
+    const uint8_t *const carrier_bytes = (const uint8_t *)scan->output;
+    static const JCOEF coef_lsb = ~(JCOEF)1;    // Mask for clearing the least significant bit
+
+    for (size_t row = start; row < end; row++)
+    {
+        JBLOCKROW blocks = scan->jpeg_rows[row];
+        size_t pos = scan->row_start[row];
+
+        // Iterate column by column from left to right
+        for (JDIMENSION x = 0; x < scan->jpeg_widths[row]; x++)
+        {
+            // Iterate over the 63 AC coefficients (same criteria as when the carrier was read)
+            for (JCOEF i = 1; i < DCTSIZE2; i++)
+            {
+                const JCOEF coef = blocks[x][i];
+
+                if (coef != 0 && coef != 1)
+                {
+                    // Store the carrier byte
+                    blocks[x][i] &= coef_lsb;
+                    blocks[x][i] |= carrier_bytes[pos++];
+                }
+            }
+        }
+
+        __scan_row_done(scan);
+    }
+}
+
+// Store the pointers to some of the carrier bytes (this function might run on a worker thread)
+static void __carrier_pointer_range(size_t start, size_t end, void *carrier_img_ptr)
+{
+    CarrierImage *const carrier_img = (CarrierImage *)carrier_img_ptr;
+
+    for (size_t i = start; i < end; i++)
+    {
+        carrier_img->carrier[i] = &carrier_img->bytes[i];
+    }
 }
 
 // Get the bytes from a JPEG image that will carry the hidden data
-void imc_jpeg_carrier_open(CarrierImage *carrier_img)
+int imc_jpeg_carrier_open(CarrierImage *carrier_img)
 {
     // Open the image for reading
+    // (reusing the decoder of the last JPEG image closed by this thread, if there is one)
     FILE *jpeg_file = carrier_img->file;
-    struct jpeg_decompress_struct *jpeg_obj = imc_malloc(sizeof(struct jpeg_decompress_struct));
-    struct jpeg_error_mgr *jpeg_err = imc_malloc(sizeof(struct jpeg_error_mgr));
-    jpeg_obj->err = jpeg_std_error(jpeg_err);   // Use the default error handler
-    jpeg_create_decompress(jpeg_obj);
+    struct jpeg_decompress_struct *jpeg_obj = imc_pool_jpeg_take();
+    JpegErrorManager *jpeg_err;
+    if (jpeg_obj)
+    {
+        jpeg_err = (JpegErrorManager *)jpeg_obj->err;
+    }
+    else
+    {
+        jpeg_obj = imc_calloc(1, sizeof(struct jpeg_decompress_struct));
+        jpeg_err = imc_malloc(sizeof(JpegErrorManager));
+        jpeg_obj->err = jpeg_std_error(&jpeg_err->base);    // Use the default error messages
+        jpeg_err->base.error_exit = &__jpeg_error_exit;     // But return to our code on error, instead of exiting
+        jpeg_create_decompress(jpeg_obj);
+    }
     jpeg_stdio_src(jpeg_obj, jpeg_file);
 
+    // Error handling
+    if (setjmp(jpeg_err->jump))
+    {
+        if (carrier_img->verbose) printf("\n");
+        imc_free(jpeg_obj->progress);
+        jpeg_destroy_decompress(jpeg_obj);
+        imc_free(jpeg_obj);
+        imc_free(jpeg_err);
+        return IMC_ERR_FILE_INVALID;
+    }
+
     // Save to memory the application markers and comment marker
     // (This is being done in order to preserve the metadata from the original image)
     for (size_t i = 1; i < 16; i++)
@@ -789,23 +2143,16 @@ void imc_jpeg_carrier_open(CarrierImage *carrier_img)
     jpeg_save_markers(jpeg_obj, JPEG_COM, 0xFFFF);
 
     // Setup the progress monitor for the JPEG's read operation
-    if (carrier_img->verbose)
+    if (carrier_img->verbose || carrier_img->progress)
     {
+        jpeg_obj->client_data = carrier_img;
         jpeg_obj->progress = imc_calloc(1, sizeof(struct jpeg_progress_mgr));
         jpeg_obj->progress->progress_monitor = &__jpeg_read_callback;
     }
 
-    // Read the DCT coefficients from the image
+    // Read the header of the image
+    const StatsTimer decode_timer = imc_stats_start();
     jpeg_read_header(jpeg_obj, true);
-    jvirt_barray_ptr *jpeg_dct = jpeg_read_coefficients(jpeg_obj);
-
-    // Finish the read's progress monitor
-    if (carrier_img->verbose)
-    {
-        imc_free(jpeg_obj->progress);
-        jpeg_obj->progress = NULL;
-        printf("Reading JPEG image... Done!  \n");
-    }
 
     // Calculate the total amount of DCT coefficients
     size_t dct_count = 0;
@@ -814,120 +2161,173 @@ void imc_jpeg_carrier_open(CarrierImage *carrier_img)
         dct_count += jpeg_obj->comp_info[comp].height_in_blocks * jpeg_obj->comp_info[comp].width_in_blocks * DCTSIZE2;
     }
 
-    // Estimate the size of the array of carrier values and allocate it
-    size_t carrier_capacity = dct_count / 8;
-    if (carrier_capacity == 0) carrier_capacity = 1;
-    carrier_bytes_t carrier_bytes = imc_calloc(carrier_capacity, sizeof(uint8_t));
-    size_t carrier_count = 0;
-    
-    // Iterate over the color components
-    for (int comp = 0; comp < jpeg_obj->num_components; comp++)
+    // Reserve the memory for the coefficients and the carrier bytes (one byte per coefficient),
+    // and at most one pointer per coefficient (if all of them are carriers)
+    const size_t jpeg_memory = dct_count * (sizeof(JCOEF) + sizeof(uint8_t));
+    const int budget_status = __steg_reserve_memory(carrier_img, jpeg_memory, jpeg_memory + (dct_count * sizeof(carrier_bytes_t)));
+    if (budget_status != IMC_SUCCESS)
     {
-        // Iterate row by row from from top to bottom
-        for (JDIMENSION y = 0; y < jpeg_obj->comp_info[comp].height_in_blocks; y++)
-        {
-            // Array of DCT coefficients for the current color component
-            JBLOCKARRAY coef_array = jpeg_obj->mem->access_virt_barray(
-                (j_common_ptr)jpeg_obj,     // Pointer to the JPEG object
-                jpeg_dct[comp],             // DCT coefficients for the current color component
-                y,                          // The current row of DCT blocks on the image
-                1,                          // Read one row of DCT blocks at a time
-                false                       // Opening the array in read-only mode
-            );
+        imc_free(jpeg_obj->progress);
+        jpeg_obj->progress = NULL;
+        imc_pool_jpeg_give(jpeg_obj);
+        return budget_status;
+    }
 
-            // Print status message (on verbose)
-            if (carrier_img->verbose)
-            {
-                const double row_count = jpeg_obj->comp_info[comp].height_in_blocks;
-                const double row_fraction = ((double)y / row_count) / (double)jpeg_obj->num_components;
-                const double comp_fraction = (double)comp / (double)jpeg_obj->num_components;
-                const double percent = (comp_fraction + row_fraction) * 100.0;
-                printf_prog("Scanning cover image for suitable carrier bits... %.1f %%\r", percent);
-            }
+    // Read the DCT coefficients from the image
+    jvirt_barray_ptr *jpeg_dct = jpeg_read_coefficients(jpeg_obj);
 
-            // Iterate column by column from left to right
-            for (JDIMENSION x = 0; x < jpeg_obj->comp_info[comp].width_in_blocks; x++)
-            {
-                // Iterate over the 63 AC coefficients
-                // (the DC coefficient of the block is skipped, because modifying it causes a bigger visual impact,
-                //  because this coefficient represents the average color of the current block of pixels)
-                for (JCOEF i = 1; i < DCTSIZE2; i++)
-                {
-                    // Resize the array of carriers if it is full
-                    if (carrier_count == carrier_capacity)
-                    {
-                        carrier_capacity *= 2;
-                        carrier_bytes = imc_realloc(carrier_bytes, carrier_capacity * sizeof(uint8_t));
-                    }
+    // Finish the read's progress monitor
+    if (jpeg_obj->progress)
+    {
+        imc_free(jpeg_obj->progress);
+        jpeg_obj->progress = NULL;
+    }
+    __steg_progress(carrier_img, IMC_STAGE_READ_IMAGE, 100.0, "Reading JPEG image... Done!  \n");
+    imc_stats_stop(IMC_STATS_DECODE, &decode_timer, dct_count * sizeof(JCOEF));
+    const StatsTimer scan_timer = imc_stats_start();
 
-                    // The current coefficient
-                    const JCOEF coef = coef_array[0][x][i];
+    // Allocate the array of carrier values
+    // Its size is the maximum possible amount of carriers (one per coefficient), so it does not need
+    // to grow while scanning the image. The operating system only commits the pages that are written to,
+    // and the unused space is freed afterwards (unless the buffer is kept by the pool for the next image).
+    const size_t carrier_capacity = (dct_count > 0) ? dct_count : 1;
+    carrier_bytes_t carrier_bytes = imc_arena_alloc_tag(carrier_img->arena, carrier_capacity * sizeof(uint8_t), IMC_MEMORY_CARRIER);
 
-                    // Only the AC coefficients that are not 0 or 1 are used as carriers
-                    // (that makes the new image to have nearly the same size as the original image,
-                    //  because JPEG compresses zeroes using run length encoding)
-                    if (coef != 0 && coef != 1)
-                    {
-                        // Store the value of the least significant byte of the coefficient
-                        carrier_bytes[carrier_count++] = (uint8_t)(coef & (JCOEF)255);
-                    }
-                }
-            }
-        }
+    // Amount of rows of DCT blocks (counting all color components)
+    size_t row_count = 0;
+    for (int comp = 0; comp < jpeg_obj->num_components; comp++)
+    {
+        row_count += jpeg_obj->comp_info[comp].height_in_blocks;
     }
 
-    // Print status message (on verbose)
-    if (carrier_img->verbose)
+    // Scan the rows in parallel, with each row storing its carriers at the maximum position where they could begin
+    CarrierScan scan;
+    __scan_init(&scan, carrier_img, IMC_STAGE_SCAN_CARRIER, "Scanning cover image for suitable carrier bits... %.1f %%\r", row_count);
+    __jpeg_gather_rows(&scan, jpeg_obj, jpeg_dct, false);
+    scan.output = carrier_bytes;
+
+    for (size_t row = 1; row < row_count; row++)
     {
-        printf("Scanning cover image for suitable carrier bits... Done!  \n");
+        scan.row_start[row] = scan.row_start[row-1] + (scan.jpeg_widths[row-1] * (DCTSIZE2 - 1));
     }
 
+    const size_t coef_per_row = (row_count > 0) ? (dct_count / row_count) : 1;
+    imc_parallel_for(row_count, 1 + (IMC_PARALLEL_MIN_ITEMS / (coef_per_row + 1)), &__jpeg_scan_range, &scan);
+
+    // Join the carriers of all rows (in order)
+    const size_t carrier_count = __scan_join(&scan, sizeof(uint8_t));
+    __scan_free(&scan);
+
+    // Print status message (on verbose)
+    __steg_progress(carrier_img, IMC_STAGE_SCAN_CARRIER, 100.0, "Scanning cover image for suitable carrier bits... Done!  \n");
+    imc_stats_stop(IMC_STATS_SCAN, &scan_timer, dct_count * sizeof(JCOEF));
+
     // Check for edge case
+    // (the image has no suitable bits for hiding the data, which may happen if it is just a flat color)
     if (carrier_count == 0)
     {
-        fprintf(stderr, "Error: the JPEG image has no suitable bits for hiding the data. "
-            "This may happen if the image is just a flat color.\n");
-        exit(EXIT_FAILURE);
+        imc_pool_jpeg_give(jpeg_obj);
+        return IMC_ERR_NO_CARRIER;
     }
     
     // Free the unused space of the array
-    carrier_bytes = imc_realloc(carrier_bytes, carrier_count * sizeof(uint8_t));
+    carrier_bytes = imc_arena_trim(carrier_img->arena, carrier_bytes, carrier_count * sizeof(uint8_t));
+    carrier_img->bytes = carrier_bytes;
 
     // Store the pointers to each element of the bytes array
-    carrier_bytes_t *carrier_ptr = imc_calloc(carrier_count, sizeof(uint8_t *));
+    carrier_bytes_t *carrier_ptr = imc_arena_alloc_tag(carrier_img->arena, carrier_count * sizeof(uint8_t *), IMC_MEMORY_CARRIER);
+    carrier_img->carrier = carrier_ptr;
+    imc_parallel_for(carrier_count, IMC_PARALLEL_MIN_ITEMS, &__carrier_pointer_range, carrier_img);
 
-    for (size_t i = 0; i < carrier_count; i++)
+    // Keep reserved only the memory that the image actually uses (the coefficients are allocated by libjpeg)
+    const int settle_status = __steg_settle_memory(carrier_img, dct_count * sizeof(JCOEF));
+    if (settle_status != IMC_SUCCESS)
     {
-        carrier_ptr[i] = &carrier_bytes[i];
+        imc_pool_jpeg_give(jpeg_obj);
+        return settle_status;
     }
 
     // Store the output
     carrier_img->bytes = carrier_bytes;             // Array of bytes
     carrier_img->carrier = carrier_ptr;             // Array of pointers to bytes
     carrier_img->carrier_length = carrier_count;    // Total amount of pointers to bytes
-    carrier_img->object = jpeg_obj;                 // Image handler
-    
-    // Store the additional heap allocated memory for the purpose of memory management
-    carrier_img->heap = imc_malloc(sizeof(void *) * 2);
-    carrier_img->heap[0] = (void *)jpeg_err;
-    carrier_img->heap[1] = (void *)jpeg_dct;
-    carrier_img->heap_length = 1;
-    /* Note:
-        The length above is set to 1, even though it is actually 2, because
-        the memory of '*jpeg_dct' is managed by libjpeg-turbo (instead of my code).
-        The length of 1 prevents my code from attempting to free that memory.
-    */
+    carrier_img->width = jpeg_obj->image_width;     // Dimensions of the image
+    carrier_img->height = jpeg_obj->image_height;
+
+    // Store the image handler, and the DCT coefficients where the carrier bytes are written back to
+    JpegState *state = imc_arena_alloc(carrier_img->arena, sizeof(JpegState));
+    *state = (JpegState){
+        .object = jpeg_obj,
+        .dct = jpeg_dct
+    };
+    carrier_img->object = state;
+
+    return IMC_SUCCESS;
 }
 
 // Progress monitor when reading a PNG image
 static void __png_read_callback(png_structp png_obj, png_uint_32 row, int pass)
 {
     const double percent = (((double)pass + ((double)row / png_num_rows)) / png_num_passes) * 100.0;
-    printf_prog("Reading PNG image... %.1f %%\r", percent);
+    __steg_progress(png_progress_img, IMC_STAGE_READ_IMAGE, percent, "Reading PNG image... %.1f %%\r", percent);
+}
+
+// Store the pointers to the carrier bytes of some rows of pixels of a PNG image (this function might run on a worker thread)
+static void __png_scan_range(size_t start, size_t end, void *scan_ptr)
+{
+    CarrierScan *const scan = (CarrierScan *)scan_ptr;
+    carrier_bytes_t *const carrier = (carrier_bytes_t *)scan->output;
+    const size_t num_channels = scan->num_channels;
+    const size_t num_colors = scan->num_colors;
+    const size_t bytes_per_pixel = num_channels * (scan->bit_depth / 8);
+
+    // Loop through the pixels of the rows to get the carrier bytes
+    // (we are going to use pixels with alpha > 0, but the alpha channel itself will not be used as carrier)
+    for (size_t y = start; y < end; y++)
+    {
+        size_t pos = scan->row_start[y];
+
+        for (size_t x = 0; x < scan->width; x++)
+        {
+            uint8_t *const pixel = &scan->pixel_rows[y][x * bytes_per_pixel];
+
+            // The bit depths can be either 8 or 16
+            // For the later, each color value is stored in big-endian byte order
+            if (scan->bit_depth == 8)
+            {
+                const uint8_t alpha = scan->has_alpha ? pixel[num_channels-1] : UINT8_MAX;
+                if (alpha > 0)
+                {
+                    for (size_t n = 0; n < num_colors; n++)
+                    {
+                        // Store the pointer to the color value (1 byte)
+                        carrier[pos++] = &pixel[n];
+                    }
+                }
+            }
+            else    // bit_depth == 16
+            {
+                // Cast the value to 16-bit unsigned integer, then convert it to the same byte order as the system
+                // (16-bit PNG uses the big-endian byte order)
+                const uint16_t alpha = scan->has_alpha ? be16toh( *(uint16_t*)(&pixel[(num_channels - 1) * 2]) ) : UINT16_MAX;
+                if (alpha > 0)
+                {
+                    for (size_t n = 0; n < num_colors; n++)
+                    {
+                        // Store the pointer to the least significant byte of the color value
+                        carrier[pos++] = &pixel[1 + (n * 2)];
+                    }
+                }
+            }
+        }
+
+        scan->row_found[y] = pos - scan->row_start[y];
+        __scan_row_done(scan);
+    }
 }
 
 // Get the bytes from a PNG image that will carry the hidden data
-void imc_png_carrier_open(CarrierImage *carrier_img)
+int imc_png_carrier_open(CarrierImage *carrier_img)
 {
     // Allocate memory for the PNG processing structs
     png_structp png_obj = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
@@ -935,8 +2335,7 @@ void imc_png_carrier_open(CarrierImage *carrier_img)
     if (!png_obj || !png_info)
     {
         png_destroy_read_struct(&png_obj, &png_info, NULL);
-        fprintf(stderr, "Error: No enough memory for reading the PNG file.\n");
-        exit(EXIT_FAILURE);
+        return IMC_ERR_NO_MEMORY;
     }
 
     // Error handling
@@ -944,7 +2343,7 @@ void imc_png_carrier_open(CarrierImage *carrier_img)
     {
         png_destroy_read_struct(&png_obj, &png_info, NULL);
         fprintf(stderr, "Error: Failed to read PNG file.\n");
-        exit(EXIT_FAILURE);
+        return IMC_ERR_FILE_INVALID;
     }
 
     // Metadata of the PNG image
@@ -957,6 +2356,7 @@ void imc_png_carrier_open(CarrierImage *carrier_img)
     int filter_method;
 
     // Parse the metadata from PNG file
+    const StatsTimer decode_timer = imc_stats_start();
     FILE *png_file = carrier_img->file;
     png_init_io(png_obj, png_file);
     png_read_info(png_obj, png_info);
@@ -987,10 +2387,11 @@ void imc_png_carrier_open(CarrierImage *carrier_img)
     }
 
     // Setup the progress monitor (when on verbose)
-    if (carrier_img->verbose)
+    if (carrier_img->verbose || carrier_img->progress)
     {
         png_num_passes = (interlace_method == PNG_INTERLACE_ADAM7) ? PNG_INTERLACE_ADAM7_PASSES : 1.0;
         png_num_rows = height;
+        png_progress_img = carrier_img;
         png_set_read_status_fn(png_obj, &__png_read_callback);
     }
 
@@ -999,16 +2400,30 @@ void imc_png_carrier_open(CarrierImage *carrier_img)
     {
         png_destroy_read_struct(&png_obj, &png_info, NULL);
         fprintf(stderr, "Error: Failed to read PNG file.\n");
-        exit(EXIT_FAILURE);
+        return IMC_ERR_FILE_INVALID;
     }
     /* from this point onwards, this function assumes that the bit depth to be either 8 or 16 */
 
     // Amount of bytes per row of the image
     const size_t stride = png_get_rowbytes(png_obj, png_info);
+
+    const bool has_alpha = color_type & PNG_COLOR_MASK_ALPHA;                   // If the image has transparency
+    const png_byte num_channels = png_get_channels(png_obj, png_info);          // Total amount of channels in image
+    const png_byte num_colors = has_alpha ? num_channels - 1 : num_channels;    // Amount of channels excluding the alpha channel
     
     // Buffer for storing the image's color values
     const size_t buffer_size = (height * sizeof(png_bytep)) + (height * stride);
-    png_bytep *row_pointers = imc_malloc(buffer_size);
+
+    // Reserve the memory for the buffer, and at most one pointer per color value (if all of them are carriers)
+    const size_t carrier_size = sizeof(carrier_bytes_t) * width * height * num_colors;
+    const int budget_status = __steg_reserve_memory(carrier_img, buffer_size, buffer_size + carrier_size);
+    if (budget_status != IMC_SUCCESS)
+    {
+        png_destroy_read_struct(&png_obj, &png_info, NULL);
+        return budget_status;
+    }
+
+    png_bytep *row_pointers = imc_arena_alloc_tag(carrier_img->arena, buffer_size, IMC_MEMORY_PIXELS);
 
     // Pointer to the buffer's position where the values of a row begin
     uintptr_t offset = (uintptr_t)row_pointers + ((size_t)height * sizeof(png_bytep));
@@ -1020,86 +2435,74 @@ void imc_png_carrier_open(CarrierImage *carrier_img)
         row_pointers[i] = (png_bytep)offset;
         offset += stride;
     }
+
+    // Error handling (the image's buffer is freed along with the arena)
+    if (setjmp(png_jmpbuf(png_obj)))
+    {
+        if (carrier_img->verbose) printf("\n");
+        png_destroy_read_struct(&png_obj, &png_info, NULL);
+        fprintf(stderr, "Error: Failed to read PNG file.\n");
+        return IMC_ERR_FILE_INVALID;
+    }
     
     // Read the image into the buffer
     png_read_image(png_obj, row_pointers);
     png_read_end(png_obj, png_info);
-    if (carrier_img->verbose) printf("Reading PNG image... Done!  \n");
-
-    const bool has_alpha = color_type & PNG_COLOR_MASK_ALPHA;                   // If the image has transparency
-    const png_byte num_channels = png_get_channels(png_obj, png_info);          // Total amount of channels in image
-    const png_byte num_colors = has_alpha ? num_channels - 1 : num_channels;    // Amount of channels excluding the alpha channel
-    const size_t bytes_per_pixel = num_channels * (bit_depth/8);                // Amount of bytes to represent a single pixel
+    __steg_progress(carrier_img, IMC_STAGE_READ_IMAGE, 100.0, "Reading PNG image... Done!  \n");
+    imc_stats_stop(IMC_STATS_DECODE, &decode_timer, (size_t)height * stride);
+    const StatsTimer scan_timer = imc_stats_start();
 
     // Buffer of pointers to the carrier bytes of the image
-    carrier_bytes_t *carrier = imc_malloc(sizeof(carrier_bytes_t) * width * height * num_colors);
-    size_t pos = 0;
+    carrier_bytes_t *carrier = imc_arena_alloc_tag(carrier_img->arena, carrier_size, IMC_MEMORY_CARRIER);
+
+    // Scan the rows in parallel, with each row storing its carriers at the maximum position where they could begin
+    CarrierScan scan;
+    __scan_init(&scan, carrier_img, IMC_STAGE_SCAN_CARRIER, "Scanning cover image for suitable carrier bits... %.1f %%\r", height);
+    scan.output = carrier;
+    scan.pixel_rows = imc_malloc(height * sizeof(uint8_t *));
+    scan.width = width;
+    scan.num_channels = num_channels;
+    scan.num_colors = num_colors;
+    scan.bit_depth = bit_depth;
+    scan.has_alpha = has_alpha;
 
-    // Loop through all pixels in the image to get the carrier bytes
-    // (we are going to use pixels with alpha > 0, but the alpha channel itself will not be used as carrier)
     for (size_t y = 0; y < height; y++)
     {
-        // Print status message (on verbose)
-        if (carrier_img->verbose)
-        {
-            const double percent = ((double)y / (double)height) * 100.0;
-            printf_prog("Scanning cover image for suitable carrier bits... %.1f %%\r", percent);
-        }
-        
-        for (size_t x = 0; x < width; x++)
-        {
-            uint8_t *const pixel = &row_pointers[y][x * bytes_per_pixel];
-
-            // The bit depths can be either 8 or 16
-            // For the later, each color value is stored in big-endian byte order
-            if (bit_depth == 8)
-            {
-                const uint8_t alpha = has_alpha ? pixel[num_channels-1] : UINT8_MAX;
-                if (alpha > 0)
-                {
-                    for (size_t n = 0; n < num_colors; n++)
-                    {
-                        // Store the pointer to the color value (1 byte)
-                        carrier[pos++] = &pixel[n];
-                    }
-                }
-            }
-            else    // bit_depth == 16
-            {
-                // Cast the value to 16-bit unsigned integer, then convert it to the same byte order as the system
-                // (16-bit PNG uses the big-endian byte order)
-                const uint16_t alpha = has_alpha ? be16toh( *(uint16_t*)(&pixel[(num_channels - 1) * 2]) ) : UINT16_MAX;
-                if (alpha > 0)
-                {
-                    for (size_t n = 0; n < num_colors; n++)
-                    {
-                        // Store the pointer to the least significant byte of the color value
-                        carrier[pos++] = &pixel[1 + (n * 2)];
-                    }
-                }
-            }
-        }
+        scan.pixel_rows[y] = row_pointers[y];
+        scan.row_start[y] = y * width * num_colors;
     }
 
+    imc_parallel_for(height, 1 + (IMC_PARALLEL_MIN_ITEMS / (stride + 1)), &__png_scan_range, &scan);
+
+    // Join the carriers of all rows (in order)
+    const size_t pos = __scan_join(&scan, sizeof(carrier_bytes_t));
+    __scan_free(&scan);
+
     // Print status message (on verbose)
-    if (carrier_img->verbose)
-    {
-        printf("Scanning cover image for suitable carrier bits... Done!  \n");
-    }
+    __steg_progress(carrier_img, IMC_STAGE_SCAN_CARRIER, 100.0, "Scanning cover image for suitable carrier bits... Done!  \n");
+    imc_stats_stop(IMC_STATS_SCAN, &scan_timer, (size_t)height * stride);
 
     // Check for edge case
+    // (the image has no suitable bits for hiding the data, which may happen if it is fully transparent)
     if (pos == 0)
     {
-        fprintf(stderr, "Error: the PNG image has no suitable bits for hiding the data. "
-            "This may happen if the image is fully transparent.\n");
-        exit(EXIT_FAILURE);
+        png_destroy_read_struct(&png_obj, &png_info, NULL);
+        return IMC_ERR_NO_CARRIER;
     }
     
     // Free the unused space of the carrier buffer
-    carrier = imc_realloc(carrier, pos * sizeof(carrier_bytes_t));
+    carrier = imc_arena_trim(carrier_img->arena, carrier, pos * sizeof(carrier_bytes_t));
+
+    // Keep reserved only the memory that the image actually uses
+    const int settle_status = __steg_settle_memory(carrier_img, 0);
+    if (settle_status != IMC_SUCCESS)
+    {
+        png_destroy_read_struct(&png_obj, &png_info, NULL);
+        return settle_status;
+    }
     
     // Store the structures necessary to handle the opened image
-    PngState *state = imc_malloc(sizeof(PngState));
+    PngState *state = imc_arena_alloc(carrier_img->arena, sizeof(PngState));
     *state = (PngState){
         .object = png_obj,
         .info = png_info,
@@ -1111,10 +2514,59 @@ void imc_png_carrier_open(CarrierImage *carrier_img)
     carrier_img->carrier = carrier;
     carrier_img->carrier_length = pos;
     carrier_img->bytes = initial_offset;
+    carrier_img->width = width;
+    carrier_img->height = height;
+
+    return IMC_SUCCESS;
+}
+
+// Store the pointers to the carrier bytes of some rows of pixels of a WebP image (this function might run on a worker thread)
+static void __webp_scan_range(size_t start, size_t end, void *scan_ptr)
+{
+    CarrierScan *const scan = (CarrierScan *)scan_ptr;
+    carrier_bytes_t *const carrier = (carrier_bytes_t *)scan->output;
+
+    // Loop through the pixels of the rows to get the carrier bytes
+    // (we are going to use pixels with alpha > 0, but the alpha channel itself will not be used as carrier)
+    for (size_t y = start; y < end; y++)
+    {
+        size_t pos = scan->row_start[y];
+
+        for (size_t x = 0; x < scan->width; x++)
+        {
+            uint8_t *const pixel = &scan->pixel_rows[y][x * 4];  // Image always is 4 bytes per pixel
+            
+            // Get the 4 color components of the pixel (alpha, red, green, blue)
+            // Note: the alpha value is the most significant byte of a 32-bit unsigned integer,
+            //       followed by red > green > blue (in decreasing order of significance).
+            #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            uint8_t *const alpha = &pixel[0];
+            uint8_t *const red   = &pixel[1];
+            uint8_t *const green = &pixel[2];
+            uint8_t *const blue  = &pixel[3];
+            #else // __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            uint8_t *const alpha = &pixel[3];
+            uint8_t *const red   = &pixel[2];
+            uint8_t *const green = &pixel[1];
+            uint8_t *const blue  = &pixel[0];
+            #endif
+            
+            // Use the RGB bytes as carriers if the pixel is not fully transparent
+            if (*alpha > 0)
+            {
+                carrier[pos++] = red;
+                carrier[pos++] = green;
+                carrier[pos++] = blue;
+            }
+        }
+
+        scan->row_found[y] = pos - scan->row_start[y];
+        __scan_row_done(scan);
+    }
 }
 
 // Get the bytes from an WebP image that will carry the hidden data
-void imc_webp_carrier_open(CarrierImage *carrier_img)
+int imc_webp_carrier_open(CarrierImage *carrier_img)
 {
     // Get the total file size of the WebP image
 
@@ -1134,289 +2586,619 @@ void imc_webp_carrier_open(CarrierImage *carrier_img)
 
     #endif
 
-    if (file_size > UINT32_MAX)
-    {
-        fprintf(stderr, "Error: Maximum size of an WebP image is 4 GB.\n");
-        exit(EXIT_FAILURE);
+    if (file_size > UINT32_MAX)
+    {
+        fprintf(stderr, "Error: Maximum size of an WebP image is 4 GB.\n");
+        return IMC_ERR_FILE_INVALID;
+    }
+
+    if (carrier_img->verbose)
+    {
+        printf("Reading WebP image... ");
+        fflush(stdout);
+    }
+    if (carrier_img->progress) carrier_img->progress(IMC_STAGE_READ_IMAGE, 0.0, carrier_img->progress_data);
+
+    // Input buffer (original image)
+    const StatsTimer decode_timer = imc_stats_start();
+    uint8_t *in_buffer = imc_arena_alloc(carrier_img->arena, file_size);
+    const size_t read_count = fread(in_buffer, 1, file_size, carrier_img->file);
+    if (read_count != file_size)
+    {
+        if (carrier_img->verbose) fprintf(stderr, "\n");
+        fprintf(stderr, "Error: WebP file could not be read.\n");
+        return IMC_ERR_FILE_INVALID;
+    }
+
+    // Data of the decoded WebP image (original file)
+    WebpState *state = imc_arena_calloc(carrier_img->arena, 1, sizeof(WebpState));
+    WebPDecoderConfig *webp_obj = &state->config;
+    WebPInitDecoderConfig(webp_obj);
+    VP8StatusCode status_vp8 = WebPGetFeatures(in_buffer, file_size, &webp_obj->input);
+
+    if (status_vp8 != VP8_STATUS_OK)
+    {
+        if (carrier_img->verbose) fprintf(stderr, "\n");
+        fprintf(stderr, "Error: Could not retrieve the header of the WebP image.\n");
+        return IMC_ERR_FILE_INVALID;
+    }
+
+    if (webp_obj->input.has_animation)
+    {
+        if (carrier_img->verbose) fprintf(stderr, "\n");
+        fprintf(stderr, "Error: Animated WebP images are not supported.\n");
+        return IMC_ERR_FILE_INVALID;
+    }
+
+    // Reserve the memory for the file, the decoded image (4 bytes per pixel), and for encoding it back when saving
+    // (estimated as 8 bytes per pixel), and at most 3 pointers per pixel (if all color values are carriers)
+    const size_t webp_pixels = (size_t)webp_obj->input.width * (size_t)webp_obj->input.height;
+    const size_t webp_external = webp_pixels * (4 + 8);
+    const size_t webp_memory = file_size + webp_external;
+    const int budget_status = __steg_reserve_memory(
+        carrier_img, webp_memory, webp_memory + (webp_pixels * 3 * sizeof(carrier_bytes_t))
+    );
+    if (budget_status != IMC_SUCCESS)
+    {
+        if (carrier_img->verbose) fprintf(stderr, "\n");
+        return budget_status;
+    }
+    
+    // Set the decoding options
+    webp_obj->options.use_threads = 1;     // Use multithreading
+    #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    webp_obj->output.colorspace = MODE_ARGB;    // 32-bit color value on big endian byte order
+    #else
+    webp_obj->output.colorspace = MODE_BGRA;    // 32-bit color value on little endian byte order
+    #endif
+    
+    // Decode the original image
+    status_vp8 = WebPDecode(in_buffer, file_size, webp_obj);
+    if (status_vp8 != VP8_STATUS_OK)
+    {
+        if (carrier_img->verbose) fprintf(stderr, "\n");
+        fprintf(stderr, "Error: Could not decode the WebP image. Reason: ");
+        switch (status_vp8)
+        {
+            case VP8_STATUS_OUT_OF_MEMORY:
+                fprintf(stderr, "no enough memory.\n");
+                break;
+            
+            case VP8_STATUS_NOT_ENOUGH_DATA:
+                fprintf(stderr, "no enough data, the file appears to be corrupted.\n");
+                break;
+            
+            case VP8_STATUS_UNSUPPORTED_FEATURE:
+                fprintf(stderr, "image uses an unsupported feature.\n");
+                break;
+            
+            case VP8_STATUS_BITSTREAM_ERROR:
+                fprintf(stderr, "not a valid WebP image.\n");
+                break;
+            
+            default:
+                fprintf(stderr, "unknown.\n");
+                break;
+        }
+        WebPFreeDecBuffer(&webp_obj->output);
+        return (status_vp8 == VP8_STATUS_OUT_OF_MEMORY) ? IMC_ERR_NO_MEMORY : IMC_ERR_FILE_INVALID;
+    }
+
+    __steg_progress(carrier_img, IMC_STAGE_READ_IMAGE, 100.0, "Done!  \n");
+
+    // Calculate the total amount of pixels in the image
+    const size_t width = webp_obj->output.width;
+    const size_t height = webp_obj->output.height;
+    const size_t pixel_count = width * height;
+    imc_stats_stop(IMC_STATS_DECODE, &decode_timer, pixel_count * 4);
+    const StatsTimer scan_timer = imc_stats_start();
+    
+    // Pointers to the carrier bytes of the image
+    carrier_bytes_t *carrier = imc_arena_alloc_tag(carrier_img->arena, sizeof(carrier_bytes_t) * pixel_count * 3, IMC_MEMORY_CARRIER);
+    
+    // Scan the rows in parallel, with each row storing its carriers at the maximum position where they could begin
+    CarrierScan scan;
+    __scan_init(&scan, carrier_img, IMC_STAGE_SCAN_CARRIER, "Scanning cover image for suitable carrier bits... %.1f %%\r", height);
+    scan.output = carrier;
+    scan.pixel_rows = imc_malloc(height * sizeof(uint8_t *));
+    scan.width = width;
+
+    for (size_t y = 0; y < height; y++)
+    {
+        scan.pixel_rows[y] = &webp_obj->output.u.RGBA.rgba[y * width * 4];
+        scan.row_start[y] = y * width * 3;
+    }
+
+    imc_parallel_for(height, 1 + (IMC_PARALLEL_MIN_ITEMS / (width * 4 + 1)), &__webp_scan_range, &scan);
+
+    // Join the carriers of all rows (in order)
+    const size_t pos = __scan_join(&scan, sizeof(carrier_bytes_t));     // Amount of carrier bytes
+    __scan_free(&scan);
+
+    __steg_progress(carrier_img, IMC_STAGE_SCAN_CARRIER, 100.0, "Scanning cover image for suitable carrier bits... Done!  \n");
+    imc_stats_stop(IMC_STATS_SCAN, &scan_timer, pixel_count * 4);
+
+    // Check for edge case
+    // (the image has no suitable bits for hiding the data, which may happen if it is fully transparent)
+    if (pos == 0)
+    {
+        WebPFreeDecBuffer(&webp_obj->output);
+        return IMC_ERR_NO_CARRIER;
+    }
+    
+    // Free the unused space of the carrier buffer
+    carrier = imc_arena_trim(carrier_img->arena, carrier, pos * sizeof(carrier_bytes_t));
+
+    // Keep reserved only the memory that the image actually uses (the decoded image is allocated by libwebp)
+    const int settle_status = __steg_settle_memory(carrier_img, webp_external);
+    if (settle_status != IMC_SUCCESS)
+    {
+        WebPFreeDecBuffer(&webp_obj->output);
+        return settle_status;
+    }
+    
+    // Store the structure necessary to handle the opened image (along with the size of the input buffer)
+    state->in_size = file_size;
+    carrier_img->object = state;
+
+    // Store the information about the carrier bytes
+    carrier_img->carrier = carrier;
+    carrier_img->carrier_length = pos;
+    carrier_img->bytes = in_buffer;
+    carrier_img->width = width;
+    carrier_img->height = height;
+
+    return IMC_SUCCESS;
+}
+
+// Check if a given path is a directory
+static bool __is_directory(const char *path)
+{
+    #ifdef _WIN32   // Windows systems
+    DWORD path_attrib = GetFileAttributes(path);
+    if (path_attrib != INVALID_FILE_ATTRIBUTES)
+    {
+        return (path_attrib & FILE_ATTRIBUTE_DIRECTORY);
+    }
+    
+    #else   // Linux systems
+    struct stat path_stat;
+    const bool status = stat(path, &path_stat);
+    if (status == 0) return S_ISDIR(path_stat.st_mode);
+    
+    #endif  // _WIN32
+
+    return false;
+}
+
+// Remove the temporary outputs on the folder of 'path' that were left behind by interrupted saves
+// (they would never be committed nor removed otherwise). Each folder is swept only once per run of the program.
+// A temporary file is locked while its save is in progress, so only the files whose lock can be taken are removed
+// (this works regardless of which process, container, or machine created them). On Windows, an open file
+// cannot be removed, which has the same effect.
+static void __output_sweep(const char *path)
+{
+    // Folders that were already swept
+    static char **swept_folders = NULL;
+    static size_t swept_count = 0;
+    static pthread_mutex_t swept_lock = PTHREAD_MUTEX_INITIALIZER;
+
+    // Split the path into its folder and its name
+    const char *name = strrchr(path, '/');
+    #ifdef _WIN32
+    const char *const back_slash = strrchr(path, '\\');
+    if (back_slash && (!name || back_slash > name)) name = back_slash;
+    #endif // _WIN32
+    const size_t dir_len = name ? (size_t)(name - path) + 1 : 0;    // Length of the folder (including the separator)
+    const size_t suffix_len = strlen(IMC_TEMP_SUFFIX);
+
+    char dir_path[dir_len + 2];
+    memcpy(dir_path, path, dir_len);
+    strcpy(&dir_path[dir_len], dir_len > 0 ? "" : ".");
+
+    // Skip the folder if it was swept before, otherwise mark it as swept
+    pthread_mutex_lock(&swept_lock);
+    for (size_t i = 0; i < swept_count; i++)
+    {
+        if (strcmp(swept_folders[i], dir_path) == 0)
+        {
+            pthread_mutex_unlock(&swept_lock);
+            return;
+        }
+    }
+    swept_folders = imc_realloc(swept_folders, (swept_count + 1) * sizeof(char *));
+    swept_folders[swept_count++] = imc_strdup(dir_path);
+    pthread_mutex_unlock(&swept_lock);
+
+    DIR *dir = opendir(dir_path);
+    if (!dir) return;
+
+    struct dirent *entry;
+    while ( (entry = readdir(dir)) )
+    {
+        // The temporary names are "NAME.PROCESS-COUNTER.imc-tmp" (with both numbers in hexadecimal)
+        const char *const entry_name = entry->d_name;
+        const size_t entry_len = strlen(entry_name);
+        if (entry_len <= suffix_len) continue;
+        if (strcmp(&entry_name[entry_len - suffix_len], IMC_TEMP_SUFFIX) != 0) continue;
+
+        // The part before the suffix must end with the two numbers (so other files are never matched)
+        const size_t stem_len = entry_len - suffix_len;
+        char stem[stem_len + 1];
+        memcpy(stem, entry_name, stem_len);
+        stem[stem_len] = '\0';
+
+        const char *const dot = strrchr(stem, '.');
+        if (!dot || dot == stem) continue;
+        const char *const numbers = dot + 1;
+        const size_t number_len = strlen(numbers);
+        const char *const dash = strchr(numbers, '-');
+        if (strspn(numbers, "0123456789abcdef-") != number_len || !dash) continue;
+        if (!isxdigit((unsigned char)numbers[0]) || !isxdigit((unsigned char)dash[1])) continue;
+
+        unsigned long entry_process;
+        unsigned int entry_counter;
+        int parsed_len = -1;
+        if (sscanf(numbers, "%lx-%x%n", &entry_process, &entry_counter, &parsed_len) != 2) continue;
+        if (parsed_len != (int)number_len) continue;
+
+        char entry_path[dir_len + entry_len + 1];
+        memcpy(entry_path, path, dir_len);
+        memcpy(&entry_path[dir_len], entry_name, entry_len + 1);
+
+        #ifdef _WIN32
+        remove(entry_path);     // Fails if the file is still open by the save that is writing it
+        #else
+        // The file is removed while its lock is held, so its save cannot start using it meanwhile
+        const int fd = open(entry_path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK);
+        if (fd < 0) continue;
+        if (flock(fd, LOCK_EX | LOCK_NB) == 0) unlink(entry_path);
+        close(fd);
+        #endif // _WIN32
+    }
+
+    closedir(dir);
+}
+
+// Open a temporary file for writing an output, on the same folder as the output's final 'path'
+// 'path' is only used once the output is committed, and it must have space for 5 more characters (a number might be
+// appended to it). 'size' is the expected size of the output, for reserving its space on the disk (zero if unknown).
+// 'flags' are the options of the output ('IMC_OUTPUT_REPLACE' and 'IMC_OUTPUT_SPARSE'). Function returns NULL if the file could not be created.
+// The returned 'OutputFile' should be freed by either 'imc_output_commit()' or 'imc_output_discard()'.
+OutputFile *imc_output_open(char *path, size_t size, uint64_t flags)
+{
+    // Counter that makes the temporary names unique among the threads
+    static atomic_uint temp_counter = 0;
+
+    const size_t temp_size = strlen(path) + 32 + sizeof(IMC_TEMP_SUFFIX);
+    OutputFile *output = imc_calloc(1, sizeof(OutputFile) + temp_size);
+    output->path = path;
+    output->flags = flags;
+
+    // Create the temporary file under a name that no other file has
+    // (so a temporary file of another save is never overwritten, and the ones left behind by interrupted saves are removed)
+    #ifdef _WIN32
+    const unsigned long process_id = GetCurrentProcessId();
+    #else
+    const unsigned long process_id = getpid();
+    #endif // _WIN32
+    __output_sweep(path);
+
+    int fd = -1;
+    for (int i = 0; i <= IMC_MAX_FILENAME_DUPLICATES && fd < 0; i++)
+    {
+        snprintf(
+            output->temp_path, temp_size, "%s.%lx-%x%s",
+            path, process_id, atomic_fetch_add(&temp_counter, 1), IMC_TEMP_SUFFIX
+        );
+
+        #ifdef _WIN32
+        fd = _open(output->temp_path, _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+        #else
+        fd = open(output->temp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+
+        // Lock the file while the output is being written, so it is not taken for one left behind by an interrupted save
+        // (the lock is released when the file is closed). If another process has removed the file before it was locked,
+        // then another name is tried. Note: if the file system does not support locks, the file is not removed either.
+        struct stat temp_stats;
+        if (fd >= 0)
+        {
+            flock(fd, LOCK_EX);
+            if (fstat(fd, &temp_stats) == 0 && temp_stats.st_nlink == 0)
+            {
+                close(fd);
+                fd = -1;
+                errno = EEXIST;
+            }
+        }
+        #endif // _WIN32
+
+        if (fd < 0 && errno != EEXIST) break;
     }
 
-    if (carrier_img->verbose)
+    if (fd < 0)
     {
-        printf("Reading WebP image... ");
-        fflush(stdout);
+        imc_free(output);
+        return NULL;
     }
 
-    // Input buffer (original image)
-    uint8_t *in_buffer = imc_malloc(file_size);
-    const size_t read_count = fread(in_buffer, 1, file_size, carrier_img->file);
-    if (read_count != file_size)
-    {
-        fprintf(stderr, "Error: WebP file could not be read.\n");
-        exit(EXIT_FAILURE);
-    }
+    #ifndef _WIN32
+    // Reserve the space of the output beforehand, so its blocks are allocated together
+    // (it is fine if the file system does not support it)
+    // Note: A sparse output is not reserved, since the space of its holes would stay allocated.
+    if (size > 0 && !(flags & IMC_OUTPUT_SPARSE)) fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size);
+    #endif // _WIN32
 
-    // Data of the decoded WebP image (original file)
-    WebPDecoderConfig *webp_obj = imc_calloc(1, sizeof(WebPDecoderConfig));
-    WebPInitDecoderConfig(webp_obj);
-    VP8StatusCode status_vp8 = WebPGetFeatures(in_buffer, file_size, &webp_obj->input);
+    #ifdef _WIN32
+    output->stream = _fdopen(fd, "wb");
+    if (!output->stream) _close(fd);
+    #else
+    output->stream = fdopen(fd, "wb");
+    if (!output->stream) close(fd);
+    #endif // _WIN32
 
-    if (status_vp8 != VP8_STATUS_OK)
+    if (!output->stream)
     {
-        if (carrier_img->verbose) fprintf(stderr, "\n");
-        fprintf(stderr, "Error: Could not retrieve the header of the WebP image.\n");
-        exit(EXIT_FAILURE);
+        remove(output->temp_path);
+        imc_free(output);
+        return NULL;
     }
 
-    if (webp_obj->input.has_animation)
+    // The image encoders make many small writes, so those are gathered into bigger ones
+    output->buffer = imc_malloc(IMC_OUTPUT_BUFFER_SIZE);
+    setvbuf(output->stream, output->buffer, _IOFBF, IMC_OUTPUT_BUFFER_SIZE);
+
+    return output;
+}
+
+// Get how many bytes at the beginning of a buffer are in blocks of 'IMC_SPARSE_BLOCK_SIZE' bytes that are all zeros
+// (a last partial block counts if it is all zeros). The result is at most 'max_size'.
+static size_t __output_zero_run(const uint8_t *data, size_t size, size_t max_size)
+{
+    if (size > max_size) size = max_size;
+    size_t run = 0;
+
+    while (run < size)
     {
-        if (carrier_img->verbose) fprintf(stderr, "\n");
-        fprintf(stderr, "Error: Animated WebP images are not supported.\n");
-        exit(EXIT_FAILURE);
+        const size_t block = (size - run < IMC_SPARSE_BLOCK_SIZE) ? size - run : IMC_SPARSE_BLOCK_SIZE;
+
+        // The block is all zeros if its first byte is zero, and each byte is equal to the next
+        const uint8_t *const start = &data[run];
+        if (start[0] != 0 || memcmp(start, start + 1, block - 1) != 0) break;
+        run += block;
     }
-    
-    // Set the decoding options
-    webp_obj->options.use_threads = 1;     // Use multithreading
-    #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-    webp_obj->output.colorspace = MODE_ARGB;    // 32-bit color value on big endian byte order
+
+    return run;
+}
+
+// Write a buffer to an output, in chunks of 'IMC_OUTPUT_CHUNK_SIZE' bytes that go straight to the file
+// (instead of being copied through the stream's buffer). Function returns 'false' if the write failed.
+// If the output has the 'IMC_OUTPUT_SPARSE' flag, the runs of at least 'IMC_SPARSE_HOLE_SIZE' zeros are skipped
+// instead of written, which leaves holes on the file (the file system reads them back as zeros, without storing them).
+// The runs are counted in blocks from the beginning of 'data', so they line up with the disk when written from the start of the file.
+bool imc_output_write(OutputFile *output, const uint8_t *data, size_t size)
+{
+    // Anything still on the stream's buffer goes before the data
+    if (fflush(output->stream) != 0) return false;
+    const int fd = fileno(output->stream);
+
+    #ifdef _WIN32
+    const bool sparse = false;  // (on Windows, a file needs to be marked as sparse before it can have holes)
     #else
-    webp_obj->output.colorspace = MODE_BGRA;    // 32-bit color value on little endian byte order
-    #endif
-    
-    // Decode the original image
-    status_vp8 = WebPDecode(in_buffer, file_size, webp_obj);
-    if (status_vp8 != VP8_STATUS_OK)
+    const bool sparse = (output->flags & IMC_OUTPUT_SPARSE);
+    #endif // _WIN32
+
+    while (size > 0)
     {
-        if (carrier_img->verbose) fprintf(stderr, "\n");
-        fprintf(stderr, "Error: Could not decode the WebP image. Reason: ");
-        switch (status_vp8)
+        // Skip a run of zeros
+        if (sparse)
         {
-            case VP8_STATUS_OUT_OF_MEMORY:
-                fprintf(stderr, "no enough memory.\n");
-                break;
-            
-            case VP8_STATUS_NOT_ENOUGH_DATA:
-                fprintf(stderr, "no enough data, the file appears to be corrupted.\n");
-                break;
-            
-            case VP8_STATUS_UNSUPPORTED_FEATURE:
-                fprintf(stderr, "image uses an unsupported feature.\n");
-                break;
-            
-            case VP8_STATUS_BITSTREAM_ERROR:
-                fprintf(stderr, "not a valid WebP image.\n");
-                break;
-            
-            default:
-                fprintf(stderr, "unknown.\n");
-                break;
+            const size_t zeros = __output_zero_run(data, size, SIZE_MAX);
+            if (zeros >= IMC_SPARSE_HOLE_SIZE)
+            {
+                #ifndef _WIN32
+                if (lseek(fd, zeros, SEEK_CUR) < 0) return false;
+                #endif // _WIN32
+
+                data += zeros;
+                size -= zeros;
+                output->hole_at_end = true;
+                continue;
+            }
         }
-        exit(EXIT_FAILURE);
-    }
 
-    if (carrier_img->verbose) printf("Done!  \n");
-
-    // Calculate the total amount of pixels in the image
-    const size_t width = webp_obj->output.width;
-    const size_t height = webp_obj->output.height;
-    const size_t pixel_count = width * height;
-    
-    // Pointers to the carrier bytes of the image
-    carrier_bytes_t *carrier = imc_malloc(sizeof(carrier_bytes_t) * pixel_count * 3);
-    size_t pos = 0; // Position on the carrier array
-    
-    // Loop through all pixels in the image to get the carrier bytes
-    // (we are going to use pixels with alpha > 0, but the alpha channel itself will not be used as carrier)
-    for (size_t i = 0; i < pixel_count; i++)
-    {
-        uint8_t *const pixel = &webp_obj->output.u.RGBA.rgba[i*4];  // Image always is 4 bytes per pixel
-        
-        // Get the 4 color components of the pixel (alpha, red, green, blue)
-        // Note: the alpha value is the most significant byte of a 32-bit unsigned integer,
-        //       followed by red > green > blue (in decreasing order of significance).
-        #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-        uint8_t *const alpha = &pixel[0];
-        uint8_t *const red   = &pixel[1];
-        uint8_t *const green = &pixel[2];
-        uint8_t *const blue  = &pixel[3];
-        #else // __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-        uint8_t *const alpha = &pixel[3];
-        uint8_t *const red   = &pixel[2];
-        uint8_t *const green = &pixel[1];
-        uint8_t *const blue  = &pixel[0];
-        #endif
-        
-        // Use the RGB bytes as carriers if the pixel is not fully transparent
-        if (*alpha > 0)
+        // Write the data up to where the next run of zeros begins (at most a chunk)
+        size_t chunk = (size < IMC_OUTPUT_CHUNK_SIZE) ? size : IMC_OUTPUT_CHUNK_SIZE;
+        if (sparse)
         {
-            carrier[pos++] = red;
-            carrier[pos++] = green;
-            carrier[pos++] = blue;
+            size_t pos = 0;
+            while (pos < chunk)
+            {
+                const size_t zeros = __output_zero_run(&data[pos], size - pos, IMC_SPARSE_HOLE_SIZE);
+                if (zeros >= IMC_SPARSE_HOLE_SIZE) break;
+                pos += zeros + IMC_SPARSE_BLOCK_SIZE;   // (the zeros, then the block that is not all zeros)
+            }
+            if (pos < chunk) chunk = pos;
         }
 
-        // Print the progress when on verbose mode
-        if ( carrier_img->verbose && (i % 4096 == 0) )
+        #ifdef _WIN32
+        const ssize_t written = _write(fd, data, chunk);
+        #else
+        const ssize_t written = write(fd, data, chunk);
+        #endif // _WIN32
+
+        if (written < 0)
         {
-            double percent = ((double)i / (double)pixel_count) * 100.0;
-            printf_prog("Scanning cover image for suitable carrier bits... %.1f %%\r", percent);
+            if (errno == EINTR) continue;
+            return false;
         }
+
+        data += written;
+        size -= written;
+        output->hole_at_end = false;
     }
 
-    printf("Scanning cover image for suitable carrier bits... Done!  \n");
+    return true;
+}
 
-    // Check for edge case
-    if (pos == 0)
+// Give a temporary file the final 'path' of its output, only if that name does not exist yet
+// Function returns 'false' if the file could not be moved ('errno' is EEXIST if the name is taken).
+static bool __output_link(const char *temp_path, const char *path)
+{
+    #ifdef _WIN32
+
+    // Convert the paths to wide char, in order to properly handle UTF-8 characters
+    const int w_temp_len = MultiByteToWideChar(CP_UTF8, 0, temp_path, -1, NULL, 0);
+    const int w_path_len = MultiByteToWideChar(CP_UTF8, 0, path, -1, NULL, 0);
+    wchar_t w_temp[w_temp_len];
+    wchar_t w_path[w_path_len];
+    MultiByteToWideChar(CP_UTF8, 0, temp_path, -1, w_temp, w_temp_len);
+    MultiByteToWideChar(CP_UTF8, 0, path, -1, w_path, w_path_len);
+
+    // Without the flag for replacing, the move fails if the name already exists
+    if (MoveFileExW(w_temp, w_path, MOVEFILE_WRITE_THROUGH)) return true;
+    const DWORD error = GetLastError();
+    errno = (error == ERROR_ALREADY_EXISTS || error == ERROR_FILE_EXISTS) ? EEXIST : EIO;
+    return false;
+
+    #else // Linux
+
+    // Rename without replacing (in a single step)
+    if (renameat2(AT_FDCWD, temp_path, AT_FDCWD, path, RENAME_NOREPLACE) == 0) return true;
+    if (errno != EINVAL && errno != ENOSYS && errno != ENOTSUP) return false;
+
+    // Not every file system supports it, so the next option is a hard link (which also fails if the name exists)
+    if (link(temp_path, path) == 0)
     {
-        fprintf(stderr, "Error: the WebP image has no suitable bits for hiding the data. "
-            "This may happen if the image is fully transparent.\n");
-        exit(EXIT_FAILURE);
+        unlink(temp_path);
+        return true;
     }
-    
-    // Free the unused space of the carrier buffer
-    carrier = imc_realloc(carrier, pos * sizeof(carrier_bytes_t));
-    
-    // Store the structure necessary to handle the opened image
-    carrier_img->object = webp_obj;
+    if (errno == EEXIST) return false;
 
-    // Store the information about the carrier bytes
-    carrier_img->carrier = carrier;
-    carrier_img->carrier_length = pos;
-    carrier_img->bytes = in_buffer;
+    // On a file system without hard links, the name is claimed by an empty file, which the rename then replaces
+    const int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (fd < 0) return false;
+    close(fd);
+    return rename(temp_path, path) == 0;
 
-    // Remember the size of the input buffer
-    carrier_img->heap = imc_malloc(sizeof(void *));
-    carrier_img->heap[0] = imc_malloc(sizeof(size_t));
-    *(size_t*)carrier_img->heap[0] = file_size;
-    carrier_img->heap_length = 1;
+    #endif // _WIN32
 }
 
-// Change a file path in order to make it unique
-// IMPORTANT: Function assumes that the path buffer must be big enough to store the new name.
-// (at most 5 characters are added to the path)
-static bool __resolve_filename_collision(char *path)
+// Move the temporary file of an output to its final path
+// Unless the output has the 'IMC_OUTPUT_REPLACE' flag, a number is appended to the name if it already exists
+// (for example, 'Image.jpg' might become 'Image (1).jpg'). Function returns IMC_ERR_FILE_EXISTS if no unique name
+// was found, or IMC_ERR_SAVE_FAIL if the file could not be moved.
+static int __output_place(OutputFile *output)
 {
-    // Try opening the file for reading to see if it already exists
-    FILE *file = fopen(path, "rb");
-    if (file == NULL) return true;
-    
+    char *const path = output->path;
+
+    if (output->flags & IMC_OUTPUT_REPLACE)
+    {
+        #ifdef _WIN32
+
+        // Convert the paths to wide char, in order to properly handle UTF-8 characters
+        const int w_temp_len = MultiByteToWideChar(CP_UTF8, 0, output->temp_path, -1, NULL, 0);
+        const int w_path_len = MultiByteToWideChar(CP_UTF8, 0, path, -1, NULL, 0);
+        wchar_t w_temp[w_temp_len];
+        wchar_t w_path[w_path_len];
+        MultiByteToWideChar(CP_UTF8, 0, output->temp_path, -1, w_temp, w_temp_len);
+        MultiByteToWideChar(CP_UTF8, 0, path, -1, w_path, w_path_len);
+
+        const bool move_success = MoveFileExW(w_temp, w_path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+
+        #else // Linux
+
+        const bool move_success = (rename(output->temp_path, path) == 0);
+
+        #endif // _WIN32
+
+        return move_success ? IMC_SUCCESS : IMC_ERR_SAVE_FAIL;
+    }
+
+    // Try the name as given
+    if (__output_link(output->temp_path, path)) return IMC_SUCCESS;
+    if (errno != EEXIST) return IMC_ERR_SAVE_FAIL;
+
     // Sanity check (so we don't risk a stack overflow)
     const size_t path_len = strlen(path);
-    if (path_len > UINT16_MAX) return false;
+    if (path_len > UINT16_MAX) return IMC_ERR_FILE_EXISTS;
 
-    // Get the filename without the directories
+    // Split the path into its stem and the extension of the file name (the dots on the directories do not count)
     char path_copy[path_len+1];
-    memset(path_copy, 0, sizeof(path_copy));
-    strncpy(path_copy, path, sizeof(path_copy));
-    char *path_base = basename(path_copy);
-    
-    // Copy the file's extension to a buffer
-    char *dot = strrchr(path_base, '.');
-    if (!dot) dot = "";
-    const size_t e_len = strlen(dot);
-    char extension[e_len+1];
-    memset(extension, 0, sizeof(extension));
-    strncpy(extension, dot, sizeof(extension));
-
-    // Copy the file's stem to a buffer
-    const size_t s_len = strlen(path) - e_len;
-    char stem[s_len+1];
-    memset(stem, 0, sizeof(stem));
-    strncpy(stem, path, s_len);
-    
+    memcpy(path_copy, path, sizeof(path_copy));
+    const char *const dot = strrchr(basename(path_copy), '.');
+    const size_t s_len = dot ? path_len - strlen(dot) : path_len;
+    char extension[path_len - s_len + 1];
+    memcpy(extension, &path[s_len], sizeof(extension));
+
     for (int i = 1; i <= IMC_MAX_FILENAME_DUPLICATES; i++)
     {
-        fclose(file);
-
-        // Create a 'number of the copy' string
-        char copy_num[6];
-        snprintf(copy_num, sizeof(copy_num), " (%d)", i);
-
         // Concatenate the stem, number, and extension to form a new filename
-        memcpy(path, stem, sizeof(stem));
-        strcat(path, copy_num);
-        strcat(path, extension);
+        snprintf(&path[s_len], 5 + sizeof(extension), " (%d)%s", i, extension);
 
-        // Test if the new filename exists
-        file = fopen(path, "rb");
-        if (file == NULL) return true;
+        // The name is only taken if no other file has it (the check and the move are a single step)
+        if (__output_link(output->temp_path, path)) return IMC_SUCCESS;
+        if (errno != EEXIST) return IMC_ERR_SAVE_FAIL;
     }
 
     // No new name could be created
     // (the amount of tries is limited to 99)
-    fclose(file);
-    return false;
+    return IMC_ERR_FILE_EXISTS;
 }
 
-// Check if a given path is a directory
-static bool __is_directory(const char *path)
+// Finish writing an output: flush its temporary file to the disk, then move it to the output's final path
+// If 'times' is not NULL, it has the 'last access' and 'last modified' times that the output gets.
+// Function returns IMC_ERR_SAVE_FAIL if the file could not be written or moved, or IMC_ERR_FILE_EXISTS if its name
+// could not be made unique (the temporary file is removed in those cases). The 'OutputFile' is freed in any case.
+int imc_output_commit(OutputFile *output, const struct timespec times[2])
 {
-    #ifdef _WIN32   // Windows systems
-    DWORD path_attrib = GetFileAttributes(path);
-    if (path_attrib != INVALID_FILE_ATTRIBUTES)
+    FILE *const file = output->stream;
+
+    // The contents must reach the disk before the rename does,
+    // otherwise a crash could leave an empty file under the final name
+    bool write_success = (fflush(file) == 0) && !ferror(file);
+
+    // If the last bytes were skipped as a hole, the file needs to be extended up to where they end
+    #ifndef _WIN32
+    if (write_success && output->hole_at_end)
     {
-        return (path_attrib & FILE_ATTRIBUTE_DIRECTORY);
+        const off_t file_size = lseek(fileno(file), 0, SEEK_CUR);
+        write_success = (file_size >= 0 && ftruncate(fileno(file), file_size) == 0);
     }
-    
-    #else   // Linux systems
-    struct stat path_stat;
-    const bool status = stat(path, &path_stat);
-    if (status == 0) return S_ISDIR(path_stat.st_mode);
-    
-    #endif  // _WIN32
+    #endif // _WIN32
 
-    return false;
-}
+    // The timestamps are set through the open file (after the last write, which would change them)
+    #ifdef _WIN32
+    if (write_success && times)
+    {
+        const FILETIME access_time = __win_timespec_to_filetime(times[0]);
+        const FILETIME mod_time = __win_timespec_to_filetime(times[1]);
+        SetFileTime(__win_get_file_handle(file), NULL, &access_time, &mod_time);
+    }
+    if (write_success) write_success = (_commit(_fileno(file)) == 0);
+    #else
+    if (write_success && times) futimens(fileno(file), times);
+    if (write_success) write_success = (fsync(fileno(file)) == 0);
+    #endif
 
-// Copy the "last access" and "last modified" times from the one file (source) to the other (dest)
-static void __copy_file_times(FILE *source_file, const char *dest_path)
-{
-    #ifdef _WIN32   // Windows systems
-    
-    // Get the handles of the source and destination files
-    // (the destination path string is converted to wide char,
-    //  in order to properly handle UTF-8 characters)
-    
-    HANDLE file_in  = __win_get_file_handle(source_file);
-    
-    size_t path_len = strlen(dest_path) + 1;
-    int w_path_len = MultiByteToWideChar(CP_UTF8, 0, dest_path, path_len, NULL, 0);
-    wchar_t w_path[w_path_len];
-    MultiByteToWideChar(CP_UTF8, 0, dest_path, path_len, w_path, w_path_len);
-    
-    HANDLE file_out = CreateFileW(
-        w_path,                 // Path to the destination file
-        FILE_WRITE_ATTRIBUTES,  // Open file for writing its attributes
-        FILE_SHARE_READ,        // Block file's write access to other programs
-        NULL,                   // Default security
-        OPEN_EXISTING,          // Open the file only if it already exists
-        FILE_ATTRIBUTE_NORMAL,  // Normal file (that is, no system or temporary file)
-        NULL                    // No template for the attributes
-    );
-    if (file_out == INVALID_HANDLE_VALUE) return;
-
-    // Timestamps from the source file
-    FILETIME access_time = {0}; // Last access time
-    FILETIME mod_time = {0};    // Last modified time
-    GetFileTime(file_in, NULL, &access_time, &mod_time);
-
-    // Set those timestamps to the destination file
-    SetFileTime(file_out, NULL, &access_time, &mod_time);
-    CloseHandle(file_out);
-    
-    #else   // Unix systems
-    
-    // Get the "last access" and "last modified" times from the original file
-    const int og_descriptor = fileno(source_file);
-    struct stat og_stats = {0};
-    fstat(og_descriptor, &og_stats);
-    const struct timespec og_last_times[2] = {
-        og_stats.st_atim,
-        og_stats.st_mtim
-    };
+    if (fclose(file) != 0) write_success = false;
+    imc_free(output->buffer);
 
-    // Set those times on the new file to the same as in the original
-    utimensat(AT_FDCWD, dest_path, og_last_times, 0);
+    const int status = write_success ? __output_place(output) : IMC_ERR_SAVE_FAIL;
+    if (status != IMC_SUCCESS) remove(output->temp_path);
 
-    #endif // _WIN32
+    imc_free(output);
+    return status;
+}
+
+// Close and remove the temporary file of an output that could not be written, then free the 'OutputFile'
+void imc_output_discard(OutputFile *output)
+{
+    if (!output) return;
+    fclose(output->stream);
+    remove(output->temp_path);
+    imc_free(output->buffer);
+    imc_free(output);
 }
 
 // Progress monitor when writing a JPEG image
@@ -1432,7 +3214,7 @@ static void __jpeg_write_callback(j_common_ptr jpeg_obj)
 
     // Percentage completed
     const double percent = ((pass_count + (unit_count / unit_max)) / pass_max) * 100.0;
-    printf_prog("Writing JPEG image... %.1f %%\r", percent);
+    __steg_progress((CarrierImage *)jpeg_obj->client_data, IMC_STAGE_WRITE_IMAGE, percent, "Writing JPEG image... %.1f %%\r", percent);
 }
 
 // Write the carrier bytes back to the JPEG image, and save it as a new file
@@ -1453,94 +3235,73 @@ int imc_jpeg_carrier_save(CarrierImage *carrier_img, const char *save_path)
         strcat(jpeg_path, ".jpg");
     }
 
-    // Append a number to the file's stem if the filename already exists
-    // Example: 'Image.jpg' might become 'Image (1).jpg'
-    // Note: The number goes up to 99, in order to avoid creating too many files accidentally
-    bool is_unique = __resolve_filename_collision(jpeg_path);
-    if (!is_unique) return IMC_ERR_FILE_EXISTS;
-
-    // Store a copy of the resulting path
-    free(carrier_img->out_path);
-    carrier_img->out_path = strdup(jpeg_path);
-
-    FILE *jpeg_file = fopen(jpeg_path, "wb");
-    if (!jpeg_file) return IMC_ERR_FILE_NOT_FOUND;
+    // The image is written to a temporary file, which is renamed once complete
+    OutputFile *jpeg_output = imc_output_open(jpeg_path, 0, 0);
+    if (!jpeg_output) return IMC_ERR_FILE_NOT_FOUND;
+    FILE *const jpeg_file = jpeg_output->stream;
 
     // Create a new JPEG compression object 
     struct jpeg_compress_struct jpeg_obj_out;
-    struct jpeg_error_mgr jpeg_err;
-    jpeg_obj_out.err = jpeg_std_error(&jpeg_err);   // Use the default error handler
+    JpegErrorManager jpeg_err;
+    jpeg_obj_out.err = jpeg_std_error(&jpeg_err.base);  // Use the default error messages
+    jpeg_err.base.error_exit = &__jpeg_error_exit;      // But return to our code on error, instead of exiting
     jpeg_create_compress(&jpeg_obj_out);
     jpeg_stdio_dest(&jpeg_obj_out, jpeg_file);
 
     // Get the original image
-    struct jpeg_decompress_struct *jpeg_obj_in = (struct jpeg_decompress_struct *)carrier_img->object;
+    const JpegState *const jpeg_in = (JpegState *)carrier_img->object;
+    struct jpeg_decompress_struct *jpeg_obj_in = jpeg_in->object;
+    JpegErrorManager *const jpeg_err_in = (JpegErrorManager *)jpeg_obj_in->err;
+
+    // Error handling (for both the output and the original images)
+    if (setjmp(jpeg_err.jump)) goto jpeg_save_error;
+    if (setjmp(jpeg_err_in->jump))
+    {
+        jpeg_save_error:
+        if (carrier_img->verbose) printf("\n");
+        imc_free(jpeg_obj_out.progress);
+        jpeg_destroy_compress(&jpeg_obj_out);
+        imc_output_discard(jpeg_output);
+        return IMC_ERR_ENCODE_FAIL;
+    }
     
     // Get the DCT coefficients from the original image
-    jvirt_barray_ptr *jpeg_dct = carrier_img->heap[1];
+    jvirt_barray_ptr *jpeg_dct = jpeg_in->dct;
     /* Note:
         The carrier bytes will be stored back to those DCT coefficients.
         Afterwards, the modified coefficients will be saved on the new image.
     */
     
-    // Iterate over the color components
-    size_t b_pos = 0;
+    // Amount of rows of DCT blocks (counting all color components)
+    size_t row_count = 0;
     for (int comp = 0; comp < jpeg_obj_in->num_components; comp++)
     {
-        // Iterate row by row from from top to bottom
-        for (JDIMENSION y = 0; y < jpeg_obj_in->comp_info[comp].height_in_blocks; y++)
-        {
-            // Array of DCT coefficients for the current color component
-            JBLOCKARRAY coef_array = jpeg_obj_in->mem->access_virt_barray(
-                (j_common_ptr)jpeg_obj_in,  // Pointer to the JPEG object
-                jpeg_dct[comp],             // DCT coefficients for the current color component
-                y,                          // The current row of DCT blocks on the image
-                1,                          // Read one row of DCT blocks at a time
-                true                        // Opening the array in write mode
-            );
+        row_count += jpeg_obj_in->comp_info[comp].height_in_blocks;
+    }
 
-            // Print status message (on verbose)
-            if (carrier_img->verbose)
-            {
-                const double row_count = jpeg_obj_in->comp_info[comp].height_in_blocks;
-                const double row_fraction = ((double)y / row_count) / (double)jpeg_obj_in->num_components;
-                const double comp_fraction = (double)comp / (double)jpeg_obj_in->num_components;
-                const double percent = (comp_fraction + row_fraction) * 100.0;
-                printf_prog("Writing carrier back to the cover image... %.1f %%\r", percent);
-            }
+    // Count the carriers on each row, in order to know where each row's carriers begin
+    const StatsTimer encode_timer = imc_stats_start();
+    CarrierScan scan;
+    __scan_init(&scan, carrier_img, IMC_STAGE_WRITE_CARRIER, "Writing carrier back to the cover image... %.1f %%\r", row_count);
+    __jpeg_gather_rows(&scan, jpeg_obj_in, jpeg_dct, true);
+    scan.output = carrier_img->bytes;
 
-            // Iterate column by column from left to right
-            for (JDIMENSION x = 0; x < jpeg_obj_in->comp_info[comp].width_in_blocks; x++)
-            {
-                // Iterate over the 63 AC coefficients
-                // (the DC coefficient of the block is skipped, because modifying it causes a bigger visual impact,
-                //  because this coefficient represents the average color of the current block of pixels)
-                for (JCOEF i = 1; i < DCTSIZE2; i++)
-                {   
-                    // The current coefficient
-                    const JCOEF coef = coef_array[0][x][i];
-                    static const JCOEF coef_lsb = ~(JCOEF)1;    // Mask for clearing the least significant bit
-
-                    // Only the AC coefficients that are not 0 or 1 are used as carriers
-                    // (that makes the new image to have nearly the same size as the original image,
-                    //  because JPEG compresses zeroes using run length encoding)
-                    if (coef != 0 && coef != 1)
-                    {
-                        // Store the carrier byte
-                        coef_array[0][x][i] &= coef_lsb;
-                        coef_array[0][x][i] |= carrier_img->bytes[b_pos++];
-                    }
-                }
-            }
-        }
-    }
+    const size_t row_width = (row_count > 0) ? (carrier_img->carrier_length / row_count) : 1;
+    const size_t min_rows = 1 + (IMC_PARALLEL_MIN_ITEMS / (row_width + 1));
+    imc_parallel_for(row_count, min_rows, &__jpeg_count_range, &scan);
 
-    // Print status message (on verbose)
-    if (carrier_img->verbose)
+    for (size_t row = 1; row < row_count; row++)
     {
-        printf("Writing carrier back to the cover image... Done!  \n");
+        scan.row_start[row] = scan.row_start[row-1] + scan.row_found[row-1];
     }
 
+    // Write the carrier back to the rows in parallel
+    imc_parallel_for(row_count, min_rows, &__jpeg_write_range, &scan);
+    __scan_free(&scan);
+
+    // Print status message (on verbose)
+    __steg_progress(carrier_img, IMC_STAGE_WRITE_CARRIER, 100.0, "Writing carrier back to the cover image... Done!  \n");
+
     // Write the modified DCT coefficients into the new image
     jpeg_copy_critical_parameters(jpeg_obj_in, &jpeg_obj_out);
     jpeg_obj_out.optimize_coding = true;
@@ -1570,8 +3331,9 @@ int imc_jpeg_carrier_save(CarrierImage *carrier_img, const char *save_path)
     }
 
     // Setup the progress monitor for the JPEG's write operation
-    if (carrier_img->verbose)
+    if (carrier_img->verbose || carrier_img->progress)
     {
+        jpeg_obj_out.client_data = carrier_img;
         jpeg_obj_out.progress = imc_calloc(1, sizeof(struct jpeg_progress_mgr));
         jpeg_obj_out.progress->progress_monitor = &__jpeg_write_callback;
     }
@@ -1579,18 +3341,31 @@ int imc_jpeg_carrier_save(CarrierImage *carrier_img, const char *save_path)
     // Write the new image to disk
     jpeg_finish_compress(&jpeg_obj_out);
     jpeg_destroy_compress(&jpeg_obj_out);
-    fclose(jpeg_file);
+    const long jpeg_size = ftell(jpeg_file);
+    imc_stats_stop(IMC_STATS_ENCODE, &encode_timer, jpeg_size);
+
+    // Move the image to its final name, with the "last access" and "last modified" times of the original image
+    // Note: The number appended to a name that already exists goes up to 99, in order to avoid creating too many files accidentally
+    off_t og_size;
+    struct timespec og_times[2];
+    __steg_file_metadata(carrier_img->file, &og_size, &og_times[0], &og_times[1]);
+    const StatsTimer write_timer = imc_stats_start();
+    const int commit_status = imc_output_commit(jpeg_output, og_times);
+    imc_stats_stop(IMC_STATS_WRITE, &write_timer, jpeg_size);
 
     // Finish the write's progress monitor
-    if (carrier_img->verbose)
+    if (jpeg_obj_out.progress)
     {
         imc_free(jpeg_obj_out.progress);
         jpeg_obj_out.progress = NULL;
-        printf("Writing JPEG image... Done!  \n");
     }
+    if (commit_status != IMC_SUCCESS) return commit_status;
+    __steg_progress(carrier_img, IMC_STAGE_WRITE_IMAGE, 100.0, "Writing JPEG image... Done!  \n");
 
-    // Copy the "last access" and "last modified" times from the original image
-    __copy_file_times(carrier_img->file, jpeg_path);
+    // Store a copy of the resulting path
+    // (a number was appended to the file's stem if the filename already existed, for example 'Image.jpg' might become 'Image (1).jpg')
+    imc_free(carrier_img->out_path);
+    carrier_img->out_path = imc_strdup(jpeg_path);
 
     return IMC_SUCCESS;
 }
@@ -1599,7 +3374,7 @@ int imc_jpeg_carrier_save(CarrierImage *carrier_img, const char *save_path)
 static void __png_write_callback(png_structp png_obj, png_uint_32 row, int pass)
 {
     const double percent = (((double)pass + ((double)row / png_num_rows)) / png_num_passes) * 100.0;
-    printf_prog("Writing PNG image... %.1f %%\r", percent);
+    __steg_progress(png_progress_img, IMC_STAGE_WRITE_IMAGE, percent, "Writing PNG image... %.1f %%\r", percent);
 }
 
 // Write the carrier bytes back to the PNG image, and save it as a new file
@@ -1616,19 +3391,12 @@ int imc_png_carrier_save(CarrierImage *carrier_img, const char *save_path)
         strcat(png_path, ".png");
     }
 
-    // Append a number to the file's stem if the filename already exists
-    // Example: 'Image.png' might become 'Image (1).png'
-    // Note: The number goes up to 99, in order to avoid creating too many files accidentally
-    bool is_unique = __resolve_filename_collision(png_path);
-    if (!is_unique) return IMC_ERR_FILE_EXISTS;
-
-    // Store a copy of the resulting path
-    free(carrier_img->out_path);
-    carrier_img->out_path = strdup(png_path);
-    
     // Open the output file for writing
-    FILE *png_file = fopen(png_path, "wb");
-    if (!png_file) return IMC_ERR_FILE_NOT_FOUND;
+    // (the image is written to a temporary file, which is renamed once complete)
+    OutputFile *png_output = imc_output_open(png_path, 0, 0);
+    if (!png_output) return IMC_ERR_FILE_NOT_FOUND;
+    FILE *const png_file = png_output->stream;
+    const StatsTimer encode_timer = imc_stats_start();
 
     // Retrieve the data from the input PNG file
     PngState *const png_in = (PngState *)carrier_img->object;
@@ -1642,17 +3410,18 @@ int imc_png_carrier_save(CarrierImage *carrier_img, const char *save_path)
     
     if (!png_obj_out || !png_info_out)
     {
-        png_destroy_read_struct(&png_obj_out, &png_info_out, NULL);
-        fprintf(stderr, "Error: No enough memory for writing the PNG file.\n");
-        exit(EXIT_FAILURE);
+        png_destroy_write_struct(&png_obj_out, &png_info_out);
+        imc_output_discard(png_output);
+        return IMC_ERR_NO_MEMORY;
     }
 
     // Error handling
     if (setjmp(png_jmpbuf(png_obj_out)))
     {
-        png_destroy_read_struct(&png_obj_out, &png_info_out, NULL);
-        fprintf(stderr, "Error: Failed to write PNG file.\n");
-        exit(EXIT_FAILURE);
+        if (carrier_img->verbose) printf("\n");
+        png_destroy_write_struct(&png_obj_out, &png_info_out);
+        imc_output_discard(png_output);
+        return IMC_ERR_ENCODE_FAIL;
     }
     
     png_init_io(png_obj_out, png_file);
@@ -1851,8 +3620,9 @@ int imc_png_carrier_save(CarrierImage *carrier_img, const char *save_path)
     }
 
     // Setup the progress monitor (when on verbose)
-    if (carrier_img->verbose)
+    if (carrier_img->verbose || carrier_img->progress)
     {
+        png_progress_img = carrier_img;
         png_set_write_status_fn(png_obj_out, &__png_write_callback);
     }
 
@@ -1865,11 +3635,24 @@ int imc_png_carrier_save(CarrierImage *carrier_img, const char *save_path)
     // Finish saving the output image
     png_write_end(png_obj_out, png_info_out);
     png_destroy_write_struct(&png_obj_out, &png_info_out);
-    fclose(png_file);
-    if (carrier_img->verbose) printf("Writing PNG image... Done!  \n");
+    const long png_size = ftell(png_file);
+    imc_stats_stop(IMC_STATS_ENCODE, &encode_timer, png_size);
+
+    // Move the image to its final name, with the "last access" and "last modified" times of the original image
+    // Note: The number appended to a name that already exists goes up to 99, in order to avoid creating too many files accidentally
+    off_t og_size;
+    struct timespec og_times[2];
+    __steg_file_metadata(carrier_img->file, &og_size, &og_times[0], &og_times[1]);
+    const StatsTimer write_timer = imc_stats_start();
+    const int commit_status = imc_output_commit(png_output, og_times);
+    imc_stats_stop(IMC_STATS_WRITE, &write_timer, png_size);
+    if (commit_status != IMC_SUCCESS) return commit_status;
+    __steg_progress(carrier_img, IMC_STAGE_WRITE_IMAGE, 100.0, "Writing PNG image... Done!  \n");
 
-    // Copy the "last access" and "last modified" times from the original image
-    __copy_file_times(carrier_img->file, png_path);
+    // Store a copy of the resulting path
+    // (a number was appended to the file's stem if the filename already existed, for example 'Image.png' might become 'Image (1).png')
+    imc_free(carrier_img->out_path);
+    carrier_img->out_path = imc_strdup(png_path);
 
     return IMC_SUCCESS;
 }
@@ -1879,7 +3662,9 @@ static int __webp_write_callback(int percent, const WebPPicture* webp_obj)
 {
     // Note: libwebp has its own timer for controlling the progress update frequency,
     //       so we are not using ours from 'printf_prog()'.
-    printf("Writing WebP image... %d %%\r", percent);
+    CarrierImage *const carrier_img = (CarrierImage *)webp_obj->user_data;
+    if (carrier_img->progress) carrier_img->progress(IMC_STAGE_WRITE_IMAGE, percent, carrier_img->progress_data);
+    else printf("Writing WebP image... %d %%\r", percent);
     return true;    // Returning 'true' allows the encoding to continue, 'false' would cancel it
 }
 
@@ -1897,26 +3682,20 @@ int imc_webp_carrier_save(CarrierImage *carrier_img, const char *save_path)
         strcat(webp_path, ".webp");
     }
 
-    // Append a number to the file's stem if the filename already exists
-    // Example: 'Image.webp' might become 'Image (1).webp'
-    // Note: The number goes up to 99, in order to avoid creating too many files accidentally
-    bool is_unique = __resolve_filename_collision(webp_path);
-    if (!is_unique) return IMC_ERR_FILE_EXISTS;
-
-    // Store a copy of the resulting path
-    free(carrier_img->out_path);
-    carrier_img->out_path = strdup(webp_path);
-    
     // Open the output file for writing
-    FILE *webp_file = fopen(webp_path, "wb");
-    if (!webp_file) return IMC_ERR_FILE_NOT_FOUND;
+    // (the image is written to a temporary file, which is renamed once complete)
+    OutputFile *webp_output = imc_output_open(webp_path, 0, 0);
+    if (!webp_output) return IMC_ERR_FILE_NOT_FOUND;
+    FILE *const webp_file = webp_output->stream;
+    const StatsTimer encode_timer = imc_stats_start();
     
     // Decoded original image
-    const WebPDecoderConfig *restrict webp_obj_in = carrier_img->object;
+    const WebpState *const webp_in = (WebpState *)carrier_img->object;
+    const WebPDecoderConfig *restrict webp_obj_in = &webp_in->config;
 
     // Encoded original image
     const uint8_t *restrict in_buffer = carrier_img->bytes;
-    const size_t in_buffer_size = *(size_t*)carrier_img->heap[0];
+    const size_t in_buffer_size = webp_in->in_size;
 
     // Configurations of the encoder for the output image
     WebPConfig enc_config;
@@ -1925,12 +3704,12 @@ int imc_webp_carrier_save(CarrierImage *carrier_img, const char *save_path)
     
     if (!enc_status)
     {
-        fclose(webp_file);
+        imc_output_discard(webp_output);
         const int version = WebPGetEncoderVersion();
         fprintf(stderr,
             "Error: Using a different version of libwebp than the one used to build this program (%d.%d.%d).\n",
             (version >> 16) & 0xFF, (version >> 8) & 0xFF, (version >> 0) & 0xFF);
-        exit(EXIT_FAILURE);
+        return IMC_ERR_ENCODE_FAIL;
     }
     
     enc_config.exact = 1;           // Do not make any changes to the color values
@@ -1948,7 +3727,11 @@ int imc_webp_carrier_save(CarrierImage *carrier_img, const char *save_path)
     webp_obj_new.use_argb = 1;
     webp_obj_new.argb = (uint32_t*)(webp_obj_in->output.u.RGBA.rgba);
     webp_obj_new.argb_stride = webp_obj_in->output.u.RGBA.stride / 4;
-    if (carrier_img->verbose) webp_obj_new.progress_hook = &__webp_write_callback;
+    if (carrier_img->verbose || carrier_img->progress)
+    {
+        webp_obj_new.progress_hook = &__webp_write_callback;
+        webp_obj_new.user_data = carrier_img;
+    }
 
     // Object for writing the new WebP image
     WebPMemoryWriter writer;
@@ -1961,9 +3744,10 @@ int imc_webp_carrier_save(CarrierImage *carrier_img, const char *save_path)
 
     if (!enc_status)
     {
-        fclose(webp_file);
-        fprintf(stderr, "Error: Could not encode the new WebP image.\n");
-        exit(EXIT_FAILURE);
+        if (carrier_img->verbose) printf("\n");
+        imc_output_discard(webp_output);
+        WebPMemoryWriterClear(&writer);
+        return IMC_ERR_ENCODE_FAIL;
     }
 
     /* Copying the metadata from the original image */
@@ -2026,60 +3810,51 @@ int imc_webp_carrier_save(CarrierImage *carrier_img, const char *save_path)
         fwrite(writer.mem, 1, writer.size, webp_file);
     }
     
-    if (carrier_img->verbose) printf("Writing WebP image... Done!  \n");
-    fclose(webp_file);
-
-    // Copy the "last access" and "last modified" times from the original image
-    __copy_file_times(carrier_img->file, webp_path);
-
     // Garbage collection
     WebPDataClear(&out_data);
     WebPMemoryWriterClear(&writer);
     WebPPictureFree(&webp_obj_new);
+    const long webp_size = ftell(webp_file);
+    imc_stats_stop(IMC_STATS_ENCODE, &encode_timer, webp_size);
+
+    // Move the image to its final name, with the "last access" and "last modified" times of the original image
+    // Note: The number appended to a name that already exists goes up to 99, in order to avoid creating too many files accidentally
+    off_t og_size;
+    struct timespec og_times[2];
+    __steg_file_metadata(carrier_img->file, &og_size, &og_times[0], &og_times[1]);
+    const StatsTimer write_timer = imc_stats_start();
+    const int commit_status = imc_output_commit(webp_output, og_times);
+    imc_stats_stop(IMC_STATS_WRITE, &write_timer, webp_size);
+    if (commit_status != IMC_SUCCESS) return commit_status;
+    __steg_progress(carrier_img, IMC_STAGE_WRITE_IMAGE, 100.0, "Writing WebP image... Done!  \n");
 
-    return IMC_SUCCESS;
-}
+    // Store a copy of the resulting path
+    // (a number was appended to the file's stem if the filename already existed, for example 'Image.webp' might become 'Image (1).webp')
+    imc_free(carrier_img->out_path);
+    carrier_img->out_path = imc_strdup(webp_path);
 
-// Free the memory of the array of heap pointers in a CarrierImage struct
-static void __carrier_heap_free(CarrierImage *carrier_img)
-{
-    for (size_t i = 0; i < carrier_img->heap_length; i++)
-    {
-        imc_free(carrier_img->heap[i]);
-    }
-    imc_free(carrier_img->heap);
+    return IMC_SUCCESS;
 }
 
-// Close the JPEG object and free the memory associated to it
+// Close the JPEG object (the memory of the image is freed along with its arena)
 void imc_jpeg_carrier_close(CarrierImage *carrier_img)
 {
-    jpeg_destroy((j_common_ptr)carrier_img->object);
-    imc_free(carrier_img->bytes);
-    imc_free(carrier_img->carrier);
-    imc_free(carrier_img->object);
-    __carrier_heap_free(carrier_img);
+    JpegState *const jpeg = (JpegState *)carrier_img->object;
+    imc_pool_jpeg_give(jpeg->object);
 }
 
-// Close the PNG object and free the memory associated to it
+// Close the PNG object (the memory of the image is freed along with its arena)
 void imc_png_carrier_close(CarrierImage *carrier_img)
 {
     PngState *const png = (PngState *)carrier_img->object;
     png_destroy_read_struct(&png->object, &png->info, NULL);
-    imc_free(png->row_pointers);
-    imc_free(carrier_img->carrier);
-    __carrier_heap_free(carrier_img);
-    free(png);
 }
 
-// Close the WebP object and free the memory associated to it
+// Close the WebP object (the memory of the image is freed along with its arena)
 void imc_webp_carrier_close(CarrierImage *carrier_img)
 {
-    WebPDecoderConfig *restrict webp_obj = carrier_img->object;
-    WebPFreeDecBuffer(&webp_obj->output);
-    imc_free(carrier_img->bytes);
-    imc_free(carrier_img->carrier);
-    imc_free(carrier_img->object);
-    __carrier_heap_free(carrier_img);
+    WebpState *const webp = (WebpState *)carrier_img->object;
+    WebPFreeDecBuffer(&webp->config.output);
 }
 
 // Save the image with hidden data
@@ -2091,6 +3866,9 @@ int imc_steg_save(CarrierImage *carrier_img, const char *save_path)
 // Free the memory of the data structures used for steganography
 void imc_steg_finish(CarrierImage *carrier_img)
 {
+    // Count the image on the statistics (the position on the carrier is how many bits the hidden files took)
+    imc_stats_add_carrier(carrier_img->carrier_length, carrier_img->carrier_pos);
+
     // Close the open files
     carrier_img->close(carrier_img);
     fclose(carrier_img->file);
@@ -2099,12 +3877,81 @@ void imc_steg_finish(CarrierImage *carrier_img)
     imc_crypto_context_destroy(carrier_img->crypto);
     imc_free(carrier_img->out_path);
     imc_free(carrier_img->steg_info);
-    imc_free(carrier_img);
+    imc_memory_close(carrier_img->reserved_memory);
+    imc_arena_destroy(carrier_img->arena);
+}
+
+// Get a short description of a status code returned by the steganographic functions
+const char *imc_steg_strerror(int status)
+{
+    switch (status)
+    {
+        case IMC_SUCCESS:               return "success";
+        case IMC_ERR_NO_MEMORY:         return "no enough memory";
+        case IMC_ERR_INVALID_PASS:      return "invalid password";
+        case IMC_ERR_FILE_NOT_FOUND:    return "file could not be opened";
+        case IMC_ERR_FILE_INVALID:      return "not a valid JPEG, PNG or WebP image";
+        case IMC_ERR_FILE_TOO_BIG:      return "no enough space in the cover image";
+        case IMC_ERR_CRYPTO_FAIL:       return "could not encrypt or decrypt the data";
+        case IMC_ERR_FILE_EXISTS:       return "a file with the same name already exists";
+        case IMC_ERR_PAYLOAD_OOB:       return "image is too small to contain hidden data";
+        case IMC_ERR_INVALID_MAGIC:     return "no hidden data or the password is incorrect";
+        case IMC_ERR_NEWER_VERSION:     return "data was hidden by a newer version of this program";
+        case IMC_ERR_SAVE_FAIL:         return "could not save the file";
+        case IMC_ERR_NAME_TOO_LONG:     return "file name is too long";
+        case IMC_ERR_FILE_CORRUPTED:    return "file is corrupted or changed while being read";
+        case IMC_ERR_PATH_IS_DIR:       return "path is a directory";
+        case IMC_ERR_NO_CARRIER:        return "image has no suitable bits for hiding data";
+        case IMC_ERR_ENCODE_FAIL:       return "could not encode the image";
+        case IMC_ERR_INPUT_TOO_BIG:     return "file is bigger than the maximum of 500 MB";
+        case IMC_ERR_SOCKET_FAIL:       return "socket could not be created or used";
+        case IMC_ERR_BAD_REQUEST:       return "malformed request";
+        case IMC_ERR_CANCELLED:         return "operation was cancelled";
+        case IMC_ERR_MEMORY_BUDGET:     return "needs more memory than the maximum allowed";
+        case IMC_ERR_SHARD_STREAM:      return "part of a split file cannot be written to a stream";
+        case IMC_ERR_TREE_STREAM:       return "hidden folder can only be written to a stream as a tar archive";
+        default:                        return "unknown error";
+    }
+}
+
+// Report the progress of a stage of the steganographic operations
+// If the image has a progress callback, the percentage is passed to it. Otherwise, on verbose mode,
+// the 'message' is printed (at most once each 1/6 second, unless the stage has completed).
+static void __steg_progress(CarrierImage *carrier_img, enum ProgressStage stage, double percent, const char *message, ...)
+{
+    if (carrier_img->progress)
+    {
+        carrier_img->progress(stage, percent, carrier_img->progress_data);
+    }
+    else if (carrier_img->verbose)
+    {
+        va_list arguments;
+        va_start(arguments, message);
+        if (percent >= 100.0)
+        {
+            vprintf(message, arguments);
+            fflush(stdout);
+        }
+        else
+        {
+            vprintf_prog(message, arguments);
+        }
+        va_end(arguments);
+    }
 }
 
 // Print text at most once each 1/6 second
 // Note: function intended for the progress monitor, it uses the same format as 'printf()'.
 void printf_prog(const char *format, ...)
+{
+    va_list arguments;
+    va_start(arguments, format);
+    vprintf_prog(format, arguments);
+    va_end(arguments);
+}
+
+// Same as 'printf_prog()', but taking a 'va_list' instead of variable arguments
+void vprintf_prog(const char *format, va_list arguments)
 {
     static const clock_t wait_millis = 166;   // Amount of milliseconds to wait before printing again
     static _Thread_local clock_t last_time = -wait_millis;  // Timestamp (in milliseconds) when printed for the last time
@@ -2115,11 +3962,8 @@ void printf_prog(const char *format, ...)
     // Print the formatted text if at least 166 milliseconds have passed
     if (now - last_time >= wait_millis)
     {
-        va_list arguments;
-        va_start(arguments, format);
         vprintf(format, arguments);
         fflush(stdout);
-        va_end(arguments);
         last_time = now;
     }
 }
@@ -32,8 +32,19 @@
     - 8 bytes: size in bytes of the file's name (counting the null terminator at the end)
     - (variable): file's name (null-terminated string encoded in UTF-8)
     - (variable): the file itself
+
+    When a file is split among many images, each image has a shard of the compressed file instead.
+    The version of the compressed data is then 'IMC_FILEINFO_SHARD', and the file itself is replaced by
+    a 'ShardHeader' followed by the shard's data (see 'imc_shard.h').
 */
 
+// Parallel compression of the hidden files
+// Files bigger than a chunk are compressed in independent chunks (using the end of the previous chunk as the dictionary),
+// which are then joined into a single Zlib stream. The chunk size does not depend on the amount of threads,
+// so the same file always compresses to the same output.
+#define IMC_DEFLATE_CHUNK       1048576 // Size in bytes of the uncompressed chunks
+#define IMC_DEFLATE_DICTIONARY  32768   // Amount of bytes from the previous chunk used as the dictionary (the size of Deflate's window)
+
 // Flags for the 'imc_steg_init()' function
 #define IMC_VERBOSE     (uint64_t)1 // Prints the progress of each step
 #define IMC_JUST_CHECK  (uint64_t)2 // Checks for the hidden file's info without saving the file
@@ -43,9 +54,42 @@ typedef uint8_t *carrier_bytes_t;
 
 enum ImageType {IMC_JPEG, IMC_PNG, IMC_WEBP};
 
+// Amount of bytes at the beginning of an image file needed for determining its format
+#define IMC_SIGNATURE_SIZE 12
+
+// Suffix of the temporary file where an output is written, before being moved to its final path
+// (so an interrupted save never leaves a half written file under the final name)
+#define IMC_TEMP_SUFFIX ".imc-tmp"
+
+#define IMC_OUTPUT_BUFFER_SIZE  262144      // Size in bytes of the buffer of the stream where an output is written
+#define IMC_OUTPUT_CHUNK_SIZE   4194304     // Size in bytes of the writes of 'imc_output_write()'
+#define IMC_OUTPUT_REPLACE      (1 << 0)    // Flag: the output replaces a file with the same name (instead of getting a number appended)
+#define IMC_OUTPUT_SPARSE       (1 << 1)    // Flag: the runs of zeros written by 'imc_output_write()' are left as holes on the file
+#define IMC_SPARSE_BLOCK_SIZE   4096        // Size in bytes of the blocks checked for zeros (the usual block size of the file systems)
+#define IMC_SPARSE_HOLE_SIZE    65536       // Smallest run of zeros that is left as a hole (so the file is not split into too many pieces)
+
+// Stages of the steganographic operations (reported to the progress callback)
+enum ProgressStage {
+    IMC_STAGE_READ_IMAGE,       // Decoding the cover image
+    IMC_STAGE_SCAN_CARRIER,     // Finding the bits of the image that can carry hidden data
+    IMC_STAGE_SHUFFLE,          // Shuffling the read/write order of the carrier
+    IMC_STAGE_WRITE_DATA,       // Writing the encrypted data to the carrier
+    IMC_STAGE_WRITE_CARRIER,    // Writing the carrier back to the image's pixels or coefficients (JPEG only)
+    IMC_STAGE_WRITE_IMAGE,      // Encoding the image with the hidden data
+};
+
+// Function that receives the progress of a stage (from 0 to 100 percent)
+typedef void (*imc_progress_func)(enum ProgressStage stage, double percent, void *user_data);
+
+// Function that receives the result of hiding each file of 'imc_steg_insert_many()' (in the order of the files)
+typedef void (*imc_insert_func)(size_t index, int status, void *user_data);
+
+// Function that receives the result of extracting each file of 'imc_steg_extract_all()' (in the order of the files)
+typedef void (*imc_extract_func)(size_t index, int status, void *user_data);
+
 // Pointers to the steganographic functions
 struct CarrierImage;
-typedef void (*carrier_open_func)(struct CarrierImage *);
+typedef int (*carrier_open_func)(struct CarrierImage *);
 typedef int (*carrier_save_func)(struct CarrierImage *, const char *save_path);
 typedef void (*carrier_close_func)(struct CarrierImage *);
 
@@ -59,12 +103,17 @@ typedef struct CarrierImage
     enum ImageType type;    // Format of the image
     char *out_path;         // Path where was saved the image with the hidden data
     struct FileMetadata *steg_info; // The metadata of the most recent extracted file
+    const char *out_dir;    // Directory where to save the extracted files (if NULL, the current working directory is used)
+    FILE *out_stream;       // Stream where to write the extracted files, instead of saving them (NULL for saving them to 'out_dir')
+    bool out_tar;           // Whether the files written to 'out_stream' are added to a tar archive (otherwise their contents are written as-is)
     
     // Manipulation of the file's carrier
     carrier_bytes_t bytes;      // Carrier bytes (same order as on the image)
     carrier_bytes_t *carrier;   // Array of pointers to the carrier bytes of the image (array order is shuffled using the password)
     size_t carrier_length;      // Amount of carrier bytes
     size_t carrier_pos;         // Current writing position on the 'carrier' array
+    uint32_t width;             // Width of the image in pixels
+    uint32_t height;            // Height of the image in pixels
     carrier_open_func open;     // Find the carrier bytes
     carrier_save_func save;     // Hide data in the carrier
     carrier_close_func close;   // Free the memory used for the carrier operation
@@ -72,10 +121,12 @@ typedef struct CarrierImage
     // Operation flags
     bool verbose;       // Whether to print the progress of each operation
     bool just_check;    // Whether to just check for the info of the hidden file instead of saving the file
+    imc_progress_func progress; // Receives the progress of each operation, instead of it being printed (NULL for printing)
+    void *progress_data;        // Pointer passed to the 'progress' function
     
     // Memory management
-    void **heap;            // Array of pointers to other heap allocated memory for this image
-    size_t heap_length;     // Amount of elements on the 'heap' array
+    struct MemoryArena *arena;  // Region from where this struct and the buffers of the image are allocated
+    size_t reserved_memory;     // Amount of memory that the image has reserved from the budget ('--max-memory' option)
 } CarrierImage;
 
 // Store the metadata of the hidden file
@@ -84,6 +135,11 @@ typedef struct FileMetadata {
     struct timespec mod_time;       // Last modified time of the file
     struct timespec steg_time;      // Time when the file was hidden by this program
     size_t file_size;               // Size in bytes of the hidden file
+    uint32_t shard_index;           // Position of the shard on its set, starting from zero (if 'shard_count' is not zero)
+    uint32_t shard_count;           // Amount of shards that the file was split into (zero if the file was hidden whole)
+    bool is_joined;                 // Whether this shard was the last one missing, so the whole file was saved
+    bool is_tree;                   // Whether a whole folder was hidden (then the size is the sum of its files)
+    size_t entry_count;             // Amount of files and subfolders on the hidden folder (if 'is_tree' is true)
     size_t name_size;               // Size in bytes of the file's name (counting the null terminator)
     char file_name[];               // Name of the file as a C-style string
 } FileMetadata;
@@ -115,6 +171,84 @@ typedef struct __attribute__ ((__packed__)) FileInfo
     uint8_t file_name[];            // Null-terminated string of the file name (with extension, if any)
 } FileInfo;
 
+// A file mapped into memory for reading (on Windows, its contents are read into a buffer)
+typedef struct MappedFile {
+    const uint8_t *data;            // Contents of the file (NULL if the file is empty)
+    size_t size;                    // Size in bytes of the file
+    bool is_mapped;                 // Whether 'data' is a memory map (otherwise it is a buffer allocated with 'imc_malloc()')
+    struct timespec access_time;    // Last access time of the file
+    struct timespec mod_time;       // Last modified time of the file
+} MappedFile;
+
+// A file that was compressed and encrypted, and is ready to be written to the carrier of an image
+// Note: the encrypted stream does not depend on the image, so it can be written to many images that use the same key.
+typedef struct PreparedPayload {
+    char *file_name;            // Name of the file (for the status messages)
+    uint8_t *stream;            // Encrypted stream, exactly as it is written to the carrier
+    size_t size;                // Size in bytes of the encrypted stream
+    size_t reserved_memory;     // Memory reserved from the budget for the stream (zero if there is no budget)
+} PreparedPayload;
+
+// File being written, which only gets its final name once complete
+// Note: The temporary file is created under a name that no other file has, and it is moved to the final path without
+//       replacing a file that already exists there. So many threads can save to the same folder at the same time.
+typedef struct OutputFile {
+    FILE *stream;       // Where the output is written (the temporary file)
+    char *path;         // Final path of the output (a number is appended to it if the name is taken)
+    char *buffer;       // Buffer of the stream
+    uint64_t flags;     // Options of the output ('IMC_OUTPUT_REPLACE' and 'IMC_OUTPUT_SPARSE')
+    bool hole_at_end;   // Whether the last bytes of the output were skipped as a hole (so the size has to be set when committing)
+    char temp_path[];   // Path of the temporary file (on the same folder as the final path)
+} OutputFile;
+
+// Files being hidden in the same image by 'imc_steg_insert_many()'
+typedef struct InsertPipeline {
+    struct CarrierImage *carrier_img;   // Image where the files are hidden
+    char *const *paths;                 // Paths to the files ("-" for the data coming from 'stream')
+    FILE *stream;                       // Stream hidden in place of the "-" path (for example, the standard input)
+    const char *stream_name;            // Name under which the stream's data is stored
+    PreparedPayload **payloads;         // Each file once compressed and encrypted (NULL if not prepared yet, or if it failed)
+    int *statuses;                      // Status code of preparing each file
+    int *errors;                        // Value of 'errno' after preparing each file (so the reason of a failure reaches the calling thread)
+    imc_insert_func report;             // Receives the result of hiding each file
+    void *report_data;                  // Passed to the 'report' function
+} InsertPipeline;
+
+// A hidden file on its way from the carrier to the disk
+typedef struct ExtractEntry {
+    uint8_t header[crypto_secretstream_xchacha20poly1305_HEADERBYTES];  // Header generated during encryption
+    uint8_t *crypto_buffer;             // Encrypted stream read from the carrier (NULL once decrypted)
+    size_t crypto_size;                 // Size in bytes of the encrypted stream
+    uint8_t *buffer;                    // Decompressed data: the file's metadata ('FileInfo') followed by its contents
+    size_t file_start;                  // Position on 'buffer' where the file's contents begin
+    size_t file_size;                   // Size in bytes of the file's contents
+    uint32_t version;                   // Version of the file's metadata ('IMC_FILEINFO_VERSION', '_SHARD', or '_TREE')
+    FileMetadata *info;                 // Metadata of the file (NULL if it could not be decoded)
+    int status;                         // Status code of decoding the file
+    size_t reserved_memory;             // Memory reserved from the budget for the buffers above (zero if there is no budget)
+} ExtractEntry;
+
+// Files being extracted from the same image by 'imc_steg_extract_all()'
+typedef struct ExtractPipeline {
+    struct CarrierImage *carrier_img;   // Image from where the files are extracted
+    ExtractEntry *entries;              // Each file hidden on the image, in the order they were read
+    bool stopped;                       // Whether a file failed (the files after it are skipped)
+    imc_extract_func report;            // Receives the result of extracting each file
+    void *report_data;                  // Passed to the 'report' function
+} ExtractPipeline;
+
+// Error manager for libjpeg-turbo, which allows recovering from errors instead of exiting the program
+typedef struct JpegErrorManager {
+    struct jpeg_error_mgr base; // Default error manager (it is the first member, so both structs share the same address)
+    jmp_buf jump;               // Where to return to when an error happens
+} JpegErrorManager;
+
+// Internal state of the JPEG manipulation functions
+typedef struct JpegState {
+    struct jpeg_decompress_struct *object;
+    jvirt_barray_ptr *dct;  // DCT coefficients of the image (managed by libjpeg-turbo)
+} JpegState;
+
 // Internal state of the PNG manipulation functions
 typedef struct PngState {
     png_structp object;
@@ -122,9 +256,126 @@ typedef struct PngState {
     png_bytep *row_pointers;
 } PngState;
 
+// Internal state of the WebP manipulation functions
+typedef struct WebpState {
+    WebPDecoderConfig config;   // Decoded image
+    size_t in_size;             // Size in bytes of the encoded image (on the 'bytes' array of the CarrierImage)
+} WebpState;
+
+// Rows of an image that are scanned in parallel for carrier bytes (or that have the carrier written back to them)
+// Each row's carriers go to their own region of the output array, and the regions are joined afterwards,
+// so the carrier ends up in the same order as if the image had been scanned row by row.
+typedef struct CarrierScan {
+    CarrierImage *carrier_img;  // Image being processed (for reporting the progress)
+    enum ProgressStage stage;   // Stage reported as the progress
+    const char *message;        // Progress message on verbose mode (with a '%.1f' for the percentage)
+    pthread_t owner;            // Thread that reports the progress (the one that started the scan)
+    atomic_size_t rows_done;    // Amount of rows processed so far
+    size_t row_count;           // Amount of rows (counting all color components)
+    size_t *row_start;          // Position on the output array where the carriers of each row begin
+    size_t *row_found;          // Amount of carriers on each row
+    void *output;               // Array of carrier bytes (JPEG) or of pointers to the carrier bytes (PNG and WebP)
+
+    // JPEG images
+    JBLOCKROW *jpeg_rows;       // Rows of DCT blocks
+    JDIMENSION *jpeg_widths;    // Amount of blocks on each row
+
+    // PNG and WebP images
+    uint8_t **pixel_rows;       // Rows of pixels
+    size_t width;               // Amount of pixels on each row
+    size_t num_channels;        // Amount of channels per pixel (including the alpha channel, if any)
+    size_t num_colors;          // Amount of color channels per pixel
+    int bit_depth;              // Bits per channel (8 or 16)
+    bool has_alpha;             // Whether the last channel of a pixel is the alpha channel
+} CarrierScan;
+
+// A chunk of the data being compressed in parallel
+typedef struct DeflateChunk {
+    uint8_t *data;              // Compressed chunk (raw Deflate, without the Zlib header)
+    size_t size;                // Size in bytes of the compressed chunk
+    uLong adler;                // Adler-32 checksum of the uncompressed chunk
+    int status;                 // Status code returned by Zlib (Z_OK on success)
+} DeflateChunk;
+
+// State of a compression that runs in parallel
+typedef struct ParallelDeflate {
+    const uint8_t *prefix;      // Data compressed before the input (its end is the dictionary of the first chunk)
+    size_t prefix_size;         // Size in bytes of the prefix (zero if there is none)
+    const uint8_t *input;       // Data being compressed
+    size_t input_size;          // Size in bytes of the data being compressed
+    DeflateChunk *chunks;       // Chunks that were compressed but not yet added to the output
+    uint8_t *output;            // Buffer where the Zlib stream is written
+    size_t output_size;         // Size in bytes of the output buffer
+    size_t output_pos;          // Amount of bytes written to the output
+    uLong adler;                // Adler-32 checksum of the chunks added to the output so far
+    int level;                  // Compression level of Zlib
+    int status;                 // Z_OK, or the first error that happened
+} ParallelDeflate;
+
+// Determine the format of an image from the first bytes of its file (at least 'IMC_SIGNATURE_SIZE' bytes should be given)
+// Function returns 'false' if the format is not supported.
+bool imc_steg_detect_type(const uint8_t *signature, size_t size, enum ImageType *output);
+
+// Open an image and allocate the struct that holds its steganographic data
+// (the image format is determined from the file's signature)
+static int __steg_open_image(const char *path, CarrierImage **output, uint64_t flags);
+
+// Get the carrier bytes of an open image, and shuffle them using the image's secret key
+// On failure, the image is closed and its struct is freed.
+static int __steg_load_carrier(CarrierImage *carrier_img);
+
+// Reserve from the memory budget what an image needs, before its buffers are allocated (if there is a budget)
+// 'base' is the memory that the image needs for certain, and 'worst' the most that it might need (depending on how many
+// carrier bytes it has). Function returns IMC_ERR_MEMORY_BUDGET if 'base' alone is bigger than the budget.
+static int __steg_reserve_memory(CarrierImage *carrier_img, size_t base, size_t worst);
+
+// Reduce the memory reserved by an image to what it actually uses, after its carrier bytes were found
+// 'external' is the memory of the image that was not allocated from its arena (by the image libraries).
+// Function returns IMC_ERR_MEMORY_BUDGET if the image uses more memory than the budget.
+static int __steg_settle_memory(CarrierImage *carrier_img, size_t external);
+
+// Reserve from the memory budget the buffers of a file being hidden or extracted (if there is a budget)
+// The amount is added to 'reserved'. Function returns IMC_ERR_MEMORY_BUDGET if the buffers do not fit in the budget.
+static int __steg_reserve_buffers(size_t bytes, size_t *reserved);
+
+// Give back to the memory budget what was reserved for the buffers of a file, except for 'keep' bytes
+static void __steg_release_buffers(size_t *reserved, size_t keep);
+
+// Shuffle the array of pointers to the carrier bytes, using the image's secret key
+// (so the order that the bytes are written depends on the password)
+static void __steg_shuffle_carrier(CarrierImage *carrier_img);
+
 // Initialize an image for hiding data in it
 int imc_steg_init(const char *path, const PassBuff *password, CarrierImage **output, uint64_t flags);
 
+// Initialize an image for hiding data in it, using a secret key that was already generated
+// (the key is copied, so the same one can be used for initializing multiple images)
+// If 'progress' is not NULL, it receives the progress of the operations on the image (along with 'progress_data').
+int imc_steg_init_from_key(
+    const char *path,
+    const CryptoContext *key,
+    CarrierImage **output,
+    uint64_t flags,
+    imc_progress_func progress,
+    void *progress_data
+);
+
+// Open an image and get its carrier bytes, without shuffling them
+// The carrier stays in the same order as on the image until a key is set with 'imc_steg_set_key()'.
+// This allows the decoding and scanning of the image to be done only once for many hiding operations.
+int imc_steg_open_cover(const char *path, CarrierImage **output, uint64_t flags);
+
+// Set the secret key of an open image, then shuffle its carrier using the key
+// The results of the previous operations on the image are cleared (the write position goes back to the beginning),
+// but the carrier bytes themselves are not restored, and the carrier is shuffled starting from its current order.
+// If 'progress' is not NULL, it receives the progress of the operations on the image (along with 'progress_data').
+int imc_steg_set_key(CarrierImage *carrier_img, const CryptoContext *key, imc_progress_func progress, void *progress_data);
+
+// Report the progress of a stage of the steganographic operations
+// If the image has a progress callback, the percentage is passed to it. Otherwise, on verbose mode,
+// the 'message' is printed (at most once each 1/6 second, unless the stage has completed).
+static void __steg_progress(CarrierImage *carrier_img, enum ProgressStage stage, double percent, const char *message, ...);
+
 // Convenience function for converting the bytes from a timespec struct into
 // the byte layout used by this program: 64-bit little endian (each value)
 static inline struct timespec64 __timespec_to_64le(struct timespec time);
@@ -133,15 +384,178 @@ static inline struct timespec64 __timespec_to_64le(struct timespec time);
 // by this program (64-bit little endian) to the standard timespec struct
 static inline struct timespec __timespec_from_64le(struct timespec64 time);
 
+// Maximum size in bytes that some data can have after being compressed by 'imc_deflate_data()'
+size_t imc_deflate_bound(size_t size);
+
+// Compress a chunk of the data (this function might run on a worker thread)
+static void __deflate_chunk(size_t index, void *deflate_ptr);
+
+// Add a compressed chunk to the output (chunks are added in order)
+static void __deflate_append(size_t index, void *deflate_ptr);
+
+// Compress some data into a Zlib stream, at the compression 'level' (either Z_BEST_COMPRESSION, or Z_NO_COMPRESSION for data that is already compressed)
+// 'output_size' is the size of the output buffer, and the function updates it to the compressed size.
+// Function returns Z_OK on success, or the error code returned by Zlib.
+int imc_deflate_data(const uint8_t *input, size_t input_size, uint8_t *output, size_t *output_size, int level);
+
+// Compress a small prefix followed by some data into a single Zlib stream, without joining them on the same buffer first
+// (the output is the same stream as compressing both together, so it is decompressed as one piece)
+// The output buffer should have at least 'imc_deflate_bound(prefix_size) + imc_deflate_bound(input_size)' bytes.
+// The other parameters and the return value are the same as of 'imc_deflate_data()'.
+int imc_deflate_prefixed(
+    const uint8_t *prefix,
+    size_t prefix_size,
+    const uint8_t *input,
+    size_t input_size,
+    uint8_t *output,
+    size_t *output_size,
+    int level
+);
+
+// Get the size and timestamps of an open file
+static void __steg_file_metadata(FILE *file, off_t *file_size, struct timespec *access_time, struct timespec *mod_time);
+
+// Read a file into a new buffer, leaving 'prefix_size' bytes at the beginning of the buffer (for the metadata stored before the file)
+// The size and timestamps of the file are stored on 'file_size_out', 'access_time', and 'mod_time'.
+// The buffer has 'prefix_size' plus 'file_size_out' bytes, and it should be freed with 'imc_clear_free()'.
+int imc_steg_read_file(
+    const char *file_path,
+    size_t prefix_size,
+    uint8_t **output,
+    size_t *file_size_out,
+    struct timespec *access_time,
+    struct timespec *mod_time
+);
+
+// Set whether the files being hidden are mapped into memory, instead of read into a buffer (disabled by default)
+// Note: If a mapped file is truncated by another process while it is being read, the program is killed by a SIGBUS signal.
+//       So the mapping should be enabled only when that cannot take down other operations (not for '--batch' nor '--serve').
+void imc_steg_set_file_mapping(bool enabled);
+
+// Map a file into memory for reading it, if the mapping was enabled (otherwise, or on Windows, the file is read into a buffer)
+// The pages are read from the disk as they are accessed, and are shared with the system's cache, so hiding
+// the same file many times does not read it again. The size and timestamps of the file are also stored on 'output'.
+// The file should be released with 'imc_steg_unmap_file()'.
+int imc_steg_map_file(const char *file_path, MappedFile *output);
+
+// Release a file mapped by 'imc_steg_map_file()'
+void imc_steg_unmap_file(MappedFile *file);
+
+// Fill the metadata stored before a file (except for the sizes and the time of hiding, which are set when the file is prepared)
+// 'file_info' must have room for the file name ('name_size' bytes, counting the null terminator).
+// Note: integers are always stored in little endian byte order.
+void imc_steg_info_init(
+    FileInfo *file_info,
+    uint32_t version,
+    const char *file_name,
+    size_t name_size,
+    struct timespec access_time,
+    struct timespec mod_time
+);
+
+// Compress and encrypt the metadata of a file (filled by 'imc_steg_info_init()') followed by the data being hidden
+// The metadata and the data do not need to be on the same buffer: the metadata is compressed first, then the data
+// continues the same stream. 'level' is the compression level of Zlib. Neither buffer is freed by this function.
+// The returned 'PreparedPayload' should be freed with 'imc_steg_prepared_free()'.
+static int __steg_prepare_stream(
+    CryptoContext *crypto,
+    FileInfo *file_info,
+    const uint8_t *data,
+    size_t data_size,
+    int level,
+    bool verbose,
+    PreparedPayload **output
+);
+
+// Compress and encrypt a buffer that begins with a 'FileInfo' (filled by 'imc_steg_info_init()'), followed by the data being hidden
+// 'level' is the compression level of Zlib. The buffer is cleared and freed by this function, even on failure.
+// The returned 'PreparedPayload' should be freed with 'imc_steg_prepared_free()'.
+int imc_steg_prepare_buffer(
+    CryptoContext *crypto,
+    uint8_t *raw_buffer,
+    size_t raw_size,
+    int level,
+    bool verbose,
+    PreparedPayload **output
+);
+
+// Read a stream until its end into a new buffer, leaving 'prefix_size' bytes at the beginning of the buffer
+// The amount of bytes read is stored on 'size_out'. The buffer should be freed with 'imc_clear_free()'.
+// Function returns IMC_ERR_INPUT_TOO_BIG if the stream has more than 'IMC_MAX_INPUT_SIZE' bytes,
+// or IMC_ERR_FILE_CORRUPTED if reading from the stream failed.
+int imc_steg_read_stream(FILE *stream, size_t prefix_size, uint8_t **output, size_t *size_out);
+
+// Read, compress, and encrypt the data coming from a stream (for example, the standard input), so it can be hidden
+// The data is stored under 'file_name' (its directories are removed), with the current time as its timestamps.
+// The returned 'PreparedPayload' should be freed with 'imc_steg_prepared_free()'.
+int imc_steg_prepare_input(CryptoContext *crypto, FILE *stream, const char *file_name, bool verbose, PreparedPayload **output);
+
+// Read, compress, and encrypt a file, so it can be hidden in one or more images
+// 'crypto' has the secret key of the images in which the file will be hidden. If 'verbose' is true, the status is printed to stdout.
+// The returned 'PreparedPayload' should be freed with 'imc_steg_prepared_free()'.
+int imc_steg_prepare(CryptoContext *crypto, const char *file_path, bool verbose, PreparedPayload **output);
+
+// Write a prepared file to the carrier of an image
+// The same 'PreparedPayload' can be written to any amount of images, as long as they use the same key as when it was prepared.
+// Note: function can be called multiple times in order to hide more files in the same image.
+int imc_steg_insert_prepared(CarrierImage *carrier_img, const PreparedPayload *payload);
+
+// Free the memory used by a prepared file
+// (its stream is not cleared, since it is encrypted, and the same bytes are written to the image anyway)
+void imc_steg_prepared_free(PreparedPayload *payload);
+
 // Hide a file in an image
 // Note: function can be called multiple times in order to hide more files in the same image.
 int imc_steg_insert(CarrierImage *carrier_img, const char *file_path);
 
+// Hide in an image the data coming from a stream (for example, the standard input), under the name 'file_name'
+// Note: function can be called multiple times in order to hide more files in the same image.
+int imc_steg_insert_input(CarrierImage *carrier_img, FILE *stream, const char *file_name);
+
+// Read, compress, and encrypt one of the files of a pipeline (this function might run on a worker thread)
+static void __insert_produce(size_t index, void *pipeline_ptr);
+
+// Write one of the files of a pipeline to the carrier (in the order of the files), then report the result
+static void __insert_consume(size_t index, void *pipeline_ptr);
+
+// Hide many files in an image, preparing the next files while the current one is written to the carrier
+// The files are written in the order of 'paths', and a path of "-" hides the data from 'stream' under 'stream_name'.
+// 'report' is called on the calling thread, in the same order, with the status code of hiding each file.
+// Note: function can be called multiple times in order to hide more files in the same image.
+void imc_steg_insert_many(
+    CarrierImage *carrier_img,
+    char *const *paths,
+    size_t count,
+    FILE *stream,
+    const char *stream_name,
+    imc_insert_func report,
+    void *report_data
+);
+
 // Helper function for reading a given amount of bytes (the payload) from the carrier of an image
 // Returns 'false' if the read would go out of bounds (no read is done in this case).
 // Returns 'true' if the read could be made (the bytes are stored of the provided buffer).
 static bool __read_payload(CarrierImage *carrier_img, size_t num_bytes, uint8_t *out_buffer);
 
+// Read the encrypted stream of the next hidden file from the carrier
+// (the streams are stored one after another, so they have to be read in order)
+static int __steg_read_entry(CarrierImage *carrier_img, ExtractEntry *entry);
+
+// Decrypt and decompress a hidden file read by '__steg_read_entry()', then parse its metadata
+// The metadata is stored on the entry even if the file's contents are refused afterwards (so the file can be named on the error).
+// This function does not change the image, so it can run on a worker thread.
+static int __steg_decode_entry(const CarrierImage *carrier_img, ExtractEntry *entry);
+
+// Store the metadata of a decoded file on the image, as its most recent extracted file ('steg_info')
+static void __steg_publish_entry(CarrierImage *carrier_img, const ExtractEntry *entry);
+
+// Save a file decoded by '__steg_decode_entry()' (or write it to the image's output stream)
+// The file's metadata must have been stored on the image by '__steg_publish_entry()'.
+static int __steg_save_entry(CarrierImage *carrier_img, const ExtractEntry *entry);
+
+// Free the buffers of a hidden file being extracted (the entry itself is not freed)
+static void __steg_entry_free(ExtractEntry *entry);
+
 // Read the hidden data from the carrier bytes, and save it
 // The function extracts and save one file each time it is called.
 // So in order to extract all the hidden files, it should be called
@@ -149,35 +563,146 @@ static bool __read_payload(CarrierImage *carrier_img, size_t num_bytes, uint8_t
 // Note: The filename is stored with the hidden data
 int imc_steg_extract(CarrierImage *carrier_img);
 
+// Decrypt and decompress one of the files of a pipeline (this function might run on a worker thread)
+static void __extract_produce(size_t index, void *pipeline_ptr);
+
+// Save one of the files of a pipeline (in the order of the files), then report the result
+static void __extract_consume(size_t index, void *pipeline_ptr);
+
+// Extract all files hidden on an image, decrypting and decompressing them in parallel
+// 'report' is called on the calling thread for each file in their order, with the status code of extracting the file,
+// then once more with the status code that ended the extraction (IMC_ERR_INVALID_MAGIC or IMC_ERR_PAYLOAD_OOB after
+// the last file). While a file is reported, its metadata is on the image's 'steg_info'. As with 'imc_steg_extract()',
+// the extraction stops on the first file that fails, and the files are just checked if the image is on "check mode".
+void imc_steg_extract_all(CarrierImage *carrier_img, imc_extract_func report, void *report_data);
+
+// Save an extracted file to 'out_dir' (or to the current working directory, if NULL), then restore its timestamps
+// If a file with the same name already exists, a number is appended to the new file's name.
+// If 'verbose' is true, the status is printed to stdout.
+int imc_steg_write_file(
+    const char *out_dir,
+    const char *name,
+    const uint8_t *data,
+    size_t size,
+    const struct timespec file_times[2],
+    bool verbose
+);
+
 // Move the read position of the carrier bytes to right after the end of the last hidden file
 // Note: this function is intended to be used when in "append mode" while hiding a file.
 void imc_steg_seek_to_end(CarrierImage *carrier_img);
 
+// Error handler of libjpeg-turbo: print the error message, then jump back to our code
+// (the default handler would exit the program instead)
+static void __jpeg_error_exit(j_common_ptr jpeg_obj);
+
 // Progress monitor when reading a JPEG image
 static void __jpeg_read_callback(j_common_ptr jpeg_obj);
 
+// Allocate the arrays of a parallel scan over 'row_count' rows
+static void __scan_init(
+    CarrierScan *scan,
+    CarrierImage *carrier_img,
+    enum ProgressStage stage,
+    const char *message,
+    size_t row_count
+);
+
+// Count a row of a parallel scan as processed, and report the progress
+// (only the thread that started the scan reports it, since the progress messages are not thread safe)
+static void __scan_row_done(CarrierScan *scan);
+
+// Move the carriers of each row of a parallel scan to right after the previous row's carriers
+// Function returns the total amount of carriers.
+static size_t __scan_join(CarrierScan *scan, size_t item_size);
+
+// Free the arrays of a parallel scan
+static void __scan_free(CarrierScan *scan);
+
+// Get the pointers to each row of DCT blocks of a JPEG image (all color components, in order)
+static void __jpeg_gather_rows(
+    CarrierScan *scan,
+    struct jpeg_decompress_struct *jpeg_obj,
+    jvirt_barray_ptr *jpeg_dct,
+    bool writable
+);
+
+// Store the carrier bytes of some rows of DCT blocks (this function might run on a worker thread)
+static void __jpeg_scan_range(size_t start, size_t end, void *scan_ptr);
+
+// Count the carrier bytes of some rows of DCT blocks (this function might run on a worker thread)
+static void __jpeg_count_range(size_t start, size_t end, void *scan_ptr);
+
+// Write the carrier bytes back to some rows of DCT blocks (this function might run on a worker thread)
+static void __jpeg_write_range(size_t start, size_t end, void *scan_ptr);
+
+// Store the pointers to some of the carrier bytes (this function might run on a worker thread)
+static void __carrier_pointer_range(size_t start, size_t end, void *carrier_img_ptr);
+
 // Get the bytes from a JPEG image that will carry the hidden data
-void imc_jpeg_carrier_open(CarrierImage *carrier_img);
+int imc_jpeg_carrier_open(CarrierImage *carrier_img);
 
 // Progress monitor when reading a PNG image
 static void __png_read_callback(png_structp png_obj, png_uint_32 row, int pass);
 
+// Store the pointers to the carrier bytes of some rows of pixels of a PNG image (this function might run on a worker thread)
+static void __png_scan_range(size_t start, size_t end, void *scan_ptr);
+
 // Get the bytes from a PNG image that will carry the hidden data
-void imc_png_carrier_open(CarrierImage *carrier_img);
+int imc_png_carrier_open(CarrierImage *carrier_img);
 
-// Get the bytes from an WebP image that will carry the hidden data
-void imc_webp_carrier_open(CarrierImage *carrier_img);
+// Store the pointers to the carrier bytes of some rows of pixels of a WebP image (this function might run on a worker thread)
+static void __webp_scan_range(size_t start, size_t end, void *scan_ptr);
 
-// Change a file path in order to make it unique
-// IMPORTANT: Function assumes that the path buffer must be big enough to store the new name.
-// (at most 5 characters are added to the path)
-static bool __resolve_filename_collision(char *path);
+// Get the bytes from an WebP image that will carry the hidden data
+int imc_webp_carrier_open(CarrierImage *carrier_img);
 
 // Check if a given path is a directory
 static bool __is_directory(const char *path);
 
-// Copy the "last access" and "last modified" times from the one file (source) to the other (dest)
-static void __copy_file_times(FILE *source_file, const char *dest_path);
+// Remove the temporary outputs on the folder of 'path' that were left behind by interrupted saves
+// (they would never be committed nor removed otherwise). Each folder is swept only once per run of the program.
+// A temporary file is locked while its save is in progress, so only the files whose lock can be taken are removed
+// (this works regardless of which process, container, or machine created them). On Windows, an open file
+// cannot be removed, which has the same effect.
+static void __output_sweep(const char *path);
+
+// Open a temporary file for writing an output, on the same folder as the output's final 'path'
+// 'path' is only used once the output is committed, and it must have space for 5 more characters (a number might be
+// appended to it). 'size' is the expected size of the output, for reserving its space on the disk (zero if unknown).
+// 'flags' are the options of the output ('IMC_OUTPUT_REPLACE' and 'IMC_OUTPUT_SPARSE'). Function returns NULL if the file could not be created.
+// The returned 'OutputFile' should be freed by either 'imc_output_commit()' or 'imc_output_discard()'.
+OutputFile *imc_output_open(char *path, size_t size, uint64_t flags);
+
+// Get how many bytes at the beginning of a buffer are in blocks of 'IMC_SPARSE_BLOCK_SIZE' bytes that are all zeros
+// (a last partial block counts if it is all zeros). The result is at most 'max_size'.
+static size_t __output_zero_run(const uint8_t *data, size_t size, size_t max_size);
+
+// Write a buffer to an output, in chunks of 'IMC_OUTPUT_CHUNK_SIZE' bytes that go straight to the file
+// (instead of being copied through the stream's buffer). Function returns 'false' if the write failed.
+// If the output has the 'IMC_OUTPUT_SPARSE' flag, the runs of at least 'IMC_SPARSE_HOLE_SIZE' zeros are skipped
+// instead of written, which leaves holes on the file (the file system reads them back as zeros, without storing them).
+// The runs are counted in blocks from the beginning of 'data', so they line up with the disk when written from the start of the file.
+bool imc_output_write(OutputFile *output, const uint8_t *data, size_t size);
+
+// Give a temporary file the final 'path' of its output, only if that name does not exist yet
+// Function returns 'false' if the file could not be moved ('errno' is EEXIST if the name is taken).
+static bool __output_link(const char *temp_path, const char *path);
+
+// Move the temporary file of an output to its final path
+// Unless the output has the 'IMC_OUTPUT_REPLACE' flag, a number is appended to the name if it already exists
+// (for example, 'Image.jpg' might become 'Image (1).jpg'). Function returns IMC_ERR_FILE_EXISTS if no unique name
+// was found, or IMC_ERR_SAVE_FAIL if the file could not be moved.
+static int __output_place(OutputFile *output);
+
+// Finish writing an output: flush its temporary file to the disk, then move it to the output's final path
+// If 'times' is not NULL, it has the 'last access' and 'last modified' times that the output gets.
+// Function returns IMC_ERR_SAVE_FAIL if the file could not be written or moved, or IMC_ERR_FILE_EXISTS if its name
+// could not be made unique (the temporary file is removed in those cases). The 'OutputFile' is freed in any case.
+int imc_output_commit(OutputFile *output, const struct timespec times[2]);
+
+// Close and remove the temporary file of an output that could not be written, then free the 'OutputFile'
+void imc_output_discard(OutputFile *output);
 
 // Progress monitor when writing a JPEG image
 static void __jpeg_write_callback(j_common_ptr jpeg_obj);
@@ -197,16 +722,13 @@ static int __webp_write_callback(int percent, const WebPPicture* webp_obj);
 // Write the carrier bytes back to the WebP image, and save it as a new file
 int imc_webp_carrier_save(CarrierImage *carrier_img, const char *save_path);
 
-// Free the memory of the array of heap pointers in a CarrierImage struct
-static void __carrier_heap_free(CarrierImage *carrier_img);
-
-// Close the JPEG object and free the memory associated to it
+// Close the JPEG object (the memory of the image is freed along with its arena)
 void imc_jpeg_carrier_close(CarrierImage *carrier_img);
 
-// Close the PNG object and free the memory associated to it
+// Close the PNG object (the memory of the image is freed along with its arena)
 void imc_png_carrier_close(CarrierImage *carrier_img);
 
-// Close the WebP object and free the memory associated to it
+// Close the WebP object (the memory of the image is freed along with its arena)
 void imc_webp_carrier_close(CarrierImage *carrier_img);
 
 // Save the image with hidden data
@@ -215,10 +737,16 @@ int imc_steg_save(CarrierImage *carrier_img, const char *save_path);
 // Free the memory of the data structures used for steganography
 void imc_steg_finish(CarrierImage *carrier_img);
 
+// Get a short description of a status code returned by the steganographic functions
+const char *imc_steg_strerror(int status);
+
 // Print text at most once each 1/6 second
 // Note: function intended for the progress monitor, it uses the same format as 'printf()'.
 void printf_prog(const char *format, ...);
 
+// Same as 'printf_prog()', but taking a 'va_list' instead of variable arguments
+void vprintf_prog(const char *format, va_list arguments);
+
 /* Windows compatibility functions */
 #ifdef _WIN32
 
@@ -13,6 +13,7 @@ some conflicts with the symbols defined by `windows.h` or the standard libraries
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <stdarg.h>
 #include <string.h>
@@ -21,21 +22,37 @@ some conflicts with the symbols defined by `windows.h` or the standard libraries
 #include <time.h>
 #include <ctype.h>
 #include <errno.h>
+#include <setjmp.h>
+#include <stdatomic.h>
 
 // System libraries
 #ifdef _WIN32
 #include <windows.h>    // Microsoft Windows API
 #include <io.h>         // For the _get_osfhandle() function
 #include <direct.h>     // _getcwd(), _mkdir(), _chdir(), _rmdir()
+#include <fcntl.h>      // For the _O_BINARY macro
+#include <sys/stat.h>   // For the _S_IREAD and _S_IWRITE macros
+#include <psapi.h>      // For the GetProcessMemoryInfo() function
 #else // Linux / Unix
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/mman.h>   // Memory mapping the capacity cache and the hidden files
 #include <libgen.h>     // For the basename() function
 #include <fcntl.h>      // For the AT_FDCWD macro
+#include <sys/file.h>   // Locking the sets of shards while they are joined
 #include <termios.h>    // For temporarily turning off input echoing in the terminal
 #include <iconv.h>      // For encoding text to UTF-8
+#include <sys/socket.h> // Local server (the '--serve' option)
+#include <sys/un.h>     // Unix domain sockets
+#include <signal.h>     // Stopping the server with Ctrl+C
+#include <poll.h>       // Waiting for the server's jobs and for its clients at the same time
+#include <sys/eventfd.h>    // Notifying when asynchronous jobs finish
+#include <sched.h>      // Processors that the program is allowed to run on
+#include <sys/resource.h>   // Peak memory and CPU time of the program (the '--stats' option)
 #endif // _WIN32
+#include <dirent.h>     // Listing the files on a directory
+#include <pthread.h>    // Multithreading (on Windows, provided by MinGW's winpthreads)
 #include <endian.h>     // Converting between different byte orders
 #include <argp.h>       // Command line interface
 
@@ -55,5 +72,22 @@ some conflicts with the symbols defined by `windows.h` or the standard libraries
 #include "imc_crypto.h"
 #include "imc_image_io.h"
 #include "imc_memory.h"
+#include "imc_pool.h"
+#include "imc_arena.h"
+#include "imc_secure.h"
+#include "imc_threads.h"
+#include "imc_prefetch.h"
+#include "imc_template.h"
+#include "imc_shard.h"
+#include "imc_tar.h"
+#include "imc_tree.h"
+#include "imc_stats.h"
+#include "imc_cache.h"
+#include "imc_plan.h"
+#include "imc_corpus.h"
+#include "imc_journal.h"
+#include "imc_batch.h"
+#include "imc_async.h"
+#include "imc_server.h"
 
 #endif  // _IMC_INCLUDES_H
\ No newline at end of file
@@ -0,0 +1,297 @@
+/* Batch journal: records the jobs that finished, so an interrupted batch can be resumed without repeating them. */
+
+#include "imc_includes.h"
+
+/* Note: See the 'imc_journal.h' file for the format of the journal. */
+
+// Comparison function for the identifiers of the records
+static int __journal_compare_id(const void *record_a, const void *record_b)
+{
+    const JournalRecord *const a = (const JournalRecord *)record_a;
+    const JournalRecord *const b = (const JournalRecord *)record_b;
+    return memcmp(a->job_id, b->job_id, IMC_JOURNAL_ID_SIZE);
+}
+
+// Comparison function for sorting the records by their identifier, then by their line on the journal
+static int __journal_compare_line(const void *record_a, const void *record_b)
+{
+    const int id_order = __journal_compare_id(record_a, record_b);
+    if (id_order != 0) return id_order;
+
+    const JournalRecord *const a = (const JournalRecord *)record_a;
+    const JournalRecord *const b = (const JournalRecord *)record_b;
+    return (a->order > b->order) - (a->order < b->order);
+}
+
+// Convert a hexadecimal string to bytes
+// Function returns 'false' if the string does not have exactly 'size' bytes in hexadecimal.
+static bool __journal_parse_hex(const char *text, uint8_t *output, size_t size)
+{
+    size_t bin_len = 0;
+    const int status = sodium_hex2bin(output, size, text, strlen(text), NULL, &bin_len, NULL);
+    return status == 0 && bin_len == size;
+}
+
+// Write bytes to the journal in hexadecimal
+static void __journal_write_hex(FILE *file, const uint8_t *data, size_t size)
+{
+    char hex[size * 2 + 1];
+    sodium_bin2hex(hex, sizeof(hex), data, size);
+    fputs(hex, file);
+}
+
+// Open the journal at 'path', loading the jobs that succeeded on previous runs (the file is created if it does not exist)
+// Function returns IMC_ERR_FILE_NOT_FOUND if the file could not be opened for appending,
+// IMC_ERR_PATH_IS_DIR if the path is a directory, or IMC_ERR_FILE_INVALID if the file is not a journal.
+// The returned 'BatchJournal' should be freed with 'imc_journal_close()'.
+int imc_journal_open(const char *path, BatchJournal **output)
+{
+    struct stat journal_stats;
+    const bool exists = stat(path, &journal_stats) == 0;
+    if (exists && S_ISDIR(journal_stats.st_mode)) return IMC_ERR_PATH_IS_DIR;
+
+    // Read the whole journal into a null-terminated string (if there is one already)
+    char *text = NULL;
+    size_t text_len = 0;
+    if (exists)
+    {
+        FILE *old_file = fopen(path, "rb");
+        if (!old_file) return IMC_ERR_FILE_NOT_FOUND;
+
+        text = imc_malloc(journal_stats.st_size + 1);
+        text_len = fread(text, 1, journal_stats.st_size, old_file);
+        text[text_len] = '\0';
+        fclose(old_file);
+
+        const size_t header_len = sizeof(IMC_JOURNAL_HEADER) - 1;
+        const bool has_header = text_len > header_len
+            && memcmp(text, IMC_JOURNAL_HEADER, header_len) == 0
+            && (text[header_len] == '\n' || text[header_len] == '\r');
+
+        if (text_len > 0 && !has_header)
+        {
+            imc_free(text);
+            return IMC_ERR_FILE_INVALID;
+        }
+    }
+
+    BatchJournal *journal = imc_calloc(1, sizeof(BatchJournal));
+    pthread_mutex_init(&journal->lock, NULL);
+    journal->last_sync = time(NULL);
+    size_t capacity = 0;
+
+    // Parse the finished jobs (only the lines that are complete, since the last one might have been cut short)
+    char *line = text ? strchr(text, '\n') : NULL;
+    if (line) line++;
+
+    while (line && *line)
+    {
+        char *next_line = strchr(line, '\n');
+        if (!next_line) break;
+        *next_line++ = '\0';
+
+        // Split the line into its tab separated fields
+        char *fields[5] = {line};
+        size_t field_count = 1;
+        for (char *c = line; *c && field_count < 5; c++)
+        {
+            if (*c == '\t')
+            {
+                *c = '\0';
+                fields[field_count++] = c + 1;
+            }
+        }
+
+        const size_t line_len = (field_count == 5) ? strlen(fields[4]) : 0;
+        if (line_len > 0 && fields[4][line_len-1] == '\r') fields[4][line_len-1] = '\0';
+
+        JournalRecord record = {0};
+        char *status_end = NULL;
+        const long status = (field_count == 5) ? strtol(fields[1], &status_end, 10) : -1;
+        const bool is_valid = field_count == 5
+            && status_end != fields[1] && *status_end == '\0'
+            && __journal_parse_hex(fields[0], record.job_id, IMC_JOURNAL_ID_SIZE)
+            && (strcmp(fields[2], "-") == 0 || (record.has_hash = __journal_parse_hex(fields[2], record.output_hash, IMC_JOURNAL_HASH_SIZE)));
+
+        line = next_line;
+        if (!is_valid) continue;
+
+        if (journal->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            journal->records = imc_realloc(journal->records, capacity * sizeof(JournalRecord));
+        }
+
+        record.status = status;
+        record.order = journal->count;
+        const size_t output_size = strlen(fields[4]) + 1;
+        record.output = imc_malloc(output_size);
+        memcpy(record.output, fields[4], output_size);
+        journal->records[journal->count++] = record;
+    }
+
+    // Keep only the last line of each job (a job might have run again, if its image was changed after it succeeded),
+    // and only if the job succeeded
+    if (journal->count > 0) qsort(journal->records, journal->count, sizeof(JournalRecord), &__journal_compare_line);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < journal->count; i++)
+    {
+        JournalRecord *const record = &journal->records[i];
+        const bool is_last = (i + 1 == journal->count) || __journal_compare_id(record, &journal->records[i+1]) != 0;
+
+        if (is_last && record->status == IMC_SUCCESS) journal->records[kept++] = *record;
+        else imc_free(record->output);
+    }
+    journal->count = kept;
+
+    // Open the journal for appending (the header is written if the journal is new)
+    journal->file = fopen(path, "ab");
+    if (!journal->file)
+    {
+        imc_free(text);
+        imc_journal_close(journal);
+        return IMC_ERR_FILE_NOT_FOUND;
+    }
+
+    if (text_len == 0)
+    {
+        fputs(IMC_JOURNAL_HEADER "\n", journal->file);
+    }
+    else if (text[text_len-1] != '\n')
+    {
+        fputc('\n', journal->file);     // End the line that was cut short, so the next line begins on its own
+    }
+
+    fflush(journal->file);
+    imc_free(text);
+
+    *output = journal;
+    return IMC_SUCCESS;
+}
+
+// Hash the contents of an output file
+// Function returns 'false' if the file could not be read.
+bool imc_journal_hash_file(const char *path, uint8_t *hash)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) return false;
+
+    const size_t buffer_size = 65536;
+    uint8_t *const buffer = imc_malloc(buffer_size);
+    crypto_generichash_state state;
+    crypto_generichash_init(&state, NULL, 0, IMC_JOURNAL_HASH_SIZE);
+
+    size_t read_count;
+    while ( (read_count = fread(buffer, 1, buffer_size, file)) > 0 )
+    {
+        crypto_generichash_update(&state, buffer, read_count);
+    }
+
+    const bool read_error = ferror(file);
+    imc_free(buffer);
+    fclose(file);
+    if (read_error) return false;
+
+    crypto_generichash_final(&state, hash, IMC_JOURNAL_HASH_SIZE);
+    return true;
+}
+
+// Check if a job succeeded on a previous run, and its new image (if any) is still the same
+// 'output_path' receives a pointer to where the new image was saved (which is valid until the journal is closed).
+bool imc_journal_is_done(BatchJournal *journal, const uint8_t *job_id, const char **output_path)
+{
+    JournalRecord key;
+    memcpy(key.job_id, job_id, IMC_JOURNAL_ID_SIZE);
+
+    const JournalRecord *record = NULL;
+    if (journal->count > 0) record = bsearch(&key, journal->records, journal->count, sizeof(JournalRecord), &__journal_compare_id);
+    if (!record) return false;
+
+    // The new image must still exist, and not have been changed since
+    if (record->has_hash)
+    {
+        uint8_t hash[IMC_JOURNAL_HASH_SIZE];
+        if (!imc_journal_hash_file(record->output, hash)) return false;
+        if (sodium_memcmp(hash, record->output_hash, IMC_JOURNAL_HASH_SIZE) != 0) return false;
+    }
+
+    *output_path = record->output;
+    return true;
+}
+
+// Record a job that finished (this function can be called from many threads at once)
+// If 'hash_output' is true, the file at 'output' is hashed, so it can be checked when resuming.
+void imc_journal_record(
+    BatchJournal *journal,
+    const uint8_t *job_id,
+    int status,
+    const char *image,
+    const char *output,
+    bool hash_output
+)
+{
+    // Hash the new image before taking the lock, so the other jobs do not wait for it
+    uint8_t hash[IMC_JOURNAL_HASH_SIZE];
+    const bool has_hash = hash_output && output && imc_journal_hash_file(output, hash);
+
+    // A job that saved an image which cannot be read back is recorded as failed (so it runs again when resuming)
+    if (hash_output && !has_hash && status == IMC_SUCCESS) status = IMC_ERR_SAVE_FAIL;
+
+    pthread_mutex_lock(&journal->lock);
+
+    __journal_write_hex(journal->file, job_id, IMC_JOURNAL_ID_SIZE);
+    fprintf(journal->file, "\t%d\t", status);
+    if (has_hash) __journal_write_hex(journal->file, hash, IMC_JOURNAL_HASH_SIZE);
+    else fputc('-', journal->file);
+    fprintf(journal->file, "\t%s\t%s\n", image, output ? output : "");
+    fflush(journal->file);
+
+    // Flush the journal to the disk at intervals (doing it for every job would make the batch wait for the disk)
+    journal->unsynced++;
+    const time_t now = time(NULL);
+    if (journal->unsynced >= IMC_JOURNAL_SYNC_COUNT || now - journal->last_sync >= IMC_JOURNAL_SYNC_SECONDS)
+    {
+        #ifdef _WIN32
+        _commit(_fileno(journal->file));
+        #else
+        fsync(fileno(journal->file));
+        #endif
+
+        journal->unsynced = 0;
+        journal->last_sync = now;
+    }
+
+    pthread_mutex_unlock(&journal->lock);
+}
+
+// Flush the journal to the disk, then free its memory
+// Function returns IMC_ERR_SAVE_FAIL if the journal could not be written.
+int imc_journal_close(BatchJournal *journal)
+{
+    if (!journal) return IMC_SUCCESS;
+
+    int status = IMC_SUCCESS;
+    if (journal->file)
+    {
+        bool write_success = (fflush(journal->file) == 0) && !ferror(journal->file);
+        #ifdef _WIN32
+        if (write_success) write_success = (_commit(_fileno(journal->file)) == 0);
+        #else
+        if (write_success) write_success = (fsync(fileno(journal->file)) == 0);
+        #endif
+        if (fclose(journal->file) != 0) write_success = false;
+        if (!write_success) status = IMC_ERR_SAVE_FAIL;
+    }
+
+    for (size_t i = 0; i < journal->count; i++)
+    {
+        imc_free(journal->records[i].output);
+    }
+
+    pthread_mutex_destroy(&journal->lock);
+    imc_free(journal->records);
+    imc_free(journal);
+
+    return status;
+}
@@ -0,0 +1,97 @@
+/* Batch journal: records the jobs that finished, so an interrupted batch can be resumed without repeating them. */
+
+#ifndef _IMC_JOURNAL_H
+#define _IMC_JOURNAL_H
+
+#include "imc_includes.h"
+
+/*  Format of the journal file
+
+    The first line is 'IMC_JOURNAL_HEADER', and each following line is a job that finished, with the fields separated by tabs:
+    JOB_ID  STATUS  OUTPUT_HASH IMAGE   OUTPUT
+
+    - JOB_ID: hash of the job's operation, image, output, and files (so the job is recognized even if the manifest
+              was edited, or the job moved to another line). Written as hexadecimal.
+    - STATUS: return code of the job (IMC_SUCCESS is zero).
+    - OUTPUT_HASH: BLAKE2b hash of the new image, in hexadecimal (or '-' if the job does not save an image).
+    - IMAGE: path to the image that was processed.
+    - OUTPUT: path where the new image was saved, or the directory of the extracted files (may be empty).
+
+    The journal is only appended to, and it is flushed to the disk after every 'IMC_JOURNAL_SYNC_COUNT' jobs
+    or 'IMC_JOURNAL_SYNC_SECONDS' seconds (whichever comes first), and when the batch finishes. A line that
+    was cut short by a crash is ignored. Since the outputs are written to a temporary file that is renamed once
+    complete, an interrupted job never leaves a half written image under the output's name.
+
+    When resuming, a job is skipped if it has a line with status IMC_SUCCESS and its new image still exists
+    with the same hash (otherwise the job runs again). The jobs that failed always run again.
+*/
+
+#define IMC_JOURNAL_HEADER          "# imgconceal journal 1"
+#define IMC_JOURNAL_ID_SIZE         16  // Size in bytes of the identifier of a job
+#define IMC_JOURNAL_HASH_SIZE       32  // Size in bytes of the hash of an output image (BLAKE2b)
+#define IMC_JOURNAL_SYNC_COUNT      32  // Maximum amount of jobs recorded between flushes to the disk
+#define IMC_JOURNAL_SYNC_SECONDS    2   // Maximum time in seconds between flushes to the disk
+
+// A job that finished on a previous run
+typedef struct JournalRecord {
+    uint8_t job_id[IMC_JOURNAL_ID_SIZE];        // Identifier of the job
+    uint8_t output_hash[IMC_JOURNAL_HASH_SIZE]; // Hash of the new image
+    bool has_hash;                              // Whether the job saved an image (so the 'output_hash' is valid)
+    char *output;                               // Path where the new image was saved
+    int status;                                 // Return code of the job
+    size_t order;                               // Position of the line on the journal (the last line of a job prevails)
+} JournalRecord;
+
+// Journal of a batch
+typedef struct BatchJournal {
+    FILE *file;                 // Stream where the finished jobs are appended
+    JournalRecord *records;     // Jobs that succeeded on previous runs, sorted by their identifier (one record per job)
+    size_t count;               // Amount of elements on the 'records' array
+    size_t unsynced;            // Amount of jobs recorded since the journal was last flushed to the disk
+    time_t last_sync;           // When the journal was last flushed to the disk
+    pthread_mutex_t lock;       // Prevents the jobs from being recorded at the same time
+} BatchJournal;
+
+// Comparison function for the identifiers of the records
+static int __journal_compare_id(const void *record_a, const void *record_b);
+
+// Comparison function for sorting the records by their identifier, then by their line on the journal
+static int __journal_compare_line(const void *record_a, const void *record_b);
+
+// Convert a hexadecimal string to bytes
+// Function returns 'false' if the string does not have exactly 'size' bytes in hexadecimal.
+static bool __journal_parse_hex(const char *text, uint8_t *output, size_t size);
+
+// Write bytes to the journal in hexadecimal
+static void __journal_write_hex(FILE *file, const uint8_t *data, size_t size);
+
+// Open the journal at 'path', loading the jobs that succeeded on previous runs (the file is created if it does not exist)
+// Function returns IMC_ERR_FILE_NOT_FOUND if the file could not be opened for appending,
+// IMC_ERR_PATH_IS_DIR if the path is a directory, or IMC_ERR_FILE_INVALID if the file is not a journal.
+// The returned 'BatchJournal' should be freed with 'imc_journal_close()'.
+int imc_journal_open(const char *path, BatchJournal **output);
+
+// Hash the contents of an output file
+// Function returns 'false' if the file could not be read.
+bool imc_journal_hash_file(const char *path, uint8_t *hash);
+
+// Check if a job succeeded on a previous run, and its new image (if any) is still the same
+// 'output_path' receives a pointer to where the new image was saved (which is valid until the journal is closed).
+bool imc_journal_is_done(BatchJournal *journal, const uint8_t *job_id, const char **output_path);
+
+// Record a job that finished (this function can be called from many threads at once)
+// If 'hash_output' is true, the file at 'output' is hashed, so it can be checked when resuming.
+void imc_journal_record(
+    BatchJournal *journal,
+    const uint8_t *job_id,
+    int status,
+    const char *image,
+    const char *output,
+    bool hash_output
+);
+
+// Flush the journal to the disk, then free its memory
+// Function returns IMC_ERR_SAVE_FAIL if the journal could not be written.
+int imc_journal_close(BatchJournal *journal);
+
+#endif  // _IMC_JOURNAL_H
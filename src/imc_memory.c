@@ -2,6 +2,26 @@
 
 #include "imc_includes.h"
 
+static size_t memory_budget = 0;       // Maximum amount of memory reserved at once (zero for no limit)
+static size_t memory_reserved = 0;     // Amount of memory reserved by the operations being processed
+static size_t memory_holders = 0;      // Amount of threads with images that reserved memory
+static size_t memory_waiting = 0;      // Amount of those threads that are waiting for more memory
+static _Thread_local size_t memory_thread_images = 0;   // Amount of images of the calling thread that reserved memory
+static pthread_mutex_t memory_lock = PTHREAD_MUTEX_INITIALIZER;     // Protects the values above
+static pthread_cond_t memory_released = PTHREAD_COND_INITIALIZER;   // Signaled when memory is given back to the budget
+
+static atomic_bool accounting_enabled = false;      // Whether the allocations are being counted
+static MemoryCounter accounting_total;              // Totals of all allocations
+static MemoryCounter accounting_tags[IMC_MEMORY_TAG_COUNT];     // Totals of the allocations of each tag
+static atomic_uint_fast64_t accounting_frees;       // Amount of counted allocations that were freed
+
+// Names of the tags, in the order of 'MemoryTag'
+static const char *const memory_tag_names[IMC_MEMORY_TAG_COUNT] = {
+    "other", "image", "pixels", "carrier", "file", "zlib", "crypto", "pool",
+};
+
+/* Note: See the 'imc_memory.h' file for how the allocations are counted. */
+
 // Exit with an error if memory could not be allocated
 static void __exit_no_mem()
 {
@@ -9,34 +29,131 @@ static void __exit_no_mem()
     abort();
 }
 
+// Add 'size' bytes to the current amount of a counter, updating its peak
+static void __memory_count_add(MemoryCounter *counter, size_t size)
+{
+    const uint_fast64_t current = atomic_fetch_add(&counter->current, size) + size;
+    uint_fast64_t peak = atomic_load(&counter->peak);
+    while (current > peak && !atomic_compare_exchange_weak(&counter->peak, &peak, current));
+}
+
+// Count a new allocation of 'size' bytes with a given tag, and fill its header
+static void __memory_count_new(MemoryHeader *header, size_t size, MemoryTag tag)
+{
+    header->size = size;
+    header->tag = tag;
+    header->counted = atomic_load_explicit(&accounting_enabled, memory_order_relaxed);
+    if (!header->counted) return;
+
+    __memory_count_add(&accounting_total, size);
+    __memory_count_add(&accounting_tags[tag], size);
+    atomic_fetch_add(&accounting_total.allocations, 1);
+    atomic_fetch_add(&accounting_tags[tag].allocations, 1);
+}
+
 // Allocate 'mem_size' bytes of memory
 void *imc_malloc(size_t mem_size)
 {
-    void *ptr = malloc(mem_size);
-    if (ptr == NULL) __exit_no_mem();
-    return ptr;
+    return imc_malloc_tag(mem_size, IMC_MEMORY_OTHER);
+}
+
+// Allocate 'mem_size' bytes of memory, with the tag telling where it is used
+void *imc_malloc_tag(size_t mem_size, MemoryTag tag)
+{
+    if (mem_size > SIZE_MAX - sizeof(MemoryHeader)) __exit_no_mem();
+    MemoryHeader *header = malloc(sizeof(MemoryHeader) + mem_size);
+    if (header == NULL) __exit_no_mem();
+    __memory_count_new(header, mem_size, tag);
+    return &header[1];
 }
 
 // Allocate 'item_count' elements of 'item_size' bytes, all initialized to zero
 void *imc_calloc(size_t item_count, size_t item_size)
 {
-    void *ptr = calloc(item_count, item_size);
-    if (ptr == NULL) __exit_no_mem();
-    return ptr;
+    return imc_calloc_tag(item_count, item_size, IMC_MEMORY_OTHER);
 }
 
-// Re-allocate 'ptr' to the new size of 'mem_size' bytes.
+// Allocate 'item_count' elements of 'item_size' bytes, all initialized to zero, with the tag telling where they are used
+void *imc_calloc_tag(size_t item_count, size_t item_size, MemoryTag tag)
+{
+    if (item_size != 0 && item_count > (SIZE_MAX - sizeof(MemoryHeader)) / item_size) __exit_no_mem();
+    const size_t mem_size = item_count * item_size;
+    MemoryHeader *header = calloc(1, sizeof(MemoryHeader) + mem_size);
+    if (header == NULL) __exit_no_mem();
+    __memory_count_new(header, mem_size, tag);
+    return &header[1];
+}
+
+// Re-allocate 'ptr' to the new size of 'mem_size' bytes (keeping its tag).
 void *imc_realloc(void *ptr, size_t mem_size)
 {
-    void *new_ptr = realloc(ptr, mem_size);
-    if (new_ptr == NULL) __exit_no_mem();
-    return new_ptr;
+    if (ptr == NULL) return imc_malloc(mem_size);
+    if (mem_size > SIZE_MAX - sizeof(MemoryHeader)) __exit_no_mem();
+
+    MemoryHeader *header = &((MemoryHeader *)ptr)[-1];
+    const size_t old_size = header->size;
+
+    header = realloc(header, sizeof(MemoryHeader) + mem_size);
+    if (header == NULL) __exit_no_mem();
+    header->size = mem_size;
+
+    if (header->counted)
+    {
+        if (mem_size >= old_size)
+        {
+            __memory_count_add(&accounting_total, mem_size - old_size);
+            __memory_count_add(&accounting_tags[header->tag], mem_size - old_size);
+        }
+        else
+        {
+            atomic_fetch_sub(&accounting_total.current, old_size - mem_size);
+            atomic_fetch_sub(&accounting_tags[header->tag].current, old_size - mem_size);
+        }
+    }
+
+    return &header[1];
+}
+
+// Copy a string to a new buffer (which should be freed with 'imc_free()')
+char *imc_strdup(const char *str)
+{
+    const size_t size = strlen(str) + 1;
+    char *const copy = imc_malloc(size);
+    memcpy(copy, str, size);
+    return copy;
+}
+
+// Change the tag of the memory allocated by 'imc_malloc()', 'imc_realloc()' or 'imc_calloc()'
+void imc_memory_retag(void *ptr, MemoryTag tag)
+{
+    if (ptr == NULL) return;
+    MemoryHeader *const header = &((MemoryHeader *)ptr)[-1];
+    if (header->tag == tag) return;
+
+    // The bytes move to the new tag (the totals do not change)
+    if (header->counted)
+    {
+        atomic_fetch_sub(&accounting_tags[header->tag].current, header->size);
+        __memory_count_add(&accounting_tags[tag], header->size);
+    }
+
+    header->tag = tag;
 }
 
 // Free the memory allocated by 'imc_malloc()', 'imc_realloc()' or 'imc_calloc()'
 void imc_free(void *ptr)
 {
-    free(ptr);
+    if (ptr == NULL) return;
+    MemoryHeader *const header = &((MemoryHeader *)ptr)[-1];
+
+    if (header->counted)
+    {
+        atomic_fetch_sub(&accounting_total.current, header->size);
+        atomic_fetch_sub(&accounting_tags[header->tag].current, header->size);
+        atomic_fetch_add(&accounting_frees, 1);
+    }
+
+    free(header);
 }
 
 // Set a memory region to zero, then free it
@@ -44,4 +161,175 @@ void imc_clear_free(void *ptr, size_t mem_size)
 {
     sodium_memzero(ptr, mem_size);
     imc_free(ptr);
+}
+
+// Start counting the allocations (the ones made before are not counted)
+void imc_memory_accounting_enable()
+{
+    atomic_store(&accounting_enabled, true);
+}
+
+// Check if the allocations are being counted
+bool imc_memory_accounting_enabled()
+{
+    return atomic_load_explicit(&accounting_enabled, memory_order_relaxed);
+}
+
+// Print the amount of memory allocated in total and for each tag to 'stream', either as a table or
+// (if 'as_json' is true) as a JSON object. Nothing is printed if the accounting was not enabled.
+void imc_memory_accounting_print(FILE *stream, bool as_json)
+{
+    if (!imc_memory_accounting_enabled()) return;
+
+    if (as_json)
+    {
+        fprintf(stream, "{\"current_bytes\":%llu,\"peak_bytes\":%llu,\"allocations\":%llu,\"frees\":%llu,\"tags\":{",
+            (unsigned long long)atomic_load(&accounting_total.current),
+            (unsigned long long)atomic_load(&accounting_total.peak),
+            (unsigned long long)atomic_load(&accounting_total.allocations),
+            (unsigned long long)atomic_load(&accounting_frees));
+    }
+    else
+    {
+        fprintf(stream, "\n%-10s %14s %14s %12s\n", "Memory", "Current", "Peak", "Allocations");
+    }
+
+    for (size_t i = 0; i < IMC_MEMORY_TAG_COUNT; i++)
+    {
+        const uint64_t current = atomic_load(&accounting_tags[i].current);
+        const uint64_t peak = atomic_load(&accounting_tags[i].peak);
+        const uint64_t allocations = atomic_load(&accounting_tags[i].allocations);
+
+        if (as_json)
+        {
+            fprintf(stream, "%s\"%s\":{\"current_bytes\":%llu,\"peak_bytes\":%llu,\"allocations\":%llu}",
+                (i > 0) ? "," : "", memory_tag_names[i],
+                (unsigned long long)current, (unsigned long long)peak, (unsigned long long)allocations);
+        }
+        else if (peak > 0 || allocations > 0)
+        {
+            fprintf(stream, "%-10s %14llu %14llu %12llu\n", memory_tag_names[i],
+                (unsigned long long)current, (unsigned long long)peak, (unsigned long long)allocations);
+        }
+    }
+
+    if (as_json)
+    {
+        fputs("}}", stream);
+    }
+    else
+    {
+        // The peak of the total is not the sum of the peaks of the tags, since they might happen at different times
+        fprintf(stream, "%-10s %14llu %14llu %12llu\n", "total",
+            (unsigned long long)atomic_load(&accounting_total.current),
+            (unsigned long long)atomic_load(&accounting_total.peak),
+            (unsigned long long)atomic_load(&accounting_total.allocations));
+    }
+}
+
+/* Note: See the 'imc_memory.h' file for how the memory budget works. */
+
+// Set the maximum amount of memory, in bytes, that the images being processed at the same time can use (zero for no limit)
+void imc_memory_set_budget(size_t bytes)
+{
+    pthread_mutex_lock(&memory_lock);
+    memory_budget = bytes;
+    pthread_cond_broadcast(&memory_released);
+    pthread_mutex_unlock(&memory_lock);
+}
+
+// Get the memory budget, in bytes (zero if there is no limit)
+size_t imc_memory_get_budget()
+{
+    pthread_mutex_lock(&memory_lock);
+    const size_t budget = memory_budget;
+    pthread_mutex_unlock(&memory_lock);
+    return budget;
+}
+
+// Wait until 'bytes' fit in the memory budget, then reserve them (the lock must be held by the calling thread)
+// A thread that holds memory for an image stops waiting when the threads of all other images are waiting too (since
+// none of them would release memory anymore), and a thread without images stops waiting when no image holds memory.
+// Function returns IMC_ERR_MEMORY_BUDGET in those cases. The threads waiting for the buffers of their images go first.
+static int __memory_wait_reserve(size_t bytes)
+{
+    if (memory_budget != 0 && bytes > memory_budget) return IMC_ERR_MEMORY_BUDGET;
+
+    const bool has_images = (memory_thread_images > 0);
+
+    while (
+        memory_budget != 0 &&
+        (memory_reserved + bytes > memory_budget || (!has_images && memory_waiting > 0))
+    )
+    {
+        if (has_images)
+        {
+            // The other waiting threads are woken up, so they check again if they can still wait
+            if (memory_waiting + 1 >= memory_holders) return IMC_ERR_MEMORY_BUDGET;
+            memory_waiting++;
+            pthread_cond_broadcast(&memory_released);
+            pthread_cond_wait(&memory_released, &memory_lock);
+            memory_waiting--;
+        }
+        else
+        {
+            if (memory_holders == 0) return IMC_ERR_MEMORY_BUDGET;
+            pthread_cond_wait(&memory_released, &memory_lock);
+        }
+    }
+
+    memory_reserved += bytes;
+    return IMC_SUCCESS;
+}
+
+// Reserve 'bytes' from the memory budget for an image, waiting until the other operations release enough of it
+// The reservation should be reduced with 'imc_memory_release()', and given back with 'imc_memory_close()' on the same thread.
+// Function returns IMC_ERR_MEMORY_BUDGET if 'bytes' is bigger than the whole budget (so the operation would never fit).
+int imc_memory_reserve(size_t bytes)
+{
+    pthread_mutex_lock(&memory_lock);
+    const int status = __memory_wait_reserve(bytes);
+
+    if (status == IMC_SUCCESS && memory_budget != 0 && memory_thread_images++ == 0)
+    {
+        memory_holders++;
+    }
+
+    pthread_mutex_unlock(&memory_lock);
+    return status;
+}
+
+// Reserve 'bytes' from the memory budget for the buffers of a file being hidden or extracted
+// The reservation should be given back with 'imc_memory_release()'. Function returns IMC_ERR_MEMORY_BUDGET if the
+// buffers do not fit in the budget along with what the other operations reserved, and waiting for them could never end.
+int imc_memory_reserve_buffers(size_t bytes)
+{
+    pthread_mutex_lock(&memory_lock);
+    const int status = __memory_wait_reserve(bytes);
+    pthread_mutex_unlock(&memory_lock);
+    return status;
+}
+
+// Give back to the budget 'bytes' that were reserved
+void imc_memory_release(size_t bytes)
+{
+    if (bytes == 0) return;
+
+    pthread_mutex_lock(&memory_lock);
+    memory_reserved -= bytes;
+    pthread_cond_broadcast(&memory_released);
+    pthread_mutex_unlock(&memory_lock);
+}
+
+// Give back to the budget what is left of the reservation of an image, once it was closed
+// (on the same thread that reserved it with 'imc_memory_reserve()')
+void imc_memory_close(size_t bytes)
+{
+    if (bytes == 0) return;
+
+    pthread_mutex_lock(&memory_lock);
+    memory_reserved -= bytes;
+    if (memory_thread_images > 0 && --memory_thread_images == 0) memory_holders--;
+    pthread_cond_broadcast(&memory_released);
+    pthread_mutex_unlock(&memory_lock);
 }
\ No newline at end of file
@@ -5,22 +5,141 @@
 
 #include "imc_includes.h"
 
+/*  Allocation accounting (the '--stats' option)
+
+    Each allocation has a small header before it, with its size and a tag telling where the memory is used
+    (for example, the carrier arrays, the pixel buffers, or the compressed and encrypted streams). So the memory
+    allocated by these functions must be freed only by 'imc_free()' (never by the standard 'free()'), and memory
+    allocated by other means (like 'strdup()') must not be passed to 'imc_free()' ('imc_strdup()' can be used instead).
+
+    When the accounting is enabled, the current and peak amount of bytes, and the amount of allocations, are counted
+    in total and for each tag. Only the allocations made after the accounting was enabled are counted (the header
+    records it), so the memory allocated before does not make the current amount go negative when freed.
+    When the accounting is disabled, the only costs are the header and a check of a flag.
+
+    The buffers kept by the pool ('imc_pool.h') are moved to the 'pool' tag while they wait to be reused, and back
+    to the tag of the new request when they are reused. The memory allocated by the libraries themselves (like the
+    DCT coefficients of libjpeg, the decoded pixels of libwebp, and the secure memory of libsodium) is not counted.
+*/
+
+// Where the allocated memory is used
+typedef enum MemoryTag {
+    IMC_MEMORY_OTHER,       // Anything without a more specific tag
+    IMC_MEMORY_IMAGE,       // Shared blocks of the images' arenas, and the encoded WebP images
+    IMC_MEMORY_PIXELS,      // Decoded pixels of the PNG images
+    IMC_MEMORY_CARRIER,     // Carrier arrays (the bytes that hide the data, and the pointers to them)
+    IMC_MEMORY_FILE,        // Contents of the files being hidden
+    IMC_MEMORY_ZLIB,        // Compressed streams, and the decompressed hidden files
+    IMC_MEMORY_CRYPTO,      // Encrypted and decrypted streams
+    IMC_MEMORY_POOL,        // Buffers waiting on the pool to be reused
+    IMC_MEMORY_TAG_COUNT    // Amount of tags (not a tag)
+} MemoryTag;
+
+// Header stored before each allocation
+typedef struct MemoryHeader {
+    _Alignas(max_align_t) size_t size;  // Amount of bytes requested (not counting the header)
+    uint32_t tag;                       // Where the memory is used (a 'MemoryTag')
+    uint32_t counted;                   // Whether the allocation was counted (the accounting was enabled when it was made)
+} MemoryHeader;
+
+// Totals of the allocations in use
+typedef struct MemoryCounter {
+    atomic_uint_fast64_t current;       // Amount of bytes currently allocated
+    atomic_uint_fast64_t peak;          // Highest amount of bytes allocated at the same time
+    atomic_uint_fast64_t allocations;   // Amount of allocations made (not counting the re-allocations)
+} MemoryCounter;
+
 // Exit with an error if memory could not be allocated
 static void __exit_no_mem();
 
+// Add 'size' bytes to the current amount of a counter, updating its peak
+static void __memory_count_add(MemoryCounter *counter, size_t size);
+
+// Count a new allocation of 'size' bytes with a given tag, and fill its header
+static void __memory_count_new(MemoryHeader *header, size_t size, MemoryTag tag);
+
 // Allocate 'mem_size' bytes of memory
 void *imc_malloc(size_t mem_size);
 
+// Allocate 'mem_size' bytes of memory, with the tag telling where it is used
+void *imc_malloc_tag(size_t mem_size, MemoryTag tag);
+
 // Allocate 'item_count' elements of 'item_size' bytes, all initialized to zero
 void *imc_calloc(size_t item_count, size_t item_size);
 
-// Re-allocate 'ptr' to the new size of 'mem_size' bytes.
+// Allocate 'item_count' elements of 'item_size' bytes, all initialized to zero, with the tag telling where they are used
+void *imc_calloc_tag(size_t item_count, size_t item_size, MemoryTag tag);
+
+// Re-allocate 'ptr' to the new size of 'mem_size' bytes (keeping its tag).
 void *imc_realloc(void *ptr, size_t mem_size);
 
+// Copy a string to a new buffer (which should be freed with 'imc_free()')
+char *imc_strdup(const char *str);
+
+// Change the tag of the memory allocated by 'imc_malloc()', 'imc_realloc()' or 'imc_calloc()'
+void imc_memory_retag(void *ptr, MemoryTag tag);
+
 // Free the memory allocated by 'imc_malloc()', 'imc_realloc()' or 'imc_calloc()'
 void imc_free(void *ptr);
 
 // Set a memory region to zero, then free it
 void imc_clear_free(void *ptr, size_t mem_size);
 
+// Start counting the allocations (the ones made before are not counted)
+void imc_memory_accounting_enable();
+
+// Check if the allocations are being counted
+bool imc_memory_accounting_enabled();
+
+// Print the amount of memory allocated in total and for each tag to 'stream', either as a table or
+// (if 'as_json' is true) as a JSON object. Nothing is printed if the accounting was not enabled.
+void imc_memory_accounting_print(FILE *stream, bool as_json);
+
+/*  Memory budget (the '--max-memory' option)
+
+    Before decoding an image, its peak memory usage is estimated from the dimensions on its header, and that amount
+    is reserved from the budget. If the images being processed at the same time have already reserved too much of it,
+    the new image waits until one of them is closed. If the image alone needs more than the whole budget, it fails right
+    away with IMC_ERR_MEMORY_BUDGET (instead of running out of memory halfway through).
+
+    The buffers of a file being hidden or extracted are reserved too, once their size is known, and given back when
+    the file is done. So the budget bounds everything that the images and their files hold at the same time.
+
+    Only the opening of an image and the buffers of a file wait for memory. Since a thread waiting for the buffers
+    of a file still holds its image, it gives up (with IMC_ERR_MEMORY_BUDGET) once the threads of all other images are
+    waiting too, so the threads never wait for each other forever. No new image is opened while a thread waits for
+    the buffers of a file, so the memory given back goes to that thread first. Under a budget, each image is processed
+    by a single thread. The decoded images kept for reuse (templates) should not be used along with a budget, since
+    they hold their reservation even when idle.
+*/
+
+// Set the maximum amount of memory, in bytes, that the images being processed at the same time can use (zero for no limit)
+void imc_memory_set_budget(size_t bytes);
+
+// Get the memory budget, in bytes (zero if there is no limit)
+size_t imc_memory_get_budget();
+
+// Wait until 'bytes' fit in the memory budget, then reserve them (the lock must be held by the calling thread)
+// A thread that holds memory for an image stops waiting when the threads of all other images are waiting too (since
+// none of them would release memory anymore), and a thread without images stops waiting when no image holds memory.
+// Function returns IMC_ERR_MEMORY_BUDGET in those cases. The threads waiting for the buffers of their images go first.
+static int __memory_wait_reserve(size_t bytes);
+
+// Reserve 'bytes' from the memory budget for an image, waiting until the other operations release enough of it
+// The reservation should be reduced with 'imc_memory_release()', and given back with 'imc_memory_close()' on the same thread.
+// Function returns IMC_ERR_MEMORY_BUDGET if 'bytes' is bigger than the whole budget (so the operation would never fit).
+int imc_memory_reserve(size_t bytes);
+
+// Reserve 'bytes' from the memory budget for the buffers of a file being hidden or extracted
+// The reservation should be given back with 'imc_memory_release()'. Function returns IMC_ERR_MEMORY_BUDGET if the
+// buffers do not fit in the budget along with what the other operations reserved, and waiting for them could never end.
+int imc_memory_reserve_buffers(size_t bytes);
+
+// Give back to the budget 'bytes' that were reserved
+void imc_memory_release(size_t bytes);
+
+// Give back to the budget what is left of the reservation of an image, once it was closed
+// (on the same thread that reserved it with 'imc_memory_reserve()')
+void imc_memory_close(size_t bytes);
+
 #endif  //_IMC_MEMORY_H
\ No newline at end of file
@@ -0,0 +1,503 @@
+/* Plan mode: assign many files to a pool of cover images, then write the assignment as a batch manifest. */
+
+#include "imc_includes.h"
+
+/* Note: See the 'imc_plan.h' file for how the files are assigned to the images. */
+
+// Comparison function for sorting the names of the files on a directory
+static int __plan_compare_name(const void *name_a, const void *name_b)
+{
+    return strcmp(*(const char *const *)name_a, *(const char *const *)name_b);
+}
+
+// Add a cover image to the plan, or all files inside it if the path is a directory
+static void __plan_add_cover(HidePlan *plan, size_t *capacity, const char *path)
+{
+    struct stat path_stats;
+    const bool is_dir = (stat(path, &path_stats) == 0) && S_ISDIR(path_stats.st_mode);
+
+    if (!is_dir)
+    {
+        if (plan->cover_count == *capacity)
+        {
+            *capacity = (*capacity > 0) ? *capacity * 2 : 16;
+            plan->covers = imc_realloc(plan->covers, *capacity * sizeof(PlanCover));
+        }
+
+        const size_t path_size = strlen(path) + 1;
+        PlanCover *const cover = &plan->covers[plan->cover_count++];
+        *cover = (PlanCover){.path = imc_malloc(path_size), .status = IMC_SUCCESS};
+        memcpy(cover->path, path, path_size);
+        return;
+    }
+
+    DIR *dir = opendir(path);
+    if (!dir) return;
+
+    // List the names on the directory, so they are added in alphabetical order
+    char **names = NULL;
+    size_t name_count = 0;
+    size_t name_capacity = 0;
+    struct dirent *entry;
+
+    while ( (entry = readdir(dir)) )
+    {
+        if (entry->d_name[0] == '.') continue;  // Hidden files, and the current and parent directories
+
+        if (name_count == name_capacity)
+        {
+            name_capacity = (name_capacity > 0) ? name_capacity * 2 : 64;
+            names = imc_realloc(names, name_capacity * sizeof(char *));
+        }
+
+        const size_t name_size = strlen(entry->d_name) + 1;
+        names[name_count] = imc_malloc(name_size);
+        memcpy(names[name_count++], entry->d_name, name_size);
+    }
+
+    closedir(dir);
+    if (name_count > 0) qsort(names, name_count, sizeof(char *), &__plan_compare_name);
+
+    // Add the files on the directory (its subdirectories are not searched)
+    const size_t dir_len = strlen(path);
+    for (size_t i = 0; i < name_count; i++)
+    {
+        const size_t entry_size = dir_len + strlen(names[i]) + 2;
+        char entry_path[entry_size];
+        snprintf(entry_path, entry_size, "%s/%s", path, names[i]);
+        imc_free(names[i]);
+
+        struct stat entry_stats;
+        if (stat(entry_path, &entry_stats) != 0 || S_ISDIR(entry_stats.st_mode)) continue;
+        __plan_add_cover(plan, capacity, entry_path);
+    }
+
+    imc_free(names);
+}
+
+// Get the capacity of some of the cover images (this function might run on a worker thread)
+static void __plan_scan_range(size_t start, size_t end, void *plan_ptr)
+{
+    HidePlan *const plan = (HidePlan *)plan_ptr;
+
+    for (size_t i = start; i < end; i++)
+    {
+        PlanCover *const cover = &plan->covers[i];
+        CarrierImage *image = NULL;
+
+        // Images whose contents are on the cache do not need to be decoded
+        uint8_t hash[IMC_CACHE_HASH_SIZE];
+        if (plan->cache)
+        {
+            enum ImageType type;
+            CacheRecord record;
+            cover->status = imc_cache_hash_file(cover->path, hash, &type);
+            if (cover->status != IMC_SUCCESS) continue;
+
+            if (imc_cache_lookup(plan->cache, hash, type, &record))
+            {
+                cover->capacity = record.carrier_count / 8;
+                cover->is_cached = true;
+                continue;
+            }
+        }
+
+        // The image is closed right away, so only one image per thread is kept in memory
+        cover->status = imc_steg_open_cover(cover->path, &image, 0);
+        if (cover->status != IMC_SUCCESS) continue;
+
+        cover->capacity = image->carrier_length / 8;
+        if (plan->cache) imc_cache_add(plan->cache, hash, image);
+        imc_steg_finish(image);
+    }
+}
+
+// Estimate the size of a file once it is compressed and encrypted
+static int __plan_estimate_file(PlanFile *file)
+{
+    FILE *input = fopen(file->path, "rb");
+    if (!input) return IMC_ERR_FILE_NOT_FOUND;
+
+    struct stat file_stats;
+    if (fstat(fileno(input), &file_stats) != 0)
+    {
+        fclose(input);
+        return IMC_ERR_FILE_NOT_FOUND;
+    }
+
+    if (S_ISDIR(file_stats.st_mode))
+    {
+        fclose(input);
+        return IMC_ERR_PATH_IS_DIR;
+    }
+
+    file->file_size = file_stats.st_size;
+    if (file->file_size > IMC_MAX_INPUT_SIZE)
+    {
+        fclose(input);
+        return IMC_ERR_INPUT_TOO_BIG;
+    }
+
+    // Size of the file name (which is stored along with the file)
+    const size_t path_len = strlen(file->path);
+    char path_temp[path_len+1];
+    memcpy(path_temp, file->path, path_len + 1);
+    const size_t name_size = strlen(basename(path_temp)) + 1;
+    if (name_size > UINT16_MAX)
+    {
+        fclose(input);
+        return IMC_ERR_NAME_TOO_LONG;
+    }
+
+    // The metadata and the encryption's overhead, and the biggest size that the file can have once compressed
+    const size_t meta_size = IMC_CRYPTO_OVERHEAD + sizeof(FileInfo) + name_size;
+    const size_t max_size = IMC_CRYPTO_OVERHEAD + offsetof(FileInfo, access_time)
+        + imc_deflate_bound(sizeof(FileInfo) - offsetof(FileInfo, access_time) + name_size + file->file_size);
+
+    size_t data_estimate = 0;
+
+    if (file->file_size <= IMC_PLAN_EXACT_LIMIT)
+    {
+        // Compress the whole file, the same way as when hiding it
+        uint8_t *const data = imc_malloc(file->file_size ? file->file_size : 1);
+        const size_t read_size = fread(data, 1, file->file_size, input);
+        fclose(input);
+
+        if (read_size != file->file_size)
+        {
+            imc_clear_free(data, file->file_size ? file->file_size : 1);
+            return IMC_ERR_FILE_CORRUPTED;
+        }
+
+        size_t compressed_size = imc_deflate_bound(file->file_size);
+        uint8_t *const compressed = imc_malloc(compressed_size);
+        const int zlib_status = imc_deflate_data(data, file->file_size, compressed, &compressed_size, Z_BEST_COMPRESSION);
+        imc_clear_free(data, file->file_size ? file->file_size : 1);
+        imc_clear_free(compressed, imc_deflate_bound(file->file_size));
+
+        if (zlib_status != Z_OK) return IMC_ERR_NO_MEMORY;
+        data_estimate = compressed_size;
+        file->is_exact = true;
+    }
+    else
+    {
+        // Compress some evenly spaced samples of the file, then apply their compression ratio to the whole file
+        /* Note: Each sample is compressed separately, without the data that comes before it. So the samples
+           usually compress a bit worse than the whole file does, which makes the estimate err on the safe side. */
+        uint8_t *const sample = imc_malloc(IMC_PLAN_SAMPLE_SIZE);
+        uLongf bound = compressBound(IMC_PLAN_SAMPLE_SIZE);
+        uint8_t *const compressed = imc_malloc(bound);
+        uint64_t sampled_total = 0;
+        uint64_t compressed_total = 0;
+        int status = IMC_SUCCESS;
+
+        const size_t stride = (file->file_size - IMC_PLAN_SAMPLE_SIZE) / (IMC_PLAN_SAMPLE_COUNT - 1);
+        for (size_t i = 0; i < IMC_PLAN_SAMPLE_COUNT; i++)
+        {
+            if (fseek(input, (long)(i * stride), SEEK_SET) != 0
+                || fread(sample, 1, IMC_PLAN_SAMPLE_SIZE, input) != IMC_PLAN_SAMPLE_SIZE)
+            {
+                status = IMC_ERR_FILE_CORRUPTED;
+                break;
+            }
+
+            uLongf compressed_size = bound;
+            if (compress2(compressed, &compressed_size, sample, IMC_PLAN_SAMPLE_SIZE, Z_BEST_COMPRESSION) != Z_OK)
+            {
+                status = IMC_ERR_NO_MEMORY;
+                break;
+            }
+
+            sampled_total += IMC_PLAN_SAMPLE_SIZE;
+            compressed_total += compressed_size;
+        }
+
+        fclose(input);
+        imc_clear_free(sample, IMC_PLAN_SAMPLE_SIZE);
+        imc_clear_free(compressed, bound);
+        if (status != IMC_SUCCESS) return status;
+
+        data_estimate = (size_t)((file->file_size * compressed_total + sampled_total - 1) / sampled_total);
+        data_estimate += (data_estimate * IMC_PLAN_MARGIN + 999) / 1000;
+        file->is_exact = false;
+    }
+
+    file->estimate = meta_size + data_estimate;
+    if (file->estimate > max_size) file->estimate = max_size;
+
+    return IMC_SUCCESS;
+}
+
+// Estimate the sizes of some of the files (this function might run on a worker thread)
+static void __plan_estimate_range(size_t start, size_t end, void *plan_ptr)
+{
+    HidePlan *const plan = (HidePlan *)plan_ptr;
+
+    for (size_t i = start; i < end; i++)
+    {
+        plan->files[i].status = __plan_estimate_file(&plan->files[i]);
+    }
+}
+
+// Comparison function for sorting the files from the biggest estimate to the smallest
+static int __plan_compare_file(const void *file_a, const void *file_b)
+{
+    const PlanFile *const a = *(const PlanFile *const *)file_a;
+    const PlanFile *const b = *(const PlanFile *const *)file_b;
+
+    if (a->estimate != b->estimate) return (a->estimate < b->estimate) ? 1 : -1;
+    return (a < b) ? -1 : (a > b);  // Files of the same size keep the order that they were given
+}
+
+// Comparison function for sorting the images from the biggest capacity to the smallest
+static int __plan_compare_cover(const void *cover_a, const void *cover_b)
+{
+    const PlanCover *const a = *(const PlanCover *const *)cover_a;
+    const PlanCover *const b = *(const PlanCover *const *)cover_b;
+
+    if (a->capacity != b->capacity) return (a->capacity < b->capacity) ? 1 : -1;
+    return (a < b) ? -1 : (a > b);  // Images of the same size keep the order that they were given
+}
+
+// Assign the files to as few images as possible (the 'order' arrays are sorted from biggest to smallest)
+static void __plan_pack_minimize(PlanFile **file_order, size_t file_count, PlanCover **cover_order, size_t cover_count)
+{
+    for (size_t i = 0; i < file_count; i++)
+    {
+        PlanFile *const file = file_order[i];
+
+        // The image being used that has the least space left, among the ones that fit the file
+        PlanCover *best = NULL;
+        for (size_t j = 0; j < cover_count; j++)
+        {
+            PlanCover *const cover = cover_order[j];
+            if (cover->file_count == 0 || cover->capacity - cover->used < file->estimate) continue;
+            if (!best || cover->capacity - cover->used < best->capacity - best->used) best = cover;
+        }
+
+        // Otherwise, the biggest image not being used yet
+        for (size_t j = 0; j < cover_count && !best; j++)
+        {
+            PlanCover *const cover = cover_order[j];
+            if (cover->file_count == 0 && cover->capacity >= file->estimate) best = cover;
+        }
+
+        if (!best) continue;
+        file->cover = best;
+        best->used += file->estimate;
+        best->file_count++;
+    }
+
+    // Swap each image by the smallest image not being used that can still hold the same files
+    for (size_t j = 0; j < cover_count; j++)
+    {
+        PlanCover *const cover = cover_order[j];
+        if (cover->file_count == 0) continue;
+
+        for (size_t k = cover_count; k-- > j + 1;)
+        {
+            PlanCover *const smaller = cover_order[k];
+            if (smaller->file_count > 0 || smaller->capacity < cover->used) continue;
+            if (smaller->capacity >= cover->capacity) break;
+
+            for (size_t i = 0; i < file_count; i++)
+            {
+                if (file_order[i]->cover == cover) file_order[i]->cover = smaller;
+            }
+
+            smaller->used = cover->used;
+            smaller->file_count = cover->file_count;
+            cover->used = 0;
+            cover->file_count = 0;
+            break;
+        }
+    }
+}
+
+// Spread the files among all images (the 'order' arrays are sorted from biggest to smallest)
+static void __plan_pack_balance(PlanFile **file_order, size_t file_count, PlanCover **cover_order, size_t cover_count)
+{
+    for (size_t i = 0; i < file_count; i++)
+    {
+        PlanFile *const file = file_order[i];
+
+        // The image that would end up with the smallest fraction of its capacity used
+        PlanCover *best = NULL;
+        double best_load = 0.0;
+        for (size_t j = 0; j < cover_count; j++)
+        {
+            PlanCover *const cover = cover_order[j];
+            if (cover->capacity - cover->used < file->estimate) continue;
+
+            const double load = (double)(cover->used + file->estimate) / (double)cover->capacity;
+            if (!best || load < best_load)
+            {
+                best = cover;
+                best_load = load;
+            }
+        }
+
+        if (!best) continue;
+        file->cover = best;
+        best->used += file->estimate;
+        best->file_count++;
+    }
+}
+
+// Assign the files at 'file_paths' to the images at 'cover_paths' (which may also be directories with images)
+// The images are opened and the files are estimated in parallel. The results of each image and file
+// are stored on the plan, including the ones that failed or did not fit.
+// If 'cache' is not NULL, the images found on it are not decoded, and the capacities of the other images are added to it.
+// The returned 'HidePlan' should be freed with 'imc_plan_free()'.
+HidePlan *imc_plan_create(
+    const char *const *cover_paths,
+    size_t cover_path_count,
+    const char *const *file_paths,
+    size_t file_count,
+    enum PlanStrategy strategy,
+    CapacityCache *cache
+)
+{
+    HidePlan *plan = imc_calloc(1, sizeof(HidePlan));
+    plan->strategy = strategy;
+    plan->cache = cache;
+
+    // List the cover images
+    size_t cover_capacity = 0;
+    for (size_t i = 0; i < cover_path_count; i++)
+    {
+        __plan_add_cover(plan, &cover_capacity, cover_paths[i]);
+    }
+
+    plan->files = imc_calloc(file_count ? file_count : 1, sizeof(PlanFile));
+    plan->file_count = file_count;
+    for (size_t i = 0; i < file_count; i++)
+    {
+        plan->files[i].path = file_paths[i];
+    }
+
+    // Get the capacities of the images and estimate the sizes of the files, in parallel
+    /* Note: Compressing the files takes much less memory than decoding the images, so the files are done first
+       while all threads are free. Then the images are scanned one per thread, as each is closed right afterwards. */
+    imc_parallel_for(plan->file_count, 1, &__plan_estimate_range, plan);
+    imc_parallel_for(plan->cover_count, 1, &__plan_scan_range, plan);
+
+    // Sort the files and the usable images from the biggest to the smallest
+    PlanFile **file_order = imc_malloc((file_count ? file_count : 1) * sizeof(PlanFile *));
+    size_t order_count = 0;
+    for (size_t i = 0; i < file_count; i++)
+    {
+        if (plan->files[i].status == IMC_SUCCESS) file_order[order_count++] = &plan->files[i];
+    }
+
+    PlanCover **cover_order = imc_malloc((plan->cover_count ? plan->cover_count : 1) * sizeof(PlanCover *));
+    size_t usable_count = 0;
+    for (size_t i = 0; i < plan->cover_count; i++)
+    {
+        if (plan->covers[i].status == IMC_SUCCESS && plan->covers[i].capacity > 0) cover_order[usable_count++] = &plan->covers[i];
+    }
+
+    if (order_count > 0) qsort(file_order, order_count, sizeof(PlanFile *), &__plan_compare_file);
+    if (usable_count > 0) qsort(cover_order, usable_count, sizeof(PlanCover *), &__plan_compare_cover);
+
+    // Assign the files to the images
+    if (strategy == IMC_PLAN_BALANCE) __plan_pack_balance(file_order, order_count, cover_order, usable_count);
+    else __plan_pack_minimize(file_order, order_count, cover_order, usable_count);
+
+    imc_free(file_order);
+    imc_free(cover_order);
+
+    return plan;
+}
+
+// Write the plan as a batch manifest to 'manifest_path'
+// 'output_dir' is the directory where the jobs save the new images (NULL for the default name of each image).
+// Function returns IMC_ERR_SAVE_FAIL if the manifest could not be written,
+// or IMC_ERR_FILE_INVALID if a path has a tab or line break (which the manifest cannot have).
+int imc_plan_write(const HidePlan *plan, const char *manifest_path, const char *output_dir)
+{
+    static const char *const forbidden = "\t\r\n";
+
+    // Check the paths before writing anything
+    if (output_dir && strpbrk(output_dir, forbidden)) return IMC_ERR_FILE_INVALID;
+    for (size_t i = 0; i < plan->cover_count; i++)
+    {
+        if (plan->covers[i].file_count > 0 && strpbrk(plan->covers[i].path, forbidden)) return IMC_ERR_FILE_INVALID;
+    }
+    for (size_t i = 0; i < plan->file_count; i++)
+    {
+        if (strpbrk(plan->files[i].path, forbidden)) return IMC_ERR_FILE_INVALID;
+    }
+
+    FILE *manifest = fopen(manifest_path, "w");
+    if (!manifest) return IMC_ERR_SAVE_FAIL;
+
+    size_t planned_files = 0;
+    size_t used_covers = 0;
+    for (size_t i = 0; i < plan->file_count; i++) planned_files += (plan->files[i].cover != NULL);
+    size_t usable_covers = 0;
+    for (size_t i = 0; i < plan->cover_count; i++) used_covers += (plan->covers[i].file_count > 0);
+    for (size_t i = 0; i < plan->cover_count; i++) usable_covers += (plan->covers[i].status == IMC_SUCCESS);
+
+    fprintf(manifest, "# Plan generated by imgconceal: %zu of %zu files on %zu of %zu images (%s)\n",
+        planned_files, plan->file_count, used_covers, usable_covers,
+        (plan->strategy == IMC_PLAN_BALANCE) ? "balanced" : "fewest images");
+    fprintf(manifest, "# Run it with: imgconceal --batch=\"%s\"\n", manifest_path);
+
+    // One 'hide' job per image, with the files in the order that they were given
+    for (size_t i = 0; i < plan->cover_count; i++)
+    {
+        const PlanCover *const cover = &plan->covers[i];
+        if (cover->file_count == 0) continue;
+
+        fprintf(manifest, "\n# Estimated use: %zu of %zu bytes (%.1f%%)\n",
+            cover->used, cover->capacity, 100.0 * (double)cover->used / (double)cover->capacity);
+
+        fprintf(manifest, "hide\t%s\t", cover->path);
+        if (output_dir)
+        {
+            const size_t cover_len = strlen(cover->path);
+            char cover_temp[cover_len + 1];
+            memcpy(cover_temp, cover->path, cover_len + 1);
+            fprintf(manifest, "%s/%s", output_dir, basename(cover_temp));
+        }
+
+        for (size_t j = 0; j < plan->file_count; j++)
+        {
+            if (plan->files[j].cover == cover) fprintf(manifest, "\t%s", plan->files[j].path);
+        }
+
+        fprintf(manifest, "\n");
+    }
+
+    // The files that were left out (as comments, so the manifest can still be run)
+    if (planned_files < plan->file_count) fprintf(manifest, "\n");
+    for (size_t i = 0; i < plan->file_count; i++)
+    {
+        const PlanFile *const file = &plan->files[i];
+        if (file->cover) continue;
+
+        fprintf(manifest, "# Not planned: %s (%s)\n", file->path,
+            (file->status == IMC_SUCCESS) ? "does not fit on any image" : imc_steg_strerror(file->status));
+    }
+
+    const bool write_error = ferror(manifest);
+    if (fclose(manifest) != 0 || write_error) return IMC_ERR_SAVE_FAIL;
+
+    return IMC_SUCCESS;
+}
+
+// Free the memory used by a plan
+void imc_plan_free(HidePlan *plan)
+{
+    if (!plan) return;
+
+    for (size_t i = 0; i < plan->cover_count; i++)
+    {
+        imc_free(plan->covers[i].path);
+    }
+
+    imc_free(plan->covers);
+    imc_free(plan->files);
+    imc_free(plan);
+}
@@ -0,0 +1,123 @@
+/* Plan mode: assign many files to a pool of cover images, then write the assignment as a batch manifest. */
+
+#ifndef _IMC_PLAN_H
+#define _IMC_PLAN_H
+
+#include "imc_includes.h"
+
+/*  How a plan is made
+
+    First, all cover images are decoded in parallel in order to get how many bytes each of them can hide.
+    The files are not hidden yet, so this does not depend on the password. If a capacity cache is given
+    (see 'imc_cache.h'), the images found on it are only hashed instead of decoded. Paths of directories are replaced
+    by the files inside them (files that are not supported images are just skipped).
+
+    Then the size that each file will have after being compressed and encrypted is estimated, also in parallel.
+    Small files are compressed entirely (so their size is exact), while for bigger files some evenly spaced
+    samples are compressed, and their ratio is applied to the whole file (with a safety margin). The estimate
+    never goes over the maximum size that the file can have after being compressed.
+
+    Finally, the files are assigned to the images, from the biggest file to the smallest:
+    - IMC_PLAN_MINIMIZE: use as few images as possible. Each file goes to the image being used with the least
+      space left that still fits it; if none fits, the biggest unused image is taken. Afterwards, each image is
+      swapped by the smallest unused image that can hold the same files.
+    - IMC_PLAN_BALANCE: spread the files among all images. Each file goes to the image that would end up with
+      the smallest fraction of its capacity used.
+
+    The plan is written as a manifest for the '--batch' option (see 'imc_batch.h'), with one 'hide' job per image.
+*/
+
+// Safety margin added to the estimates of the files that are sampled (in parts per thousand of the estimate)
+#define IMC_PLAN_MARGIN         20
+
+// Files up to this size in bytes are compressed entirely, instead of sampled
+#define IMC_PLAN_EXACT_LIMIT    4000000
+
+// Amount and size in bytes of the samples taken from the bigger files
+#define IMC_PLAN_SAMPLE_COUNT   32
+#define IMC_PLAN_SAMPLE_SIZE    65536
+
+// How the files are assigned to the images
+enum PlanStrategy {IMC_PLAN_MINIMIZE, IMC_PLAN_BALANCE};
+
+// A cover image that can receive files
+typedef struct PlanCover {
+    char *path;                 // Path to the cover image
+    size_t capacity;            // How many bytes the image can hide
+    size_t used;                // Estimated amount of bytes used by the files assigned to the image
+    size_t file_count;          // Amount of files assigned to the image
+    bool is_cached;             // Whether the capacity was found on the cache (so the image was not decoded)
+    int status;                 // Status code of opening the image (IMC_SUCCESS if it could be opened)
+} PlanCover;
+
+// A file being hidden
+typedef struct PlanFile {
+    const char *path;           // Path to the file
+    size_t file_size;           // Size in bytes of the file
+    size_t estimate;            // Estimated size in bytes of the file once it is compressed and encrypted
+    bool is_exact;              // Whether the file was compressed entirely (instead of sampled)
+    PlanCover *cover;           // Image that the file was assigned to (NULL if it did not fit on any image)
+    int status;                 // Status code of reading the file (IMC_SUCCESS if it could be read)
+} PlanFile;
+
+// Assignment of the files to the images
+typedef struct HidePlan {
+    PlanCover *covers;          // All cover images (including the ones that could not be opened)
+    size_t cover_count;         // Amount of elements on the 'covers' array
+    PlanFile *files;            // All files being hidden, in the order that they were given
+    size_t file_count;          // Amount of elements on the 'files' array
+    enum PlanStrategy strategy; // How the files were assigned to the images
+    CapacityCache *cache;       // Capacities of the images that were scanned before (NULL if no cache is used)
+} HidePlan;
+
+// Comparison function for sorting the names of the files on a directory
+static int __plan_compare_name(const void *name_a, const void *name_b);
+
+// Add a cover image to the plan, or all files inside it if the path is a directory
+static void __plan_add_cover(HidePlan *plan, size_t *capacity, const char *path);
+
+// Get the capacity of some of the cover images (this function might run on a worker thread)
+static void __plan_scan_range(size_t start, size_t end, void *plan_ptr);
+
+// Estimate the size of a file once it is compressed and encrypted
+static int __plan_estimate_file(PlanFile *file);
+
+// Estimate the sizes of some of the files (this function might run on a worker thread)
+static void __plan_estimate_range(size_t start, size_t end, void *plan_ptr);
+
+// Comparison function for sorting the files from the biggest estimate to the smallest
+static int __plan_compare_file(const void *file_a, const void *file_b);
+
+// Comparison function for sorting the images from the biggest capacity to the smallest
+static int __plan_compare_cover(const void *cover_a, const void *cover_b);
+
+// Assign the files to as few images as possible (the 'order' arrays are sorted from biggest to smallest)
+static void __plan_pack_minimize(PlanFile **file_order, size_t file_count, PlanCover **cover_order, size_t cover_count);
+
+// Spread the files among all images (the 'order' arrays are sorted from biggest to smallest)
+static void __plan_pack_balance(PlanFile **file_order, size_t file_count, PlanCover **cover_order, size_t cover_count);
+
+// Assign the files at 'file_paths' to the images at 'cover_paths' (which may also be directories with images)
+// The images are opened and the files are estimated in parallel. The results of each image and file
+// are stored on the plan, including the ones that failed or did not fit.
+// If 'cache' is not NULL, the images found on it are not decoded, and the capacities of the other images are added to it.
+// The returned 'HidePlan' should be freed with 'imc_plan_free()'.
+HidePlan *imc_plan_create(
+    const char *const *cover_paths,
+    size_t cover_path_count,
+    const char *const *file_paths,
+    size_t file_count,
+    enum PlanStrategy strategy,
+    CapacityCache *cache
+);
+
+// Write the plan as a batch manifest to 'manifest_path'
+// 'output_dir' is the directory where the jobs save the new images (NULL for the default name of each image).
+// Function returns IMC_ERR_SAVE_FAIL if the manifest could not be written,
+// or IMC_ERR_FILE_INVALID if a path has a tab or line break (which the manifest cannot have).
+int imc_plan_write(const HidePlan *plan, const char *manifest_path, const char *output_dir);
+
+// Free the memory used by a plan
+void imc_plan_free(HidePlan *plan);
+
+#endif  // _IMC_PLAN_H
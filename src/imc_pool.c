@@ -0,0 +1,173 @@
+/* Buffer pool: reuse the big buffers and the JPEG decoders between the images processed by the same thread. */
+
+#include "imc_includes.h"
+
+/* Note: See the 'imc_pool.h' file for how the buffers are reused. */
+
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pool_key;      // Stores the cache of each thread
+
+// Create the key that stores the cache of each thread (this function runs only once)
+static void __pool_key_create()
+{
+    pthread_key_create(&pool_key, &__pool_cache_destroy);
+}
+
+// Free a JPEG decoder, along with its error manager
+static void __pool_jpeg_destroy(struct jpeg_decompress_struct *jpeg_obj)
+{
+    struct jpeg_error_mgr *const jpeg_err = jpeg_obj->err;
+    jpeg_destroy_decompress(jpeg_obj);
+    imc_free(jpeg_err);
+    imc_free(jpeg_obj);
+}
+
+// Free a cache and all buffers in it (this function runs when a thread exits)
+static void __pool_cache_destroy(void *cache_ptr)
+{
+    BufferCache *const cache = (BufferCache *)cache_ptr;
+
+    for (size_t i = 0; i < IMC_POOL_CLASSES; i++)
+    {
+        for (size_t j = 0; j < cache->counts[i]; j++)
+        {
+            imc_free(cache->buffers[i][j]);
+        }
+    }
+
+    if (cache->jpeg_decoder) __pool_jpeg_destroy(cache->jpeg_decoder);
+    imc_free(cache);
+}
+
+// Get the cache of the calling thread (it is created if the thread does not have one yet)
+static BufferCache *__pool_get_cache()
+{
+    pthread_once(&pool_key_once, &__pool_key_create);
+
+    BufferCache *cache = pthread_getspecific(pool_key);
+    if (!cache)
+    {
+        cache = imc_calloc(1, sizeof(BufferCache));
+        pthread_setspecific(pool_key, cache);
+    }
+
+    return cache;
+}
+
+// Class of the buffers big enough for 'size' bytes (zero if the buffer is too big to be cached)
+// When there is a memory budget, the buffers are not cached (so the memory goes back to the system once an image is closed).
+static size_t __pool_class(size_t size)
+{
+    if (imc_memory_get_budget() != 0) return 0;
+
+    size_t class = IMC_POOL_MIN_CLASS;
+    while (class <= IMC_POOL_MAX_CLASS && ((size_t)1 << class) < size) class++;
+    return (class <= IMC_POOL_MAX_CLASS) ? class : 0;
+}
+
+// Get a buffer of at least 'size' bytes (its contents are not initialized), with the tag telling where it is used
+// The buffer should be freed with 'imc_pool_free()'.
+void *imc_pool_alloc(size_t size, MemoryTag tag)
+{
+    const size_t class = __pool_class(size);
+    PoolHeader *header;
+
+    if (class == 0)
+    {
+        // Too big to be cached, so only the requested size is allocated
+        header = imc_malloc_tag(sizeof(PoolHeader) + size, tag);
+        header->capacity = size;
+        header->class = 0;
+        return &header[1];
+    }
+
+    // Reuse a cached buffer of the same class, if there is one
+    BufferCache *const cache = __pool_get_cache();
+    const size_t index = class - IMC_POOL_MIN_CLASS;
+
+    if (cache->counts[index] > 0)
+    {
+        header = cache->buffers[index][--cache->counts[index]];
+        cache->total_bytes -= header->capacity;
+        imc_memory_retag(header, tag);
+        return &header[1];
+    }
+
+    // Otherwise allocate the whole class, so the buffer can serve any request of the same class later
+    const size_t capacity = (size_t)1 << class;
+    header = imc_malloc_tag(sizeof(PoolHeader) + capacity, tag);
+    header->capacity = capacity;
+    header->class = class;
+    return &header[1];
+}
+
+// Free the unused space of a buffer, so it has 'size' bytes (only if the buffer cannot be cached, otherwise it is unchanged)
+// Function returns the new address of the buffer.
+void *imc_pool_trim(void *ptr, size_t size)
+{
+    PoolHeader *header = &((PoolHeader *)ptr)[-1];
+    if (header->class != 0 || size >= header->capacity) return ptr;
+
+    header = imc_realloc(header, sizeof(PoolHeader) + size);
+    header->capacity = size;
+    return &header[1];
+}
+
+// Return a buffer to the cache of the calling thread (or free it, if the cache is full)
+void imc_pool_free(void *ptr)
+{
+    if (!ptr) return;
+    PoolHeader *const header = &((PoolHeader *)ptr)[-1];
+
+    if (header->class != 0 && imc_memory_get_budget() == 0)
+    {
+        BufferCache *const cache = __pool_get_cache();
+        const size_t index = header->class - IMC_POOL_MIN_CLASS;
+
+        if (cache->counts[index] < IMC_POOL_PER_CLASS && cache->total_bytes + header->capacity <= IMC_POOL_THREAD_BYTES)
+        {
+            cache->buffers[index][cache->counts[index]++] = header;
+            cache->total_bytes += header->capacity;
+            imc_memory_retag(header, IMC_MEMORY_POOL);
+            return;
+        }
+    }
+
+    imc_free(header);
+}
+
+// Get the amount of memory used by a buffer (including the space that was rounded up, and its header)
+size_t imc_pool_footprint(void *ptr)
+{
+    const PoolHeader *const header = &((PoolHeader *)ptr)[-1];
+    return sizeof(PoolHeader) + header->capacity;
+}
+
+// Take the JPEG decoder cached by the calling thread
+// Function returns NULL if there is none, in which case a new decoder should be created.
+struct jpeg_decompress_struct *imc_pool_jpeg_take()
+{
+    BufferCache *const cache = __pool_get_cache();
+    struct jpeg_decompress_struct *const jpeg_obj = cache->jpeg_decoder;
+    cache->jpeg_decoder = NULL;
+    return jpeg_obj;
+}
+
+// Reset a JPEG decoder, and keep it on the cache of the calling thread (or free it, if the thread already has one)
+// The decoder must have been created with 'jpeg_create_decompress()', and its error manager with 'imc_malloc()'.
+void imc_pool_jpeg_give(struct jpeg_decompress_struct *jpeg_obj)
+{
+    BufferCache *const cache = __pool_get_cache();
+
+    if (cache->jpeg_decoder)
+    {
+        __pool_jpeg_destroy(jpeg_obj);
+        return;
+    }
+
+    // Free the memory of the last image (the decoder's permanent memory is kept)
+    jpeg_abort_decompress(jpeg_obj);
+    jpeg_obj->progress = NULL;
+    jpeg_obj->client_data = NULL;
+    cache->jpeg_decoder = jpeg_obj;
+}
@@ -0,0 +1,87 @@
+/* Buffer pool: reuse the big buffers and the JPEG decoders between the images processed by the same thread. */
+
+#ifndef _IMC_POOL_H
+#define _IMC_POOL_H
+
+#include "imc_includes.h"
+
+/*  How the buffers are reused
+
+    Each thread keeps its own cache, so taking or returning a buffer never waits for a lock. The buffers are grouped
+    in classes by their capacity (a power of two), and a request is served by a cached buffer of the same class
+    (the buffer might have been returned by another image of a different size, as long as it rounds up to the same
+    power of two). When an image is closed, its buffers go back to the cache of the thread that closed it, so the next
+    image does not need to allocate them again (and the operating system does not need to map new pages to them).
+
+    Each thread caches at most 'IMC_POOL_PER_CLASS' buffers per class, and at most 'IMC_POOL_THREAD_BYTES' bytes in total.
+    Buffers bigger than 'IMC_POOL_MAX_CLASS' are never cached (they are allocated exactly and freed when returned).
+    The cache is freed when its thread exits. When there is a memory budget ('--max-memory' option), the buffers
+    are allocated with their exact size and are not cached.
+
+    The JPEG decoders are reused in the same way: after an image is closed, its decoder is reset with
+    'jpeg_abort_decompress()' and kept by the thread, so the next JPEG image skips creating a new one.
+    libpng has no way of resetting a read struct, so the PNG structs are still created for each image.
+*/
+
+#define IMC_POOL_MIN_CLASS      12          // Smallest class of buffers (2^12 = 4 KB)
+#define IMC_POOL_MAX_CLASS      26          // Biggest class of buffers that can be cached (2^26 = 64 MB)
+#define IMC_POOL_CLASSES        (IMC_POOL_MAX_CLASS - IMC_POOL_MIN_CLASS + 1)
+#define IMC_POOL_PER_CLASS      2           // Maximum amount of cached buffers of the same class (per thread)
+#define IMC_POOL_THREAD_BYTES   134217728   // Maximum amount of bytes cached by each thread (128 MB)
+
+// Header stored before each buffer of the pool
+typedef union PoolHeader {
+    struct {
+        size_t capacity;    // Amount of bytes that the buffer can hold
+        size_t class;       // Class of the buffer (zero if the buffer cannot be cached)
+    };
+    max_align_t align;      // Keep the buffer aligned as if it was returned by 'malloc()'
+} PoolHeader;
+
+// Buffers and decoders cached by a thread
+typedef struct BufferCache {
+    PoolHeader *buffers[IMC_POOL_CLASSES][IMC_POOL_PER_CLASS];  // Buffers that can be reused, by class
+    size_t counts[IMC_POOL_CLASSES];                            // Amount of buffers cached on each class
+    size_t total_bytes;                                         // Sum of the capacities of the cached buffers
+    struct jpeg_decompress_struct *jpeg_decoder;                // JPEG decoder that can be reused (NULL if none)
+} BufferCache;
+
+// Create the key that stores the cache of each thread (this function runs only once)
+static void __pool_key_create();
+
+// Free a JPEG decoder, along with its error manager
+static void __pool_jpeg_destroy(struct jpeg_decompress_struct *jpeg_obj);
+
+// Free a cache and all buffers in it (this function runs when a thread exits)
+static void __pool_cache_destroy(void *cache_ptr);
+
+// Get the cache of the calling thread (it is created if the thread does not have one yet)
+static BufferCache *__pool_get_cache();
+
+// Class of the buffers big enough for 'size' bytes (zero if the buffer is too big to be cached)
+// When there is a memory budget, the buffers are not cached (so the memory goes back to the system once an image is closed).
+static size_t __pool_class(size_t size);
+
+// Get a buffer of at least 'size' bytes (its contents are not initialized), with the tag telling where it is used
+// The buffer should be freed with 'imc_pool_free()'.
+void *imc_pool_alloc(size_t size, MemoryTag tag);
+
+// Free the unused space of a buffer, so it has 'size' bytes (only if the buffer cannot be cached, otherwise it is unchanged)
+// Function returns the new address of the buffer.
+void *imc_pool_trim(void *ptr, size_t size);
+
+// Return a buffer to the cache of the calling thread (or free it, if the cache is full)
+void imc_pool_free(void *ptr);
+
+// Get the amount of memory used by a buffer (including the space that was rounded up, and its header)
+size_t imc_pool_footprint(void *ptr);
+
+// Take the JPEG decoder cached by the calling thread
+// Function returns NULL if there is none, in which case a new decoder should be created.
+struct jpeg_decompress_struct *imc_pool_jpeg_take();
+
+// Reset a JPEG decoder, and keep it on the cache of the calling thread (or free it, if the thread already has one)
+// The decoder must have been created with 'jpeg_create_decompress()', and its error manager with 'imc_malloc()'.
+void imc_pool_jpeg_give(struct jpeg_decompress_struct *jpeg_obj);
+
+#endif  // _IMC_POOL_H
@@ -0,0 +1,147 @@
+/* File prefetching: read ahead the images that are about to be processed, so the disk works while the processors decode. */
+
+#include "imc_includes.h"
+
+/* Note: See the 'imc_prefetch.h' file for how the files are prefetched. */
+
+// Start reading a file into the system's cache (up to 'IMC_PREFETCH_MAX_SIZE' bytes)
+static void __prefetch_file(const char *path)
+{
+    #ifdef _WIN32
+
+    // Read the file and discard its contents (it stays on the system's cache)
+    FILE *file = fopen(path, "rb");
+    if (!file) return;
+
+    uint8_t *const buffer = imc_malloc(IMC_PREFETCH_CHUNK);
+    size_t total = 0;
+    while (total < IMC_PREFETCH_MAX_SIZE && fread(buffer, 1, IMC_PREFETCH_CHUNK, file) == IMC_PREFETCH_CHUNK)
+    {
+        total += IMC_PREFETCH_CHUNK;
+    }
+    imc_free(buffer);
+    fclose(file);
+
+    #else // Linux
+
+    // Ask the kernel to read the file in the background
+    const int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) return;
+    posix_fadvise(descriptor, 0, IMC_PREFETCH_MAX_SIZE, POSIX_FADV_WILLNEED);
+    close(descriptor);
+
+    #endif // _WIN32
+}
+
+// Main loop of the prefetching thread
+static void *__prefetch_worker(void *prefetcher_ptr)
+{
+    FilePrefetcher *const prefetcher = (FilePrefetcher *)prefetcher_ptr;
+
+    pthread_mutex_lock(&prefetcher->lock);
+
+    while (true)
+    {
+        // Wait until there is a file queued, and the window has room for it
+        while (!prefetcher->shutdown && (!prefetcher->head || prefetcher->issued >= prefetcher->consumed + prefetcher->window))
+        {
+            pthread_cond_wait(&prefetcher->changed, &prefetcher->lock);
+        }
+
+        if (prefetcher->shutdown) break;
+
+        PrefetchNode *const node = prefetcher->head;
+        prefetcher->head = node->next;
+        if (!prefetcher->head) prefetcher->tail = NULL;
+        prefetcher->issued++;
+
+        // The file is read without holding the lock, so the workers are not blocked meanwhile
+        pthread_mutex_unlock(&prefetcher->lock);
+        __prefetch_file(node->path);
+        imc_free(node);
+        pthread_mutex_lock(&prefetcher->lock);
+    }
+
+    pthread_mutex_unlock(&prefetcher->lock);
+    return NULL;
+}
+
+// Start a prefetching thread that keeps 'window' files ahead of the ones being processed
+// Function returns NULL if 'window' is zero (prefetching disabled), and the other functions accept NULL in that case.
+// The returned 'FilePrefetcher' should be freed with 'imc_prefetch_destroy()'.
+FilePrefetcher *imc_prefetch_create(size_t window)
+{
+    if (window == 0) return NULL;
+
+    FilePrefetcher *prefetcher = imc_calloc(1, sizeof(FilePrefetcher));
+    prefetcher->window = window;
+    pthread_mutex_init(&prefetcher->lock, NULL);
+    pthread_cond_init(&prefetcher->changed, NULL);
+
+    if (pthread_create(&prefetcher->thread, NULL, &__prefetch_worker, prefetcher) != 0)
+    {
+        // Prefetching is only an optimization, so the files are just read without it
+        pthread_cond_destroy(&prefetcher->changed);
+        pthread_mutex_destroy(&prefetcher->lock);
+        imc_free(prefetcher);
+        return NULL;
+    }
+
+    return prefetcher;
+}
+
+// Queue a file to be prefetched (the files should be queued in the same order that they are going to be processed)
+void imc_prefetch_add(FilePrefetcher *prefetcher, const char *path)
+{
+    if (!prefetcher) return;
+
+    const size_t path_size = strlen(path) + 1;
+    PrefetchNode *node = imc_malloc(sizeof(PrefetchNode) + path_size);
+    node->next = NULL;
+    memcpy(node->path, path, path_size);
+
+    pthread_mutex_lock(&prefetcher->lock);
+
+    if (prefetcher->tail) prefetcher->tail->next = node;
+    else prefetcher->head = node;
+    prefetcher->tail = node;
+
+    pthread_cond_signal(&prefetcher->changed);
+    pthread_mutex_unlock(&prefetcher->lock);
+}
+
+// Signal that a worker has started processing the next file (so one more file can be prefetched)
+void imc_prefetch_consume(FilePrefetcher *prefetcher)
+{
+    if (!prefetcher) return;
+
+    pthread_mutex_lock(&prefetcher->lock);
+    prefetcher->consumed++;
+    pthread_cond_signal(&prefetcher->changed);
+    pthread_mutex_unlock(&prefetcher->lock);
+}
+
+// Stop the prefetching thread (the files not prefetched yet are discarded), then free its memory
+void imc_prefetch_destroy(FilePrefetcher *prefetcher)
+{
+    if (!prefetcher) return;
+
+    pthread_mutex_lock(&prefetcher->lock);
+    prefetcher->shutdown = true;
+    pthread_cond_signal(&prefetcher->changed);
+    pthread_mutex_unlock(&prefetcher->lock);
+
+    pthread_join(prefetcher->thread, NULL);
+
+    PrefetchNode *node = prefetcher->head;
+    while (node)
+    {
+        PrefetchNode *const next = node->next;
+        imc_free(node);
+        node = next;
+    }
+
+    pthread_cond_destroy(&prefetcher->changed);
+    pthread_mutex_destroy(&prefetcher->lock);
+    imc_free(prefetcher);
+}
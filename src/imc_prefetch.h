@@ -0,0 +1,65 @@
+/* File prefetching: read ahead the images that are about to be processed, so the disk works while the processors decode. */
+
+#ifndef _IMC_PREFETCH_H
+#define _IMC_PREFETCH_H
+
+#include "imc_includes.h"
+
+/*  How the files are prefetched
+
+    The paths are queued in the order that the files are going to be processed. A dedicated thread takes them
+    from the queue, and asks the operating system to start reading each file into its page cache, keeping at most
+    'window' files ahead of the ones that the workers have already started. So when a worker opens an image,
+    its contents are usually already in memory, and the worker spends its time decoding instead of waiting for the disk.
+
+    On Linux, the reading is started with 'posix_fadvise(POSIX_FADV_WILLNEED)', which returns without waiting
+    for the disk (so the thread can request many files at once, and the disk can reorder the reads).
+    On Windows, the thread reads the files itself (which also leaves them on the system's cache).
+*/
+
+#define IMC_PREFETCH_DEFAULT    8           // Default amount of files read ahead of the ones being processed
+#define IMC_PREFETCH_MAX        1024        // Maximum amount of files read ahead
+#define IMC_PREFETCH_CHUNK      1048576     // Size in bytes of each read, when the files are read by the thread itself
+#define IMC_PREFETCH_MAX_SIZE   67108864    // Only the beginning of bigger files is prefetched (so a big file that is
+                                            // not an image does not push the other files out of the cache)
+
+// A file waiting to be prefetched
+typedef struct PrefetchNode {
+    struct PrefetchNode *next;  // File queued after this one
+    char path[];                // Path to the file
+} PrefetchNode;
+
+// Thread that reads ahead the files about to be processed
+typedef struct FilePrefetcher {
+    PrefetchNode *head;         // Next file to be prefetched
+    PrefetchNode *tail;         // Last file queued
+    size_t window;              // Maximum amount of files prefetched ahead of the ones being processed
+    size_t issued;              // Amount of files that were prefetched
+    size_t consumed;            // Amount of files that the workers have started processing
+    bool shutdown;              // Signals the thread to exit
+    pthread_t thread;           // Handle of the prefetching thread
+    pthread_mutex_t lock;       // Protects the fields above
+    pthread_cond_t changed;     // Signaled when a file is queued or consumed (or on shutdown)
+} FilePrefetcher;
+
+// Start reading a file into the system's cache (up to 'IMC_PREFETCH_MAX_SIZE' bytes)
+static void __prefetch_file(const char *path);
+
+// Main loop of the prefetching thread
+static void *__prefetch_worker(void *prefetcher_ptr);
+
+// Start a prefetching thread that keeps 'window' files ahead of the ones being processed
+// Function returns NULL if 'window' is zero (prefetching disabled), and the other functions accept NULL in that case.
+// The returned 'FilePrefetcher' should be freed with 'imc_prefetch_destroy()'.
+FilePrefetcher *imc_prefetch_create(size_t window);
+
+// Queue a file to be prefetched (the files should be queued in the same order that they are going to be processed)
+void imc_prefetch_add(FilePrefetcher *prefetcher, const char *path);
+
+// Signal that a worker has started processing the next file (so one more file can be prefetched)
+void imc_prefetch_consume(FilePrefetcher *prefetcher);
+
+// Stop the prefetching thread (the files not prefetched yet are discarded), then free its memory
+void imc_prefetch_destroy(FilePrefetcher *prefetcher);
+
+#endif  // _IMC_PREFETCH_H
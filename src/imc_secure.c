@@ -0,0 +1,192 @@
+/* Secure memory pool: small buffers for secrets, taken from a locked region kept by each thread. */
+
+#include "imc_includes.h"
+
+/* Note: See the 'imc_secure.h' file for how the secure memory is pooled. */
+
+static pthread_once_t secure_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t secure_key;    // Stores the region of each thread
+static uint64_t secure_canary;      // Random value stored before each buffer
+
+// Create the key that stores the region of each thread (this function runs only once)
+static void __secure_key_create()
+{
+    pthread_key_create(&secure_key, &__secure_region_release);
+    randombytes_buf(&secure_canary, sizeof(secure_canary));
+}
+
+// Get the size in bytes of a memory page
+static size_t __secure_page_size()
+{
+    #ifdef _WIN32
+    SYSTEM_INFO sys_info;
+    GetSystemInfo(&sys_info);
+    const long page_size = sys_info.dwPageSize;
+    #else
+    const long page_size = sysconf(_SC_PAGESIZE);
+    #endif // _WIN32
+
+    return (page_size >= IMC_SECURE_PAGE_MIN) ? (size_t)page_size : IMC_SECURE_PAGE_MIN;
+}
+
+// Get the canary of a secure buffer (the bytes right before the buffer)
+static uint64_t *__secure_canary(void *ptr)
+{
+    _Static_assert(sizeof(SecureHeader) >= sizeof(SecureRegion *) + sizeof(uint64_t), "The canary does not fit on the header");
+    return &((uint64_t *)ptr)[-1];
+}
+
+// Get the first byte of a slot of a region
+static uint8_t *__secure_slot(const SecureRegion *region, size_t slot)
+{
+    // Each slot is preceded by a guard page
+    return &region->memory[(2 * slot + 1) * region->page_size];
+}
+
+// Free a region and its locked memory
+static void __secure_region_destroy(SecureRegion *region)
+{
+    // The slots are already cleared, but unlocking them clears them once more
+    for (size_t i = 0; i < IMC_SECURE_SLOT_COUNT; i++)
+    {
+        sodium_munlock(__secure_slot(region, i), region->page_size);
+    }
+
+    const size_t region_size = (2 * IMC_SECURE_SLOT_COUNT + 1) * region->page_size;
+    #ifdef _WIN32
+    VirtualFree(region->memory, 0, MEM_RELEASE);
+    (void)region_size;
+    #else
+    munmap(region->memory, region_size);
+    #endif // _WIN32
+
+    pthread_mutex_destroy(&region->lock);
+    imc_free(region);
+}
+
+// Release the region of a thread that exited (it is freed once all of its slots are released)
+static void __secure_region_release(void *region_ptr)
+{
+    SecureRegion *const region = (SecureRegion *)region_ptr;
+
+    pthread_mutex_lock(&region->lock);
+    region->is_orphan = true;
+    const bool is_unused = (region->used == 0);
+    pthread_mutex_unlock(&region->lock);
+
+    if (is_unused) __secure_region_destroy(region);
+}
+
+// Get the region of the calling thread (it is created if the thread does not have one yet)
+// Function returns NULL if the locked memory could not be allocated.
+static SecureRegion *__secure_get_region()
+{
+    pthread_once(&secure_key_once, &__secure_key_create);
+
+    SecureRegion *region = pthread_getspecific(secure_key);
+    if (region) return region;
+
+    // Map the slots and the guard pages between them (the new pages are already zero)
+    const size_t page_size = __secure_page_size();
+    const size_t region_size = (2 * IMC_SECURE_SLOT_COUNT + 1) * page_size;
+
+    #ifdef _WIN32
+    uint8_t *const memory = VirtualAlloc(NULL, region_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!memory) return NULL;
+    #else
+    uint8_t *const memory = mmap(NULL, region_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return NULL;
+    #endif // _WIN32
+
+    region = imc_calloc(1, sizeof(SecureRegion));
+    region->memory = memory;
+    region->page_size = page_size;
+
+    // Turn every other page into a guard page, then lock the slots in memory
+    // (like 'sodium_malloc()', it is fine if the slots could not be locked: the limit of locked memory might be low)
+    for (size_t i = 0; i <= IMC_SECURE_SLOT_COUNT; i++)
+    {
+        uint8_t *const guard_page = &memory[2 * i * page_size];
+        #ifdef _WIN32
+        DWORD old_protection;
+        VirtualProtect(guard_page, page_size, PAGE_NOACCESS, &old_protection);
+        #else
+        mprotect(guard_page, page_size, PROT_NONE);
+        #endif // _WIN32
+
+        if (i < IMC_SECURE_SLOT_COUNT) sodium_mlock(__secure_slot(region, i), page_size);
+    }
+
+    pthread_mutex_init(&region->lock, NULL);
+    pthread_setspecific(secure_key, region);
+
+    return region;
+}
+
+// Allocate 'size' bytes of secure memory, initialized to zero
+// Function returns NULL if no enough memory was available. The buffer should be freed with 'imc_secure_free()'.
+void *imc_secure_alloc(size_t size)
+{
+    // The size is rounded up to the alignment, because the buffer is placed right before a guard page
+    const size_t alignment = sizeof(SecureHeader);
+    const size_t total_size = (sizeof(SecureHeader) + size + alignment - 1) / alignment * alignment;
+    if (total_size < size) return NULL;
+
+    SecureRegion *const region = (total_size <= IMC_SECURE_PAGE_MIN) ? __secure_get_region() : NULL;
+
+    if (region && total_size <= region->page_size)
+    {
+        // Take the first free slot (the slots are cleared when freed, so they are already zero)
+        pthread_mutex_lock(&region->lock);
+        size_t slot = 0;
+        while (slot < IMC_SECURE_SLOT_COUNT && (region->used & ((uint64_t)1 << slot))) slot++;
+        if (slot < IMC_SECURE_SLOT_COUNT) region->used |= ((uint64_t)1 << slot);
+        pthread_mutex_unlock(&region->lock);
+
+        if (slot < IMC_SECURE_SLOT_COUNT)
+        {
+            uint8_t *const slot_end = __secure_slot(region, slot) + region->page_size;
+            SecureHeader *const header = (SecureHeader *)(slot_end - total_size);
+            header->region = region;
+            *__secure_canary(&header[1]) = secure_canary;
+            return &header[1];
+        }
+    }
+
+    // Too big for a slot, or no slot available
+    SecureHeader *const header = sodium_malloc(total_size);
+    if (!header) return NULL;
+    sodium_memzero(header, total_size);
+    *__secure_canary(&header[1]) = secure_canary;
+
+    return &header[1];
+}
+
+// Clear a buffer allocated by 'imc_secure_alloc()', then free it
+void imc_secure_free(void *ptr)
+{
+    if (!ptr) return;
+    SecureHeader *const header = &((SecureHeader *)ptr)[-1];
+    SecureRegion *const region = header->region;
+
+    // Something wrote before the beginning of the buffer: the program stops, rather than keep going with corrupted memory
+    if (*__secure_canary(ptr) != secure_canary) sodium_misuse();
+
+    if (!region)
+    {
+        sodium_free(header);    // This function already overwrites the memory before freeing it
+        return;
+    }
+
+    // Clear only the part of the slot that was used (from the header to the guard page), then mark the slot as free
+    const size_t slot = ((uint8_t *)header - region->memory) / (2 * region->page_size);
+    uint8_t *const slot_end = __secure_slot(region, slot) + region->page_size;
+    sodium_memzero(header, slot_end - (uint8_t *)header);
+
+    pthread_mutex_lock(&region->lock);
+    region->used &= ~((uint64_t)1 << slot);
+    const bool is_done = region->is_orphan && region->used == 0;
+    pthread_mutex_unlock(&region->lock);
+
+    if (is_done) __secure_region_destroy(region);
+}
@@ -0,0 +1,75 @@
+/* Secure memory pool: small buffers for secrets, taken from a locked region kept by each thread. */
+
+#ifndef _IMC_SECURE_H
+#define _IMC_SECURE_H
+
+#include "imc_includes.h"
+
+/*  How the secure memory is pooled
+
+    Allocating each key with 'sodium_malloc()' costs several system calls (mapping the pages, locking them in memory,
+    and protecting the guard pages around them), and the same again for freeing it. Since every image gets its own copy
+    of the key, that cost was paid for each image.
+
+    Instead, each thread maps once a region of memory split into slots of one page each, with a guard page (which
+    cannot be accessed) before and after every slot. The slots are locked in memory and excluded from core dumps
+    ('sodium_mlock()'), the same as the memory from 'sodium_malloc()'. The small secrets (the keys, the states of the
+    number generator, and the password hashes) are placed at the end of a slot, right before its guard page, so writing
+    past a buffer faults right away instead of reaching the secret on the next slot. Before each buffer there is a
+    canary, which is checked when the buffer is freed (catching writes before the buffer, like 'sodium_free()' does).
+    A slot is cleared as soon as it is freed, so only the bytes that held the secret need to be wiped.
+
+    A slot can be freed from any thread (a key copied on one thread might be destroyed on another), so each region
+    has a lock. When a thread exits, its region is only freed after all of its slots are released.
+    Buffers bigger than a slot, or requested when the region is full, are allocated with 'sodium_malloc()' as before.
+*/
+
+#define IMC_SECURE_SLOT_COUNT   16      // Amount of slots on the region of each thread (at most 64, the bits of the mask)
+#define IMC_SECURE_PAGE_MIN     4096    // Smallest page size of the supported systems (so a slot has at least this size)
+
+// Header stored before each secure buffer
+// (its last bytes, right before the buffer, hold the canary: see '__secure_canary()')
+typedef union SecureHeader {
+    struct SecureRegion *region;    // Region that contains the buffer (NULL if it was allocated with 'sodium_malloc()')
+    max_align_t align;              // Keep the buffer aligned as if it was returned by 'malloc()'
+} SecureHeader;
+
+// Locked memory kept by a thread for its secrets
+typedef struct SecureRegion {
+    uint8_t *memory;        // Beginning of the mapped memory (a guard page, followed by the slots and their guard pages)
+    size_t page_size;       // Size in bytes of a memory page (each slot has one page)
+    uint64_t used;          // Mask of the slots that are in use (one bit per slot)
+    bool is_orphan;         // Whether the thread that owns the region has exited
+    pthread_mutex_t lock;   // Protects the fields above (slots can be freed from other threads)
+} SecureRegion;
+
+// Create the key that stores the region of each thread (this function runs only once)
+static void __secure_key_create();
+
+// Get the size in bytes of a memory page
+static size_t __secure_page_size();
+
+// Get the canary of a secure buffer (the bytes right before the buffer)
+static uint64_t *__secure_canary(void *ptr);
+
+// Get the first byte of a slot of a region
+static uint8_t *__secure_slot(const SecureRegion *region, size_t slot);
+
+// Free a region and its locked memory
+static void __secure_region_destroy(SecureRegion *region);
+
+// Release the region of a thread that exited (it is freed once all of its slots are released)
+static void __secure_region_release(void *region_ptr);
+
+// Get the region of the calling thread (it is created if the thread does not have one yet)
+// Function returns NULL if the locked memory could not be allocated.
+static SecureRegion *__secure_get_region();
+
+// Allocate 'size' bytes of secure memory, initialized to zero
+// Function returns NULL if no enough memory was available. The buffer should be freed with 'imc_secure_free()'.
+void *imc_secure_alloc(size_t size);
+
+// Clear a buffer allocated by 'imc_secure_alloc()', then free it
+void imc_secure_free(void *ptr);
+
+#endif  // _IMC_SECURE_H
@@ -0,0 +1,611 @@
+/* Server mode: a long-running process that performs hide, extract, or check operations requested through a local socket. */
+
+#include "imc_includes.h"
+
+/* Note: See the 'imc_server.h' file for the protocol used by the server. */
+
+#ifndef _WIN32
+
+// Set by the signal handler when the server should stop
+static volatile sig_atomic_t server_stopping = 0;
+
+// Names of the stages of the operations, as sent on the progress messages (indexed by 'enum ProgressStage')
+static const char *const server_stage_names[] = {
+    [IMC_STAGE_READ_IMAGE] = "read-image",
+    [IMC_STAGE_SCAN_CARRIER] = "scan-carrier",
+    [IMC_STAGE_SHUFFLE] = "shuffle",
+    [IMC_STAGE_WRITE_DATA] = "write-data",
+    [IMC_STAGE_WRITE_CARRIER] = "write-carrier",
+    [IMC_STAGE_WRITE_IMAGE] = "write-image",
+};
+
+// Get the secret key for a password, generating it only if it is not on the cache
+// The returned key is a copy, which should be freed with 'imc_crypto_context_destroy()'.
+// 'was_cached' is set to whether the key was already on the cache.
+// Function returns NULL if there is no enough memory for generating the key.
+static CryptoContext *__server_get_key(ServerContext *server, const PassBuff *password, bool *was_cached)
+{
+    // The entries are identified by a keyed hash, so the cache does not store anything derived only from the password
+    uint8_t id[crypto_generichash_BYTES];
+    crypto_generichash(id, sizeof(id), password->buffer, password->length, server->cache_secret, sizeof(server->cache_secret));
+
+    CryptoContext *key = NULL;
+    *was_cached = false;
+
+    // Look for the key on the cache
+    pthread_mutex_lock(&server->lock);
+    for (size_t i = 0; i < IMC_SERVER_KEY_CACHE; i++)
+    {
+        KeyCacheEntry *const entry = &server->key_cache[i];
+        if (entry->key && sodium_memcmp(entry->id, id, sizeof(id)) == 0)
+        {
+            entry->last_used = ++server->cache_clock;
+            *was_cached = (imc_crypto_context_copy(entry->key, &key) == IMC_SUCCESS);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    if (*was_cached) return key;
+
+    // Generate the key from the password
+    // (this is done outside of the lock, because it takes a while and other keys can be looked up meanwhile)
+    if (imc_crypto_context_create(password, &key) != IMC_SUCCESS) return NULL;
+
+    // Store a copy of the key on the cache, replacing the least recently used entry
+    pthread_mutex_lock(&server->lock);
+    KeyCacheEntry *oldest = &server->key_cache[0];
+    for (size_t i = 0; i < IMC_SERVER_KEY_CACHE; i++)
+    {
+        KeyCacheEntry *const entry = &server->key_cache[i];
+
+        if (entry->key && sodium_memcmp(entry->id, id, sizeof(id)) == 0)
+        {
+            // Another connection has already cached the same key while this one was being generated
+            oldest = NULL;
+            break;
+        }
+
+        if (!entry->key || (oldest->key && entry->last_used < oldest->last_used)) oldest = entry;
+    }
+
+    if (oldest)
+    {
+        imc_crypto_context_destroy(oldest->key);
+        oldest->key = NULL;
+        if (imc_crypto_context_copy(key, &oldest->key) == IMC_SUCCESS)
+        {
+            memcpy(oldest->id, id, sizeof(id));
+            oldest->last_used = ++server->cache_clock;
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    return key;
+}
+
+// Read exactly 'size' bytes from a connection, storing on 'fds' the file descriptors passed along with them
+// 'fd_count' is incremented by the amount of received descriptors (the extra ones are closed).
+// Function returns false if the connection was closed, timed out, or failed.
+static bool __server_recv_all(int socket_fd, uint8_t *buffer, size_t size, int *fds, size_t *fd_count)
+{
+    size_t received = 0;
+    while (received < size)
+    {
+        struct iovec data = {.iov_base = &buffer[received], .iov_len = size - received};
+
+        // Buffer for the ancillary data (where the file descriptors come)
+        union {
+            struct cmsghdr align;
+            uint8_t buf[CMSG_SPACE(sizeof(int) * IMC_SERVER_MAX_FDS)];
+        } control;
+
+        struct msghdr message = {
+            .msg_iov = &data,
+            .msg_iovlen = 1,
+            .msg_control = control.buf,
+            .msg_controllen = sizeof(control.buf),
+        };
+
+        const ssize_t count = recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return false;
+        received += count;
+
+        // Store the received file descriptors
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg))
+        {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+
+            const size_t num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int cmsg_fds[num_fds];
+            memcpy(cmsg_fds, CMSG_DATA(cmsg), sizeof(cmsg_fds));
+
+            for (size_t i = 0; i < num_fds; i++)
+            {
+                if (*fd_count < IMC_SERVER_MAX_FDS) fds[(*fd_count)++] = cmsg_fds[i];
+                else close(cmsg_fds[i]);
+            }
+        }
+    }
+
+    return true;
+}
+
+// Write exactly 'size' bytes to a connection
+// Function returns false if the connection was closed or failed.
+static bool __server_send_all(int socket_fd, const void *buffer, size_t size)
+{
+    const uint8_t *data = (const uint8_t *)buffer;
+    size_t sent = 0;
+    while (sent < size)
+    {
+        const ssize_t count = send(socket_fd, &data[sent], size - sent, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return false;
+        sent += count;
+    }
+
+    return true;
+}
+
+// Send the progress of a request's operation to the client (this function runs on the operation's worker thread)
+// Only the changes of the whole percentage are sent, and nothing else is sent once a message could not be.
+static void __server_send_progress(enum ProgressStage stage, double percent, void *connection_ptr)
+{
+    ServerConnection *const connection = (ServerConnection *)connection_ptr;
+    const int whole_percent = (int)percent;
+
+    if (connection->progress_failed) return;
+    if ((int)stage == connection->progress_stage && whole_percent == connection->progress_percent) return;
+    connection->progress_stage = stage;
+    connection->progress_percent = whole_percent;
+
+    // The message's length (with the progress flag), followed by its text
+    char message[64];
+    const int text_len = snprintf(&message[4], sizeof(message) - 4, "%s %d\n", server_stage_names[stage], whole_percent);
+    const uint32_t message_size = htobe32(IMC_SERVER_PROGRESS_FLAG | (uint32_t)text_len);
+    memcpy(message, &message_size, sizeof(message_size));
+
+    if (!__server_send_all(connection->fd, message, sizeof(message_size) + text_len)) connection->progress_failed = true;
+}
+
+// Wait for the operation of a request to finish, while watching whether the client closes the connection
+// If it does, the operation is cancelled (and the connection is marked as closed).
+// Function returns the finished job, which should be freed with 'imc_async_free()'.
+static AsyncJob *__server_wait_job(ServerConnection *connection, AsyncJob *job)
+{
+    AsyncQueue *const queue = connection->queue;
+
+    struct pollfd watched[2] = {
+        {.fd = imc_async_get_fd(queue), .events = POLLIN},
+        {.fd = connection->fd, .events = POLLIN},
+    };
+
+    AsyncJob *finished = NULL;
+    while ( !(finished = imc_async_poll(queue)) )
+    {
+        const int count = poll(watched, 2, -1);
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0) return imc_async_wait(queue);
+
+        if (watched[1].revents & (POLLHUP | POLLERR))
+        {
+            // The client has closed the connection, so nobody is waiting for the result anymore
+            imc_async_cancel(job);
+            connection->is_closed = true;
+            watched[1].fd = -1;     // Note: 'poll()' ignores negative file descriptors.
+        }
+        else if (watched[1].revents & POLLIN)
+        {
+            // The client has sent its next request already (it is read once this one is answered)
+            watched[1].fd = -1;
+        }
+    }
+
+    return finished;
+}
+
+// Perform a single request and write its status messages to 'log'
+// The 'fields' are the null-separated fields received from the client (see the protocol above).
+// Function returns the status code of the operation.
+static int __server_handle_request(
+    ServerConnection *connection,
+    char **fields,
+    size_t field_count,
+    const int *fds,
+    size_t fd_count,
+    FILE *log,
+    bool *was_cached
+)
+{
+    *was_cached = false;
+
+    if (field_count < 3 || fields[2][0] == '\0')
+    {
+        fprintf(log, "FAIL: the request needs at least the OPERATION, PASSWORD, and IMAGE fields.\n");
+        return IMC_ERR_BAD_REQUEST;
+    }
+
+    // Operation (optionally followed by the suffix that asks for the progress)
+    AsyncRequest request = {.log = log};
+    const char *const suffix = strchr(fields[0], '+');
+    const bool wants_progress = suffix && strcmp(suffix, "+progress") == 0;
+    const size_t name_len = suffix ? (size_t)(suffix - fields[0]) : strlen(fields[0]);
+    char operation[name_len + 1];
+    memcpy(operation, fields[0], name_len);
+    operation[name_len] = '\0';
+
+    if (strcmp(operation, "hide") == 0)
+    {
+        request.operation = IMC_ASYNC_HIDE;
+    }
+    else if (strcmp(operation, "append") == 0)
+    {
+        request.operation = IMC_ASYNC_HIDE;
+        request.append = true;
+    }
+    else if (strcmp(operation, "extract") == 0)
+    {
+        request.operation = IMC_ASYNC_EXTRACT;
+    }
+    else if (strcmp(operation, "check") == 0)
+    {
+        request.operation = IMC_ASYNC_CHECK;
+    }
+    else
+    {
+        if (suffix && !wants_progress) fprintf(log, "FAIL: unknown suffix '%s' (it should be '+progress').\n", suffix);
+        else fprintf(log, "FAIL: unknown operation '%s' (it should be 'hide', 'append', 'extract', or 'check').\n", operation);
+        return IMC_ERR_BAD_REQUEST;
+    }
+
+    // Image (either a path or a file descriptor passed with the request)
+    char fd_path[64];
+    request.image = fields[2];
+
+    if (strncmp(request.image, "fd:", 3) == 0)
+    {
+        char *end = NULL;
+        const unsigned long fd_index = strtoul(&request.image[3], &end, 10);
+
+        if (end == &request.image[3] || *end != '\0' || fd_index >= fd_count)
+        {
+            fprintf(log, "FAIL: '%s' does not refer to any of the %zu file descriptors sent with the request.\n", request.image, fd_count);
+            return IMC_ERR_BAD_REQUEST;
+        }
+
+        snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fds[fd_index]);
+        request.image = fd_path;
+    }
+
+    // Output (an empty field means the default output)
+    if (field_count >= 4 && fields[3][0] != '\0') request.output = fields[3];
+
+    // Files being hidden
+    const char *payloads[field_count];
+    request.payloads = payloads;
+
+    if (request.operation == IMC_ASYNC_HIDE)
+    {
+        for (size_t i = 4; i < field_count; i++)
+        {
+            if (fields[i][0] != '\0') payloads[request.payload_count++] = fields[i];
+        }
+
+        if (request.payload_count == 0)
+        {
+            fprintf(log, "FAIL: '%s' needs at least one file to be hidden.\n", operation);
+            return IMC_ERR_BAD_REQUEST;
+        }
+
+        if (request.image == fd_path && !request.output)
+        {
+            fprintf(log, "FAIL: an output path is needed when the cover image is a file descriptor.\n");
+            return IMC_ERR_BAD_REQUEST;
+        }
+    }
+
+    // Get the secret key from the password
+    PassBuff *password = sodium_malloc(sizeof(PassBuff));
+    if (!password)
+    {
+        fprintf(log, "FAIL: no enough memory for the password.\n");
+        return IMC_ERR_NO_MEMORY;
+    }
+    password->capacity = sizeof(password->buffer);
+    password->length = strlen(fields[1]);
+    if (password->length > password->capacity) password->length = password->capacity;
+    memcpy(password->buffer, fields[1], password->length);
+
+    CryptoContext *key = __server_get_key(connection->server, password, was_cached);
+    sodium_free(password);
+
+    if (!key)
+    {
+        fprintf(log, "FAIL: no enough memory for hashing the password.\n");
+        return IMC_ERR_NO_MEMORY;
+    }
+
+    // Perform the operation on the server's job pool, so this thread can watch whether the client goes away meanwhile
+    request.key = key;
+    if (wants_progress)
+    {
+        request.progress = &__server_send_progress;
+        request.user_data = connection;
+        connection->progress_failed = false;
+        connection->progress_stage = -1;
+        connection->progress_percent = -1;
+    }
+
+    AsyncJob *job = imc_async_submit(connection->queue, &request);
+    imc_crypto_context_destroy(key);
+
+    if (!job)
+    {
+        fprintf(log, "FAIL: no enough memory for the secret key.\n");
+        return IMC_ERR_NO_MEMORY;
+    }
+
+    job = __server_wait_job(connection, job);
+    const int status = job->status;
+    imc_async_free(job);
+
+    return status;
+}
+
+// Serve the requests of a client until it disconnects (this function runs on a worker thread)
+static void __server_serve_connection(void *connection_ptr)
+{
+    ServerConnection *const connection = (ServerConnection *)connection_ptr;
+    ServerContext *const server = connection->server;
+    connection->queue = imc_async_create_shared(server->job_pool);
+
+    while (!server_stopping && !connection->is_closed)
+    {
+        int fds[IMC_SERVER_MAX_FDS];
+        size_t fd_count = 0;
+
+        // Size of the request
+        uint32_t request_size;
+        if (!__server_recv_all(connection->fd, (uint8_t *)&request_size, sizeof(request_size), fds, &fd_count)) break;
+        request_size = be32toh(request_size);
+
+        if (request_size > IMC_SERVER_MAX_REQUEST)
+        {
+            for (size_t i = 0; i < fd_count; i++) close(fds[i]);
+            break;
+        }
+
+        // Contents of the request
+        char *request = imc_malloc(request_size + 1);
+        if (!__server_recv_all(connection->fd, (uint8_t *)request, request_size, fds, &fd_count))
+        {
+            for (size_t i = 0; i < fd_count; i++) close(fds[i]);
+            imc_clear_free(request, request_size + 1);
+            break;
+        }
+        request[request_size] = '\0';
+
+        struct timespec time_start, time_end;
+        clock_gettime(CLOCK_MONOTONIC, &time_start);
+
+        // Split the request into its null-separated fields
+        // (a null character at the very end is just a terminator, rather than the beginning of an empty field)
+        size_t field_count = 1;
+        for (size_t i = 0; i < request_size; i++)
+        {
+            if (request[i] == '\0' && i + 1 < request_size) field_count++;
+        }
+
+        char *fields[field_count];
+        fields[0] = request;
+        for (size_t i = 1; i < field_count; i++)
+        {
+            fields[i] = fields[i-1] + strlen(fields[i-1]) + 1;
+        }
+
+        pthread_mutex_lock(&server->lock);
+        const size_t request_num = ++server->request_count;
+        pthread_mutex_unlock(&server->lock);
+
+        // Perform the request, while collecting its status messages
+        char *messages = NULL;
+        size_t messages_size = 0;
+        FILE *log = open_memstream(&messages, &messages_size);
+
+        bool was_cached = false;
+        const int status = log
+            ? __server_handle_request(connection, fields, field_count, fds, fd_count, log, &was_cached)
+            : IMC_ERR_NO_MEMORY;
+
+        if (log) fclose(log);
+        for (size_t i = 0; i < fd_count; i++) close(fds[i]);
+
+        clock_gettime(CLOCK_MONOTONIC, &time_end);
+        const uint64_t elapsed_us = (time_end.tv_sec - time_start.tv_sec) * 1000000ULL
+                                  + (time_end.tv_nsec - time_start.tv_nsec) / 1000;
+
+        // Log entry of the request
+        if (!server->silent)
+        {
+            pthread_mutex_lock(&server->lock);
+            printf(
+                "Request #%zu: %s '%s' - %s in %.1f ms%s\n",
+                request_num,
+                fields[0],
+                (field_count >= 3) ? fields[2] : "",
+                imc_steg_strerror(status),
+                elapsed_us / 1000.0,
+                was_cached ? " (cached key)" : ""
+            );
+            fflush(stdout);
+            pthread_mutex_unlock(&server->lock);
+        }
+
+        imc_clear_free(request, request_size + 1);
+
+        // There is nobody to receive the response if the client has closed the connection
+        if (connection->is_closed)
+        {
+            free(messages);
+            break;
+        }
+
+        // Send the response: its size, the status line, then the status messages
+        char status_line[64];
+        const int status_len = snprintf(status_line, sizeof(status_line), "%d %llu\n", status, (unsigned long long)elapsed_us);
+        const uint32_t response_size = htobe32(status_len + messages_size);
+
+        const bool sent = __server_send_all(connection->fd, &response_size, sizeof(response_size))
+                       && __server_send_all(connection->fd, status_line, status_len)
+                       && __server_send_all(connection->fd, messages ? messages : "", messages_size);
+
+        free(messages);     // Note: this buffer was allocated by 'open_memstream()'.
+        if (!sent) break;
+    }
+
+    imc_async_destroy(connection->queue);
+    close(connection->fd);
+    imc_free(connection);
+}
+
+// Signal handler that makes the server stop accepting new connections
+static void __server_stop(int signal_num)
+{
+    (void)signal_num;
+    server_stopping = 1;
+}
+
+// Listen on the socket at 'socket_path' and serve the requests until the program is interrupted (Ctrl+C)
+// 'num_threads' is the amount of requests processed at the same time (zero for one per processor).
+// Function returns IMC_ERR_NAME_TOO_LONG if the path does not fit on a socket address,
+// IMC_ERR_FILE_EXISTS if there is already a file at the path (other than a stale socket),
+// and IMC_ERR_SOCKET_FAIL if the socket could not be created (the reason is on 'errno').
+int imc_server_run(const char *socket_path, size_t num_threads, bool silent)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(address.sun_path)) return IMC_ERR_NAME_TOO_LONG;
+    strcpy(address.sun_path, socket_path);
+
+    const int socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket_fd < 0) return IMC_ERR_SOCKET_FAIL;
+
+    // If there is already a socket at the path, remove it only if no other server is listening on it
+    struct stat path_stats;
+    if (lstat(socket_path, &path_stats) == 0)
+    {
+        const bool is_stale = S_ISSOCK(path_stats.st_mode)
+            && connect(socket_fd, (struct sockaddr *)&address, sizeof(address)) != 0
+            && errno == ECONNREFUSED;
+
+        if (!is_stale)
+        {
+            close(socket_fd);
+            return IMC_ERR_FILE_EXISTS;
+        }
+
+        unlink(socket_path);
+    }
+
+    // Create the socket with read and write access for only the current user
+    const mode_t old_umask = umask(0177);
+    const int bind_status = bind(socket_fd, (struct sockaddr *)&address, sizeof(address));
+    umask(old_umask);
+
+    if (bind_status != 0 || listen(socket_fd, IMC_SERVER_BACKLOG) != 0)
+    {
+        const int bind_errno = errno;
+        close(socket_fd);
+        if (bind_status == 0) unlink(socket_path);
+        errno = bind_errno;
+        return IMC_ERR_SOCKET_FAIL;
+    }
+
+    ServerContext *server = sodium_malloc(sizeof(ServerContext));
+    if (!server)
+    {
+        close(socket_fd);
+        unlink(socket_path);
+        return IMC_ERR_NO_MEMORY;
+    }
+    memset(server, 0, sizeof(ServerContext));
+    server->socket_fd = socket_fd;
+    server->silent = silent;
+    randombytes_buf(server->cache_secret, sizeof(server->cache_secret));
+    pthread_mutex_init(&server->lock, NULL);
+
+    // Stop the server on Ctrl+C or on a termination request
+    // (no SA_RESTART, so the waiting for a connection is interrupted by the signal)
+    struct sigaction stop_action = {.sa_handler = &__server_stop};
+    sigemptyset(&stop_action.sa_mask);
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
+    signal(SIGPIPE, SIG_IGN);   // A client disconnecting should not terminate the server
+
+    // Each connection is served by one worker thread. Once all workers are busy and the queue is full,
+    // no more connections are accepted until one finishes (the new clients wait on the socket's backlog).
+    // Since there is room on the pool before each connection is accepted, submitting it never blocks.
+    // Note: the stop signals are blocked while the workers are created, so they are only delivered to this thread.
+    sigset_t stop_signals, old_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &old_signals);
+    // The operations themselves run on a separate pool, so the connection's worker can watch the client meanwhile.
+    ThreadPool *pool = imc_threadpool_create(num_threads);
+    imc_threadpool_set_limit(pool, pool->num_threads * 2);
+    server->job_pool = imc_threadpool_create(pool->num_threads);
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+    if (!silent)
+    {
+        printf("Listening on '%s' with %zu worker threads. Press Ctrl+C to stop.\n", socket_path, pool->num_threads);
+        fflush(stdout);
+    }
+
+    // Accept the connections
+    while (!server_stopping)
+    {
+        // While the pool is full, keep checking whether a stop signal has arrived
+        if (!imc_threadpool_wait_room(pool, IMC_SERVER_STOP_CHECK)) continue;
+
+        const int client_fd = accept(socket_fd, NULL, NULL);
+        if (client_fd < 0) continue;
+
+        // Close the connections that stay idle for too long, so they do not hold a worker thread forever
+        // (the same goes for a client that stops reading the progress messages or the response)
+        const struct timeval timeout = {.tv_sec = IMC_SERVER_TIMEOUT};
+        setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        ServerConnection *connection = imc_calloc(1, sizeof(ServerConnection));
+        connection->fd = client_fd;
+        connection->server = server;
+        imc_threadpool_submit(pool, &__server_serve_connection, connection);
+    }
+
+    if (!silent)
+    {
+        printf("\nStopping the server...\n");
+        fflush(stdout);
+    }
+
+    // Stop accepting connections, and wait for the current ones to finish
+    close(socket_fd);
+    unlink(socket_path);
+    imc_threadpool_destroy(pool);
+    imc_threadpool_destroy(server->job_pool);
+
+    // Erase the cached keys
+    for (size_t i = 0; i < IMC_SERVER_KEY_CACHE; i++)
+    {
+        imc_crypto_context_destroy(server->key_cache[i].key);
+    }
+    pthread_mutex_destroy(&server->lock);
+    sodium_free(server);
+
+    return IMC_SUCCESS;
+}
+
+#endif // _WIN32
@@ -0,0 +1,142 @@
+/* Server mode: a long-running process that performs hide, extract, or check operations requested through a local socket. */
+
+#ifndef _IMC_SERVER_H
+#define _IMC_SERVER_H
+
+#include "imc_includes.h"
+
+/*  Protocol of the server
+
+    The server listens on a Unix domain socket. A client connects to it, then sends one or more requests
+    on the same connection, and for each request the server sends back one response.
+
+    Request: a 4-byte length (unsigned, big-endian), followed by that many bytes with the fields of the request.
+    The fields are separated by null characters ('\0'):
+    OPERATION   PASSWORD   IMAGE   OUTPUT   FILE_1   FILE_2   ...
+
+    - OPERATION: 'hide', 'append' (hide while keeping the existing hidden files), 'extract', or 'check'.
+                 The suffix '+progress' (for example, 'hide+progress') asks for the progress to be sent (see below).
+    - PASSWORD: the password in UTF-8 encoding (an empty field means no password).
+    - IMAGE: path to the image being processed.
+    - OUTPUT: where to save the new image (when hiding) or the directory for the extracted files (when extracting).
+              This field can be left empty in order to use the default behavior, and it is not used when checking.
+    - FILE_1, FILE_2, ...: paths of the files being hidden (at least one is needed when hiding).
+
+    Instead of a path, IMAGE can be "fd:N", where N is the index (starting from zero) of a file descriptor
+    passed with the request as SCM_RIGHTS ancillary data. This allows to process an image without it
+    having a path (for example, a memfd). In that case, an OUTPUT path is needed when hiding.
+
+    Response: a 4-byte length (unsigned, big-endian), followed by that many bytes of text.
+    The first line has the status code and how long the request took (in microseconds):
+    STATUS ELAPSED
+    The remaining lines are the status messages of the operation (same as printed by the '--batch' option).
+    A status of zero means that the operation succeeded, and a negative value is one of the error codes from 'globals.h'.
+
+    Progress: if the operation has the '+progress' suffix, the response can be preceded by progress messages.
+    They have the same framing as the response, but the highest bit of their length is set (IMC_SERVER_PROGRESS_FLAG),
+    and their text is a single line with the stage of the operation and its completed percentage (from 0 to 100):
+    STAGE PERCENT
+    The stages are 'read-image', 'scan-carrier', 'shuffle', 'write-data', 'write-carrier', and 'write-image'.
+    A message is sent only when the whole percentage changes, so the client is not flooded with them.
+
+    Cancellation: the operations run on separate worker threads, while the connection's thread watches the client.
+    If the client closes the connection before receiving the response, the operation is cancelled (it stops between
+    the files being hidden or extracted, and the new image is not saved). Shutting down only the writing side
+    of the connection (after sending the last request) does not cancel anything.
+
+    Relative paths are relative to the server's working directory.
+*/
+
+#define IMC_SERVER_MAX_REQUEST  1048576 // Maximum size in bytes of a request
+#define IMC_SERVER_MAX_FDS      4       // Maximum amount of file descriptors that can be passed with a request
+#define IMC_SERVER_KEY_CACHE    16      // How many secret keys are kept in memory (the most recently used ones)
+#define IMC_SERVER_TIMEOUT      30      // Seconds that a connection can stay idle before being closed
+#define IMC_SERVER_BACKLOG      64      // Maximum amount of connections waiting to be accepted by the server
+#define IMC_SERVER_STOP_CHECK   200     // Milliseconds between checks for a stop signal while all workers are busy
+#define IMC_SERVER_PROGRESS_FLAG 0x80000000U   // Bit set on the length of the progress messages (to tell them apart from the response)
+
+#ifndef _WIN32
+
+// Secret key that was generated from a password, kept in memory for reuse
+typedef struct KeyCacheEntry {
+    uint8_t id[crypto_generichash_BYTES];   // Keyed hash of the password (used for finding the entry)
+    CryptoContext *key;                     // Secret key generated from the password (NULL if the entry is unused)
+    uint64_t last_used;                     // When the entry was used for the last time (higher is more recent)
+} KeyCacheEntry;
+
+// State shared by all connections to the server
+typedef struct ServerContext {
+    int socket_fd;                  // File descriptor of the listening socket
+    ThreadPool *job_pool;           // Worker threads that perform the operations requested by all connections
+    size_t request_count;           // Amount of requests received so far (used for numbering them on the log)
+    bool silent;                    // Do not print a log entry for each request
+    uint8_t cache_secret[crypto_generichash_KEYBYTES];  // Random key for hashing the passwords on the key cache
+    KeyCacheEntry key_cache[IMC_SERVER_KEY_CACHE];      // Most recently used secret keys
+    uint64_t cache_clock;           // Counter that is incremented each time the key cache is accessed
+    pthread_mutex_t lock;           // Protects the fields above from being accessed at the same time
+} ServerContext;
+
+// A client connected to the server
+typedef struct ServerConnection {
+    int fd;                     // File descriptor of the connection's socket
+    ServerContext *server;      // The server that accepted the connection
+    AsyncQueue *queue;          // Where the operations requested by the client are submitted (on the server's job pool)
+    bool is_closed;             // Whether the client has closed the connection
+    bool progress_failed;       // Whether sending a progress message failed (no more are sent for the request)
+    int progress_stage;         // Stage of the last progress message sent (-1 if none was sent yet)
+    int progress_percent;       // Whole percentage of the last progress message sent
+} ServerConnection;
+
+// Get the secret key for a password, generating it only if it is not on the cache
+// The returned key is a copy, which should be freed with 'imc_crypto_context_destroy()'.
+// 'was_cached' is set to whether the key was already on the cache.
+// Function returns NULL if there is no enough memory for generating the key.
+static CryptoContext *__server_get_key(ServerContext *server, const PassBuff *password, bool *was_cached);
+
+// Read exactly 'size' bytes from a connection, storing on 'fds' the file descriptors passed along with them
+// 'fd_count' is incremented by the amount of received descriptors (the extra ones are closed).
+// Function returns false if the connection was closed, timed out, or failed.
+static bool __server_recv_all(int socket_fd, uint8_t *buffer, size_t size, int *fds, size_t *fd_count);
+
+// Write exactly 'size' bytes to a connection
+// Function returns false if the connection was closed or failed.
+static bool __server_send_all(int socket_fd, const void *buffer, size_t size);
+
+// Send the progress of a request's operation to the client (this function runs on the operation's worker thread)
+// Only the changes of the whole percentage are sent, and nothing else is sent once a message could not be.
+static void __server_send_progress(enum ProgressStage stage, double percent, void *connection_ptr);
+
+// Wait for the operation of a request to finish, while watching whether the client closes the connection
+// If it does, the operation is cancelled (and the connection is marked as closed).
+// Function returns the finished job, which should be freed with 'imc_async_free()'.
+static AsyncJob *__server_wait_job(ServerConnection *connection, AsyncJob *job);
+
+// Perform a single request and write its status messages to 'log'
+// The 'fields' are the null-separated fields received from the client (see the protocol above).
+// Function returns the status code of the operation.
+static int __server_handle_request(
+    ServerConnection *connection,
+    char **fields,
+    size_t field_count,
+    const int *fds,
+    size_t fd_count,
+    FILE *log,
+    bool *was_cached
+);
+
+// Serve the requests of a client until it disconnects (this function runs on a worker thread)
+static void __server_serve_connection(void *connection_ptr);
+
+// Signal handler that makes the server stop accepting new connections
+static void __server_stop(int signal_num);
+
+// Listen on the socket at 'socket_path' and serve the requests until the program is interrupted (Ctrl+C)
+// 'num_threads' is the amount of requests processed at the same time (zero for one per processor).
+// Function returns IMC_ERR_NAME_TOO_LONG if the path does not fit on a socket address,
+// IMC_ERR_FILE_EXISTS if there is already a file at the path (other than a stale socket),
+// and IMC_ERR_SOCKET_FAIL if the socket could not be created (the reason is on 'errno').
+int imc_server_run(const char *socket_path, size_t num_threads, bool silent);
+
+#endif // _WIN32
+
+#endif  // _IMC_SERVER_H
@@ -0,0 +1,526 @@
+/* Shard mode: a file split among many cover images, when a single image cannot hold it. */
+
+#include "imc_includes.h"
+
+/* Note: See the 'imc_shard.h' file for how the files are split into shards. */
+
+// Maximum size of a shard that fits in an image with 'carrier_bytes' bytes of capacity
+// (the shard's metadata and the overhead of the compression and encryption are subtracted from the capacity)
+static size_t __shard_capacity(size_t carrier_bytes, size_t name_size)
+{
+    // Bytes that are not compressed (the magic, the encryption's header and tag, and the start of the 'FileInfo')
+    const size_t fixed_size = IMC_CRYPTO_OVERHEAD + offsetof(FileInfo, access_time);
+    if (carrier_bytes <= fixed_size) return 0;
+
+    // Bytes that are compressed together with the shard's data
+    const size_t meta_size = sizeof(FileInfo) - offsetof(FileInfo, access_time) + name_size + sizeof(ShardHeader);
+
+    // Find the biggest shard whose compression bound still fits in the image
+    // (the shards are stored without compression, so the bound is only a few bytes bigger than the shard)
+    size_t low = 0;
+    size_t high = carrier_bytes;
+    while (low < high)
+    {
+        const size_t middle = low + (high - low + 1) / 2;
+        if (fixed_size + imc_deflate_bound(meta_size + middle) <= carrier_bytes) low = middle;
+        else high = middle - 1;
+    }
+
+    return low;
+}
+
+// Open some of the cover images, and get their capacities (this function might run on a worker thread)
+static void __shard_open_range(size_t start, size_t end, void *set_ptr)
+{
+    ShardSet *const set = (ShardSet *)set_ptr;
+
+    for (size_t i = start; i < end; i++)
+    {
+        ShardTarget *const target = &set->targets[i];
+        target->status = imc_steg_init_from_key(target->cover, set->key, &target->image, 0, NULL, NULL);
+        if (target->status != IMC_SUCCESS)
+        {
+            target->image = NULL;
+            continue;
+        }
+
+        target->capacity = __shard_capacity(target->image->carrier_length / 8, set->name_size);
+    }
+}
+
+// Hide the shards in some of the cover images, then save and close them (this function might run on a worker thread)
+static void __shard_embed_range(size_t start, size_t end, void *set_ptr)
+{
+    ShardSet *const set = (ShardSet *)set_ptr;
+
+    for (size_t i = start; i < end; i++)
+    {
+        ShardTarget *const target = &set->targets[i];
+        if (!target->image) continue;
+        if (target->size == 0)
+        {
+            // The image was not needed for the file
+            imc_steg_finish(target->image);
+            target->image = NULL;
+            continue;
+        }
+
+        // Buffer with the file's metadata, the shard's header, and the shard's data
+        const size_t info_size = sizeof(FileInfo) + set->name_size;
+        const size_t raw_size = info_size + sizeof(ShardHeader) + target->size;
+        uint8_t *const raw_buffer = imc_malloc_tag(raw_size, IMC_MEMORY_FILE);
+
+        imc_steg_info_init((FileInfo *)raw_buffer, IMC_FILEINFO_SHARD, set->file_name, set->name_size, set->access_time, set->mod_time);
+
+        ShardHeader header = set->header;
+        header.index = htole32(target->index);
+        header.offset = htole64(target->offset);
+        memcpy(&raw_buffer[info_size], &header, sizeof(ShardHeader));
+        memcpy(&raw_buffer[info_size + sizeof(ShardHeader)], &set->compressed[target->offset], target->size);
+
+        // The shard's data is already compressed, so it is stored without compressing it again
+        PreparedPayload *payload = NULL;
+        target->status = imc_steg_prepare_buffer(set->key, raw_buffer, raw_size, Z_NO_COMPRESSION, false, &payload);
+
+        if (target->status == IMC_SUCCESS)
+        {
+            target->status = imc_steg_insert_prepared(target->image, payload);
+            imc_steg_prepared_free(payload);
+        }
+
+        // Save the image on the output directory (or next to its cover)
+        if (target->status == IMC_SUCCESS)
+        {
+            char *save_path = (char *)target->cover;
+            if (set->output_dir)
+            {
+                const size_t cover_len = strlen(target->cover);
+                char cover_temp[cover_len + 1];
+                memcpy(cover_temp, target->cover, cover_len + 1);
+                const char *const cover_name = basename(cover_temp);
+
+                const size_t path_size = strlen(set->output_dir) + strlen(cover_name) + 2;
+                save_path = imc_malloc(path_size);
+                snprintf(save_path, path_size, "%s/%s", set->output_dir, cover_name);
+            }
+
+            target->status = imc_steg_save(target->image, save_path);
+            if (save_path != target->cover) imc_free(save_path);
+
+            if (target->status == IMC_SUCCESS)
+            {
+                const size_t out_size = strlen(target->image->out_path) + 1;
+                target->out_path = imc_malloc(out_size);
+                memcpy(target->out_path, target->image->out_path, out_size);
+            }
+        }
+
+        imc_steg_finish(target->image);
+        target->image = NULL;
+    }
+}
+
+// Split a file among the cover images of 'targets' (whose 'cover' field must be set), then save the images with the shards
+// The images receive the shards in the order of the array, and the images left over are not saved.
+// 'output_dir' is where to save the images (NULL for the same directory as their cover). Each image is named after its cover,
+// with a number appended if the name already exists. The results of each image are stored on its 'ShardTarget'.
+// Function returns IMC_ERR_FILE_TOO_BIG if the file does not fit on all images together,
+// or the status code of the first image that failed.
+int imc_shard_hide(
+    const char *file_path,
+    ShardTarget *targets,
+    size_t target_count,
+    const char *output_dir,
+    CryptoContext *key
+)
+{
+    for (size_t i = 0; i < target_count; i++)
+    {
+        targets[i] = (ShardTarget){.cover = targets[i].cover, .status = IMC_SUCCESS};
+    }
+
+    // Get the file name from the path
+    const size_t path_len = strlen(file_path);
+    char path_temp[path_len+1];
+    strcpy(path_temp, file_path);
+    const char *const file_name = basename(path_temp);
+
+    const size_t name_size = strlen(file_name) + 1;
+    if (name_size > UINT16_MAX) return IMC_ERR_NAME_TOO_LONG;
+
+    // Read the whole file
+    uint8_t *file_buffer = NULL;
+    size_t file_size = 0;
+    struct timespec access_time, mod_time;
+    const int read_status = imc_steg_read_file(file_path, 0, &file_buffer, &file_size, &access_time, &mod_time);
+    if (read_status != IMC_SUCCESS) return read_status;
+
+    ShardSet set = {
+        .targets = targets,
+        .target_count = target_count,
+        .key = key,
+        .output_dir = output_dir,
+        .file_name = file_name,
+        .name_size = name_size,
+        .access_time = access_time,
+        .mod_time = mod_time,
+    };
+
+    // Fields shared by all shards
+    randombytes_buf(set.header.set_id, sizeof(set.header.set_id));
+    crypto_generichash(set.header.hash, sizeof(set.header.hash), file_buffer, file_size, NULL, 0);
+    set.header.file_size = htole64(file_size);
+
+    // Compress the whole file once (the shards are slices of the compressed file)
+    size_t compressed_size = imc_deflate_bound(file_size);
+    uint8_t *compressed = imc_malloc_tag(compressed_size, IMC_MEMORY_ZLIB);
+    const int zlib_status = imc_deflate_data(file_buffer, file_size, compressed, &compressed_size, Z_BEST_COMPRESSION);
+    imc_clear_free(file_buffer, file_size);
+
+    if (zlib_status != Z_OK)
+    {
+        imc_free(compressed);
+        return IMC_ERR_NO_MEMORY;
+    }
+
+    set.compressed = compressed;
+    set.header.compressed_size = htole64(compressed_size);
+
+    // Open all cover images in parallel
+    imc_parallel_for(target_count, 1, &__shard_open_range, &set);
+
+    // Give to each image, in order, the biggest slice of the compressed file that fits on it
+    size_t offset = 0;
+    uint32_t shard_count = 0;
+    for (size_t i = 0; i < target_count && offset < compressed_size; i++)
+    {
+        ShardTarget *const target = &targets[i];
+        if (!target->image || target->capacity == 0) continue;
+
+        const size_t remaining = compressed_size - offset;
+        target->offset = offset;
+        target->size = (target->capacity < remaining) ? target->capacity : remaining;
+        target->index = shard_count++;
+        offset += target->size;
+    }
+
+    int status = IMC_SUCCESS;
+    if (offset < compressed_size)
+    {
+        // The images do not have enough space for the whole file
+        for (size_t i = 0; i < target_count; i++)
+        {
+            targets[i].size = 0;
+        }
+        status = IMC_ERR_FILE_TOO_BIG;
+    }
+
+    set.header.count = htole32(shard_count);
+
+    // Hide the shards and save the images in parallel (or just close the images, if the file did not fit)
+    imc_parallel_for(target_count, 1, &__shard_embed_range, &set);
+    imc_clear_free(compressed, compressed_size);
+
+    if (status != IMC_SUCCESS) return status;
+
+    for (size_t i = 0; i < target_count; i++)
+    {
+        if (targets[i].size > 0 && targets[i].status != IMC_SUCCESS) return targets[i].status;
+    }
+
+    return IMC_SUCCESS;
+}
+
+// Free the memory used by the results of 'imc_shard_hide()' (the array itself is not freed)
+void imc_shard_targets_free(ShardTarget *targets, size_t target_count)
+{
+    for (size_t i = 0; i < target_count; i++)
+    {
+        imc_free(targets[i].out_path);
+        targets[i].out_path = NULL;
+    }
+}
+
+// Build the path of a part file of a set of shards, on 'out_dir' (or on the current working directory, if NULL)
+// Function returns false if the path does not fit on 'output_size' bytes (see 'IMC_SHARD_PATH_EXTRA').
+static bool __shard_part_path(const char *out_dir, const uint8_t *set_id, const char *suffix, char *output, size_t output_size)
+{
+    char id_hex[IMC_SHARD_ID_SIZE * 2 + 1];
+    sodium_bin2hex(id_hex, sizeof(id_hex), set_id, IMC_SHARD_ID_SIZE);
+
+    const int length = out_dir
+        ? snprintf(output, output_size, "%s/imcshard-%s-%s", out_dir, id_hex, suffix)
+        : snprintf(output, output_size, "imcshard-%s-%s", id_hex, suffix);
+
+    return (length >= 0 && (size_t)length < output_size);
+}
+
+// Take the lock of a set of shards, waiting while another thread or process holds it
+// The lock belongs to the open lock file, so it is released when the file is closed or the process ends
+// (even if it crashes): a set is never left locked. Function returns the lock's file descriptor, or -1 on failure.
+static int __shard_lock(const char *lock_path)
+{
+    #ifdef _WIN32
+    const int lock_fd = _open(lock_path, _O_RDWR | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+    if (lock_fd < 0) return -1;
+
+    OVERLAPPED overlapped = {0};
+    if (!LockFileEx((HANDLE)_get_osfhandle(lock_fd), LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped))
+    {
+        _close(lock_fd);
+        return -1;
+    }
+
+    return lock_fd;
+
+    #else // Linux
+    while (true)
+    {
+        const int lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (lock_fd < 0) return -1;
+
+        int lock_status;
+        while ( (lock_status = flock(lock_fd, LOCK_EX)) != 0 && errno == EINTR );
+        if (lock_status != 0)
+        {
+            close(lock_fd);
+            return -1;
+        }
+
+        // The lock file is deleted by the thread that joins the set, so a thread that was waiting for it
+        // might now be holding the lock of a file that no longer has the path. In that case, lock the path again.
+        struct stat fd_stats, path_stats;
+        const bool is_current = fstat(lock_fd, &fd_stats) == 0 && stat(lock_path, &path_stats) == 0
+            && fd_stats.st_dev == path_stats.st_dev && fd_stats.st_ino == path_stats.st_ino;
+
+        if (is_current) return lock_fd;
+        close(lock_fd);
+    }
+    #endif // _WIN32
+}
+
+// Release the lock of a set of shards, optionally deleting its lock file ('lock_path' is NULL for keeping the file)
+static void __shard_unlock(int lock_fd, const char *lock_path)
+{
+    #ifdef _WIN32
+    // Note: on Windows, a file cannot be deleted while it is open, so it is deleted after the lock is released.
+    _close(lock_fd);
+    if (lock_path) remove(lock_path);
+
+    #else // Linux
+    // Note: the file is deleted while still locked, so no other thread joins the set in between.
+    if (lock_path) remove(lock_path);
+    close(lock_fd);
+    #endif // _WIN32
+}
+
+// Delete all files of a set of shards on 'out_dir' (the parts, and the temporary files of interrupted saves),
+// except for its lock file. This should be called while holding the lock of the set.
+static void __shard_remove_set(const char *out_dir, const uint8_t *set_id)
+{
+    char prefix[IMC_SHARD_ID_SIZE * 2 + 16];
+    char id_hex[IMC_SHARD_ID_SIZE * 2 + 1];
+    sodium_bin2hex(id_hex, sizeof(id_hex), set_id, IMC_SHARD_ID_SIZE);
+    const int prefix_len = snprintf(prefix, sizeof(prefix), "imcshard-%s-", id_hex);
+
+    DIR *dir = opendir(out_dir ? out_dir : ".");
+    if (!dir) return;
+
+    const size_t dir_len = out_dir ? strlen(out_dir) + 1 : 0;
+    struct dirent *entry;
+    while ( (entry = readdir(dir)) )
+    {
+        if (strncmp(entry->d_name, prefix, prefix_len) != 0) continue;
+        if (strcmp(&entry->d_name[prefix_len], "lock") == 0) continue;
+
+        char path[dir_len + strlen(entry->d_name) + 1];
+        if (out_dir) snprintf(path, sizeof(path), "%s/%s", out_dir, entry->d_name);
+        else snprintf(path, sizeof(path), "%s", entry->d_name);
+        remove(path);
+    }
+
+    closedir(dir);
+}
+
+// Check if all parts of a set of shards are present on 'out_dir'
+static bool __shard_has_all_parts(const char *out_dir, const ShardHeader *header)
+{
+    const uint32_t count = le32toh(header->count);
+    const size_t path_size = (out_dir ? strlen(out_dir) : 0) + IMC_SHARD_PATH_EXTRA;
+    char part_path[path_size];
+    char suffix[IMC_SHARD_SUFFIX_SIZE];
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        snprintf(suffix, sizeof(suffix), "%u.part", i);
+        struct stat part_stats;
+        if (!__shard_part_path(out_dir, header->set_id, suffix, part_path, path_size)) return false;
+        if (stat(part_path, &part_stats) != 0) return false;
+    }
+
+    return true;
+}
+
+// Join the parts of a set of shards, then save the file and delete the parts
+// This should be called while holding the lock of the set, and after checking that all parts are present.
+static int __shard_join(CarrierImage *carrier_img, const FileInfo *file_info, const ShardHeader *header)
+{
+    const char *const out_dir = carrier_img->out_dir;
+    const uint32_t count = le32toh(header->count);
+    const size_t path_size = (out_dir ? strlen(out_dir) : 0) + IMC_SHARD_PATH_EXTRA;
+    char part_path[path_size];
+    char suffix[IMC_SHARD_SUFFIX_SIZE];
+
+    // Join the parts of the compressed file
+    const uint64_t compressed_size = le64toh(header->compressed_size);
+    const uint64_t file_size = le64toh(header->file_size);
+    uint8_t *compressed = imc_malloc_tag(compressed_size, IMC_MEMORY_ZLIB);
+    size_t joined = 0;
+    int status = IMC_SUCCESS;
+
+    for (uint32_t i = 0; i < count && status == IMC_SUCCESS; i++)
+    {
+        snprintf(suffix, sizeof(suffix), "%u.part", i);
+        FILE *part = __shard_part_path(out_dir, header->set_id, suffix, part_path, path_size) ? fopen(part_path, "rb") : NULL;
+        if (!part)
+        {
+            status = IMC_ERR_FILE_NOT_FOUND;
+            break;
+        }
+
+        // Check that the part belongs to the same set, and that it continues where the previous part ended
+        ShardHeader part_header;
+        const bool has_header = fread(&part_header, sizeof(ShardHeader), 1, part) == 1;
+        const bool is_valid = has_header
+            && memcmp(part_header.set_id, header->set_id, IMC_SHARD_ID_SIZE) == 0
+            && memcmp(part_header.hash, header->hash, IMC_SHARD_HASH_SIZE) == 0
+            && le32toh(part_header.index) == i
+            && le32toh(part_header.count) == count
+            && le64toh(part_header.offset) == joined
+            && le64toh(part_header.compressed_size) == compressed_size
+            && le64toh(part_header.file_size) == file_size;
+
+        if (is_valid)
+        {
+            joined += fread(&compressed[joined], 1, compressed_size - joined, part);
+        }
+        else
+        {
+            status = IMC_ERR_FILE_CORRUPTED;
+        }
+
+        fclose(part);
+    }
+
+    if (status == IMC_SUCCESS && joined != compressed_size) status = IMC_ERR_FILE_CORRUPTED;
+
+    // Decompress the file, then check it against the hash of the original file
+    uint8_t *file_buffer = imc_malloc_tag(file_size ? file_size : 1, IMC_MEMORY_ZLIB);
+    if (status == IMC_SUCCESS)
+    {
+        uLongf decompress_size = file_size;
+        const int zlib_status = uncompress(file_buffer, &decompress_size, compressed, compressed_size);
+
+        uint8_t hash[IMC_SHARD_HASH_SIZE];
+        crypto_generichash(hash, sizeof(hash), file_buffer, decompress_size, NULL, 0);
+
+        if (zlib_status != Z_OK || decompress_size != file_size || sodium_memcmp(hash, header->hash, sizeof(hash)) != 0)
+        {
+            status = IMC_ERR_CRYPTO_FAIL;
+        }
+    }
+
+    imc_clear_free(compressed, compressed_size);
+
+    // Save the file
+    if (status == IMC_SUCCESS)
+    {
+        const struct timespec file_times[2] = {
+            {.tv_sec = le64toh(file_info->access_time.tv_sec), .tv_nsec = le64toh(file_info->access_time.tv_nsec)},
+            {.tv_sec = le64toh(file_info->mod_time.tv_sec), .tv_nsec = le64toh(file_info->mod_time.tv_nsec)},
+        };
+
+        status = imc_steg_write_file(out_dir, (const char *)file_info->file_name, file_buffer, file_size, file_times, carrier_img->verbose);
+    }
+
+    // Delete the parts (every file of the set goes, not only the parts that were joined, so nothing is left behind)
+    if (status == IMC_SUCCESS)
+    {
+        __shard_remove_set(out_dir, header->set_id);
+        carrier_img->steg_info->is_joined = true;
+    }
+
+    imc_clear_free(file_buffer, file_size ? file_size : 1);
+
+    return status;
+}
+
+// Save a shard that was extracted from an image, then join the file if all of its shards were extracted
+// 'data' has the shard's header and data. If the file was joined, 'is_joined' is set on the image's 'steg_info'.
+int imc_shard_store(CarrierImage *carrier_img, const FileInfo *file_info, const uint8_t *data, size_t size)
+{
+    if (size < sizeof(ShardHeader)) return IMC_ERR_FILE_CORRUPTED;
+    ShardHeader header;
+    memcpy(&header, data, sizeof(ShardHeader));
+
+    // Sanity check of the header
+    const uint32_t index = le32toh(header.index);
+    const uint32_t count = le32toh(header.count);
+    const uint64_t offset = le64toh(header.offset);
+    const uint64_t compressed_size = le64toh(header.compressed_size);
+    const uint64_t file_size = le64toh(header.file_size);
+    const size_t shard_size = size - sizeof(ShardHeader);
+
+    if (index >= count || offset + shard_size > compressed_size || file_size > IMC_MAX_INPUT_SIZE)
+    {
+        return IMC_ERR_FILE_CORRUPTED;
+    }
+
+    // Save the part (if the same shard was extracted before, its part is just written again)
+    const char *const out_dir = carrier_img->out_dir;
+    const size_t path_size = (out_dir ? strlen(out_dir) : 0) + IMC_SHARD_PATH_EXTRA;
+    char part_path[path_size];
+    char lock_path[path_size];
+    char suffix[IMC_SHARD_SUFFIX_SIZE];
+    snprintf(suffix, sizeof(suffix), "%u.part", index);
+    if (!__shard_part_path(out_dir, header.set_id, suffix, part_path, path_size)) return IMC_ERR_NAME_TOO_LONG;
+    if (!__shard_part_path(out_dir, header.set_id, "lock", lock_path, path_size)) return IMC_ERR_NAME_TOO_LONG;
+
+    // The part is saved and the set is joined while holding the lock of the set, so no part is written while
+    // another thread or process is joining the set (which would leave that part behind once the others are deleted)
+    const int lock_fd = __shard_lock(lock_path);
+    if (lock_fd < 0) return IMC_ERR_SAVE_FAIL;
+
+    if (carrier_img->verbose) printf("Saving shard %u of %u of '%s'... ", index + 1, count, (const char *)file_info->file_name);
+    if (carrier_img->verbose) fflush(stdout);
+
+    // The part is written to a temporary file, so an interrupted save is never taken for a complete part
+    const StatsTimer write_timer = imc_stats_start();
+    OutputFile *part = imc_output_open(part_path, size, IMC_OUTPUT_REPLACE);
+    bool is_saved = false;
+    if (part)
+    {
+        if (imc_output_write(part, data, size)) is_saved = (imc_output_commit(part, NULL) == IMC_SUCCESS);
+        else imc_output_discard(part);
+    }
+
+    if (!is_saved)
+    {
+        if (carrier_img->verbose) printf("\n");
+        __shard_unlock(lock_fd, NULL);
+        return IMC_ERR_SAVE_FAIL;
+    }
+    imc_stats_stop(IMC_STATS_WRITE, &write_timer, size);
+
+    if (carrier_img->verbose) printf("Done!\n");
+
+    // Join the file, if this was the last shard missing
+    // (the lock file is deleted along with the set, otherwise it is kept for the next part)
+    int status = IMC_SUCCESS;
+    const bool has_all_parts = __shard_has_all_parts(out_dir, &header);
+    if (has_all_parts) status = __shard_join(carrier_img, file_info, &header);
+
+    __shard_unlock(lock_fd, (has_all_parts && status == IMC_SUCCESS) ? lock_path : NULL);
+
+    return status;
+}
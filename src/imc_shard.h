@@ -0,0 +1,126 @@
+/* Shard mode: a file split among many cover images, when a single image cannot hold it. */
+
+#ifndef _IMC_SHARD_H
+#define _IMC_SHARD_H
+
+#include "imc_includes.h"
+
+/*  How a file is split into shards
+
+    The file is compressed only once, then the compressed stream is split into consecutive slices, each one sized
+    to the capacity of its cover image. Each slice is hidden as a regular entry of its image (so it is encrypted and
+    authenticated like any other hidden file), but the version of its metadata is 'IMC_FILEINFO_SHARD', and the slice
+    comes after a 'ShardHeader'. The images are opened, written, and saved in parallel.
+
+    All shards of a file share a random set ID, the sizes of the file, and the hash of the whole file. So shards of
+    different files (or of different times that the same file was split) are never mixed, and a file is only saved
+    after it matches the hash.
+
+    When extracting, a shard is saved on the output directory as a part file ('imcshard-SETID-INDEX.part').
+    Once all parts of a set are present, no matter the order in which their images were extracted, the parts are
+    joined, and the file is saved with its original name and timestamps (then the parts are deleted).
+    Saving a part and joining the set are done while holding a lock on the file 'imcshard-SETID-lock' (with 'flock()',
+    or 'LockFileEx()' on Windows), so images of the same set can be extracted at the same time by many threads or
+    processes. Since the lock is released by the system when a process ends, a crash never leaves the set locked.
+    Older versions of this program refuse the shards as data hidden by a newer version.
+*/
+
+#define IMC_SHARD_ID_SIZE   16  // Size in bytes of the random identifier of a set of shards
+#define IMC_SHARD_HASH_SIZE 32  // Size in bytes of the hash of the whole file (BLAKE2b)
+#define IMC_SHARD_SUFFIX_SIZE   24  // Size of the buffer for the end of a part's name (its index and extension)
+#define IMC_SHARD_PATH_EXTRA    (IMC_SHARD_ID_SIZE * 2 + IMC_SHARD_SUFFIX_SIZE + 16)    // Bytes added to the directory on a part's path
+
+// Header stored before the data of each shard
+// Note: integers are always stored in little endian byte order.
+typedef struct __attribute__ ((__packed__)) ShardHeader
+{
+    uint8_t set_id[IMC_SHARD_ID_SIZE];  // Random identifier shared by all shards of the same file
+    uint32_t index;                     // Position of the shard on the set (starting from zero)
+    uint32_t count;                     // Amount of shards on the set
+    uint64_t offset;                    // Position on the compressed file where the shard's data begins
+    uint64_t compressed_size;           // Size in bytes of the whole compressed file
+    uint64_t file_size;                 // Size in bytes of the original file
+    uint8_t hash[IMC_SHARD_HASH_SIZE];  // Hash of the original file
+} ShardHeader;
+
+// A cover image that can receive a shard of the file
+typedef struct ShardTarget {
+    const char *cover;          // Path to the cover image
+    CarrierImage *image;        // The open image (NULL if it could not be opened, or after it was closed)
+    size_t capacity;            // How many bytes of the compressed file fit on the image
+    size_t offset;              // Position on the compressed file where the image's shard begins
+    size_t size;                // Size in bytes of the image's shard (zero if the image was not needed)
+    uint32_t index;             // Position of the image's shard on the set
+    char *out_path;             // Where the image with the shard was saved (NULL if it was not saved)
+    int status;                 // Status code of the operations on the image (IMC_SUCCESS if everything went well)
+} ShardTarget;
+
+// State shared by the threads hiding the shards of a file
+typedef struct ShardSet {
+    ShardTarget *targets;       // Cover images, in the order that they receive the shards
+    size_t target_count;        // Amount of elements on the 'targets' array
+    CryptoContext *key;         // Secret key used for all images (each image uses a copy of it)
+    const char *output_dir;     // Directory where to save the images (NULL for the same directory as their cover)
+    const uint8_t *compressed;  // The whole compressed file
+    ShardHeader header;         // Fields shared by the headers of all shards (the index and offset are set for each shard)
+    const char *file_name;      // Name of the file (stored with each shard)
+    size_t name_size;           // Size in bytes of the file name (counting the null terminator)
+    struct timespec access_time;    // Last access time of the file
+    struct timespec mod_time;       // Last modified time of the file
+} ShardSet;
+
+// Maximum size of a shard that fits in an image with 'carrier_bytes' bytes of capacity
+// (the shard's metadata and the overhead of the compression and encryption are subtracted from the capacity)
+static size_t __shard_capacity(size_t carrier_bytes, size_t name_size);
+
+// Open some of the cover images, and get their capacities (this function might run on a worker thread)
+static void __shard_open_range(size_t start, size_t end, void *set_ptr);
+
+// Hide the shards in some of the cover images, then save and close them (this function might run on a worker thread)
+static void __shard_embed_range(size_t start, size_t end, void *set_ptr);
+
+// Split a file among the cover images of 'targets' (whose 'cover' field must be set), then save the images with the shards
+// The images receive the shards in the order of the array, and the images left over are not saved.
+// 'output_dir' is where to save the images (NULL for the same directory as their cover). Each image is named after its cover,
+// with a number appended if the name already exists. The results of each image are stored on its 'ShardTarget'.
+// Function returns IMC_ERR_FILE_TOO_BIG if the file does not fit on all images together,
+// or the status code of the first image that failed.
+int imc_shard_hide(
+    const char *file_path,
+    ShardTarget *targets,
+    size_t target_count,
+    const char *output_dir,
+    CryptoContext *key
+);
+
+// Free the memory used by the results of 'imc_shard_hide()' (the array itself is not freed)
+void imc_shard_targets_free(ShardTarget *targets, size_t target_count);
+
+// Build the path of a part file of a set of shards, on 'out_dir' (or on the current working directory, if NULL)
+// Function returns false if the path does not fit on 'output_size' bytes (see 'IMC_SHARD_PATH_EXTRA').
+static bool __shard_part_path(const char *out_dir, const uint8_t *set_id, const char *suffix, char *output, size_t output_size);
+
+// Take the lock of a set of shards, waiting while another thread or process holds it
+// The lock belongs to the open lock file, so it is released when the file is closed or the process ends
+// (even if it crashes): a set is never left locked. Function returns the lock's file descriptor, or -1 on failure.
+static int __shard_lock(const char *lock_path);
+
+// Release the lock of a set of shards, optionally deleting its lock file ('lock_path' is NULL for keeping the file)
+static void __shard_unlock(int lock_fd, const char *lock_path);
+
+// Delete all files of a set of shards on 'out_dir' (the parts, and the temporary files of interrupted saves),
+// except for its lock file. This should be called while holding the lock of the set.
+static void __shard_remove_set(const char *out_dir, const uint8_t *set_id);
+
+// Check if all parts of a set of shards are present on 'out_dir'
+static bool __shard_has_all_parts(const char *out_dir, const ShardHeader *header);
+
+// Join the parts of a set of shards, then save the file and delete the parts
+// This should be called while holding the lock of the set, and after checking that all parts are present.
+static int __shard_join(CarrierImage *carrier_img, const FileInfo *file_info, const ShardHeader *header);
+
+// Save a shard that was extracted from an image, then join the file if all of its shards were extracted
+// 'data' has the shard's header and data. If the file was joined, 'is_joined' is set on the image's 'steg_info'.
+int imc_shard_store(CarrierImage *carrier_img, const FileInfo *file_info, const uint8_t *data, size_t size);
+
+#endif  // _IMC_SHARD_H
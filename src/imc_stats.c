@@ -0,0 +1,210 @@
+/* Statistics: how much time and memory each stage of the processing took (the '--stats' option). */
+
+#include "imc_includes.h"
+
+static atomic_bool stats_enabled = false;       // Whether the stages are being measured
+static bool stats_as_json = false;              // Whether the statistics are printed as a JSON object (instead of a table)
+static uint64_t stats_start_time = 0;           // Wall clock time when the statistics were enabled, in nanoseconds
+static StatsCounter stats_counters[IMC_STATS_STAGE_COUNT];  // Totals of each stage
+static atomic_uint_fast64_t stats_carrier_count;    // Amount of cover images processed
+static atomic_uint_fast64_t stats_carrier_bits;     // Total amount of bits where data can be hidden on those images
+static atomic_uint_fast64_t stats_used_bits;        // Total amount of those bits that were used by hidden data
+
+// Names of the stages, in the order of 'StatsStage'
+static const char *const stats_stage_names[IMC_STATS_STAGE_COUNT] = {
+    "kdf", "read_file", "decode", "scan", "shuffle", "compress", "encrypt",
+    "embed", "extract", "decrypt", "inflate", "encode", "write",
+};
+
+/* Note: See the 'imc_stats.h' file for how the statistics are collected. */
+
+// Get the wall clock time, in nanoseconds (from an arbitrary starting point)
+static uint64_t __stats_wall_now()
+{
+    struct timespec now;
+    #ifdef _WIN32
+    timespec_get(&now, TIME_UTC);
+    #else
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    #endif
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+// Get the CPU time used by the calling thread, in nanoseconds
+static uint64_t __stats_cpu_now()
+{
+    #ifdef _WIN32
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (!GetThreadTimes(GetCurrentThread(), &creation_time, &exit_time, &kernel_time, &user_time)) return 0;
+
+    // The times are counted in units of 100 nanoseconds
+    const uint64_t kernel = ((uint64_t)kernel_time.dwHighDateTime << 32) | kernel_time.dwLowDateTime;
+    const uint64_t user = ((uint64_t)user_time.dwHighDateTime << 32) | user_time.dwLowDateTime;
+    return (kernel + user) * 100;
+
+    #else
+    struct timespec now;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) != 0) return 0;
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    #endif // _WIN32
+}
+
+// Start collecting the statistics (from this point, the elapsed time and the allocations are counted)
+// The statistics are printed to stderr when the program exits (even on failure), as a JSON object if 'as_json' is true.
+void imc_stats_enable(bool as_json)
+{
+    if (imc_stats_enabled()) return;
+    stats_as_json = as_json;
+    stats_start_time = __stats_wall_now();
+    atomic_store(&stats_enabled, true);
+    imc_memory_accounting_enable();
+    atexit(&__stats_print_at_exit);
+}
+
+// Check if the statistics are being collected
+bool imc_stats_enabled()
+{
+    return atomic_load_explicit(&stats_enabled, memory_order_relaxed);
+}
+
+// Begin measuring a stage on the calling thread
+// The returned 'StatsTimer' should be passed to 'imc_stats_stop()', on the same thread.
+StatsTimer imc_stats_start()
+{
+    if (!imc_stats_enabled()) return (StatsTimer){0};
+    return (StatsTimer){.wall = __stats_wall_now(), .cpu = __stats_cpu_now()};
+}
+
+// Finish measuring a stage, adding its times and the amount of 'bytes' that it processed to the totals of 'stage'
+void imc_stats_stop(StatsStage stage, const StatsTimer *timer, uint64_t bytes)
+{
+    if (timer->wall == 0 || stage >= IMC_STATS_STAGE_COUNT) return;
+
+    const uint64_t wall_now = __stats_wall_now();
+    const uint64_t cpu_now = __stats_cpu_now();
+    StatsCounter *const counter = &stats_counters[stage];
+
+    atomic_fetch_add(&counter->calls, 1);
+    atomic_fetch_add(&counter->wall, (wall_now > timer->wall) ? wall_now - timer->wall : 0);
+    atomic_fetch_add(&counter->cpu, (cpu_now > timer->cpu) ? cpu_now - timer->cpu : 0);
+    atomic_fetch_add(&counter->bytes, bytes);
+}
+
+// Add a cover image to the totals, with the amount of bits where data can be hidden and how many of them were used
+void imc_stats_add_carrier(uint64_t carrier_bits, uint64_t used_bits)
+{
+    if (!imc_stats_enabled()) return;
+    atomic_fetch_add(&stats_carrier_count, 1);
+    atomic_fetch_add(&stats_carrier_bits, carrier_bits);
+    atomic_fetch_add(&stats_used_bits, used_bits);
+}
+
+// Get the user and system CPU time of the process (in seconds), and its peak resident memory (in bytes)
+static void __stats_process_usage(double *user_time, double *system_time, uint64_t *peak_memory)
+{
+    *user_time = 0.0;
+    *system_time = 0.0;
+    *peak_memory = 0;
+
+    #ifdef _WIN32
+    FILETIME creation_time, exit_time, kernel_time, user_cpu_time;
+    if (GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_cpu_time))
+    {
+        // The times are counted in units of 100 nanoseconds
+        *user_time = (double)(((uint64_t)user_cpu_time.dwHighDateTime << 32) | user_cpu_time.dwLowDateTime) / 1e7;
+        *system_time = (double)(((uint64_t)kernel_time.dwHighDateTime << 32) | kernel_time.dwLowDateTime) / 1e7;
+    }
+
+    PROCESS_MEMORY_COUNTERS memory_counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &memory_counters, sizeof(memory_counters)))
+    {
+        *peak_memory = memory_counters.PeakWorkingSetSize;
+    }
+
+    #else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        *user_time = (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1e6;
+        *system_time = (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1e6;
+        *peak_memory = (uint64_t)usage.ru_maxrss * 1024;    // On Linux, the peak is given in kilobytes
+    }
+    #endif // _WIN32
+}
+
+// Print the statistics collected so far to 'stream', either as a table or (if 'as_json' is true) as a JSON object
+void imc_stats_print(FILE *stream, bool as_json)
+{
+    const double elapsed = (double)(__stats_wall_now() - stats_start_time) / 1e9;
+    double user_time, system_time;
+    uint64_t peak_memory;
+    __stats_process_usage(&user_time, &system_time, &peak_memory);
+
+    const uint64_t carrier_count = atomic_load(&stats_carrier_count);
+    const uint64_t carrier_bits = atomic_load(&stats_carrier_bits);
+    const uint64_t used_bits = atomic_load(&stats_used_bits);
+
+    if (as_json)
+    {
+        fprintf(stream, "{\"elapsed_seconds\":%.6f,\"user_cpu_seconds\":%.6f,\"system_cpu_seconds\":%.6f,\"peak_rss_bytes\":%llu,",
+            elapsed, user_time, system_time, (unsigned long long)peak_memory);
+        fprintf(stream, "\"carriers\":%llu,\"carrier_bits\":%llu,\"carrier_used_bits\":%llu,\"stages\":{",
+            (unsigned long long)carrier_count, (unsigned long long)carrier_bits, (unsigned long long)used_bits);
+    }
+    else
+    {
+        fprintf(stream, "\n%-10s %8s %11s %11s %14s %10s\n", "Stage", "Calls", "Wall (s)", "CPU (s)", "Bytes", "MB/s");
+    }
+
+    bool first_stage = true;
+    for (size_t i = 0; i < IMC_STATS_STAGE_COUNT; i++)
+    {
+        const uint64_t calls = atomic_load(&stats_counters[i].calls);
+        const double wall = (double)atomic_load(&stats_counters[i].wall) / 1e9;
+        const double cpu = (double)atomic_load(&stats_counters[i].cpu) / 1e9;
+        const uint64_t bytes = atomic_load(&stats_counters[i].bytes);
+        const double throughput = (wall > 0.0) ? (double)bytes / wall / 1e6 : 0.0;
+
+        if (as_json)
+        {
+            // All stages are listed on the JSON object (even the ones never run), so its fields are always the same
+            fprintf(stream, "%s\"%s\":{\"calls\":%llu,\"wall_seconds\":%.6f,\"cpu_seconds\":%.6f,\"bytes\":%llu,\"mb_per_second\":%.3f}",
+                first_stage ? "" : ",", stats_stage_names[i], (unsigned long long)calls, wall, cpu, (unsigned long long)bytes, throughput);
+            first_stage = false;
+        }
+        else if (calls > 0)
+        {
+            fprintf(stream, "%-10s %8llu %11.4f %11.4f %14llu %10.2f\n",
+                stats_stage_names[i], (unsigned long long)calls, wall, cpu, (unsigned long long)bytes, throughput);
+        }
+    }
+
+    if (as_json)
+    {
+        // The allocations counted by 'imc_memory.c' (if enabled) go on their own object
+        fputs("}", stream);
+        if (imc_memory_accounting_enabled())
+        {
+            fputs(",\"memory\":", stream);
+            imc_memory_accounting_print(stream, true);
+        }
+        fputs("}\n", stream);
+    }
+    else
+    {
+        imc_memory_accounting_print(stream, false);
+        const double used_percent = (carrier_bits > 0) ? (double)used_bits * 100.0 / (double)carrier_bits : 0.0;
+        fprintf(stream, "\nElapsed: %.4f s (user CPU: %.4f s, system CPU: %.4f s)\n", elapsed, user_time, system_time);
+        fprintf(stream, "Peak memory: %.1f MB\n", (double)peak_memory / 1e6);
+        fprintf(stream, "Cover images: %llu (%llu of %llu bits used, %.1f%%)\n",
+            (unsigned long long)carrier_count, (unsigned long long)used_bits, (unsigned long long)carrier_bits, used_percent);
+    }
+
+    fflush(stream);
+}
+
+// Print the statistics to stderr (registered by 'imc_stats_enable()' to run when the program exits)
+static void __stats_print_at_exit()
+{
+    imc_stats_print(stderr, stats_as_json);
+}
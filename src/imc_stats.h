@@ -0,0 +1,88 @@
+/* Statistics: how much time and memory each stage of the processing took (the '--stats' option). */
+
+#ifndef _IMC_STATS_H
+#define _IMC_STATS_H
+
+#include "imc_includes.h"
+
+/*  How the statistics are collected
+
+    Each stage is measured by calling 'imc_stats_start()' before it and 'imc_stats_stop()' after it, on the same thread.
+    The stage then gets one more call, the wall clock time and the CPU time of the thread between those two points,
+    and the amount of bytes that it processed (what "bytes" means depends on the stage: for example, the size of the
+    file read, of the data encrypted, or of the image encoded). The counters are atomic, so the stages can be measured
+    on any thread. When the statistics are disabled, measuring a stage costs only a check of a flag.
+
+    The times of a stage are summed over all threads: when many images are processed in parallel, the wall time of a
+    stage can be longer than the whole run, and the stages that overlap (like reading a file while another one is
+    encoded) are counted on each of them. The throughput is the amount of bytes divided by the wall time of the stage.
+    The totals at the end (elapsed time, user and system CPU time of the whole process, and its peak resident memory)
+    are measured by the operating system, so they include the time and memory spent outside of the measured stages.
+    A file being hidden is usually mapped into memory, so most of its reading happens while it is compressed.
+*/
+
+// Stages of the processing that are measured
+typedef enum StatsStage {
+    IMC_STATS_KDF,          // Generating the secret key from the password
+    IMC_STATS_READ_FILE,    // Reading a file being hidden
+    IMC_STATS_DECODE,       // Decoding a cover image
+    IMC_STATS_SCAN,         // Finding the positions of the image where data can be hidden
+    IMC_STATS_SHUFFLE,      // Shuffling the positions of the image
+    IMC_STATS_COMPRESS,     // Compressing a file being hidden
+    IMC_STATS_ENCRYPT,      // Encrypting a file being hidden
+    IMC_STATS_EMBED,        // Writing the encrypted data to the image
+    IMC_STATS_EXTRACT,      // Reading the encrypted data from the image
+    IMC_STATS_DECRYPT,      // Decrypting a hidden file
+    IMC_STATS_INFLATE,      // Decompressing a hidden file
+    IMC_STATS_ENCODE,       // Encoding the image with the hidden data
+    IMC_STATS_WRITE,        // Writing an extracted file to the disk
+    IMC_STATS_STAGE_COUNT   // Amount of stages (not a stage)
+} StatsStage;
+
+// Point in time where the measurement of a stage began
+typedef struct StatsTimer {
+    uint64_t wall;          // Wall clock time, in nanoseconds (zero if the statistics are disabled)
+    uint64_t cpu;           // CPU time of the thread, in nanoseconds
+} StatsTimer;
+
+// Totals of a stage
+typedef struct StatsCounter {
+    atomic_uint_fast64_t calls;     // Amount of times that the stage was measured
+    atomic_uint_fast64_t wall;      // Total wall clock time, in nanoseconds
+    atomic_uint_fast64_t cpu;       // Total CPU time of the threads, in nanoseconds
+    atomic_uint_fast64_t bytes;     // Total amount of bytes processed
+} StatsCounter;
+
+// Get the wall clock time, in nanoseconds (from an arbitrary starting point)
+static uint64_t __stats_wall_now();
+
+// Get the CPU time used by the calling thread, in nanoseconds
+static uint64_t __stats_cpu_now();
+
+// Start collecting the statistics (from this point, the elapsed time and the allocations are counted)
+// The statistics are printed to stderr when the program exits (even on failure), as a JSON object if 'as_json' is true.
+void imc_stats_enable(bool as_json);
+
+// Check if the statistics are being collected
+bool imc_stats_enabled();
+
+// Begin measuring a stage on the calling thread
+// The returned 'StatsTimer' should be passed to 'imc_stats_stop()', on the same thread.
+StatsTimer imc_stats_start();
+
+// Finish measuring a stage, adding its times and the amount of 'bytes' that it processed to the totals of 'stage'
+void imc_stats_stop(StatsStage stage, const StatsTimer *timer, uint64_t bytes);
+
+// Add a cover image to the totals, with the amount of bits where data can be hidden and how many of them were used
+void imc_stats_add_carrier(uint64_t carrier_bits, uint64_t used_bits);
+
+// Get the user and system CPU time of the process (in seconds), and its peak resident memory (in bytes)
+static void __stats_process_usage(double *user_time, double *system_time, uint64_t *peak_memory);
+
+// Print the statistics collected so far to 'stream', either as a table or (if 'as_json' is true) as a JSON object
+void imc_stats_print(FILE *stream, bool as_json);
+
+// Print the statistics to stderr (registered by 'imc_stats_enable()' to run when the program exits)
+static void __stats_print_at_exit();
+
+#endif  // _IMC_STATS_H
@@ -0,0 +1,125 @@
+/* Tar stream: writes the extracted files as a tar archive, so many files can be sent through a single stream. */
+
+#include "imc_includes.h"
+
+/* Note: See the 'imc_tar.h' file for the format of the archive. */
+
+// Write a header block to the stream, after filling its checksum
+// Function returns 'false' if the block could not be written.
+static bool __tar_write_header(
+    FILE *stream,
+    TarHeader *header,
+    char type,
+    const char *name,
+    uint32_t mode,
+    size_t size,
+    int64_t mod_time
+)
+{
+    memset(header, 0, sizeof(TarHeader));
+
+    // The name field does not need a null terminator when it is completely filled,
+    // but a longer name is stored on an extended header anyway (so here it is just cut short)
+    strncpy(header->name, name, sizeof(header->name) - 1);
+    snprintf(header->mode, sizeof(header->mode), "%07o", (unsigned int)mode);
+    snprintf(header->uid, sizeof(header->uid), "%07o", 0);
+    snprintf(header->gid, sizeof(header->gid), "%07o", 0);
+    snprintf(header->size, sizeof(header->size), "%011llo", (unsigned long long)size);
+    // A time after the year 2242 does not fit on the field, so it is clamped to the latest time that does
+    unsigned long long mtime = (mod_time > 0) ? (unsigned long long)mod_time : 0;
+    if (mtime > IMC_TAR_MAX_NUMBER) mtime = IMC_TAR_MAX_NUMBER;
+    snprintf(header->mtime, sizeof(header->mtime), "%011llo", mtime);
+    header->type = type;
+    memcpy(header->magic, "ustar", 6);
+    memcpy(header->version, "00", 2);
+
+    // The checksum is calculated with its own field filled with spaces
+    memset(header->checksum, ' ', sizeof(header->checksum));
+    unsigned int checksum = 0;
+    const uint8_t *const bytes = (const uint8_t *)header;
+    for (size_t i = 0; i < sizeof(TarHeader); i++) checksum += bytes[i];
+    snprintf(header->checksum, sizeof(header->checksum), "%06o", checksum);
+    header->checksum[7] = ' ';
+
+    return fwrite(header, sizeof(TarHeader), 1, stream) == 1;
+}
+
+// Write zeros to the stream until the amount of bytes written since the last header is a multiple of the block size
+// Function returns 'false' if the zeros could not be written.
+static bool __tar_write_padding(FILE *stream, size_t size)
+{
+    static const uint8_t zeros[IMC_TAR_BLOCK_SIZE] = {0};
+    const size_t remainder = size % IMC_TAR_BLOCK_SIZE;
+    if (remainder == 0) return true;
+
+    return fwrite(zeros, 1, IMC_TAR_BLOCK_SIZE - remainder, stream) == IMC_TAR_BLOCK_SIZE - remainder;
+}
+
+// Add an entry to a tar archive being written to a stream, under 'path' exactly as given
+// (the path should have been checked already, since it is not restricted to a base name)
+// 'type' is the type of the entry ('IMC_TAR_TYPE_FILE' or 'IMC_TAR_TYPE_FOLDER'), and 'mode' its permissions.
+// Function returns IMC_ERR_SAVE_FAIL if writing to the stream failed.
+int imc_tar_write_entry(
+    FILE *stream,
+    const char *path,
+    char type,
+    uint32_t mode,
+    const uint8_t *data,
+    size_t size,
+    struct timespec mod_time
+)
+{
+    TarHeader header;
+    const size_t path_len = strlen(path);
+
+    // A long path goes on an extended header, as a record: "LENGTH path=PATH\n"
+    // (where the length counts the whole record, including its own digits)
+    if (path_len >= IMC_TAR_NAME_SIZE)
+    {
+        const size_t text_len = strlen(" path=\n") + path_len;
+        size_t record_len = text_len + 1;
+        while (snprintf(NULL, 0, "%zu", record_len) + text_len != record_len) record_len++;
+
+        char *const record = imc_malloc(record_len + 1);
+        snprintf(record, record_len + 1, "%zu path=%s\n", record_len, path);
+
+        const bool pax_success = __tar_write_header(stream, &header, 'x', "././@PaxHeader", 0644, record_len, mod_time.tv_sec)
+            && fwrite(record, 1, record_len, stream) == record_len
+            && __tar_write_padding(stream, record_len);
+
+        imc_free(record);
+        if (!pax_success) return IMC_ERR_SAVE_FAIL;
+    }
+
+    // Header and contents of the entry
+    const bool success = __tar_write_header(stream, &header, type, path, mode, size, mod_time.tv_sec)
+        && (size == 0 || fwrite(data, 1, size, stream) == size)
+        && __tar_write_padding(stream, size);
+
+    return success ? IMC_SUCCESS : IMC_ERR_SAVE_FAIL;
+}
+
+// Add a file to a tar archive being written to a stream
+// 'name' is the file name (its directories are removed), and 'mod_time' is its last modified time.
+// Function returns IMC_ERR_SAVE_FAIL if writing to the stream failed.
+int imc_tar_write_file(FILE *stream, const char *name, const uint8_t *data, size_t size, struct timespec mod_time)
+{
+    // Remove the directories from the name (on either kind of separator)
+    const char *base_name = name;
+    for (const char *c = name; *c != '\0'; c++)
+    {
+        if (*c == '/' || *c == '\\') base_name = c + 1;
+    }
+    if (base_name[0] == '\0' || strcmp(base_name, ".") == 0 || strcmp(base_name, "..") == 0) base_name = "unnamed";
+
+    return imc_tar_write_entry(stream, base_name, IMC_TAR_TYPE_FILE, 0644, data, size, mod_time);
+}
+
+// Write the end of a tar archive (two blocks of zeros), then flush the stream
+// Function returns IMC_ERR_SAVE_FAIL if writing to the stream failed.
+int imc_tar_finish(FILE *stream)
+{
+    static const uint8_t zeros[IMC_TAR_BLOCK_SIZE * 2] = {0};
+    const bool success = fwrite(zeros, 1, sizeof(zeros), stream) == sizeof(zeros) && fflush(stream) == 0;
+    return success ? IMC_SUCCESS : IMC_ERR_SAVE_FAIL;
+}
@@ -0,0 +1,89 @@
+/* Tar stream: writes the extracted files as a tar archive, so many files can be sent through a single stream. */
+
+#ifndef _IMC_TAR_H
+#define _IMC_TAR_H
+
+#include "imc_includes.h"
+
+/*  Format of the archive
+
+    Each file is a 512-byte header in the POSIX 'ustar' format, followed by the file's contents padded with zeros to
+    a multiple of 512 bytes. The archive ends with two blocks of zeros. The files are written one at a time as they
+    are extracted, so the archive never needs to be held in memory or seeked back into (it can go to a pipe).
+
+    Names longer than the 100 bytes of the header's name field are stored on a 'pax' extended header before the file
+    (which every modern tar understands). Only the base name of each file is used, so an archive made from a crafted
+    image cannot write outside of the folder where it is unpacked. The exception are the entries of a hidden folder
+    ('imc_tree.h'), which keep their paths inside the folder after those paths were checked.
+*/
+
+#define IMC_TAR_BLOCK_SIZE  512     // Size in bytes of the blocks of the archive
+#define IMC_TAR_NAME_SIZE   100     // Size in bytes of the name field of the header (counting the null terminator)
+#define IMC_TAR_TYPE_FILE   '0'     // Type of an entry that is a regular file
+#define IMC_TAR_TYPE_FOLDER '5'     // Type of an entry that is a folder
+#define IMC_TAR_MAX_NUMBER  077777777777ULL     // Largest number on the 12-byte fields (11 octal digits)
+
+// Header of a file on the archive (POSIX 'ustar' format)
+// All numbers are written as null terminated octal strings.
+typedef struct TarHeader {
+    char name[IMC_TAR_NAME_SIZE];   // Name of the file
+    char mode[8];                   // Permissions of the file
+    char uid[8];                    // User ID of the owner
+    char gid[8];                    // Group ID of the owner
+    char size[12];                  // Size in bytes of the file
+    char mtime[12];                 // Last modified time (seconds since the Unix epoch)
+    char checksum[8];               // Sum of the bytes of the header (with this field set to spaces)
+    char type;                      // Type of the entry ('0' for a regular file, '5' for a folder, 'x' for an extended header)
+    char link_name[100];            // Target of a link (unused)
+    char magic[6];                  // "ustar" (null terminated)
+    char version[2];                // "00"
+    char user_name[32];             // Name of the owner
+    char group_name[32];            // Name of the group
+    char dev_major[8];              // Device numbers (unused)
+    char dev_minor[8];
+    char prefix[155];               // Directory of the file (unused)
+    char padding[12];               // Completes the block
+} TarHeader;
+
+_Static_assert(sizeof(TarHeader) == IMC_TAR_BLOCK_SIZE, "The tar header must have exactly one block.");
+
+// Write a header block to the stream, after filling its checksum
+// Function returns 'false' if the block could not be written.
+static bool __tar_write_header(
+    FILE *stream,
+    TarHeader *header,
+    char type,
+    const char *name,
+    uint32_t mode,
+    size_t size,
+    int64_t mod_time
+);
+
+// Write zeros to the stream until the amount of bytes written since the last header is a multiple of the block size
+// Function returns 'false' if the zeros could not be written.
+static bool __tar_write_padding(FILE *stream, size_t size);
+
+// Add an entry to a tar archive being written to a stream, under 'path' exactly as given
+// (the path should have been checked already, since it is not restricted to a base name)
+// 'type' is the type of the entry ('IMC_TAR_TYPE_FILE' or 'IMC_TAR_TYPE_FOLDER'), and 'mode' its permissions.
+// Function returns IMC_ERR_SAVE_FAIL if writing to the stream failed.
+int imc_tar_write_entry(
+    FILE *stream,
+    const char *path,
+    char type,
+    uint32_t mode,
+    const uint8_t *data,
+    size_t size,
+    struct timespec mod_time
+);
+
+// Add a file to a tar archive being written to a stream
+// 'name' is the file name (its directories are removed), and 'mod_time' is its last modified time.
+// Function returns IMC_ERR_SAVE_FAIL if writing to the stream failed.
+int imc_tar_write_file(FILE *stream, const char *name, const uint8_t *data, size_t size, struct timespec mod_time);
+
+// Write the end of a tar archive (two blocks of zeros), then flush the stream
+// Function returns IMC_ERR_SAVE_FAIL if writing to the stream failed.
+int imc_tar_finish(FILE *stream);
+
+#endif  // _IMC_TAR_H
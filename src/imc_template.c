@@ -0,0 +1,196 @@
+/* Template mode: a cover image that is decoded and scanned once, then used for hiding many different payloads. */
+
+#include "imc_includes.h"
+
+/* Note: See the 'imc_template.h' file for how the templates work. */
+
+// Create a template for the cover image at 'path'
+// The image is only decoded when a job first acquires it. Up to 'max_instances' copies can be decoded
+// (zero for one per thread used for processing the images).
+CarrierTemplate *imc_template_create(const char *path, uint64_t flags, size_t max_instances)
+{
+    if (max_instances == 0) max_instances = imc_threads_get_count();
+
+    CarrierTemplate *cover = imc_calloc(1, sizeof(CarrierTemplate));
+    cover->path = imc_strdup(path);
+    cover->flags = flags;
+    cover->max_instances = max_instances;
+    cover->all = imc_calloc(max_instances, sizeof(TemplateInstance *));
+    cover->open_status = IMC_SUCCESS;
+    pthread_mutex_init(&cover->lock, NULL);
+    pthread_cond_init(&cover->has_idle, NULL);
+
+    return cover;
+}
+
+// Decode a new copy of the template's image, and take a snapshot of its carrier
+static int __template_decode(CarrierTemplate *cover, TemplateInstance **output)
+{
+    CarrierImage *carrier_img = NULL;
+    const int open_status = imc_steg_open_cover(cover->path, &carrier_img, cover->flags);
+    if (open_status != IMC_SUCCESS) return open_status;
+
+    const size_t length = carrier_img->carrier_length;
+    TemplateInstance *instance = imc_malloc(sizeof(TemplateInstance));
+    *instance = (TemplateInstance){
+        .image = carrier_img,
+        .order = imc_malloc(length * sizeof(carrier_bytes_t)),
+        .pristine = imc_malloc(length * sizeof(uint8_t)),
+        .next = NULL,
+    };
+
+    // The carrier is still in the same order as on the image (it is only shuffled once a key is set)
+    memcpy(instance->order, carrier_img->carrier, length * sizeof(carrier_bytes_t));
+    for (size_t i = 0; i < length; i++)
+    {
+        instance->pristine[i] = *instance->order[i];
+    }
+
+    *output = instance;
+    return IMC_SUCCESS;
+}
+
+// Restore the original values and order of some of the carrier bytes (this function might run on a worker thread)
+static void __template_restore_range(size_t start, size_t end, void *instance_ptr)
+{
+    TemplateInstance *const instance = (TemplateInstance *)instance_ptr;
+    carrier_bytes_t *const carrier = instance->image->carrier;
+
+    for (size_t i = start; i < end; i++)
+    {
+        *instance->order[i] = instance->pristine[i];
+        carrier[i] = instance->order[i];
+    }
+}
+
+// Get a decoded copy of the template's image, with its original carrier shuffled by 'key'
+// The image is ready for hiding files in it, and it should be given back with 'imc_template_release()' afterwards
+// (instead of being closed with 'imc_steg_finish()').
+// If 'progress' is not NULL, it receives the progress of the operations on the image (along with 'progress_data').
+// Function returns the same status codes as 'imc_steg_init()'.
+int imc_template_acquire(
+    CarrierTemplate *cover,
+    const CryptoContext *key,
+    CarrierImage **output,
+    imc_progress_func progress,
+    void *progress_data
+)
+{
+    TemplateInstance *instance = NULL;
+    bool was_used = false;  // Whether the instance was used by a previous job (so its carrier needs to be restored)
+
+    pthread_mutex_lock(&cover->lock);
+    while (!instance)
+    {
+        // Take an idle copy of the image
+        if (cover->idle)
+        {
+            instance = cover->idle;
+            cover->idle = instance->next;
+            instance->next = NULL;
+            was_used = true;
+            break;
+        }
+
+        // Do not try again to decode an image that could not be opened
+        if (cover->open_status != IMC_SUCCESS)
+        {
+            const int status = cover->open_status;
+            pthread_mutex_unlock(&cover->lock);
+            return status;
+        }
+
+        // Decode a new copy if all others are in use (the lock is not held while decoding)
+        if (cover->instance_count < cover->max_instances)
+        {
+            cover->instance_count++;
+            pthread_mutex_unlock(&cover->lock);
+            const int decode_status = __template_decode(cover, &instance);
+            pthread_mutex_lock(&cover->lock);
+
+            if (decode_status != IMC_SUCCESS)
+            {
+                cover->instance_count--;
+                cover->open_status = decode_status;
+                pthread_cond_broadcast(&cover->has_idle);
+                pthread_mutex_unlock(&cover->lock);
+                return decode_status;
+            }
+
+            // Remember the new copy, so it can be freed later
+            for (size_t i = 0; i < cover->max_instances; i++)
+            {
+                if (cover->all[i]) continue;
+                cover->all[i] = instance;
+                break;
+            }
+            break;
+        }
+
+        // Wait for another job to release its copy
+        pthread_cond_wait(&cover->has_idle, &cover->lock);
+    }
+    pthread_mutex_unlock(&cover->lock);
+
+    CarrierImage *const carrier_img = instance->image;
+
+    // Undo the changes made by the previous job
+    if (was_used)
+    {
+        imc_parallel_for(carrier_img->carrier_length, IMC_PARALLEL_MIN_ITEMS, &__template_restore_range, instance);
+    }
+
+    // Shuffle the carrier using the job's key
+    const int key_status = imc_steg_set_key(carrier_img, key, progress, progress_data);
+    if (key_status != IMC_SUCCESS)
+    {
+        imc_template_release(cover, carrier_img);
+        return key_status;
+    }
+
+    *output = carrier_img;
+    return IMC_SUCCESS;
+}
+
+// Give back to the template an image that was acquired from it
+void imc_template_release(CarrierTemplate *cover, CarrierImage *carrier_img)
+{
+    pthread_mutex_lock(&cover->lock);
+
+    for (size_t i = 0; i < cover->max_instances; i++)
+    {
+        TemplateInstance *const instance = cover->all[i];
+        if (!instance || instance->image != carrier_img) continue;
+
+        instance->next = cover->idle;
+        cover->idle = instance;
+        break;
+    }
+
+    pthread_cond_signal(&cover->has_idle);
+    pthread_mutex_unlock(&cover->lock);
+}
+
+// Free the memory used by a template, including its decoded images
+// (all images acquired from the template must have been released)
+void imc_template_destroy(CarrierTemplate *cover)
+{
+    if (!cover) return;
+
+    for (size_t i = 0; i < cover->max_instances; i++)
+    {
+        TemplateInstance *const instance = cover->all[i];
+        if (!instance) continue;
+
+        imc_steg_finish(instance->image);
+        imc_free(instance->order);
+        imc_free(instance->pristine);
+        imc_free(instance);
+    }
+
+    pthread_cond_destroy(&cover->has_idle);
+    pthread_mutex_destroy(&cover->lock);
+    imc_free(cover->all);
+    imc_free(cover->path);
+    imc_free(cover);
+}
@@ -0,0 +1,75 @@
+/* Template mode: a cover image that is decoded and scanned once, then used for hiding many different payloads. */
+
+#ifndef _IMC_TEMPLATE_H
+#define _IMC_TEMPLATE_H
+
+#include "imc_includes.h"
+
+/*  How the templates work
+
+    Decoding a cover image and scanning it for carrier bytes takes most of the time of hiding a small file.
+    When the same cover is used for many outputs, a template keeps the decoded image in memory, along with
+    a snapshot of the original values of its carrier bytes (and of the order of the carrier on the image).
+
+    Each job takes the decoded image from the template with 'imc_template_acquire()', which restores the
+    carrier bytes from the snapshot, then shuffles the carrier using the job's key. Afterwards, the job
+    hides its files and saves the image as usual, then gives the image back with 'imc_template_release()'.
+
+    Since a decoded image can be used by only one job at a time, a template can hold more than one copy
+    of the image (up to 'max_instances'). A new copy is decoded only when all others are in use,
+    so the cover is decoded at most once per job running at the same time, instead of once per job.
+*/
+
+// A decoded copy of the cover image, along with the original values of its carrier
+typedef struct TemplateInstance {
+    CarrierImage *image;            // Decoded image (its carrier is restored before each job)
+    carrier_bytes_t *order;         // Pointers to the carrier bytes, in the same order as on the image
+    uint8_t *pristine;              // Original values of the carrier bytes (same order as 'order')
+    struct TemplateInstance *next;  // Next idle instance of the template
+} TemplateInstance;
+
+// Cover image that is decoded once, then used for many hiding operations
+typedef struct CarrierTemplate {
+    char *path;                 // Path to the cover image
+    uint64_t flags;             // Flags for opening the image (see 'imc_steg_init()')
+    TemplateInstance *idle;     // Decoded copies of the image that are not in use
+    TemplateInstance **all;     // All decoded copies of the image (for freeing them)
+    size_t instance_count;      // Amount of copies that were decoded or are being decoded
+    size_t max_instances;       // Maximum amount of decoded copies (one per job running at the same time)
+    int open_status;            // Status code of the decoding (IMC_SUCCESS if the image could be opened)
+    pthread_mutex_t lock;       // Protects all the fields above
+    pthread_cond_t has_idle;    // Signaled when an instance is released (or when decoding a new one failed)
+} CarrierTemplate;
+
+// Create a template for the cover image at 'path'
+// The image is only decoded when a job first acquires it. Up to 'max_instances' copies can be decoded
+// (zero for one per thread used for processing the images).
+CarrierTemplate *imc_template_create(const char *path, uint64_t flags, size_t max_instances);
+
+// Decode a new copy of the template's image, and take a snapshot of its carrier
+static int __template_decode(CarrierTemplate *cover, TemplateInstance **output);
+
+// Restore the original values and order of some of the carrier bytes (this function might run on a worker thread)
+static void __template_restore_range(size_t start, size_t end, void *instance_ptr);
+
+// Get a decoded copy of the template's image, with its original carrier shuffled by 'key'
+// The image is ready for hiding files in it, and it should be given back with 'imc_template_release()' afterwards
+// (instead of being closed with 'imc_steg_finish()').
+// If 'progress' is not NULL, it receives the progress of the operations on the image (along with 'progress_data').
+// Function returns the same status codes as 'imc_steg_init()'.
+int imc_template_acquire(
+    CarrierTemplate *cover,
+    const CryptoContext *key,
+    CarrierImage **output,
+    imc_progress_func progress,
+    void *progress_data
+);
+
+// Give back to the template an image that was acquired from it
+void imc_template_release(CarrierTemplate *cover, CarrierImage *carrier_img);
+
+// Free the memory used by a template, including its decoded images
+// (all images acquired from the template must have been released)
+void imc_template_destroy(CarrierTemplate *cover);
+
+#endif  // _IMC_TEMPLATE_H
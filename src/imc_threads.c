@@ -0,0 +1,595 @@
+/* Pool of worker threads for running independent tasks concurrently. */
+
+#ifndef _WIN32
+#define _GNU_SOURCE     // For the sched_getaffinity() function
+#endif // _WIN32
+
+#include "imc_includes.h"
+
+/* Note: See the 'imc_threads.h' file for how the tasks are distributed among the threads. */
+
+static size_t global_thread_count = 0;      // Threads used for processing an image (zero until it is set or detected)
+static ThreadPool *global_pool = NULL;      // Workers that help the thread calling the parallel functions
+static pthread_once_t global_pool_once = PTHREAD_ONCE_INIT;     // Ensures that the global pool is created only once
+static _Thread_local WorkerInfo *current_worker = NULL;        // Set when the thread is a worker of a pool
+
+// Amount of logical processors available to this program
+// (on Linux, this takes into account the processors that the program is allowed to run on,
+//  and the CPU quota of its control group, which is how containers usually limit the CPU usage)
+size_t imc_cpu_count()
+{
+    #ifdef _WIN32   // Windows systems
+    SYSTEM_INFO sys_info;
+    GetSystemInfo(&sys_info);
+    long cpu_count = sys_info.dwNumberOfProcessors;
+
+    #else   // Linux systems
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // Processors that the program is allowed to run on (e.g. when started with 'taskset')
+    cpu_set_t cpu_set;
+    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0)
+    {
+        const long allowed_count = CPU_COUNT(&cpu_set);
+        if (allowed_count > 0 && allowed_count < cpu_count) cpu_count = allowed_count;
+    }
+
+    // CPU quota of the control group (e.g. when running in a container with a CPU limit)
+    const long quota_count = (long)__cgroup_cpu_limit();
+    if (quota_count > 0 && quota_count < cpu_count) cpu_count = quota_count;
+    #endif // _WIN32
+
+    return (cpu_count > 0) ? (size_t)cpu_count : 1;
+}
+
+// Get the CPU quota of the program's control group (cgroup v2 or v1), rounded up to a whole amount of processors
+// Function returns zero if there is no quota.
+static size_t __cgroup_cpu_limit()
+{
+    #ifdef _WIN32
+    return 0;
+
+    #else // Linux
+    long long quota = -1;   // Microseconds of CPU time that the group can use per period (-1 for no limit)
+    long long period = 0;   // Length of the period in microseconds
+
+    // Find the group of the program on the cgroup v2 hierarchy (its line on the file begins with "0::")
+    char group_path[512] = "";
+    FILE *file = fopen("/proc/self/cgroup", "r");
+    if (file)
+    {
+        char line[sizeof(group_path) + 8];
+        while (fgets(line, sizeof(line), file))
+        {
+            if (strncmp(line, "0::", 3) != 0) continue;
+
+            // A path too long for the buffer is not used (the quota at the root of the hierarchy is read instead)
+            const size_t path_len = strcspn(&line[3], "\n");
+            const bool is_complete = (line[3 + path_len] == '\n' || feof(file));
+            if (is_complete && path_len < sizeof(group_path) && strncmp(&line[3], "/", path_len) != 0)
+            {
+                memcpy(group_path, &line[3], path_len);
+                group_path[path_len] = '\0';
+            }
+            break;
+        }
+        fclose(file);
+    }
+
+    // cgroup v2: The file has the quota (or "max") and the period
+    char max_path[sizeof(group_path) + 32];
+    snprintf(max_path, sizeof(max_path), "/sys/fs/cgroup%s/cpu.max", group_path);
+    file = fopen(max_path, "r");
+    if (!file) file = fopen("/sys/fs/cgroup/cpu.max", "r");
+
+    if (file)
+    {
+        char quota_text[32];
+        if (fscanf(file, "%31s %lld", quota_text, &period) == 2 && strcmp(quota_text, "max") != 0)
+        {
+            quota = atoll(quota_text);
+        }
+        fclose(file);
+    }
+    else
+    {
+        // cgroup v1: The quota and the period are on separate files
+        file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r");
+        if (file)
+        {
+            if (fscanf(file, "%lld", &quota) != 1) quota = -1;
+            fclose(file);
+        }
+
+        file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+        if (file)
+        {
+            if (fscanf(file, "%lld", &period) != 1) period = 0;
+            fclose(file);
+        }
+    }
+
+    if (quota <= 0 || period <= 0) return 0;
+    return (size_t)((quota + period - 1) / period);
+    #endif // _WIN32
+}
+
+// Set how many threads are used for processing an image (zero for one per processor)
+// This needs to be called before any image is processed, because the global pool is created only once.
+void imc_threads_set_count(size_t num_threads)
+{
+    global_thread_count = num_threads;
+}
+
+// Amount of threads used for processing an image (including the thread that calls the parallel functions)
+size_t imc_threads_get_count()
+{
+    pthread_once(&global_pool_once, &__threadpool_global_init);
+    return global_thread_count;
+}
+
+// Create the global pool (called only once, the first time that it is needed)
+static void __threadpool_global_init()
+{
+    if (global_thread_count == 0) global_thread_count = imc_cpu_count();
+
+    // The thread calling the parallel functions also does part of the work, so it is not counted on the pool
+    if (global_thread_count > 1) global_pool = imc_threadpool_create(global_thread_count - 1);
+
+    /* Note:
+        The global pool is never destroyed, because the program might exit while one of its workers
+        is running a task. Its idle threads are just terminated when the program exits.
+    */
+}
+
+// Get the global pool used by the parallel functions (NULL if only one thread is used)
+ThreadPool *imc_threadpool_global()
+{
+    pthread_once(&global_pool_once, &__threadpool_global_init);
+    return global_pool;
+}
+
+// Create a pool with 'num_threads' worker threads
+// (if 'num_threads' is zero, one thread per logical processor is created)
+ThreadPool *imc_threadpool_create(size_t num_threads)
+{
+    if (num_threads == 0) num_threads = imc_cpu_count();
+
+    ThreadPool *pool = imc_calloc(1, sizeof(ThreadPool));
+    pool->threads = imc_calloc(num_threads, sizeof(pthread_t));
+    pool->workers = imc_calloc(num_threads, sizeof(WorkerInfo));
+    pool->num_queues = num_threads + 1;
+    pool->queues = imc_calloc(pool->num_queues, sizeof(TaskQueue));
+    atomic_init(&pool->queued, 0);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->has_task, NULL);
+    pthread_cond_init(&pool->has_room, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+
+    for (size_t i = 0; i < pool->num_queues; i++)
+    {
+        pthread_mutex_init(&pool->queues[i].lock, NULL);
+    }
+
+    // Start the worker threads
+    for (size_t i = 0; i < num_threads; i++)
+    {
+        pool->workers[i] = (WorkerInfo){.pool = pool, .index = i};
+        if (pthread_create(&pool->threads[i], NULL, &__threadpool_worker, &pool->workers[i]) != 0) break;
+        pool->num_threads++;
+    }
+
+    if (pool->num_threads == 0)
+    {
+        fprintf(stderr, "Error: Could not create the worker threads.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return pool;
+}
+
+// Limit how many tasks can be pending at the same time (zero for no limit)
+// Once the limit is reached, 'imc_threadpool_submit()' blocks until a task finishes.
+void imc_threadpool_set_limit(ThreadPool *pool, size_t max_pending)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->max_pending = max_pending;
+    pthread_cond_broadcast(&pool->has_room);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Take the newest task from a queue (done by the queue's owner)
+static ThreadTask *__queue_pop_newest(TaskQueue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+
+    ThreadTask *task = queue->newest;
+    if (task)
+    {
+        queue->newest = task->prev;
+        if (queue->newest) queue->newest->next = NULL;
+        else queue->oldest = NULL;
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+    return task;
+}
+
+// Take the oldest task from a queue (done when stealing from another queue)
+static ThreadTask *__queue_pop_oldest(TaskQueue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+
+    ThreadTask *task = queue->oldest;
+    if (task)
+    {
+        queue->oldest = task->next;
+        if (queue->oldest) queue->oldest->prev = NULL;
+        else queue->newest = NULL;
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+    return task;
+}
+
+// Get a task for a worker: the newest from its own queue, otherwise the oldest from the other queues
+// Function returns NULL if all queues are empty.
+static ThreadTask *__threadpool_find_task(ThreadPool *pool, size_t worker_index)
+{
+    if (atomic_load(&pool->queued) == 0) return NULL;
+
+    ThreadTask *task = __queue_pop_newest(&pool->queues[worker_index]);
+
+    // Steal from the other queues, starting from the next one
+    // (so the workers do not all try to steal from the same queue)
+    for (size_t i = 1; !task && i < pool->num_queues; i++)
+    {
+        task = __queue_pop_oldest(&pool->queues[(worker_index + i) % pool->num_queues]);
+    }
+
+    if (task) atomic_fetch_sub(&pool->queued, 1);
+    return task;
+}
+
+// Main loop of a worker thread: run the tasks from the queues until the pool is shut down
+static void *__threadpool_worker(void *worker_ptr)
+{
+    WorkerInfo *const worker = (WorkerInfo *)worker_ptr;
+    ThreadPool *const pool = worker->pool;
+    current_worker = worker;
+
+    while (true)
+    {
+        ThreadTask *task = __threadpool_find_task(pool, worker->index);
+
+        if (!task)
+        {
+            // Wait for a task to be available
+            pthread_mutex_lock(&pool->lock);
+            while (atomic_load(&pool->queued) == 0 && !pool->shutdown)
+            {
+                pthread_cond_wait(&pool->has_task, &pool->lock);
+            }
+
+            // Exit if the pool is shutting down and there is nothing else to do
+            const bool should_exit = (atomic_load(&pool->queued) == 0);
+            pthread_mutex_unlock(&pool->lock);
+            if (should_exit) break;
+
+            continue;
+        }
+
+        // Run the task
+        task->func(task->arg);
+        imc_free(task);
+
+        // Notify the waiting threads if this was the last pending task
+        pthread_mutex_lock(&pool->lock);
+        pool->pending--;
+        pthread_cond_signal(&pool->has_room);
+        if (pool->pending == 0) pthread_cond_broadcast(&pool->all_done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+// Add a task to the pool
+// (if the pool has a limit of pending tasks, this function waits until there is room for the new task)
+void imc_threadpool_submit(ThreadPool *pool, imc_task_func func, void *arg)
+{
+    ThreadTask *task = imc_malloc(sizeof(ThreadTask));
+    *task = (ThreadTask){
+        .func = func,
+        .arg = arg,
+        .prev = NULL,
+        .next = NULL,
+    };
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->max_pending > 0 && pool->pending >= pool->max_pending)
+    {
+        pthread_cond_wait(&pool->has_room, &pool->lock);
+    }
+    pool->pending++;
+    pthread_mutex_unlock(&pool->lock);
+
+    // A worker of this pool adds the task to its own queue, while other threads use the pool's shared queue
+    const bool is_own_worker = (current_worker && current_worker->pool == pool);
+    TaskQueue *const queue = &pool->queues[is_own_worker ? current_worker->index : pool->num_queues - 1];
+
+    // Add the task to the end of the queue
+    pthread_mutex_lock(&queue->lock);
+    task->prev = queue->newest;
+    if (queue->newest) queue->newest->next = task;
+    else queue->oldest = task;
+    queue->newest = task;
+    pthread_mutex_unlock(&queue->lock);
+
+    atomic_fetch_add(&pool->queued, 1);
+
+    // Wake up an idle worker
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->has_task);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Wait up to 'timeout_ms' milliseconds for the pool to have room for one more task (if it has a limit of pending tasks)
+// Function returns whether there is room, so 'imc_threadpool_submit()' can be called without blocking.
+// Note: this allows the caller to check for other conditions (like a stop signal) while the pool is full.
+bool imc_threadpool_wait_room(ThreadPool *pool, unsigned int timeout_ms)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->max_pending > 0 && pool->pending >= pool->max_pending)
+    {
+        if (pthread_cond_timedwait(&pool->has_room, &pool->lock, &deadline) == ETIMEDOUT) break;
+    }
+    const bool has_room = (pool->max_pending == 0 || pool->pending < pool->max_pending);
+    pthread_mutex_unlock(&pool->lock);
+
+    return has_room;
+}
+
+// Block until all submitted tasks have finished
+void imc_threadpool_wait(ThreadPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+    {
+        pthread_cond_wait(&pool->all_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Wait for the pending tasks, then stop the worker threads and free the pool
+void imc_threadpool_destroy(ThreadPool *pool)
+{
+    if (!pool) return;
+
+    imc_threadpool_wait(pool);
+
+    // Tell the workers to exit
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->has_task);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->num_threads; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < pool->num_queues; i++)
+    {
+        pthread_mutex_destroy(&pool->queues[i].lock);
+    }
+
+    pthread_cond_destroy(&pool->all_done);
+    pthread_cond_destroy(&pool->has_room);
+    pthread_cond_destroy(&pool->has_task);
+    pthread_mutex_destroy(&pool->lock);
+    imc_free(pool->queues);
+    imc_free(pool->workers);
+    imc_free(pool->threads);
+    imc_free(pool);
+}
+
+// Process the chunks of a parallel loop until none is left
+static void __parallel_loop_work(ParallelLoop *loop)
+{
+    size_t chunk;
+    while ( (chunk = atomic_fetch_add(&loop->next_chunk, 1)) < loop->num_chunks )
+    {
+        const size_t start = chunk * loop->chunk_size;
+        const size_t end = (start + loop->chunk_size < loop->count) ? start + loop->chunk_size : loop->count;
+        loop->func(start, end, loop->arg);
+
+        // Wake up the thread that started the loop, if this was the last chunk
+        if (atomic_fetch_add(&loop->done_chunks, 1) + 1 == loop->num_chunks)
+        {
+            pthread_mutex_lock(&loop->lock);
+            pthread_cond_broadcast(&loop->finished);
+            pthread_mutex_unlock(&loop->lock);
+        }
+    }
+}
+
+// Task that helps processing a parallel loop on a worker thread
+static void __parallel_loop_task(void *loop_ptr)
+{
+    ParallelLoop *const loop = (ParallelLoop *)loop_ptr;
+    __parallel_loop_work(loop);
+    __parallel_loop_release(loop);
+}
+
+// Release a reference to a parallel loop, freeing it if it was the last one
+static void __parallel_loop_release(ParallelLoop *loop)
+{
+    if (atomic_fetch_sub(&loop->references, 1) != 1) return;
+
+    pthread_cond_destroy(&loop->finished);
+    pthread_mutex_destroy(&loop->lock);
+    imc_free(loop);
+}
+
+// Run 'func' over the items from 0 to 'count', split into chunks of at least 'min_chunk' items that are processed in parallel
+// The function returns once all items were processed. The order in which the chunks are processed is not defined,
+// so each chunk should write only to its own part of the output.
+void imc_parallel_for(size_t count, size_t min_chunk, imc_range_func func, void *arg)
+{
+    if (count == 0) return;
+    if (min_chunk == 0) min_chunk = 1;
+
+    // Split the items into a few chunks per thread, so a thread that finishes early can take the remaining chunks
+    ThreadPool *const pool = imc_threadpool_global();
+    const size_t num_parts = imc_threads_get_count() * IMC_PARALLEL_CHUNKS;
+    size_t chunk_size = (count + num_parts - 1) / num_parts;
+    if (chunk_size < min_chunk) chunk_size = min_chunk;
+    const size_t num_chunks = (count + chunk_size - 1) / chunk_size;
+
+    // Just process the items on the current thread if they are not worth splitting
+    if (!pool || num_chunks <= 1)
+    {
+        func(0, count, arg);
+        return;
+    }
+
+    // Helpers that are going to be added to the pool
+    const size_t num_helpers = (num_chunks - 1 < pool->num_threads) ? num_chunks - 1 : pool->num_threads;
+
+    ParallelLoop *loop = imc_malloc(sizeof(ParallelLoop));
+    *loop = (ParallelLoop){
+        .func = func,
+        .arg = arg,
+        .count = count,
+        .chunk_size = chunk_size,
+        .num_chunks = num_chunks,
+    };
+    atomic_init(&loop->next_chunk, 0);
+    atomic_init(&loop->done_chunks, 0);
+    atomic_init(&loop->references, num_helpers + 1);
+    pthread_mutex_init(&loop->lock, NULL);
+    pthread_cond_init(&loop->finished, NULL);
+
+    for (size_t i = 0; i < num_helpers; i++)
+    {
+        imc_threadpool_submit(pool, &__parallel_loop_task, loop);
+    }
+
+    // Work on the chunks alongside the helpers, then wait for the chunks that they are still processing
+    __parallel_loop_work(loop);
+
+    pthread_mutex_lock(&loop->lock);
+    while (atomic_load(&loop->done_chunks) < num_chunks)
+    {
+        pthread_cond_wait(&loop->finished, &loop->lock);
+    }
+    pthread_mutex_unlock(&loop->lock);
+
+    __parallel_loop_release(loop);
+}
+
+// Produce an item of an ordered pipeline, unless another thread has already started it
+static void __parallel_pipeline_produce(ParallelPipeline *pipeline, size_t index)
+{
+    int expected = IMC_ITEM_WAITING;
+    if (!atomic_compare_exchange_strong(&pipeline->state[index], &expected, IMC_ITEM_PRODUCING)) return;
+
+    pipeline->produce(index, pipeline->arg);
+    atomic_store(&pipeline->state[index], IMC_ITEM_READY);
+
+    pthread_mutex_lock(&pipeline->lock);
+    pthread_cond_broadcast(&pipeline->item_ready);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+// Task that produces an item of an ordered pipeline on a worker thread
+static void __parallel_pipeline_task(void *task_ptr)
+{
+    PipelineTask *const task = (PipelineTask *)task_ptr;
+    __parallel_pipeline_produce(task->pipeline, task->index);
+    __parallel_pipeline_release(task->pipeline);
+    imc_free(task);
+}
+
+// Release a reference to an ordered pipeline, freeing it if it was the last one
+static void __parallel_pipeline_release(ParallelPipeline *pipeline)
+{
+    if (atomic_fetch_sub(&pipeline->references, 1) != 1) return;
+
+    pthread_cond_destroy(&pipeline->item_ready);
+    pthread_mutex_destroy(&pipeline->lock);
+    imc_free(pipeline->state);
+    imc_free(pipeline);
+}
+
+// Ordered pipeline: call 'produce' on the items from 0 to 'count' in parallel, and 'consume' on the same items
+// in their order (on the calling thread) as soon as each one is ready.
+// At most 'window' items are produced ahead of the item being consumed, which limits the memory in use.
+void imc_parallel_ordered(size_t count, size_t window, imc_item_func produce, imc_item_func consume, void *arg)
+{
+    ThreadPool *const pool = imc_threadpool_global();
+
+    // Without helper threads, just alternate between producing and consuming
+    if (!pool || count <= 1 || window == 0)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            produce(i, arg);
+            consume(i, arg);
+        }
+        return;
+    }
+
+    ParallelPipeline *pipeline = imc_malloc(sizeof(ParallelPipeline));
+    *pipeline = (ParallelPipeline){
+        .produce = produce,
+        .arg = arg,
+        .state = imc_malloc(count * sizeof(atomic_int)),
+    };
+    atomic_init(&pipeline->references, 1);
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->item_ready, NULL);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        atomic_init(&pipeline->state[i], IMC_ITEM_WAITING);
+    }
+
+    size_t submitted = 0;   // Amount of items that were handed to the pool
+    for (size_t i = 0; i < count; i++)
+    {
+        // Keep the pool busy with the items after the current one
+        while (submitted < count && submitted <= i + window)
+        {
+            PipelineTask *task = imc_malloc(sizeof(PipelineTask));
+            *task = (PipelineTask){.pipeline = pipeline, .index = submitted++};
+            atomic_fetch_add(&pipeline->references, 1);
+            imc_threadpool_submit(pool, &__parallel_pipeline_task, task);
+        }
+
+        // Produce the current item if no worker has started it yet, otherwise wait for it to be ready
+        __parallel_pipeline_produce(pipeline, i);
+
+        pthread_mutex_lock(&pipeline->lock);
+        while (atomic_load(&pipeline->state[i]) != IMC_ITEM_READY)
+        {
+            pthread_cond_wait(&pipeline->item_ready, &pipeline->lock);
+        }
+        pthread_mutex_unlock(&pipeline->lock);
+
+        consume(i, arg);
+    }
+
+    __parallel_pipeline_release(pipeline);
+}
@@ -0,0 +1,195 @@
+/* Pool of worker threads for running independent tasks concurrently. */
+
+#ifndef _IMC_THREADS_H
+#define _IMC_THREADS_H
+
+#include "imc_includes.h"
+
+/*  How the tasks are distributed (work stealing)
+
+    Each worker thread has its own queue of tasks, and there is one more queue for the tasks submitted
+    from outside of the pool. A task submitted by a worker goes to that worker's queue, and the worker
+    runs the newest task of its queue first (its data is more likely to still be on the processor's cache).
+    Once a worker's queue is empty, it takes the oldest task from the other queues. This way the workers
+    rarely compete for the same queue, and a task that splits its work into more tasks keeps the other
+    workers busy.
+
+    Besides the pools created for a specific purpose (like running the jobs of '--batch'), there is a global
+    pool for splitting the processing of a single image among the processors: see 'imc_parallel_for()'
+    and 'imc_parallel_ordered()'. The thread that calls those functions also does part of the work,
+    so they can be called from within a task without the risk of all workers waiting on each other.
+*/
+
+#define IMC_PARALLEL_MIN_ITEMS  32768   // Minimum amount of work (in bytes or coefficients) worth giving to another thread
+#define IMC_PARALLEL_CHUNKS     4       // Chunks per thread that a parallel loop is split into (for balancing the load)
+
+// Function that performs a task on a worker thread
+typedef void (*imc_task_func)(void *arg);
+
+// Function that processes the items from 'start' to 'end' (not including 'end') of a parallel loop
+typedef void (*imc_range_func)(size_t start, size_t end, void *arg);
+
+// Function that processes the item at 'index' of an ordered pipeline
+typedef void (*imc_item_func)(size_t index, void *arg);
+
+// Task waiting on a queue of the thread pool
+typedef struct ThreadTask {
+    imc_task_func func;         // Function to be run
+    void *arg;                  // Argument passed to the function
+    struct ThreadTask *prev;    // Older task on the queue
+    struct ThreadTask *next;    // Newer task on the queue
+} ThreadTask;
+
+// Queue of tasks that can be taken from both ends
+// (the owner takes the newest task, while the other workers steal the oldest one)
+typedef struct TaskQueue {
+    ThreadTask *oldest;         // Task at the beginning of the queue
+    ThreadTask *newest;         // Task at the end of the queue
+    pthread_mutex_t lock;       // Protects the fields above
+} TaskQueue;
+
+struct ThreadPool;
+
+// Identifies a worker thread to itself
+typedef struct WorkerInfo {
+    struct ThreadPool *pool;    // The pool that the worker belongs to
+    size_t index;               // Position of the worker's queue on the pool
+} WorkerInfo;
+
+// Fixed amount of worker threads, each one with its own queue of tasks
+typedef struct ThreadPool {
+    pthread_t *threads;         // Handles of the worker threads
+    WorkerInfo *workers;        // Information passed to each worker thread
+    size_t num_threads;         // Amount of worker threads
+    TaskQueue *queues;          // One queue per worker, plus one for the tasks submitted from outside of the pool
+    size_t num_queues;          // Amount of elements on the 'queues' array
+    atomic_size_t queued;       // Amount of tasks waiting on the queues
+    size_t pending;             // Amount of tasks that were submitted but have not finished yet
+    size_t max_pending;         // Submitting blocks while this many tasks are pending (zero for no limit)
+    bool shutdown;              // Signals the workers to exit once the queues are empty
+    pthread_mutex_t lock;       // Protects 'pending', 'max_pending', and 'shutdown'
+    pthread_cond_t has_task;    // Signaled when a task is added to a queue (or on shutdown)
+    pthread_cond_t has_room;    // Signaled when a task finishes (so a blocked submission can proceed)
+    pthread_cond_t all_done;    // Signaled when there are no more pending tasks
+} ThreadPool;
+
+// State shared by the threads working on the same 'imc_parallel_for()'
+typedef struct ParallelLoop {
+    imc_range_func func;        // Function that processes a chunk of items
+    void *arg;                  // Argument passed to the function
+    size_t count;               // Total amount of items
+    size_t chunk_size;          // Amount of items on each chunk
+    size_t num_chunks;          // Amount of chunks that the items were split into
+    atomic_size_t next_chunk;   // Next chunk to be processed
+    atomic_size_t done_chunks;  // Amount of chunks that were completed
+    atomic_size_t references;   // Amount of threads still using this struct (the last one frees it)
+    pthread_mutex_t lock;       // Used for waiting on the 'finished' condition
+    pthread_cond_t finished;    // Signaled when all chunks were completed
+} ParallelLoop;
+
+// States of an item on an ordered pipeline
+enum PipelineState {IMC_ITEM_WAITING, IMC_ITEM_PRODUCING, IMC_ITEM_READY};
+
+// State shared by the threads working on the same 'imc_parallel_ordered()'
+typedef struct ParallelPipeline {
+    imc_item_func produce;      // Function that processes the items in parallel
+    void *arg;                  // Argument passed to the function
+    atomic_int *state;          // Whether each item is waiting, being produced, or ready (enum PipelineState)
+    atomic_size_t references;   // Amount of threads still using this struct (the last one frees it)
+    pthread_mutex_t lock;       // Used for waiting on the 'item_ready' condition
+    pthread_cond_t item_ready;  // Signaled when an item finishes being produced
+} ParallelPipeline;
+
+// Task that produces a specific item of an ordered pipeline
+typedef struct PipelineTask {
+    ParallelPipeline *pipeline; // The pipeline that the item belongs to
+    size_t index;               // Position of the item
+} PipelineTask;
+
+// Amount of logical processors available to this program
+// (on Linux, this takes into account the processors that the program is allowed to run on,
+//  and the CPU quota of its control group, which is how containers usually limit the CPU usage)
+size_t imc_cpu_count();
+
+// Get the CPU quota of the program's control group (cgroup v2 or v1), rounded up to a whole amount of processors
+// Function returns zero if there is no quota.
+static size_t __cgroup_cpu_limit();
+
+// Set how many threads are used for processing an image (zero for one per processor)
+// This needs to be called before any image is processed, because the global pool is created only once.
+void imc_threads_set_count(size_t num_threads);
+
+// Amount of threads used for processing an image (including the thread that calls the parallel functions)
+size_t imc_threads_get_count();
+
+// Create the global pool (called only once, the first time that it is needed)
+static void __threadpool_global_init();
+
+// Get the global pool used by the parallel functions (NULL if only one thread is used)
+ThreadPool *imc_threadpool_global();
+
+// Create a pool with 'num_threads' worker threads
+// (if 'num_threads' is zero, one thread per logical processor is created)
+ThreadPool *imc_threadpool_create(size_t num_threads);
+
+// Limit how many tasks can be pending at the same time (zero for no limit)
+// Once the limit is reached, 'imc_threadpool_submit()' blocks until a task finishes.
+void imc_threadpool_set_limit(ThreadPool *pool, size_t max_pending);
+
+// Take the newest task from a queue (done by the queue's owner)
+static ThreadTask *__queue_pop_newest(TaskQueue *queue);
+
+// Take the oldest task from a queue (done when stealing from another queue)
+static ThreadTask *__queue_pop_oldest(TaskQueue *queue);
+
+// Get a task for a worker: the newest from its own queue, otherwise the oldest from the other queues
+// Function returns NULL if all queues are empty.
+static ThreadTask *__threadpool_find_task(ThreadPool *pool, size_t worker_index);
+
+// Main loop of a worker thread: run the tasks from the queues until the pool is shut down
+static void *__threadpool_worker(void *worker_ptr);
+
+// Add a task to the pool
+// (if the pool has a limit of pending tasks, this function waits until there is room for the new task)
+void imc_threadpool_submit(ThreadPool *pool, imc_task_func func, void *arg);
+
+// Wait up to 'timeout_ms' milliseconds for the pool to have room for one more task (if it has a limit of pending tasks)
+// Function returns whether there is room, so 'imc_threadpool_submit()' can be called without blocking.
+// Note: this allows the caller to check for other conditions (like a stop signal) while the pool is full.
+bool imc_threadpool_wait_room(ThreadPool *pool, unsigned int timeout_ms);
+
+// Block until all submitted tasks have finished
+void imc_threadpool_wait(ThreadPool *pool);
+
+// Wait for the pending tasks, then stop the worker threads and free the pool
+void imc_threadpool_destroy(ThreadPool *pool);
+
+// Process the chunks of a parallel loop until none is left
+static void __parallel_loop_work(ParallelLoop *loop);
+
+// Task that helps processing a parallel loop on a worker thread
+static void __parallel_loop_task(void *loop_ptr);
+
+// Release a reference to a parallel loop, freeing it if it was the last one
+static void __parallel_loop_release(ParallelLoop *loop);
+
+// Run 'func' over the items from 0 to 'count', split into chunks of at least 'min_chunk' items that are processed in parallel
+// The function returns once all items were processed. The order in which the chunks are processed is not defined,
+// so each chunk should write only to its own part of the output.
+void imc_parallel_for(size_t count, size_t min_chunk, imc_range_func func, void *arg);
+
+// Produce an item of an ordered pipeline, unless another thread has already started it
+static void __parallel_pipeline_produce(ParallelPipeline *pipeline, size_t index);
+
+// Task that produces an item of an ordered pipeline on a worker thread
+static void __parallel_pipeline_task(void *task_ptr);
+
+// Release a reference to an ordered pipeline, freeing it if it was the last one
+static void __parallel_pipeline_release(ParallelPipeline *pipeline);
+
+// Ordered pipeline: call 'produce' on the items from 0 to 'count' in parallel, and 'consume' on the same items
+// in their order (on the calling thread) as soon as each one is ready.
+// At most 'window' items are produced ahead of the item being consumed, which limits the memory in use.
+void imc_parallel_ordered(size_t count, size_t window, imc_item_func produce, imc_item_func consume, void *arg);
+
+#endif  // _IMC_THREADS_H
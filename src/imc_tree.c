@@ -0,0 +1,517 @@
+/* Directory trees: a whole folder is hidden as a single file, which is an archive of its files and subfolders. */
+
+#include "imc_includes.h"
+
+/* Note: See the 'imc_tree.h' file for the format of the archive. */
+
+// Get the size, permissions, and timestamps of an entry from its stats
+static void __tree_node_stats(TreeNode *node, const struct stat *stats)
+{
+    node->type = S_ISDIR(stats->st_mode) ? IMC_TREE_FOLDER : IMC_TREE_FILE;
+    node->mode = stats->st_mode & 0777;
+    node->size = S_ISDIR(stats->st_mode) ? 0 : stats->st_size;
+
+    #ifdef _WIN32
+    node->access_time = (struct timespec){.tv_sec = stats->st_atime, .tv_nsec = 0};
+    node->mod_time = (struct timespec){.tv_sec = stats->st_mtime, .tv_nsec = 0};
+    #else
+    node->access_time = stats->st_atim;
+    node->mod_time = stats->st_mtim;
+    #endif // _WIN32
+}
+
+// Walk a folder, adding its files and subfolders to the list of entries (the subfolders are walked recursively)
+// 'relative_offset' is the position on the paths where the part relative to the hidden folder begins.
+// Function returns IMC_ERR_FILE_NOT_FOUND if the folder could not be listed, IMC_ERR_NAME_TOO_LONG if a relative path
+// is too long, or IMC_ERR_INPUT_TOO_BIG if the archive would be bigger than 'IMC_MAX_INPUT_SIZE'.
+static int __tree_walk(TreeWalk *walk, const char *dir_path, size_t relative_offset)
+{
+    DIR *dir = opendir(dir_path);
+    if (!dir) return IMC_ERR_FILE_NOT_FOUND;
+
+    const size_t dir_len = strlen(dir_path);
+    const bool has_separator = (dir_len > 0) && (dir_path[dir_len-1] == '/');
+    struct dirent *entry;
+    int status = IMC_SUCCESS;
+
+    while ( status == IMC_SUCCESS && (entry = readdir(dir)) )
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        // Path of the entry
+        const size_t path_size = dir_len + strlen(entry->d_name) + 2;
+        char *const path = imc_malloc(path_size);
+        snprintf(path, path_size, has_separator ? "%s%s" : "%s/%s", dir_path, entry->d_name);
+
+        // Symbolic links are not followed (so the walk cannot loop, nor store anything from outside of the folder)
+        struct stat entry_stats;
+        #ifdef _WIN32
+        const bool is_valid = stat(path, &entry_stats) == 0;
+        #else
+        const bool is_valid = lstat(path, &entry_stats) == 0;
+        #endif
+
+        if (!is_valid || !(S_ISDIR(entry_stats.st_mode) || S_ISREG(entry_stats.st_mode)))
+        {
+            imc_free(path);
+            continue;
+        }
+
+        // The relative path is stored with its size on 16 bits
+        const size_t relative_size = strlen(&path[relative_offset]) + 1;
+        if (relative_size > UINT16_MAX)
+        {
+            imc_free(path);
+            status = IMC_ERR_NAME_TOO_LONG;
+            break;
+        }
+
+        // Add the entry to the list
+        if (walk->count == walk->capacity)
+        {
+            walk->capacity = walk->capacity ? walk->capacity * 2 : 64;
+            walk->nodes = imc_realloc(walk->nodes, walk->capacity * sizeof(TreeNode));
+        }
+
+        TreeNode *const node = &walk->nodes[walk->count++];
+        *node = (TreeNode){
+            .path = path,
+            .relative_offset = relative_offset,
+            .offset = walk->archive_size,
+            .status = IMC_SUCCESS,
+        };
+        __tree_node_stats(node, &entry_stats);
+
+        walk->archive_size += sizeof(TreeEntry) + relative_size + node->size;
+        if (walk->archive_size > IMC_MAX_INPUT_SIZE)
+        {
+            status = IMC_ERR_INPUT_TOO_BIG;
+            break;
+        }
+
+        // The contents of a folder come right after it
+        // (the node is not used after this point, since the array may be moved while walking the subfolder)
+        if (S_ISDIR(entry_stats.st_mode)) status = __tree_walk(walk, path, relative_offset);
+    }
+
+    closedir(dir);
+    return status;
+}
+
+// Read some of the files into their place on the archive (this function might run on a worker thread)
+static void __tree_read_range(size_t start, size_t end, void *walk_ptr)
+{
+    TreeWalk *const walk = (TreeWalk *)walk_ptr;
+
+    for (size_t i = start; i < end; i++)
+    {
+        TreeNode *const node = &walk->nodes[i];
+        if (node->type != IMC_TREE_FILE) continue;
+
+        const size_t relative_size = strlen(&node->path[node->relative_offset]) + 1;
+        uint8_t *const data = &walk->archive[node->offset + sizeof(TreeEntry) + relative_size];
+
+        FILE *file = fopen(node->path, "rb");
+        if (!file)
+        {
+            node->status = IMC_ERR_FILE_NOT_FOUND;
+            continue;
+        }
+
+        // The file must still have the size that it had when the folder was walked
+        const size_t read_count = (node->size > 0) ? fread(data, 1, node->size, file) : 0;
+        const bool at_end = (fgetc(file) == EOF);
+        fclose(file);
+
+        node->status = (read_count == node->size && at_end) ? IMC_SUCCESS : IMC_ERR_FILE_CORRUPTED;
+    }
+}
+
+// Free the entries of a walk (the archive itself is not freed)
+static void __tree_walk_free(TreeWalk *walk)
+{
+    for (size_t i = 0; i < walk->count; i++) imc_free(walk->nodes[i].path);
+    imc_free(walk->nodes);
+    walk->nodes = NULL;
+    walk->count = 0;
+    walk->capacity = 0;
+}
+
+// Read, compress, and encrypt a whole folder, so it can be hidden as a single file
+// If 'verbose' is true, the status is printed to stdout.
+// The returned 'PreparedPayload' should be freed with 'imc_steg_prepared_free()'.
+int imc_tree_prepare(CryptoContext *crypto, const char *dir_path, bool verbose, PreparedPayload **output)
+{
+    // Stats of the folder itself
+    struct stat dir_stats;
+    if (stat(dir_path, &dir_stats) != 0) return IMC_ERR_FILE_NOT_FOUND;
+    TreeNode root = {0};
+    __tree_node_stats(&root, &dir_stats);
+
+    // Name of the folder
+    // (the full path is resolved first, so a path like '.' is stored under the folder's actual name)
+    #ifdef _WIN32
+    char *const full_path = _fullpath(NULL, dir_path, 0);
+    #else
+    char *const full_path = realpath(dir_path, NULL);
+    #endif // _WIN32
+    if (!full_path) return IMC_ERR_FILE_NOT_FOUND;
+
+    const char *dir_name = basename(full_path);
+    if (!__tree_valid_component(dir_name, strlen(dir_name))) dir_name = "folder";  // The root of the file system
+
+    const size_t name_size = strlen(dir_name) + 1;
+    if (name_size > UINT16_MAX)
+    {
+        free(full_path);
+        return IMC_ERR_NAME_TOO_LONG;
+    }
+    const size_t info_size = sizeof(FileInfo) + name_size;
+
+    // List the entries, so the size of the archive is known before reading any file
+    if (verbose) printf("Listing '%s'... ", dir_name);
+    if (verbose) fflush(stdout);
+    const size_t dir_len = strlen(dir_path);
+    const size_t relative_offset = dir_len + ((dir_len > 0 && dir_path[dir_len-1] == '/') ? 0 : 1);
+    TreeWalk walk = {0};
+    int status = __tree_walk(&walk, dir_path, relative_offset);
+
+    // Reserve the archive from the memory budget (its compressed and encrypted streams are reserved when prepared)
+    const size_t raw_size = info_size + walk.archive_size;
+    const size_t reserved_memory = (imc_memory_get_budget() != 0) ? raw_size : 0;
+    if (status == IMC_SUCCESS) status = imc_memory_reserve_buffers(reserved_memory);
+
+    if (status != IMC_SUCCESS)
+    {
+        __tree_walk_free(&walk);
+        free(full_path);
+        if (verbose) printf("\n");
+        return status;
+    }
+    if (verbose) printf("Done! (%zu entries)\n", walk.count);
+
+    // Buffer with the folder's metadata, followed by the archive
+    uint8_t *const raw_buffer = imc_malloc_tag(raw_size, IMC_MEMORY_FILE);
+    walk.archive = &raw_buffer[info_size];
+
+    // Write the header and path of each entry
+    for (size_t i = 0; i < walk.count; i++)
+    {
+        const TreeNode *const node = &walk.nodes[i];
+        const char *const relative_path = &node->path[node->relative_offset];
+        const size_t relative_size = strlen(relative_path) + 1;
+
+        const TreeEntry header = {
+            .type = node->type,
+            .mode = htole32(node->mode),
+            .access_time = {htole64((int64_t)node->access_time.tv_sec), htole64((int64_t)node->access_time.tv_nsec)},
+            .mod_time = {htole64((int64_t)node->mod_time.tv_sec), htole64((int64_t)node->mod_time.tv_nsec)},
+            .size = htole64(node->size),
+            .path_size = htole16(relative_size),
+        };
+
+        memcpy(&walk.archive[node->offset], &header, sizeof(TreeEntry));
+        memcpy(&walk.archive[node->offset + sizeof(TreeEntry)], relative_path, relative_size);
+    }
+
+    // Read the files into the archive, in parallel
+    if (verbose) printf("Reading the files of '%s'... ", dir_name);
+    if (verbose) fflush(stdout);
+    imc_parallel_for(walk.count, 1, &__tree_read_range, &walk);
+
+    // Fail on the first file that could not be read
+    for (size_t i = 0; i < walk.count && status == IMC_SUCCESS; i++) status = walk.nodes[i].status;
+
+    if (status != IMC_SUCCESS)
+    {
+        imc_clear_free(raw_buffer, raw_size);
+        imc_memory_release(reserved_memory);
+        __tree_walk_free(&walk);
+        free(full_path);
+        if (verbose) printf("\n");
+        return status;
+    }
+    if (verbose) printf("Done!\n");
+
+    // Store the metadata, then compress and encrypt the whole buffer
+    imc_steg_info_init((FileInfo *)raw_buffer, IMC_FILEINFO_TREE, dir_name, name_size, root.access_time, root.mod_time);
+    __tree_walk_free(&walk);
+    free(full_path);
+
+    status = imc_steg_prepare_buffer(crypto, raw_buffer, raw_size, Z_BEST_COMPRESSION, verbose, output);
+    imc_memory_release(reserved_memory);
+    return status;
+}
+
+// Check if a name can be used as a component of a path being restored (it cannot be empty, '.', '..', or have separators)
+static bool __tree_valid_component(const char *name, size_t name_len)
+{
+    if (name_len == 0) return false;
+    if (name_len == 1 && name[0] == '.') return false;
+    if (name_len == 2 && name[0] == '.' && name[1] == '.') return false;
+
+    for (size_t i = 0; i < name_len; i++)
+    {
+        if (name[i] == '/') return false;
+        #ifdef _WIN32
+        if (name[i] == '\\' || name[i] == ':') return false;   // Also a separator, or a drive letter
+        #endif // _WIN32
+    }
+
+    return true;
+}
+
+// Check the name of a hidden folder and all entries of its archive, before anything is written
+// The amount of entries and the total size of the files are stored on 'entry_count' and 'files_size'.
+// Function returns IMC_ERR_FILE_CORRUPTED if the archive is malformed or has a path that is not allowed.
+int imc_tree_check(const char *name, const uint8_t *archive, size_t size, size_t *entry_count, size_t *files_size)
+{
+    if (!__tree_valid_component(name, strlen(name))) return IMC_ERR_FILE_CORRUPTED;
+
+    size_t pos = 0;
+    size_t count = 0;
+    size_t total_size = 0;
+
+    while (pos < size)
+    {
+        if (size - pos < sizeof(TreeEntry)) return IMC_ERR_FILE_CORRUPTED;
+        TreeEntry header;
+        memcpy(&header, &archive[pos], sizeof(TreeEntry));
+        pos += sizeof(TreeEntry);
+
+        // The path must be inside the archive, and end on its only null terminator
+        const size_t path_size = le16toh(header.path_size);
+        if (path_size < 2 || size - pos < path_size) return IMC_ERR_FILE_CORRUPTED;
+        const char *const path = (const char *)&archive[pos];
+        if (strnlen(path, path_size) != path_size - 1) return IMC_ERR_FILE_CORRUPTED;
+        pos += path_size;
+
+        // Only a file has contents
+        const uint64_t data_size = le64toh(header.size);
+        if (header.type == IMC_TREE_FOLDER)
+        {
+            if (data_size != 0) return IMC_ERR_FILE_CORRUPTED;
+        }
+        else if (header.type != IMC_TREE_FILE || data_size > size - pos)
+        {
+            return IMC_ERR_FILE_CORRUPTED;
+        }
+        pos += data_size;
+
+        // Every component of the path must be a plain name
+        // (so an absolute path, or a path that goes up a folder, is refused)
+        const char *component = path;
+        while (true)
+        {
+            const char *const separator = strchr(component, '/');
+            const size_t component_len = separator ? (size_t)(separator - component) : strlen(component);
+            if (!__tree_valid_component(component, component_len)) return IMC_ERR_FILE_CORRUPTED;
+            if (!separator) break;
+            component = separator + 1;
+        }
+
+        count++;
+        total_size += data_size;
+    }
+
+    *entry_count = count;
+    *files_size = total_size;
+    return IMC_SUCCESS;
+}
+
+// Create the folder where a hidden folder is restored, on 'out_dir' (or on the current working directory, if NULL)
+// If the name already exists, a number is appended to it. The path of the new folder is written to 'output'.
+static int __tree_create_root(const char *out_dir, const char *name, char *output, size_t output_size)
+{
+    if (out_dir) snprintf(output, output_size, "%s/%s", out_dir, name);
+    else snprintf(output, output_size, "%s", name);
+    const size_t base_len = strlen(output);
+
+    for (int i = 0; i <= IMC_MAX_FILENAME_DUPLICATES; i++)
+    {
+        if (i > 0) snprintf(&output[base_len], output_size - base_len, " (%d)", i);
+
+        // The folder is created with access for only the current user (the same as the output folder)
+        #ifdef _WIN32
+        const int mk_status = _mkdir(output);
+        #else
+        const int mk_status = mkdir(output, 0700);
+        #endif // _WIN32
+
+        if (mk_status == 0) return IMC_SUCCESS;
+        if (errno != EEXIST) return IMC_ERR_SAVE_FAIL;
+    }
+
+    return IMC_ERR_FILE_EXISTS;
+}
+
+// Restore the timestamps of a folder (on Windows, the folders keep the time when they were created)
+static void __tree_set_folder_times(const char *path, const struct timespec times[2])
+{
+    #ifndef _WIN32
+    utimensat(AT_FDCWD, path, times, 0);
+    #endif // _WIN32
+}
+
+// Restore a hidden folder (already checked by 'imc_tree_check()') on 'out_dir' (or on the current working directory, if NULL)
+// 'access_time' and 'mod_time' are the timestamps of the folder itself. If 'verbose' is true, the status is printed to stdout.
+// Function returns IMC_ERR_FILE_EXISTS if the folder's name could not be made unique, or IMC_ERR_SAVE_FAIL if an entry could not be written.
+int imc_tree_restore(
+    const char *out_dir,
+    const char *name,
+    const uint8_t *archive,
+    size_t size,
+    struct timespec access_time,
+    struct timespec mod_time,
+    bool verbose
+)
+{
+    // Create the restored folder (with a new name, so nothing that already exists is written into)
+    const size_t root_size = (out_dir ? strlen(out_dir) + 1 : 0) + strlen(name) + 16;
+    char root_path[root_size];
+    int status = __tree_create_root(out_dir, name, root_path, root_size);
+    if (status != IMC_SUCCESS) return status;
+    const size_t root_len = strlen(root_path);
+    if (verbose) printf("Restoring folder '%s'...\n", root_path);
+
+    // Positions on the archive of the folders, which get their timestamps and permissions at the end
+    size_t *folders = NULL;
+    size_t folder_count = 0;
+    size_t folder_capacity = 0;
+
+    size_t pos = 0;
+    while (pos < size && status == IMC_SUCCESS)
+    {
+        TreeEntry header;
+        memcpy(&header, &archive[pos], sizeof(TreeEntry));
+        const size_t path_size = le16toh(header.path_size);
+        const size_t data_size = le64toh(header.size);
+        const char *const relative_path = (const char *)&archive[pos + sizeof(TreeEntry)];
+        const uint8_t *const data = &archive[pos + sizeof(TreeEntry) + path_size];
+
+        // Full path of the entry
+        char path[root_len + path_size + 1];
+        snprintf(path, sizeof(path), "%s/%s", root_path, relative_path);
+
+        if (header.type == IMC_TREE_FOLDER)
+        {
+            // The folder can be written into until the end, then it gets its own permissions
+            #ifdef _WIN32
+            const int mk_status = _mkdir(path);
+            #else
+            const int mk_status = mkdir(path, 0700);
+            #endif // _WIN32
+            if (mk_status != 0) status = IMC_ERR_SAVE_FAIL;
+
+            if (folder_count == folder_capacity)
+            {
+                folder_capacity = folder_capacity ? folder_capacity * 2 : 16;
+                folders = imc_realloc(folders, folder_capacity * sizeof(size_t));
+            }
+            folders[folder_count++] = pos;
+        }
+        else
+        {
+            // The restored folder was just created, so a file that already exists means that the archive has the same path twice
+            struct stat file_stats;
+            if (stat(path, &file_stats) == 0)
+            {
+                status = IMC_ERR_FILE_EXISTS;
+                break;
+            }
+
+            // The file is saved on its folder (which was created by an earlier entry)
+            char *const separator = strrchr(path, '/');
+            *separator = '\0';
+
+            const struct timespec file_times[2] = {
+                {.tv_sec = le64toh(header.access_time.tv_sec), .tv_nsec = le64toh(header.access_time.tv_nsec)},
+                {.tv_sec = le64toh(header.mod_time.tv_sec), .tv_nsec = le64toh(header.mod_time.tv_nsec)},
+            };
+            status = imc_steg_write_file(path, separator + 1, data, data_size, file_times, verbose);
+            *separator = '/';
+
+            #ifndef _WIN32
+            if (status == IMC_SUCCESS) chmod(path, le32toh(header.mode) & 0777);
+            #endif // _WIN32
+        }
+
+        pos += sizeof(TreeEntry) + path_size + data_size;
+    }
+
+    // Restore the folders from the innermost ones, so a folder without write permission does not
+    // prevent the ones inside it from being changed (the contents of the folders do not change anymore)
+    for (size_t i = folder_count; i > 0 && status == IMC_SUCCESS; i--)
+    {
+        TreeEntry header;
+        memcpy(&header, &archive[folders[i-1]], sizeof(TreeEntry));
+        const char *const relative_path = (const char *)&archive[folders[i-1] + sizeof(TreeEntry)];
+
+        char path[root_len + le16toh(header.path_size) + 1];
+        snprintf(path, sizeof(path), "%s/%s", root_path, relative_path);
+
+        const struct timespec folder_times[2] = {
+            {.tv_sec = le64toh(header.access_time.tv_sec), .tv_nsec = le64toh(header.access_time.tv_nsec)},
+            {.tv_sec = le64toh(header.mod_time.tv_sec), .tv_nsec = le64toh(header.mod_time.tv_nsec)},
+        };
+        __tree_set_folder_times(path, folder_times);
+
+        #ifndef _WIN32
+        chmod(path, le32toh(header.mode) & 0777);
+        #endif // _WIN32
+    }
+
+    imc_free(folders);
+    if (status != IMC_SUCCESS) return status;
+
+    // The restored folder itself keeps the permissions it was created with
+    const struct timespec root_times[2] = {access_time, mod_time};
+    __tree_set_folder_times(root_path, root_times);
+
+    return IMC_SUCCESS;
+}
+
+// Write a hidden folder (already checked by 'imc_tree_check()') as entries of a tar archive being written to a stream
+// Function returns IMC_ERR_SAVE_FAIL if writing to the stream failed.
+int imc_tree_write_tar(FILE *stream, const char *name, const uint8_t *archive, size_t size, struct timespec mod_time)
+{
+    // The folder itself
+    const size_t name_len = strlen(name);
+    char root_path[name_len + 2];
+    snprintf(root_path, sizeof(root_path), "%s/", name);
+    int status = imc_tar_write_entry(stream, root_path, IMC_TAR_TYPE_FOLDER, 0755, NULL, 0, mod_time);
+
+    // Its entries, under the folder's name (the paths of the folders end with a separator)
+    size_t pos = 0;
+    while (pos < size && status == IMC_SUCCESS)
+    {
+        TreeEntry header;
+        memcpy(&header, &archive[pos], sizeof(TreeEntry));
+        const size_t path_size = le16toh(header.path_size);
+        const size_t data_size = le64toh(header.size);
+        const char *const relative_path = (const char *)&archive[pos + sizeof(TreeEntry)];
+        const bool is_folder = (header.type == IMC_TREE_FOLDER);
+
+        char path[name_len + path_size + 2];
+        snprintf(path, sizeof(path), is_folder ? "%s/%s/" : "%s/%s", name, relative_path);
+
+        const struct timespec entry_time = {
+            .tv_sec = le64toh(header.mod_time.tv_sec),
+            .tv_nsec = le64toh(header.mod_time.tv_nsec),
+        };
+
+        status = imc_tar_write_entry(
+            stream,
+            path,
+            is_folder ? IMC_TAR_TYPE_FOLDER : IMC_TAR_TYPE_FILE,
+            le32toh(header.mode) & 0777,
+            &archive[pos + sizeof(TreeEntry) + path_size],
+            data_size,
+            entry_time
+        );
+
+        pos += sizeof(TreeEntry) + path_size + data_size;
+    }
+
+    return status;
+}
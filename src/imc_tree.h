@@ -0,0 +1,118 @@
+/* Directory trees: a whole folder is hidden as a single file, which is an archive of its files and subfolders. */
+
+#ifndef _IMC_TREE_H
+#define _IMC_TREE_H
+
+#include "imc_includes.h"
+
+/*  Format of the archive
+
+    A folder is hidden like a regular file named after the folder, but the version of its metadata is
+    'IMC_FILEINFO_TREE', and its data is a sequence of entries: each one is a 'TreeEntry', followed by the entry's
+    path (relative to the folder, with '/' as the separator), followed by the contents of the file (nothing for a
+    folder). A folder always comes before the entries inside it, so the tree can be restored in a single pass.
+
+    When hiding, the folder is walked first, so the size of the archive is known beforehand (only regular files and
+    folders are stored; symbolic links and other special files are skipped). Then the files are read in parallel,
+    each one straight into its place on the archive, and the archive is compressed and encrypted as a single stream.
+    No temporary archive is written to the disk, and the small files share the overhead of a single hidden file.
+
+    When extracting, the folder is created on the output folder (with a number appended to its name, if the name
+    already exists). All paths are checked before anything is written: an absolute path, or a path with an empty,
+    '.', or '..' component, makes the whole archive be refused, so a crafted image cannot write outside of the
+    restored folder. The timestamps and the permissions (only the read, write, and execute bits) are restored;
+    the folders get theirs last, since creating the entries inside a folder changes it.
+    Older versions of this program refuse the archive as data hidden by a newer version.
+*/
+
+#define IMC_TREE_FILE       0   // Type of an entry that is a regular file
+#define IMC_TREE_FOLDER     1   // Type of an entry that is a folder
+
+// Header stored before each entry of the archive
+// Note: integers are always stored in little endian byte order.
+typedef struct __attribute__ ((__packed__)) TreeEntry
+{
+    uint8_t type;                   // Whether the entry is a file or a folder ('IMC_TREE_FILE' or 'IMC_TREE_FOLDER')
+    uint32_t mode;                  // Permissions of the entry (the read, write, and execute bits)
+    struct timespec64 access_time;  // Last access time of the entry
+    struct timespec64 mod_time;     // Last modified time of the entry
+    uint64_t size;                  // Size in bytes of the file's contents (zero for a folder)
+    uint16_t path_size;             // Amount of bytes on the path (counting the null terminator)
+    uint8_t path[];                 // Null-terminated path of the entry, relative to the hidden folder
+} TreeEntry;
+
+// An entry found while walking the folder being hidden
+typedef struct TreeNode {
+    char *path;                     // Path of the entry on the disk
+    size_t relative_offset;         // Position on 'path' where the part relative to the hidden folder begins
+    uint8_t type;                   // 'IMC_TREE_FILE' or 'IMC_TREE_FOLDER'
+    uint32_t mode;                  // Permissions of the entry
+    struct timespec access_time;    // Last access time of the entry
+    struct timespec mod_time;       // Last modified time of the entry
+    size_t size;                    // Size in bytes of the file (zero for a folder)
+    size_t offset;                  // Position on the archive where the entry's header begins
+    int status;                     // Status code of reading the file into the archive
+} TreeNode;
+
+// Entries of the folder being hidden, and the archive where they are stored
+typedef struct TreeWalk {
+    TreeNode *nodes;                // Entries in the order they are stored (each folder before its contents)
+    size_t count;                   // Amount of elements on the 'nodes' array
+    size_t capacity;                // Amount of elements that the 'nodes' array can hold
+    size_t archive_size;            // Size in bytes of the whole archive
+    uint8_t *archive;               // Where the entries are stored
+} TreeWalk;
+
+// Get the size, permissions, and timestamps of an entry from its stats
+static void __tree_node_stats(TreeNode *node, const struct stat *stats);
+
+// Walk a folder, adding its files and subfolders to the list of entries (the subfolders are walked recursively)
+// 'relative_offset' is the position on the paths where the part relative to the hidden folder begins.
+// Function returns IMC_ERR_FILE_NOT_FOUND if the folder could not be listed, IMC_ERR_NAME_TOO_LONG if a relative path
+// is too long, or IMC_ERR_INPUT_TOO_BIG if the archive would be bigger than 'IMC_MAX_INPUT_SIZE'.
+static int __tree_walk(TreeWalk *walk, const char *dir_path, size_t relative_offset);
+
+// Read some of the files into their place on the archive (this function might run on a worker thread)
+static void __tree_read_range(size_t start, size_t end, void *walk_ptr);
+
+// Free the entries of a walk (the archive itself is not freed)
+static void __tree_walk_free(TreeWalk *walk);
+
+// Read, compress, and encrypt a whole folder, so it can be hidden as a single file
+// If 'verbose' is true, the status is printed to stdout.
+// The returned 'PreparedPayload' should be freed with 'imc_steg_prepared_free()'.
+int imc_tree_prepare(CryptoContext *crypto, const char *dir_path, bool verbose, PreparedPayload **output);
+
+// Check if a name can be used as a component of a path being restored (it cannot be empty, '.', '..', or have separators)
+static bool __tree_valid_component(const char *name, size_t name_len);
+
+// Check the name of a hidden folder and all entries of its archive, before anything is written
+// The amount of entries and the total size of the files are stored on 'entry_count' and 'files_size'.
+// Function returns IMC_ERR_FILE_CORRUPTED if the archive is malformed or has a path that is not allowed.
+int imc_tree_check(const char *name, const uint8_t *archive, size_t size, size_t *entry_count, size_t *files_size);
+
+// Create the folder where a hidden folder is restored, on 'out_dir' (or on the current working directory, if NULL)
+// If the name already exists, a number is appended to it. The path of the new folder is written to 'output'.
+static int __tree_create_root(const char *out_dir, const char *name, char *output, size_t output_size);
+
+// Restore the timestamps of a folder (on Windows, the folders keep the time when they were created)
+static void __tree_set_folder_times(const char *path, const struct timespec times[2]);
+
+// Restore a hidden folder (already checked by 'imc_tree_check()') on 'out_dir' (or on the current working directory, if NULL)
+// 'access_time' and 'mod_time' are the timestamps of the folder itself. If 'verbose' is true, the status is printed to stdout.
+// Function returns IMC_ERR_FILE_EXISTS if the folder's name could not be made unique, or IMC_ERR_SAVE_FAIL if an entry could not be written.
+int imc_tree_restore(
+    const char *out_dir,
+    const char *name,
+    const uint8_t *archive,
+    size_t size,
+    struct timespec access_time,
+    struct timespec mod_time,
+    bool verbose
+);
+
+// Write a hidden folder (already checked by 'imc_tree_check()') as entries of a tar archive being written to a stream
+// Function returns IMC_ERR_SAVE_FAIL if writing to the stream failed.
+int imc_tree_write_tar(FILE *stream, const char *name, const uint8_t *archive, size_t size, struct timespec mod_time);
+
+#endif  // _IMC_TREE_H